@@ -8,11 +8,15 @@
 
 #define __NR_getcwd        17ull
 #define __NR_dup3          24ull
+#define __NR_fcntl         25ull
 #define __NR_ioctl         29ull
 #define __NR_mkdirat       34ull
 #define __NR_unlinkat      35ull
 #define __NR_symlinkat     36ull
 #define __NR_linkat        37ull
+#define __NR_truncate      45ull
+#define __NR_ftruncate     46ull
+#define __NR_fallocate     47ull
 #define __NR_chdir         49ull
 #define __NR_fchmodat      53ull
 #define __NR_openat        56ull
@@ -24,6 +28,8 @@
 #define __NR_write         64ull
 #define __NR_readlinkat    78ull
 #define __NR_newfstatat    79ull
+#define __NR_sync          81ull
+#define __NR_fsync         82ull
 #define __NR_exit          93ull
 #define __NR_exit_group    94ull
 #define __NR_set_tid_address 96ull
@@ -34,7 +40,9 @@
 #define __NR_rt_sigaction  134ull
 #define __NR_rt_sigprocmask 135ull
 #define __NR_reboot        142ull
+#define __NR_times         153ull
 #define __NR_uname         160ull
+#define __NR_getrusage     165ull
 #define __NR_getpid        172ull
 #define __NR_getppid       173ull
 #define __NR_getuid        174ull
@@ -44,9 +52,11 @@
 #define __NR_gettid        178ull
 #define __NR_brk           214ull
 #define __NR_munmap        215ull
+#define __NR_mremap        216ull
 #define __NR_clone         220ull
 #define __NR_execve        221ull
 #define __NR_mmap          222ull
+#define __NR_madvise       233ull
 #define __NR_wait4         260ull
 #define __NR_prlimit64     261ull
 #define __NR_getrandom     278ull
@@ -71,3 +81,6 @@
 #define __NR_mona_tcp6_connect  4103ull
 #define __NR_mona_tcp6_send     4104ull
 #define __NR_mona_tcp6_recv     4105ull
+
+/* mona-specific: posix_spawn-like process creation with dup2/close actions. */
+#define __NR_mona_spawn         4106ull
@@ -0,0 +1,559 @@
+#include "blk.h"
+
+#include "errno.h"
+#include "pmm.h"
+#include "proc.h"
+#include "sched.h"
+#include "sdhci.h"
+#include "string.h"
+#include "time.h"
+#include "timer.h"
+#include "wait.h"
+
+#define SECTORS_PER_BLK (BLK_SIZE / SDHCI_SECTOR_SIZE)
+
+#define BLK_HASH_SIZE 256u
+
+/* Readahead window, in blocks: it starts small after a random read and
+ * doubles while misses follow on from the previous one.
+ */
+#define BLK_RA_MIN 4u
+#define BLK_RA_MAX 32u
+
+/* Periodic write-back: every BLK_FLUSH_PERIOD_NS, blocks dirty for longer
+ * than BLK_DIRTY_EXPIRE_NS go out. Past BLK_DIRTY_MAX dirty blocks, writers
+ * send everything out themselves and wait for it.
+ */
+#define BLK_FLUSH_PERIOD_NS 1000000000ull
+#define BLK_DIRTY_EXPIRE_NS 5000000000ull
+#define BLK_DIRTY_MAX (BLK_CACHE_MAX / 4u)
+
+/* Device commands in flight at once (queued at the controller). */
+#define BLK_NREQ 8u
+
+enum {
+    BUF_DIRTY = 1u << 0,
+    BUF_NEW = 1u << 1,     /* handed out by blk_write_begin(), not cached yet */
+    BUF_READING = 1u << 2, /* being read in: no data yet */
+    BUF_WRITING = 1u << 3, /* being written back: must not change */
+};
+
+#define BUF_BUSY (BUF_READING | BUF_WRITING)
+
+typedef struct blk_buf {
+    struct blk_buf *hash_next;
+    struct blk_buf *lru_prev; /* towards the most recently used */
+    struct blk_buf *lru_next;
+    uint64_t blkno;
+    uint64_t dirty_ns; /* when it was first dirtied */
+    uint8_t *data;     /* one page, 0 until first used */
+    uint32_t flags;
+    uint32_t _pad;
+} blk_buf_t;
+
+/* One device command over a run of consecutive blocks. */
+typedef struct {
+    sdhci_req_t sd;
+    blk_buf_t *run[SDHCI_MAX_SEGS];
+    sdhci_seg_t segs[SDHCI_MAX_SEGS];
+    uint64_t t0;
+    uint32_t n;
+    uint8_t used;
+    uint8_t held; /* the submitter collects the result (req_release()) */
+    uint8_t done;
+    uint8_t _pad;
+    int rc;
+} blk_req_t;
+
+static blk_buf_t g_bufs[BLK_CACHE_MAX];
+static blk_buf_t *g_hash[BLK_HASH_SIZE];
+static blk_buf_t *g_free;    /* unhashed, off the LRU (via hash_next) */
+static blk_buf_t g_lru;      /* sentinel: next = most recent */
+static blk_buf_t *g_sorted[BLK_CACHE_MAX];
+
+static blk_req_t g_reqs[BLK_NREQ];
+static uint32_t g_reqs_used;
+static uint64_t g_write_errors;
+/* Tasks waiting for a block or a request slot; woken on every change. */
+static waitq_t g_io_wq = WAITQ_INIT;
+
+static uint64_t g_blocks;
+static uint64_t g_ra_next;   /* block a sequential reader wants next */
+static uint32_t g_ra_win;
+static ktimer_t g_flush_timer;
+static blk_stats_t g_stats;
+
+static inline uint32_t hash_idx(uint64_t blkno) {
+    return (uint32_t)((blkno * 0x9E3779B97F4A7C15ull) >> 56) % BLK_HASH_SIZE;
+}
+
+static blk_buf_t *buf_lookup(uint64_t blkno) {
+    for (blk_buf_t *b = g_hash[hash_idx(blkno)]; b; b = b->hash_next) {
+        if (b->blkno == blkno) return b;
+    }
+    return 0;
+}
+
+static void buf_hash(blk_buf_t *b) {
+    uint32_t h = hash_idx(b->blkno);
+    b->hash_next = g_hash[h];
+    g_hash[h] = b;
+}
+
+static void buf_unhash(blk_buf_t *b) {
+    blk_buf_t **pp = &g_hash[hash_idx(b->blkno)];
+    while (*pp && *pp != b) pp = &(*pp)->hash_next;
+    if (*pp) *pp = b->hash_next;
+    b->hash_next = 0;
+}
+
+static void lru_unlink(blk_buf_t *b) {
+    b->lru_prev->lru_next = b->lru_next;
+    b->lru_next->lru_prev = b->lru_prev;
+    b->lru_prev = b->lru_next = 0;
+}
+
+static void lru_push_front(blk_buf_t *b) {
+    b->lru_prev = &g_lru;
+    b->lru_next = g_lru.lru_next;
+    g_lru.lru_next->lru_prev = b;
+    g_lru.lru_next = b;
+}
+
+static void lru_touch(blk_buf_t *b) {
+    if (g_lru.lru_next == b) return;
+    lru_unlink(b);
+    lru_push_front(b);
+}
+
+/* Sleep until the next completion or released request slot, then look
+ * again. Only from a syscall, never from the flusher.
+ */
+static void blk_wait(void) {
+    wait_block(proc_current(), PROC_BLOCKED_IO, &g_io_wq, 0);
+    sched_block();
+}
+
+static void buf_clean(blk_buf_t *b) {
+    if ((b->flags & BUF_DIRTY) == 0) return;
+    b->flags &= ~BUF_DIRTY;
+    g_stats.dirty--;
+}
+
+static void buf_put_free(blk_buf_t *b) {
+    b->flags = 0;
+    b->hash_next = g_free;
+    g_free = b;
+    g_stats.cached--;
+}
+
+static blk_req_t *req_alloc(void) {
+    for (uint32_t i = 0; i < BLK_NREQ; i++) {
+        blk_req_t *q = &g_reqs[i];
+        if (q->used) continue;
+        q->used = 1;
+        q->held = 0;
+        q->done = 0;
+        q->rc = 0;
+        g_reqs_used++;
+        return q;
+    }
+    return 0;
+}
+
+static void req_release(blk_req_t *q) {
+    q->used = 0;
+    g_reqs_used--;
+    waitq_wake_all(&g_io_wq);
+}
+
+/* The controller is done with q (from its IRQ or timeout timer). Written
+ * blocks are clean unless it failed; blocks read in join the LRU, or are
+ * dropped if it failed.
+ */
+static void req_done(sdhci_req_t *sr, int rc) {
+    blk_req_t *q = (blk_req_t *)sr->arg;
+    uint64_t dt = time_now_ns() - q->t0;
+    uint32_t n = q->n;
+
+    if (rc != 0) {
+        g_stats.errors++;
+        if (sr->write) g_write_errors++;
+    } else if (sr->write) {
+        g_stats.wr_ios++;
+        g_stats.wr_merges += n - 1u;
+        g_stats.wr_sectors += (uint64_t)n * SECTORS_PER_BLK;
+        g_stats.wr_ns += dt;
+    } else {
+        g_stats.rd_ios++;
+        g_stats.rd_merges += n - 1u;
+        g_stats.rd_sectors += (uint64_t)n * SECTORS_PER_BLK;
+        g_stats.rd_ns += dt;
+    }
+
+    if (sr->write) {
+        for (uint32_t i = 0; i < n; i++) {
+            q->run[i]->flags &= ~BUF_WRITING;
+            if (rc == 0) buf_clean(q->run[i]);
+        }
+    } else if (rc == 0) {
+        /* Readahead lands behind the block asked for in LRU order. */
+        for (uint32_t i = n; i-- > 0;) {
+            q->run[i]->flags &= ~BUF_READING;
+            lru_push_front(q->run[i]);
+        }
+        g_stats.readahead += n - 1u;
+    } else {
+        for (uint32_t i = 0; i < n; i++) {
+            buf_unhash(q->run[i]);
+            buf_put_free(q->run[i]);
+        }
+    }
+
+    q->rc = rc;
+    q->done = 1;
+    if (q->held) {
+        waitq_wake_all(&g_io_wq);
+    } else {
+        req_release(q);
+    }
+}
+
+/* Start one device command on q for run[0..n), which hold consecutive
+ * blocks; it completes in req_done().
+ */
+static void req_start(blk_req_t *q, int write, blk_buf_t **run, uint32_t n) {
+    for (uint32_t i = 0; i < n; i++) {
+        q->run[i] = run[i];
+        q->segs[i].buf = run[i]->data;
+        q->segs[i].len = BLK_SIZE;
+        run[i]->flags |= write ? BUF_WRITING : BUF_READING;
+    }
+    q->n = n;
+    q->sd.write = write;
+    q->sd.lba = run[0]->blkno * SECTORS_PER_BLK;
+    q->sd.segs = q->segs;
+    q->sd.nsegs = n;
+    q->sd.done = req_done;
+    q->sd.arg = q;
+    q->t0 = time_now_ns();
+    if (sdhci_submit(&q->sd) != 0) {
+        req_done(&q->sd, -(int)EIO);
+    }
+}
+
+/* Dirty and not already on its way out? */
+static inline int buf_writable(const blk_buf_t *b) {
+    return b && (b->flags & (BUF_DIRTY | BUF_BUSY)) == BUF_DIRTY;
+}
+
+/* Start writing out the run of dirty blocks around b as one command.
+ * Returns 0, or -EBUSY if no request slot is free.
+ */
+static int writeback_around(blk_buf_t *b) {
+    blk_buf_t *run[SDHCI_MAX_SEGS];
+
+    blk_req_t *q = req_alloc();
+    if (!q) return -(int)EBUSY;
+
+    uint64_t first = b->blkno;
+    while (first > 0 && b->blkno - first + 1u < SDHCI_MAX_SEGS) {
+        if (!buf_writable(buf_lookup(first - 1u))) break;
+        first--;
+    }
+
+    uint32_t n = 0;
+    for (uint64_t blk = first; n < SDHCI_MAX_SEGS; blk++) {
+        blk_buf_t *p = (blk == b->blkno) ? b : buf_lookup(blk);
+        if (!buf_writable(p)) break;
+        run[n++] = p;
+    }
+
+    req_start(q, 1, run, n);
+    return 0;
+}
+
+/* Start writing back the blocks dirtied at or before cutoff_ns in block
+ * order, adjacent ones merged, as far as request slots go. Never waits.
+ */
+static void writeback_start(uint64_t cutoff_ns) {
+    uint32_t n = 0;
+    for (blk_buf_t *b = g_lru.lru_next; b != &g_lru; b = b->lru_next) {
+        if (buf_writable(b) && b->dirty_ns <= cutoff_ns) g_sorted[n++] = b;
+    }
+    if (n == 0) return;
+
+    /* Shell sort by block number: the elevator order for the card. */
+    for (uint32_t gap = n / 2u; gap > 0; gap /= 2u) {
+        for (uint32_t i = gap; i < n; i++) {
+            blk_buf_t *t = g_sorted[i];
+            uint32_t j = i;
+            for (; j >= gap && g_sorted[j - gap]->blkno > t->blkno; j -= gap) {
+                g_sorted[j] = g_sorted[j - gap];
+            }
+            g_sorted[j] = t;
+        }
+    }
+
+    uint32_t i = 0;
+    while (i < n) {
+        uint32_t len = 1;
+        while (i + len < n && len < SDHCI_MAX_SEGS &&
+               g_sorted[i + len]->blkno == g_sorted[i]->blkno + len) {
+            len++;
+        }
+        blk_req_t *q = req_alloc();
+        if (!q) return;
+        req_start(q, 1, &g_sorted[i], len);
+        i += len;
+    }
+}
+
+/* Only queues the commands: the controller IRQ moves the data and
+ * completes them, so the timer callback never waits for the card.
+ */
+static void flush_timer_fn(ktimer_t *t, void *arg) {
+    (void)arg;
+    uint64_t now = time_now_ns();
+    writeback_start(now > BLK_DIRTY_EXPIRE_NS ? now - BLK_DIRTY_EXPIRE_NS : 0);
+    if (g_stats.dirty != 0) {
+        timer_arm(t, now + BLK_FLUSH_PERIOD_NS);
+    }
+}
+
+static void buf_dirty(blk_buf_t *b) {
+    if ((b->flags & BUF_DIRTY) != 0) return;
+    b->flags |= BUF_DIRTY;
+    b->dirty_ns = time_now_ns();
+    g_stats.dirty++;
+
+    uint64_t now = b->dirty_ns;
+    if (now != 0 && !timer_pending(&g_flush_timer)) {
+        timer_arm(&g_flush_timer, now + BLK_FLUSH_PERIOD_NS);
+    }
+}
+
+/* A buffer with a page, unhashed and off the LRU: a never used one while
+ * pages last, else the least recently used clean idle one (starting dirty
+ * ones on their way out as it passes them). 0 if none can be had now.
+ */
+static blk_buf_t *buf_get(void) {
+    blk_buf_t *f = g_free;
+    if (f && !f->data) {
+        uint64_t pa = pmm_alloc_page();
+        if (pa != 0) f->data = (uint8_t *)(uintptr_t)pa;
+    }
+    if (f && f->data) {
+        g_free = f->hash_next;
+        f->hash_next = 0;
+        f->flags = 0;
+        g_stats.cached++;
+        return f;
+    }
+
+    for (blk_buf_t *b = g_lru.lru_prev; b != &g_lru; b = b->lru_prev) {
+        if ((b->flags & BUF_BUSY) != 0) continue;
+        if ((b->flags & BUF_DIRTY) != 0) {
+            (void)writeback_around(b);
+            continue;
+        }
+        buf_unhash(b);
+        lru_unlink(b);
+        b->flags = 0;
+        return b;
+    }
+    return 0;
+}
+
+/* Cached block blkno, read in (with up to ra following blocks that are not
+ * cached yet) if it is not; it may be on its way out. Sleeps while it is
+ * being read in, by us or anyone else. Sets *err on failure.
+ */
+static blk_buf_t *buf_read(uint64_t blkno, uint32_t ra, int *err) {
+    int missed = 0;
+    for (;;) {
+        blk_buf_t *b = buf_lookup(blkno);
+        if (b && (b->flags & BUF_READING) != 0) {
+            blk_wait();
+            continue;
+        }
+        if (b) {
+            if (!missed) g_stats.hits++;
+            lru_touch(b);
+            return b;
+        }
+
+        blk_req_t *q = req_alloc();
+        if (!q) {
+            blk_wait();
+            continue;
+        }
+
+        blk_buf_t *run[SDHCI_MAX_SEGS];
+        uint32_t want = ra + 1u;
+        if (want > SDHCI_MAX_SEGS) want = SDHCI_MAX_SEGS;
+        uint32_t n = 0;
+        while (n < want && blkno + n < g_blocks && (n == 0 || !buf_lookup(blkno + n))) {
+            blk_buf_t *p = buf_get();
+            if (!p) break;
+            p->blkno = blkno + n;
+            buf_hash(p);
+            run[n++] = p;
+        }
+        if (n == 0) {
+            /* Everything is dirty or busy: wait for some of it to go out. */
+            req_release(q);
+            if (g_reqs_used == 0) {
+                *err = -(int)ENOMEM;
+                return 0;
+            }
+            blk_wait();
+            continue;
+        }
+
+        if (!missed) g_stats.misses++;
+        missed = 1;
+        q->held = 1;
+        req_start(q, 0, run, n);
+        while (!q->done) blk_wait();
+        int rc = q->rc;
+        req_release(q);
+        if (rc != 0) {
+            *err = -(int)EIO;
+            return 0;
+        }
+        /* Look it up again: it may have been evicted while we slept. */
+    }
+}
+
+int blk_init(void) {
+    g_blocks = sdhci_sectors() / SECTORS_PER_BLK;
+    if (g_blocks == 0) return -1;
+
+    g_lru.lru_next = g_lru.lru_prev = &g_lru;
+    g_free = 0;
+    for (uint32_t i = BLK_CACHE_MAX; i-- > 0;) {
+        g_bufs[i].hash_next = g_free;
+        g_free = &g_bufs[i];
+    }
+    g_ra_next = ~0ull;
+    g_ra_win = BLK_RA_MIN;
+    timer_init(&g_flush_timer, flush_timer_fn, 0);
+    return 0;
+}
+
+uint64_t blk_size(void) {
+    return g_blocks * BLK_SIZE;
+}
+
+int64_t blk_read_span(uint64_t off, const uint8_t **out) {
+    uint64_t blkno = off / BLK_SIZE;
+    if (blkno >= g_blocks) return 0;
+
+    uint32_t ra = 0;
+    if (!buf_lookup(blkno)) {
+        if (blkno == g_ra_next) {
+            g_ra_win = (g_ra_win * 2u > BLK_RA_MAX) ? BLK_RA_MAX : g_ra_win * 2u;
+        } else {
+            g_ra_win = BLK_RA_MIN;
+        }
+        ra = g_ra_win;
+    }
+    g_ra_next = blkno + 1u;
+
+    int err = 0;
+    blk_buf_t *b = buf_read(blkno, ra, &err);
+    if (!b) return err;
+
+    uint64_t in = off % BLK_SIZE;
+    *out = b->data + in;
+    return (int64_t)(BLK_SIZE - in);
+}
+
+int64_t blk_write_begin(uint64_t off, uint64_t len, uint8_t **out, struct blk_buf **bp) {
+    uint64_t blkno = off / BLK_SIZE;
+    if (blkno >= g_blocks || len == 0) return 0;
+
+    uint64_t in = off % BLK_SIZE;
+    uint64_t span = BLK_SIZE - in;
+    if (span > len) span = len;
+
+    while (g_stats.dirty >= BLK_DIRTY_MAX) {
+        writeback_start(~0ull);
+        if (g_reqs_used == 0) break;
+        blk_wait();
+    }
+
+    int counted = 0;
+    for (;;) {
+        blk_buf_t *b = buf_lookup(blkno);
+        if (b && (b->flags & BUF_BUSY) != 0) {
+            blk_wait();
+            continue;
+        }
+        if (b) {
+            if (!counted) g_stats.hits++;
+            lru_touch(b);
+        } else if (span == BLK_SIZE) {
+            /* Overwritten whole: no need to read it first. It is only cached
+             * once the caller has filled it (blk_write_end()); until then
+             * nobody else can see it, and it holds zeros rather than whatever
+             * block the buffer held before.
+             */
+            b = buf_get();
+            if (!b) {
+                if (g_reqs_used == 0) return -(int64_t)ENOMEM;
+                blk_wait();
+                continue;
+            }
+            memset(b->data, 0, BLK_SIZE);
+            b->blkno = blkno;
+            b->flags = BUF_NEW;
+        } else {
+            /* Read it in, then look again: it must not be on its way out. */
+            int err = 0;
+            if (!buf_read(blkno, 0, &err)) return err;
+            counted = 1;
+            continue;
+        }
+
+        *bp = b;
+        *out = b->data + in;
+        return (int64_t)span;
+    }
+}
+
+void blk_write_end(struct blk_buf *b, int filled) {
+    if ((b->flags & BUF_NEW) != 0) {
+        if (!filled) {
+            buf_put_free(b);
+            return;
+        }
+        b->flags &= ~BUF_NEW;
+        buf_hash(b);
+        lru_push_front(b);
+    }
+    /* A cached block stays what reads see even if the copy stopped part
+     * way, so it is written back either way.
+     */
+    buf_dirty(b);
+}
+
+int blk_sync(void) {
+    if (g_blocks == 0) return 0;
+
+    /* Until nothing is dirty or in flight, or a write failed (what failed
+     * stays dirty for the flusher to retry).
+     */
+    uint64_t errors = g_write_errors;
+    for (;;) {
+        if (g_write_errors == errors) writeback_start(~0ull);
+        if (g_reqs_used == 0 && (g_stats.dirty == 0 || g_write_errors != errors)) break;
+        blk_wait();
+    }
+    return (g_write_errors == errors) ? 0 : -(int)EIO;
+}
+
+void blk_get_stats(blk_stats_t *out) {
+    *out = g_stats;
+}
@@ -41,6 +41,10 @@ static inline void dc_ivac(uint64_t v) {
     __asm__ volatile("dc ivac, %0" :: "r"(v) : "memory");
 }
 
+static inline void dc_civac(uint64_t v) {
+    __asm__ volatile("dc civac, %0" :: "r"(v) : "memory");
+}
+
 static inline uint64_t read_ctr_el0(void) {
     uint64_t v;
     __asm__ volatile("mrs %0, ctr_el0" : "=r"(v));
@@ -164,27 +168,39 @@ void cache_clean_invalidate_all(void) {
     isb();
 }
 
+/*
+ * CTR_EL0 line sizes, read once:
+ *  - DminLine (bits [19:16]): log2(words) => bytes = 4 << n
+ *  - IminLine (bits [3:0]):   log2(words) => bytes = 4 << n
+ */
+static uint64_t g_dline;
+static uint64_t g_iline;
+
+static uint64_t ctr_line_bytes(uint64_t words_log2) {
+    uint64_t line = 4ull << words_log2;
+    if (line < 16) line = 16;
+    if (line > 256) line = 256;
+    return line;
+}
+
+static void cache_read_lines(void) {
+    uint64_t ctr = read_ctr_el0();
+    g_iline = ctr_line_bytes(ctr & 0xFull);
+    g_dline = ctr_line_bytes((ctr >> 16) & 0xFull);
+}
+
+uint64_t cache_dline_bytes(void) {
+    if (g_dline == 0) cache_read_lines();
+    return g_dline;
+}
+
 void cache_sync_icache_for_range(uint64_t start, uint64_t size) {
     if (size == 0) {
         return;
     }
 
-    /*
-     * CTR_EL0:
-     *  - DminLine (bits [19:16]): log2(words) => bytes = 4 << n
-     *  - IminLine (bits [3:0]):   log2(words) => bytes = 4 << n
-     */
-    uint64_t ctr = read_ctr_el0();
-    uint64_t dminline_words_log2 = (ctr >> 16) & 0xFull;
-    uint64_t iminline_words_log2 = ctr & 0xFull;
-
-    uint64_t dline = 4ull << dminline_words_log2;
-    uint64_t iline = 4ull << iminline_words_log2;
-
-    if (dline < 16) dline = 16;
-    if (dline > 256) dline = 256;
-    if (iline < 16) iline = 16;
-    if (iline > 256) iline = 256;
+    uint64_t dline = cache_dline_bytes();
+    uint64_t iline = g_iline;
 
     uint64_t s_d = start & ~(dline - 1);
     uint64_t e_d = (start + size + (dline - 1)) & ~(dline - 1);
@@ -204,19 +220,10 @@ void cache_sync_icache_for_range(uint64_t start, uint64_t size) {
     isb();
 }
 
-static uint64_t dcache_line_bytes(void) {
-    uint64_t ctr = read_ctr_el0();
-    uint64_t dminline_words_log2 = (ctr >> 16) & 0xFull;
-    uint64_t dline = 4ull << dminline_words_log2;
-    if (dline < 16) dline = 16;
-    if (dline > 256) dline = 256;
-    return dline;
-}
-
 void cache_clean_dcache_for_range(uint64_t start, uint64_t size) {
     if (size == 0) return;
 
-    uint64_t line = dcache_line_bytes();
+    uint64_t line = cache_dline_bytes();
     uint64_t s = start & ~(line - 1);
     uint64_t e = (start + size + (line - 1)) & ~(line - 1);
 
@@ -229,12 +236,29 @@ void cache_clean_dcache_for_range(uint64_t start, uint64_t size) {
 void cache_invalidate_dcache_for_range(uint64_t start, uint64_t size) {
     if (size == 0) return;
 
-    uint64_t line = dcache_line_bytes();
+    uint64_t line = cache_dline_bytes();
+    uint64_t s = start & ~(line - 1);
+    uint64_t e = (start + size + (line - 1)) & ~(line - 1);
+
+    for (uint64_t p = s; p < e; p += line) {
+        /* A line only partly inside the range may hold someone else's dirty
+         * bytes: write it back rather than drop it.
+         */
+        if (p < start || p + line > start + size) dc_civac(p);
+        else dc_ivac(p);
+    }
+    dsb_ish();
+}
+
+void cache_clean_invalidate_dcache_for_range(uint64_t start, uint64_t size) {
+    if (size == 0) return;
+
+    uint64_t line = cache_dline_bytes();
     uint64_t s = start & ~(line - 1);
     uint64_t e = (start + size + (line - 1)) & ~(line - 1);
 
     for (uint64_t p = s; p < e; p += line) {
-        dc_ivac(p);
+        dc_civac(p);
     }
     dsb_ish();
 }
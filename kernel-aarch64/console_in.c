@@ -1,9 +1,11 @@
 #include "console_in.h"
 
 #include "uart_pl011.h"
+#include "wait.h"
 
 #if defined(ENABLE_USB_KBD) || defined(ENABLE_USB_NET)
 #include "time.h"
+#include "timer.h"
 #include "usb.h"
 #endif
 
@@ -14,10 +16,16 @@ static char g_ring[CONSOLE_IN_RING_SIZE];
 static uint32_t g_r; /* read index */
 static uint32_t g_w; /* write index */
 
+/* Tasks blocked in read() on the console. */
+static waitq_t g_readers = WAITQ_INIT;
+
+#if defined(ENABLE_USB_KBD) || defined(ENABLE_USB_NET)
 /* For polling-only input backends (currently: USB keyboard), avoid polling on
- * every scheduler iteration. Instead poll on a fixed cadence.
+ * every scheduler iteration. Instead poll on a fixed cadence from a kernel
+ * timer, which also wakes idle cores when it is due.
  */
-static uint64_t g_next_poll_ns;
+static ktimer_t g_poll_timer;
+#endif
 
 /* Conservative default cadence. HID interrupt endpoints are commonly 10ms.
  * This is a tradeoff: lower values reduce latency but cost CPU.
@@ -36,8 +44,13 @@ static void ring_push(char c) {
         /* full: drop newest (safe default for console input) */
         return;
     }
+    int was_empty = (g_r == g_w);
     g_ring[g_w] = c;
     g_w = next;
+    if (was_empty) {
+        /* One reader per batch: it passes the baton on if it leaves data. */
+        waitq_wake_one(&g_readers);
+    }
 }
 
 void console_in_inject_char(char c) {
@@ -52,10 +65,24 @@ static int ring_pop(char *out) {
     return 1;
 }
 
+#if defined(ENABLE_USB_KBD) || defined(ENABLE_USB_NET)
+static void console_in_poll_timer_fn(ktimer_t *t, void *arg) {
+    (void)arg;
+    usb_poll();
+    timer_arm(t, time_now_ns() + CONSOLE_IN_POLL_INTERVAL_NS);
+}
+#endif
+
 void console_in_init(void) {
     g_r = 0;
     g_w = 0;
-    g_next_poll_ns = 0;
+
+#if defined(ENABLE_USB_KBD) || defined(ENABLE_USB_NET)
+    timer_init(&g_poll_timer, console_in_poll_timer_fn, 0);
+    if (time_now_ns() != 0) {
+        timer_arm(&g_poll_timer, time_now_ns() + CONSOLE_IN_POLL_INTERVAL_NS);
+    }
+#endif
 }
 
 void console_in_poll(void) {
@@ -68,15 +95,10 @@ void console_in_poll(void) {
     }
 
 #if defined(ENABLE_USB_KBD) || defined(ENABLE_USB_NET)
-    uint64_t now = time_now_ns();
-    if (now != 0) {
-        if (g_next_poll_ns == 0 || now >= g_next_poll_ns) {
-            usb_poll();
-            /* Schedule the next poll. */
-            g_next_poll_ns = now + CONSOLE_IN_POLL_INTERVAL_NS;
-        }
-    } else {
-        /* If time isn't available, fall back to the original behavior. */
+    /* USB is normally polled by g_poll_timer. If time isn't available, fall
+     * back to the original behavior.
+     */
+    if (!timer_pending(&g_poll_timer)) {
         usb_poll();
     }
 #endif
@@ -88,6 +110,10 @@ int console_in_has_data(void) {
     return g_r != g_w;
 }
 
+waitq_t *console_in_waitq(void) {
+    return &g_readers;
+}
+
 int console_in_pop(char *out) {
     return ring_pop(out);
 }
@@ -112,11 +138,3 @@ int console_in_needs_polling(void) {
     return 0;
 #endif
 }
-
-uint64_t console_in_next_poll_deadline_ns(void) {
-#if defined(ENABLE_USB_KBD) || defined(ENABLE_USB_NET)
-    return g_next_poll_ns;
-#else
-    return 0;
-#endif
-}
@@ -0,0 +1,83 @@
+#include "dma.h"
+
+#include "mmu.h"
+#include "pmm.h"
+#include "string.h"
+#include "uart_pl011.h"
+
+#define DMA_GRANULES (DMA_POOL_SIZE / DMA_ALIGN)
+
+static uint64_t g_dma_base;
+/* One bit per DMA_ALIGN granule, set = in use. */
+static uint64_t g_dma_used[DMA_GRANULES / 64u];
+
+static inline int granule_used(uint64_t i) {
+    return (g_dma_used[i / 64u] >> (i % 64u)) & 1u;
+}
+
+static void granules_mark(uint64_t first, uint64_t n, int used) {
+    for (uint64_t i = first; i < first + n; i++) {
+        if (used) g_dma_used[i / 64u] |= 1ull << (i % 64u);
+        else g_dma_used[i / 64u] &= ~(1ull << (i % 64u));
+    }
+}
+
+int dma_init(void) {
+    if (g_dma_base != 0) return 0;
+
+    /* The pool must fill whole 2MiB blocks: the identity map changes memory
+     * type in block units.
+     */
+    uint64_t pa = pmm_alloc_2mib_aligned();
+    if (pa == 0) {
+        uart_write("dma: no memory for pool\n");
+        return -1;
+    }
+    if (mmu_mark_region_uncached(pa, DMA_POOL_SIZE) != 0) {
+        uart_write("dma: cannot map pool uncached\n");
+        pmm_free_2mib_aligned(pa);
+        return -1;
+    }
+    memset((void *)(uintptr_t)pa, 0, DMA_POOL_SIZE);
+    g_dma_base = pa;
+
+    uart_write("dma: pool at ");
+    uart_write_hex_u64(pa);
+    uart_write("\n");
+    return 0;
+}
+
+void *dma_alloc(size_t size) {
+    if (g_dma_base == 0 || size == 0 || size > DMA_POOL_SIZE) return 0;
+
+    uint64_t n = (size + DMA_ALIGN - 1u) / DMA_ALIGN;
+    uint64_t run = 0;
+    for (uint64_t i = 0; i < DMA_GRANULES; i++) {
+        if (granule_used(i)) {
+            run = 0;
+            continue;
+        }
+        if (++run == n) {
+            uint64_t first = i + 1u - n;
+            granules_mark(first, n, 1);
+            return (void *)(uintptr_t)(g_dma_base + first * DMA_ALIGN);
+        }
+    }
+    return 0;
+}
+
+void dma_free(void *p, size_t size) {
+    if (!p || size == 0 || !dma_is_coherent(p)) return;
+
+    uint64_t off = (uint64_t)(uintptr_t)p - g_dma_base;
+    uint64_t n = (size + DMA_ALIGN - 1u) / DMA_ALIGN;
+    if (off % DMA_ALIGN != 0 || off / DMA_ALIGN + n > DMA_GRANULES) return;
+    /* Hand it out zeroed again. */
+    memset(p, 0, n * DMA_ALIGN);
+    granules_mark(off / DMA_ALIGN, n, 0);
+}
+
+int dma_is_coherent(const void *p) {
+    uint64_t a = (uint64_t)(uintptr_t)p;
+    return g_dma_base != 0 && a >= g_dma_base && a < g_dma_base + DMA_POOL_SIZE;
+}
@@ -1,11 +1,6 @@
 #include "elf64.h"
 
-static void byte_copy(void *dst, const uint8_t *src, size_t n) {
-    uint8_t *d = (uint8_t *)dst;
-    for (size_t i = 0; i < n; i++) {
-        d[i] = src[i];
-    }
-}
+#include "string.h"
 
 static int range_ok(uint64_t base, uint64_t size, uint64_t p, uint64_t n) {
     if (n == 0) return 1;
@@ -16,18 +11,19 @@ static int range_ok(uint64_t base, uint64_t size, uint64_t p, uint64_t n) {
     return 1;
 }
 
-int elf64_load_etexec(const uint8_t *img,
-                      size_t img_size,
-                      uint64_t user_va_base,
-                      uint64_t user_size,
-                      uint64_t user_pa_base,
-                      uint64_t *entry_out,
-                      uint64_t *min_loaded_va_out,
-                      uint64_t *max_loaded_va_out) {
+static uint32_t phdr_prot(uint32_t p_flags) {
+    uint32_t prot = 0;
+    if (p_flags & PF_R) prot |= MMU_PROT_READ;
+    if (p_flags & PF_W) prot |= MMU_PROT_WRITE;
+    if (p_flags & PF_X) prot |= MMU_PROT_EXEC;
+    return prot;
+}
+
+int elf64_parse(const uint8_t *img, size_t img_size, elf64_image_t *out) {
     if (!img || img_size < sizeof(elf64_ehdr_t)) return -1;
 
     elf64_ehdr_t eh;
-    byte_copy(&eh, img, sizeof(eh));
+    memcpy(&eh, img, sizeof(eh));
 
     if (eh.e_ident[0] != ELF_MAGIC0 || eh.e_ident[1] != ELF_MAGIC1 ||
         eh.e_ident[2] != ELF_MAGIC2 || eh.e_ident[3] != ELF_MAGIC3) {
@@ -46,16 +42,30 @@ int elf64_load_etexec(const uint8_t *img,
     if (ph_end < eh.e_phoff) return -1;
     if (ph_end > (uint64_t)img_size) return -1;
 
+    out->img = img;
+    out->img_size = (uint64_t)img_size;
+    out->entry = eh.e_entry;
+    out->phdr_va = 0;
+    out->phent = (uint64_t)eh.e_phentsize;
+    out->phnum = (uint64_t)eh.e_phnum;
+    out->nloads = 0;
+
     uint64_t min_va = ~0ull;
     uint64_t max_va = 0;
+    uint64_t phdr_load_va = 0;
 
+    /* Segments come sorted by address; two may share a page (our link.ld
+     * packs .data right after .rodata), but overlap no further.
+     */
+    uint64_t mapped_end = 0;
     for (uint16_t i = 0; i < eh.e_phnum; i++) {
-        uint64_t ph_off = eh.e_phoff + (uint64_t)i * sizeof(elf64_phdr_t);
-        if (ph_off + sizeof(elf64_phdr_t) > (uint64_t)img_size) return -1;
-
         elf64_phdr_t ph;
-        byte_copy(&ph, img + ph_off, sizeof(ph));
+        memcpy(&ph, img + eh.e_phoff + (uint64_t)i * sizeof(elf64_phdr_t), sizeof(ph));
 
+        if (ph.p_type == PT_PHDR) {
+            if (out->phdr_va == 0) out->phdr_va = ph.p_vaddr;
+            continue;
+        }
         if (ph.p_type != PT_LOAD) continue;
 
         /* Ignore empty load segments. */
@@ -65,21 +75,26 @@ int elf64_load_etexec(const uint8_t *img,
         if (ph.p_offset + ph.p_filesz < ph.p_offset) return -1;
         if (ph.p_offset + ph.p_filesz > (uint64_t)img_size) return -1;
 
-        if (!range_ok(user_va_base, user_size, ph.p_vaddr, ph.p_memsz)) return -1;
-
-        if (ph.p_vaddr < user_va_base) return -1;
-        uint64_t off_in_user = ph.p_vaddr - user_va_base;
-        if (off_in_user + ph.p_memsz < off_in_user) return -1;
-        if (off_in_user + ph.p_memsz > user_size) return -1;
-
-        volatile uint8_t *dst = (volatile uint8_t *)(uintptr_t)(user_pa_base + off_in_user);
-        const uint8_t *src = img + ph.p_offset;
+        if (!range_ok(USER_REGION_BASE, USER_REGION_SIZE, ph.p_vaddr, ph.p_memsz)) return -1;
 
-        for (uint64_t j = 0; j < ph.p_filesz; j++) {
-            dst[j] = src[j];
+        uint64_t start = ph.p_vaddr & ~(VM_PAGE_SIZE - 1ull);
+        uint64_t end = (ph.p_vaddr + ph.p_memsz + VM_PAGE_SIZE - 1ull) & ~(VM_PAGE_SIZE - 1ull);
+        if (start < mapped_end && (ph.p_vaddr < max_va || start + VM_PAGE_SIZE < mapped_end)) {
+            return -1; /* unsorted or overlapping beyond a shared page */
         }
-        for (uint64_t j = ph.p_filesz; j < ph.p_memsz; j++) {
-            dst[j] = 0;
+        if (end > mapped_end) mapped_end = end;
+
+        if (out->nloads == ELF64_MAX_LOADS) return -1;
+        elf64_load_t *l = &out->loads[out->nloads++];
+        l->vaddr = ph.p_vaddr;
+        l->memsz = ph.p_memsz;
+        l->offset = ph.p_offset;
+        l->filesz = ph.p_filesz;
+        l->prot = phdr_prot(ph.p_flags);
+
+        /* Program headers are typically within the first PT_LOAD segment. */
+        if (phdr_load_va == 0 && ph.p_offset == 0 && ph_end <= ph.p_filesz) {
+            phdr_load_va = ph.p_vaddr + eh.e_phoff;
         }
 
         if (ph.p_vaddr < min_va) min_va = ph.p_vaddr;
@@ -87,9 +102,78 @@ int elf64_load_etexec(const uint8_t *img,
     }
 
     if (min_va == ~0ull) return -1;
+    out->min_va = min_va;
+    out->max_va = max_va;
+
+    /* AT_PHDR: prefer PT_PHDR; only report headers that end up mapped. */
+    if (out->phdr_va == 0) out->phdr_va = phdr_load_va;
+    uint64_t phdr_len = out->phnum * out->phent;
+    if (out->phdr_va < min_va || out->phdr_va > max_va || phdr_len > max_va - out->phdr_va) {
+        out->phdr_va = 0;
+    }
+    return 0;
+}
+
+/* Copy the file bytes of l that fall into [lo, hi). */
+static int load_copy_part(vm_space_t *vm, const elf64_image_t *im, const elf64_load_t *l, uint64_t lo, uint64_t hi) {
+    uint64_t a = (lo > l->vaddr) ? lo : l->vaddr;
+    uint64_t b = l->vaddr + l->filesz;
+    if (hi < b) b = hi;
+    if (a >= b) return 0;
+    return vm_copy_to(vm, a, im->img + l->offset + (a - l->vaddr), b - a);
+}
 
-    if (entry_out) *entry_out = eh.e_entry;
-    if (min_loaded_va_out) *min_loaded_va_out = min_va;
-    if (max_loaded_va_out) *max_loaded_va_out = max_va;
+int elf64_map(const elf64_image_t *im, vm_space_t *vm, int in_place) {
+    /* Pass 1: VMAs, and the file contents from each segment's first page
+     * boundary on. A page shared by two segments gets both segments'
+     * permissions and is filled in pass 2. All of it is a VMA_FILE: it holds
+     * file contents that a demand-zero refill would lose.
+     */
+    uint64_t mapped_end = 0;
+    uint32_t mapped_prot = 0;
+    for (uint32_t i = 0; i < im->nloads; i++) {
+        const elf64_load_t *l = &im->loads[i];
+        uint64_t start = l->vaddr & ~(VM_PAGE_SIZE - 1ull);
+        uint64_t head = (l->vaddr + VM_PAGE_SIZE - 1ull) & ~(VM_PAGE_SIZE - 1ull);
+        uint64_t end = (l->vaddr + l->memsz + VM_PAGE_SIZE - 1ull) & ~(VM_PAGE_SIZE - 1ull);
+        int rc;
+
+        if (start < mapped_end) {
+            uint64_t shared = mapped_end - VM_PAGE_SIZE;
+            if ((rc = vm_unmap(vm, shared, VM_PAGE_SIZE)) != 0) return rc;
+            if ((rc = vm_map(vm, shared, VM_PAGE_SIZE, l->prot | mapped_prot, VMA_FILE)) != 0) return rc;
+            start = mapped_end;
+        }
+        if (start < head) {
+            if ((rc = vm_map(vm, start, head - start, l->prot, VMA_FILE)) != 0) return rc;
+            start = head;
+        }
+        if (start < end) {
+            uint64_t skip = start - l->vaddr;
+            uint64_t size = (l->filesz > skip) ? l->filesz - skip : 0;
+            rc = vm_map_data(vm, start, end - start, l->prot, im->img + l->offset + skip, size, in_place);
+            if (rc != 0) return rc;
+        }
+        if (end > mapped_end) {
+            mapped_end = end;
+            mapped_prot = l->prot;
+        }
+    }
+
+    /* Pass 2: partial first pages, and last pages taken over by the next
+     * segment.
+     */
+    for (uint32_t i = 0; i < im->nloads; i++) {
+        const elf64_load_t *l = &im->loads[i];
+        uint64_t start = l->vaddr & ~(VM_PAGE_SIZE - 1ull);
+        uint64_t head = (l->vaddr + VM_PAGE_SIZE - 1ull) & ~(VM_PAGE_SIZE - 1ull);
+        int rc = load_copy_part(vm, im, l, start, head);
+        if (rc != 0) return rc;
+
+        if (i + 1 < im->nloads) {
+            uint64_t next = im->loads[i + 1].vaddr & ~(VM_PAGE_SIZE - 1ull);
+            if ((rc = load_copy_part(vm, im, l, next, next + VM_PAGE_SIZE)) != 0) return rc;
+        }
+    }
     return 0;
 }
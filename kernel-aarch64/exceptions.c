@@ -1,16 +1,28 @@
 #include "exceptions.h"
 
 #include "errno.h"
+#include "linux_abi.h"
 #include "mmu.h"
 #include "proc.h"
 #include "sched.h"
+#include "smp.h"
 #include "syscalls.h"
 #include "syscall_numbers.h"
+#include "uaccess.h"
 #include "uart_pl011.h"
 #include "irq.h"
+#include "vm.h"
 
 #define PROC_TRACE 0
 
+/* ESR_EL1 exception classes. */
+#define EC_SVC64        0x15ull
+#define EC_IABT_LOWER   0x20ull
+#define EC_DABT_LOWER   0x24ull
+#define EC_DABT_CUR     0x25ull
+/* Data abort ISS: the access was a write. */
+#define ESR_DABT_WNR    (1ull << 6)
+
 static void proc_trace(const char *msg, uint64_t a, uint64_t b) {
 #if PROC_TRACE
     uart_write("[proc] ");
@@ -117,7 +129,7 @@ void exception_report(uint64_t kind,
         uart_write_hex_u64(tf->x[30]);
     }
 
-    if (kind == 8 && elr >= USER_REGION_BASE && (elr + 4u) <= (USER_REGION_BASE + USER_REGION_SIZE)) {
+    if (kind == 8 && vm_range_ok(&proc_current()->vm, elr, 4)) {
         uint32_t insn = *(volatile uint32_t *)(uintptr_t)elr;
         uart_write(" insn=");
         uart_write_hex_u64((uint64_t)insn);
@@ -125,32 +137,131 @@ void exception_report(uint64_t kind,
     uart_write("\n");
 }
 
-uint64_t exception_handle(trap_frame_t *tf,
-                          uint64_t kind,
-                          uint64_t esr,
-                          uint64_t elr,
-                          uint64_t far,
-                          uint64_t spsr) {
-    (void)esr;
-    (void)far;
-    (void)spsr;
+static uint32_t fault_access(uint64_t esr) {
+    uint64_t ec = (esr >> 26) & 0x3Full;
+    if (ec == EC_IABT_LOWER) return MMU_PROT_EXEC;
+    return ((esr & ESR_DABT_WNR) != 0) ? MMU_PROT_WRITE : MMU_PROT_READ;
+}
 
-    /* IRQ in EL1h: used for wfi-based idle wakeups. */
-    if (kind == 5) {
+/* Sync exception from EL0 other than a syscall. Returns if the faulting
+ * instruction can be retried; otherwise the process is gone.
+ */
+static void user_fault(proc_t *cur,
+                       const trap_frame_t *tf,
+                       uint64_t esr,
+                       uint64_t elr,
+                       uint64_t far,
+                       uint64_t spsr) {
+    uint64_t ec = (esr >> 26) & 0x3Full;
+    uint64_t code = 128u + LINUX_SIGILL;
+
+    if (ec == EC_IABT_LOWER || ec == EC_DABT_LOWER) {
+        if (vm_fault(&cur->vm, far, fault_access(esr)) == 0) {
+            cur->minflt++;
+            proc_note_rss(cur);
+            return;
+        }
+        code = 128u + LINUX_SIGSEGV;
+    }
+
+    uart_write("[fault] pid=");
+    uart_write_hex_u64(cur->pid);
+    exception_report(8, esr, elr, far, spsr, tf);
+    proc_exit(code);
+}
+
+extern const ex_entry_t __ex_table_start[];
+extern const ex_entry_t __ex_table_end[];
+
+/* Where a user copy that faulted at pc continues, or 0 if pc is not one. */
+static uint64_t ex_fixup(uint64_t pc) {
+    for (const ex_entry_t *e = __ex_table_start; e < __ex_table_end; e++) {
+        if (e->insn == pc) return e->fixup;
+    }
+    return 0;
+}
+
+/* Sync exception in EL1h, with the kernel lock already held by the code that
+ * was interrupted. Syscalls touch user buffers directly, so the first access
+ * to a page of the current process commits it like a fault from EL0 would.
+ */
+static uint64_t kernel_fault(const trap_frame_t *tf,
+                             uint64_t esr,
+                             uint64_t elr,
+                             uint64_t far,
+                             uint64_t spsr) {
+    uint64_t ec = (esr >> 26) & 0x3Full;
+    int user = g_cur_proc >= 0 && far >= USER_REGION_BASE &&
+               far < USER_REGION_BASE + USER_REGION_SIZE;
+
+    if (ec == EC_DABT_CUR && user) {
+        proc_t *cur = proc_current();
+        if (vm_fault(&cur->vm, far, fault_access(esr)) == 0) {
+            cur->minflt++;
+            proc_note_rss(cur);
+            return 1;
+        }
+        /* A bad pointer handed to a user copy: the copy fails with -EFAULT. */
+        uint64_t fixup = ex_fixup(elr);
+        if (fixup != 0) return fixup;
+        /* A bad user pointer the syscall did not catch (e.g. a write to
+         * read-only memory): the process goes, the kernel carries on.
+         */
+        uart_write("[fault] pid=");
+        uart_write_hex_u64(cur->pid);
+        exception_report(4, esr, elr, far, spsr, tf);
+        proc_exit(128u + LINUX_SIGSEGV);
+    }
+
+    exception_report(4, esr, elr, far, spsr, tf);
+    return 0;
+}
+
+static uint64_t exception_dispatch(trap_frame_t *tf,
+                                   uint64_t kind,
+                                   uint64_t esr,
+                                   uint64_t elr,
+                                   uint64_t far,
+                                   uint64_t spsr) {
+    /* tf is the trap frame at the top of the current task's kernel stack
+     * (cur->tf): syscalls read their arguments from it and leave results in
+     * it, and it stays put while the task blocks or is switched out.
+     */
+    proc_t *cur = proc_current();
+
+    /* Everything since the last return to EL0 ran in user mode. */
+    if (kind == 8 || kind == 9) {
+        proc_acct_user(cur);
+    }
+
+    /* IRQ in EL0: service devices, then preempt if the quantum is used up. */
+    if (kind == 9) {
+        cur->elr = elr;
         irq_handle();
+        if (cur->pending_kill) {
+            proc_exit(cur->pending_kill_code);
+        }
+        sched_preempt();
+        proc_acct_sys(cur);
         return 1;
     }
 
-    /* Only support EL0 AArch64 sync (SVC) for syscalls. */
+    /* Only EL0 AArch64 sync is handled here: syscalls and page faults. */
     if (kind != 8) {
         return 0;
     }
 
-    proc_init_if_needed(elr, tf);
-    g_procs[g_cur_proc].elr = elr;
-    tf_copy(&g_procs[g_cur_proc].tf, tf);
-    if (g_procs[g_cur_proc].stack_low == 0 || tf->sp_el0 < g_procs[g_cur_proc].stack_low) {
-        g_procs[g_cur_proc].stack_low = tf->sp_el0;
+    cur->elr = elr;
+
+    /* Killed from another core while running: exit instead of the syscall. */
+    if (cur->pending_kill) {
+        proc_exit(cur->pending_kill_code);
+    }
+
+    if (((esr >> 26) & 0x3Full) != EC_SVC64) {
+        user_fault(cur, tf, esr, elr, far, spsr);
+        proc_acct_sys(cur);
+        return 1;
     }
 
     uint64_t nr = tf->x[8];
@@ -163,7 +274,6 @@ uint64_t exception_handle(trap_frame_t *tf,
 
     uint64_t ret = 0;
     int set_x0_ret = 1;
-    int update_saved_elr = 1;
 
     switch (nr) {
         case __NR_getcwd:
@@ -186,6 +296,14 @@ uint64_t exception_handle(trap_frame_t *tf,
             ret = sys_munmap(a0, a1);
             break;
 
+        case __NR_mremap:
+            ret = sys_mremap(a0, a1, a2, a3, a4);
+            break;
+
+        case __NR_madvise:
+            ret = sys_madvise(a0, a1, a2);
+            break;
+
         case __NR_getpid:
             ret = g_procs[g_cur_proc].pid;
             break;
@@ -223,12 +341,7 @@ uint64_t exception_handle(trap_frame_t *tf,
             break;
 
         case __NR_kill:
-            ret = sys_kill(tf, (int64_t)a0, a1, elr);
-            if (ret == SYSCALL_SWITCHED) {
-                /* sys_kill already switched contexts. */
-                tf_copy(&g_procs[g_cur_proc].tf, tf);
-                return 1;
-            }
+            ret = sys_kill((int64_t)a0, a1);
             break;
 
         case __NR_set_tid_address:
@@ -248,12 +361,7 @@ uint64_t exception_handle(trap_frame_t *tf,
             break;
 
         case __NR_nanosleep:
-            ret = sys_nanosleep(tf, a0, a1, elr);
-            if (ret == SYSCALL_SWITCHED) {
-                /* sys_nanosleep already switched contexts. */
-                tf_copy(&g_procs[g_cur_proc].tf, tf);
-                return 1;
-            }
+            ret = sys_nanosleep(a0, a1);
             break;
 
         case __NR_chdir:
@@ -264,6 +372,10 @@ uint64_t exception_handle(trap_frame_t *tf,
             ret = sys_dup3(a0, a1, a2);
             break;
 
+        case __NR_fcntl:
+            ret = sys_fcntl(a0, a1, a2);
+            break;
+
         case __NR_mkdirat:
             ret = sys_mkdirat((int64_t)a0, a1, a2);
             break;
@@ -293,12 +405,7 @@ uint64_t exception_handle(trap_frame_t *tf,
             break;
 
         case __NR_read:
-            ret = sys_read(tf, a0, a1, a2, elr);
-            if (ret == SYSCALL_SWITCHED) {
-                /* sys_read already switched contexts. */
-                tf_copy(&g_procs[g_cur_proc].tf, tf);
-                return 1;
-            }
+            ret = sys_read(a0, a1, a2);
             break;
 
         case __NR_getdents64:
@@ -309,6 +416,26 @@ uint64_t exception_handle(trap_frame_t *tf,
             ret = sys_lseek(a0, (int64_t)a1, a2);
             break;
 
+        case __NR_truncate:
+            ret = sys_truncate(a0, (int64_t)a1);
+            break;
+
+        case __NR_ftruncate:
+            ret = sys_ftruncate(a0, (int64_t)a1);
+            break;
+
+        case __NR_fallocate:
+            ret = sys_fallocate(a0, a1, (int64_t)a2, (int64_t)a3);
+            break;
+
+        case __NR_sync:
+            ret = sys_sync();
+            break;
+
+        case __NR_fsync:
+            ret = sys_fsync(a0);
+            break;
+
         case __NR_write:
             ret = sys_write(a0, (const void *)(uintptr_t)a1, a2);
             break;
@@ -341,11 +468,10 @@ uint64_t exception_handle(trap_frame_t *tf,
             proc_trace("execve", g_procs[g_cur_proc].pid, a0);
             ret = sys_execve(tf, a0, a1, a2);
             if (ret == 0) {
-                /* Success: sys_execve prepared initial user register state (argc/argv/envp).
-                 * execve does not return to the caller.
+                /* Success: sys_execve prepared initial user register state (argc/argv/envp)
+                 * and the new entry point. execve does not return to the caller.
                  */
                 set_x0_ret = 0;
-                update_saved_elr = 0;
             }
             break;
 
@@ -354,14 +480,17 @@ uint64_t exception_handle(trap_frame_t *tf,
             ret = sys_clone(tf, a0, a1, a2, a3, a4, elr);
             break;
 
+        case __NR_times:
+            ret = sys_times(a0);
+            break;
+
+        case __NR_getrusage:
+            ret = sys_getrusage((int64_t)a0, a1);
+            break;
+
         case __NR_wait4:
             proc_trace("wait4", g_procs[g_cur_proc].pid, (uint64_t)(int64_t)a0);
-            ret = sys_wait4(tf, (int64_t)a0, a1, a2, a3, elr);
-            if (ret == SYSCALL_SWITCHED) {
-                /* sys_wait4 already switched contexts. */
-                tf_copy(&g_procs[g_cur_proc].tf, tf);
-                return 1;
-            }
+            ret = sys_wait4((int64_t)a0, a1, a2, a3);
             break;
 
         case __NR_mona_dmesg:
@@ -369,12 +498,7 @@ uint64_t exception_handle(trap_frame_t *tf,
             break;
 
         case __NR_mona_ping6:
-            ret = sys_mona_ping6(tf, a0, a1, a2, a3, a4, elr);
-            if (ret == SYSCALL_SWITCHED) {
-                /* sys_mona_ping6 already switched contexts. */
-                tf_copy(&g_procs[g_cur_proc].tf, tf);
-                return 1;
-            }
+            ret = sys_mona_ping6(a0, a1, a2, a3, a4);
             break;
 
         case __NR_mona_udp6_socket:
@@ -390,12 +514,7 @@ uint64_t exception_handle(trap_frame_t *tf,
             break;
 
         case __NR_mona_udp6_recvfrom:
-            ret = sys_mona_udp6_recvfrom(tf, a0, a1, a2, a3, a4, a5, elr);
-            if (ret == SYSCALL_SWITCHED) {
-                /* sys_mona_udp6_recvfrom already switched contexts. */
-                tf_copy(&g_procs[g_cur_proc].tf, tf);
-                return 1;
-            }
+            ret = sys_mona_udp6_recvfrom(a0, a1, a2, a3, a4, a5);
             break;
 
         case __NR_mona_net6_get_dns:
@@ -403,7 +522,7 @@ uint64_t exception_handle(trap_frame_t *tf,
             break;
 
         case __NR_mona_tcp6_connect:
-            ret = sys_mona_tcp6_connect(tf, a0, a1, a2, elr);
+            ret = sys_mona_tcp6_connect(a0, a1, a2);
             break;
 
         case __NR_mona_tcp6_send:
@@ -414,10 +533,15 @@ uint64_t exception_handle(trap_frame_t *tf,
             ret = sys_mona_tcp6_recv(a0, a1, a2, a3);
             break;
 
+        case __NR_mona_spawn:
+            proc_trace("spawn", g_procs[g_cur_proc].pid, a0);
+            ret = sys_mona_spawn(tf, a0, a1, a2, a3, a4, elr);
+            break;
+
         case __NR_exit:
         case __NR_exit_group:
             proc_trace("exit", g_procs[g_cur_proc].pid, a0);
-            return handle_exit_and_maybe_switch(tf, a0) ? 1 : 0;
+            proc_exit(a0);
 
         default:
             ret = (uint64_t)(-(int64_t)ENOSYS);
@@ -428,10 +552,35 @@ uint64_t exception_handle(trap_frame_t *tf,
     if (set_x0_ret) {
         tf->x[0] = ret;
     }
-    tf_copy(&g_procs[g_cur_proc].tf, tf);
-    if (update_saved_elr) {
-        g_procs[g_cur_proc].elr = elr;
-    }
-    sched_maybe_switch(tf);
+    sched_yield();
+    proc_acct_sys(cur);
     return 1;
 }
+
+uint64_t exception_handle(trap_frame_t *tf,
+                          uint64_t kind,
+                          uint64_t esr,
+                          uint64_t elr,
+                          uint64_t far,
+                          uint64_t spsr) {
+    if (kind == 4) {
+        return kernel_fault(tf, esr, elr, far, spsr);
+    }
+
+    /* All kernel work runs under the kernel lock; other cores keep running
+     * user code and block only if they trap into the kernel meanwhile.
+     */
+    kernel_lock();
+
+    uint64_t ret;
+    if (kind == 5) {
+        /* IRQ in EL1h: used for wfi/wfe-based idle wakeups. */
+        irq_handle();
+        ret = 1;
+    } else {
+        ret = exception_dispatch(tf, kind, esr, elr, far, spsr);
+    }
+
+    kernel_unlock();
+    return ret;
+}
@@ -0,0 +1,59 @@
+#include "exec_cache.h"
+
+#include "errno.h"
+#include "initramfs.h"
+#include "stat_bits.h"
+
+enum {
+    EXEC_CACHE_SLOTS = 16,
+    MAX_PATH = 256,
+};
+
+typedef struct {
+    uint64_t last_use; /* 0 = free */
+    char path[MAX_PATH];
+    elf64_image_t im;
+} exec_cache_slot_t;
+
+static exec_cache_slot_t g_slots[EXEC_CACHE_SLOTS];
+static uint64_t g_clock;
+
+static int path_eq(const char *a, const char *b) {
+    while (*a && *a == *b) {
+        a++;
+        b++;
+    }
+    return *a == *b;
+}
+
+int exec_cache_lookup(const char *path, const elf64_image_t **out) {
+    exec_cache_slot_t *victim = &g_slots[0];
+    for (uint32_t i = 0; i < EXEC_CACHE_SLOTS; i++) {
+        exec_cache_slot_t *s = &g_slots[i];
+        if (s->last_use != 0 && path_eq(s->path, path)) {
+            s->last_use = ++g_clock;
+            *out = &s->im;
+            return 0;
+        }
+        if (s->last_use < victim->last_use) victim = s;
+    }
+
+    const uint8_t *img = 0;
+    uint64_t img_size = 0;
+    uint32_t mode = 0;
+    if (initramfs_lookup(path, &img, &img_size, &mode) != 0) return -(int)ENOENT;
+    if (S_ISDIR(mode)) return -(int)EISDIR;
+
+    /* A bad image must not evict anything. */
+    elf64_image_t im;
+    if (elf64_parse(img, (size_t)img_size, &im) != 0) return -(int)ENOEXEC;
+
+    /* Resolved paths are at most MAX_PATH long. */
+    uint64_t n = 0;
+    for (; n + 1 < MAX_PATH && path[n] != '\0'; n++) victim->path[n] = path[n];
+    victim->path[n] = '\0';
+    victim->last_use = ++g_clock;
+    victim->im = im;
+    *out = &victim->im;
+    return 0;
+}
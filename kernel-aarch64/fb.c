@@ -171,12 +171,15 @@ int fb_init_from_mailbox_ex(uint32_t phys_w, uint32_t phys_h,
 
     /*
      * Memory type for the framebuffer:
-     * - On real hardware, mapping it as DEVICE avoids cache coherency issues (we don't clean caches on every draw).
-     * - Under QEMU, DEVICE mappings are extremely slow for per-pixel text rendering; keep it NORMAL for speed.
+     * - On real hardware the GPU scans it out behind our caches, so it must
+     *   not be cached (we don't clean caches on every draw). Normal
+     *   non-cacheable rather than DEVICE still lets stores be gathered.
+     * - Under QEMU, uncached mappings are slow for per-pixel text rendering;
+     *   keep it NORMAL for speed.
      */
 #ifndef QEMU_SEMIHOSTING
-    if (mmu_mark_region_device(g_fb.phys_addr, (uint64_t)g_fb.size_bytes) != 0) {
-        uart_write("fb: warning: failed to mark fb region as device\n");
+    if (mmu_mark_region_uncached(g_fb.phys_addr, (uint64_t)g_fb.size_bytes) != 0) {
+        uart_write("fb: warning: failed to mark fb region uncached\n");
     }
 #endif
 
@@ -1,8 +1,11 @@
 #include "fd.h"
 
+#include "idtab.h"
 #include "net_tcp6.h"
 #include "net_udp6.h"
 #include "pipe.h"
+#include "slab.h"
+#include "vfs.h"
 
 /* errno values (match exceptions.c) */
 #define EBADF 9
@@ -12,7 +15,18 @@ typedef struct {
     fd_table_t fdt;
 } fd_table_wrapper_t;
 
-file_desc_t g_descs[MAX_FILEDESCS];
+/* File descriptions come from a slab cache; fd tables refer to them by id
+ * (int16_t), which bounds the id space.
+ */
+#define MAX_FILEDESC_IDS 32767u
+
+static idtab_t g_descs = IDTAB_INIT(MAX_FILEDESC_IDS);
+static kmem_cache_t *g_desc_cache;
+
+file_desc_t *desc_get(int didx) {
+    if (didx < 0) return 0;
+    return (file_desc_t *)idtab_get(&g_descs, (uint32_t)didx);
+}
 
 void desc_clear(file_desc_t *d) {
     d->kind = FDESC_UNUSED;
@@ -22,14 +36,15 @@ void desc_clear(file_desc_t *d) {
     d->u.initramfs.off = 0;
     d->u.initramfs.mode = 0;
     d->u.initramfs.is_dir = 0;
-    d->u.initramfs.dir_path[0] = '\0';
+    d->u.initramfs.dir = 0;
+    d->u.initramfs.cursor = 0;
     d->u.pipe.pipe_id = 0;
     d->u.pipe.end = 0;
     d->u.ramfile.file_id = 0;
     d->u.ramfile._pad = 0;
     d->u.ramfile.off = 0;
     d->u.proc.node = 0;
-    d->u.proc._pad = 0;
+    d->u.proc.pid = 0;
     d->u.proc.off = 0;
     d->u.udp6.sock_id = 0;
     d->u.udp6._pad = 0;
@@ -38,27 +53,28 @@ void desc_clear(file_desc_t *d) {
 }
 
 void fd_init(void) {
-    for (uint64_t i = 0; i < (uint64_t)MAX_FILEDESCS; i++) {
-        desc_clear(&g_descs[i]);
+    if (!g_desc_cache) {
+        g_desc_cache = kmem_cache_create("file_desc", sizeof(file_desc_t), 0, 0);
     }
 }
 
 int desc_alloc(void) {
-    for (int i = 0; i < (int)MAX_FILEDESCS; i++) {
-        if (g_descs[i].refs == 0) {
-            /* Reserve immediately so subsequent desc_alloc() calls cannot return the same slot. */
-            desc_clear(&g_descs[i]);
-            g_descs[i].refs = 1;
-            return i;
-        }
+    file_desc_t *d = (file_desc_t *)kmem_cache_alloc(g_desc_cache);
+    if (!d) return -1;
+    /* Reserve immediately so subsequent desc_alloc() calls cannot return the same id. */
+    desc_clear(d);
+    d->refs = 1;
+    int didx = idtab_alloc(&g_descs, d);
+    if (didx < 0) {
+        kmem_cache_free(g_desc_cache, d);
+        return -1;
     }
-    return -1;
+    return didx;
 }
 
 void desc_incref(int didx) {
-    if (didx < 0 || didx >= (int)MAX_FILEDESCS) return;
-    file_desc_t *d = &g_descs[didx];
-    if (d->refs == 0) return;
+    file_desc_t *d = desc_get(didx);
+    if (!d || d->refs == 0) return;
     d->refs++;
 
     if (d->kind == FDESC_PIPE) {
@@ -75,9 +91,8 @@ void desc_incref(int didx) {
 }
 
 void desc_decref(int didx) {
-    if (didx < 0 || didx >= (int)MAX_FILEDESCS) return;
-    file_desc_t *d = &g_descs[didx];
-    if (d->refs == 0) return;
+    file_desc_t *d = desc_get(didx);
+    if (!d || d->refs == 0) return;
 
     if (d->kind == FDESC_PIPE) {
         pipe_on_desc_decref(d->u.pipe.pipe_id, d->u.pipe.end);
@@ -93,7 +108,12 @@ void desc_decref(int didx) {
 
     d->refs--;
     if (d->refs == 0) {
-        desc_clear(d);
+        if (d->kind == FDESC_INITRAMFS) {
+            vfs_dir_close(d->u.initramfs.cursor);
+            vfs_dput(d->u.initramfs.dir);
+        }
+        idtab_remove(&g_descs, (uint32_t)didx);
+        kmem_cache_free(g_desc_cache, d);
     }
 }
 
@@ -101,8 +121,8 @@ int fd_get_desc_idx(fd_table_t *t, uint64_t fd) {
     if (!t) return -1;
     if (fd >= MAX_FDS) return -1;
     int didx = t->fd_to_desc[fd];
-    if (didx < 0 || didx >= (int)MAX_FILEDESCS) return -1;
-    if (g_descs[didx].refs == 0) return -1;
+    file_desc_t *d = desc_get(didx);
+    if (!d || d->refs == 0) return -1;
     return didx;
 }
 
@@ -0,0 +1,54 @@
+#include "idtab.h"
+
+#include "errno.h"
+#include "slab.h"
+
+#define IDTAB_MIN_CAP 16u
+
+static int idtab_grow(idtab_t *t) {
+    if (t->cap >= t->max) return -1;
+
+    uint32_t ncap = t->cap ? t->cap * 2u : IDTAB_MIN_CAP;
+    if (ncap > t->max) ncap = t->max;
+
+    void **ns = (void **)kmalloc((uint64_t)ncap * sizeof(void *));
+    if (!ns) return -1;
+    for (uint32_t i = 0; i < ncap; i++) {
+        ns[i] = (i < t->cap) ? t->slots[i] : 0;
+    }
+    kfree(t->slots);
+    t->slots = ns;
+    t->cap = ncap;
+    return 0;
+}
+
+int idtab_alloc(idtab_t *t, void *obj) {
+    if (!t || !obj) return -(int)ENOMEM;
+
+    if (t->count >= t->cap && idtab_grow(t) != 0) {
+        return -(int)ENOMEM;
+    }
+
+    uint32_t start = (t->hint < t->cap) ? t->hint : 0;
+    for (uint32_t n = 0; n < t->cap; n++) {
+        uint32_t id = (start + n) % t->cap;
+        if (!t->slots[id]) {
+            t->slots[id] = obj;
+            t->count++;
+            t->hint = id + 1u;
+            return (int)id;
+        }
+    }
+    return -(int)ENOMEM;
+}
+
+void *idtab_remove(idtab_t *t, uint32_t id) {
+    if (!t || id >= t->cap) return 0;
+    void *obj = t->slots[id];
+    if (obj) {
+        t->slots[id] = 0;
+        t->count--;
+        if (id < t->hint) t->hint = id;
+    }
+    return obj;
+}
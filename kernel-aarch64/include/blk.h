@@ -0,0 +1,85 @@
+#pragma once
+
+#include "stdint.h"
+
+/*
+ * Block layer and buffer cache for the SD card (sdhci.h).
+ *
+ * The card is cached in 4KiB blocks, each in a PMM page, looked up by block
+ * number through a hash and kept in LRU order. Misses read in a run of the
+ * following uncached blocks as well (readahead), the run doubling while
+ * reads stay sequential. Writes only dirty the cache; dirty blocks go out
+ * when they are evicted, on blk_sync(), or from a periodic flusher once they
+ * have been dirty for a while. Going out, they are sorted by block number
+ * and adjacent blocks are merged into one multi-block command.
+ *
+ * Commands are queued at the controller and complete from its interrupt. A
+ * caller that needs one to finish (a miss, a full cache, blk_sync()) sleeps
+ * on a wait queue meanwhile, giving up the kernel lock, so the calls below
+ * that can wait are for syscall context only; the flusher only queues.
+ * Blocks being read in, or written back, are waited for rather than used.
+ *
+ * A trailing part of the card smaller than a block is not used. Requires
+ * the kernel lock.
+ */
+
+#define BLK_SIZE 4096u
+
+/* Most blocks cached at once (pages taken as needed). */
+#define BLK_CACHE_MAX 2048u
+
+/* Cumulative counters, like /proc/diskstats: ios are device commands,
+ * merges the extra blocks they carried, ns the time the device was busy.
+ */
+typedef struct {
+    uint64_t rd_ios;
+    uint64_t rd_merges;
+    uint64_t rd_sectors;
+    uint64_t rd_ns;
+    uint64_t wr_ios;
+    uint64_t wr_merges;
+    uint64_t wr_sectors;
+    uint64_t wr_ns;
+    uint64_t errors;
+    uint64_t hits;
+    uint64_t misses;
+    uint64_t readahead; /* blocks read in before they were asked for */
+    uint32_t cached;    /* blocks */
+    uint32_t dirty;
+} blk_stats_t;
+
+/* Set up the cache over the card brought up by sdhci_init(). Returns 0 or
+ * -1 (no card: blk_size() is 0).
+ */
+int blk_init(void);
+
+/* Usable device size in bytes, 0 without a device. */
+uint64_t blk_size(void);
+
+/* The cached bytes from off to the end of its block, in *out, reading the
+ * block in if needed (may sleep). They stay valid until the caller next
+ * sleeps. Returns their count, 0 at or past the end, -EIO or -ENOMEM.
+ */
+int64_t blk_read_span(uint64_t off, const uint8_t **out);
+
+struct blk_buf;
+
+/* Like blk_read_span() for writing len bytes at off (fewer if they cross a
+ * block): the block is read in first unless they cover all of it. The caller
+ * fills the span, then calls blk_write_end() with *bp, without sleeping in
+ * between. Returns the byte count, 0 past the end, -EIO or -ENOMEM.
+ */
+int64_t blk_write_begin(uint64_t off, uint64_t len, uint8_t **out, struct blk_buf **bp);
+
+/* Finish a blk_write_begin(): filled says whether the span was filled. The
+ * block is marked dirty; a block that was not cached before is only cached
+ * (and later written) if it was filled, else it is dropped.
+ */
+void blk_write_end(struct blk_buf *b, int filled);
+
+/* Write back every dirty block and wait for it (may sleep). Returns 0 or
+ * -EIO (what failed stays dirty).
+ */
+int blk_sync(void);
+
+void blk_get_stats(blk_stats_t *out);
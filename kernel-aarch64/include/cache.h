@@ -4,18 +4,31 @@
 
 /* Cache maintenance helpers for AArch64 EL1 bring-up. */
 
+/* Whole-cache maintenance by set/way. Boot only (MMU bring-up, releasing
+ * secondaries): it is slow and not coherent with other running cores.
+ * Everything else maintains the lines of its own buffers (below) or uses
+ * uncached DMA memory (dma.h).
+ */
 void cache_invalidate_all(void);
 
-/* Clean+invalidate D-cache and invalidate I-cache (global).
- * Useful when switching between distinct EL0 address spaces without ASIDs.
- */
+/* Clean+invalidate D-cache and invalidate I-cache (global). */
 void cache_clean_invalidate_all(void);
 
+/* Smallest D-cache line (CTR_EL0.DminLine), the stride of the range
+ * operations below.
+ */
+uint64_t cache_dline_bytes(void);
+
 /* Clean D-cache to PoU and invalidate I-cache for a VA range. */
 void cache_sync_icache_for_range(uint64_t start, uint64_t size);
 
-/* DMA helpers (D-cache maintenance for a VA range).
- * These are needed when device DMA reads/writes memory while caches are enabled.
+/* DMA helpers (D-cache maintenance for a VA range, to the point of
+ * coherency). Needed when a device reads or writes cacheable memory:
+ * - clean (dc cvac) before the device reads the range,
+ * - invalidate (dc ivac) before it writes there; lines straddling the ends
+ *   are cleaned too, so bytes next to the buffer survive,
+ * - clean+invalidate (dc civac) for both directions at once.
  */
 void cache_clean_dcache_for_range(uint64_t start, uint64_t size);
 void cache_invalidate_dcache_for_range(uint64_t start, uint64_t size);
+void cache_clean_invalidate_dcache_for_range(uint64_t start, uint64_t size);
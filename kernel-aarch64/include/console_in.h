@@ -1,6 +1,7 @@
 #pragma once
 
 #include "stdint.h"
+#include "wait.h"
 
 /*
  * Console input multiplexer.
@@ -24,6 +25,9 @@ int console_in_has_data(void);
 /* Pop one buffered character (does not poll). Returns 1 if read into *out. */
 int console_in_pop(char *out);
 
+/* Readers waiting for input; one is woken whenever the ring becomes non-empty. */
+waitq_t *console_in_waitq(void);
+
 /* Non-blocking: returns 1 if a char was read into *out, else 0. */
 int console_in_try_getc(char *out);
 
@@ -36,8 +40,3 @@ char console_in_getc_blocking(void);
 
 /* Returns 1 if any configured input backend requires polling (e.g. USB kbd). */
 int console_in_needs_polling(void);
-
-/* If polling is needed, return the next time (ns, monotonic) that polling should
- * run. Returns 0 if no polling is needed or time is unavailable.
- */
-uint64_t console_in_next_poll_deadline_ns(void);
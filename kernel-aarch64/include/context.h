@@ -0,0 +1,39 @@
+#pragma once
+
+#include "stdint.h"
+
+/*
+ * Kernel execution context of a suspended task (or a core's idle loop).
+ *
+ * Every task runs kernel code on its own kernel stack, so switching tasks only
+ * has to preserve what the AAPCS64 says a callee must: x19-x28, the frame
+ * pointer, the return address and sp. Everything else (the user registers
+ * included) already lives on the stack being switched away from.
+ *
+ * Layout is shared with arch/switch.S.
+ */
+typedef struct {
+    uint64_t x19;
+    uint64_t x20;
+    uint64_t x21;
+    uint64_t x22;
+    uint64_t x23;
+    uint64_t x24;
+    uint64_t x25;
+    uint64_t x26;
+    uint64_t x27;
+    uint64_t x28;
+    uint64_t fp;
+    uint64_t lr; /* where cpu_switch() "returns" to in the resumed context */
+    uint64_t sp;
+} cpu_context_t;
+
+/* Save the callee-saved state into prev and resume next. Returns when some
+ * core switches back to prev (arch/switch.S).
+ */
+void cpu_switch(cpu_context_t *prev, const cpu_context_t *next);
+
+/* First kernel code of a new task: finishes the switch and returns to EL0
+ * through the trap frame at the top of its kernel stack (arch/switch.S).
+ */
+void ret_from_fork(void);
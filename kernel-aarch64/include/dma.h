@@ -0,0 +1,31 @@
+#pragma once
+
+#include "stddef.h"
+#include "stdint.h"
+
+/*
+ * DMA-coherent memory.
+ *
+ * One 2MiB block of RAM, mapped normal non-cacheable (mmu.h), carved into
+ * buffers for devices that read or write memory themselves (USB host
+ * controller, VideoCore mailbox). CPU accesses go straight to memory, so
+ * neither side needs cache maintenance; drivers copy through these buffers
+ * rather than maintaining the lines of arbitrary ones.
+ *
+ * Buffers are 64-byte aligned, zero-filled and never shared with other data
+ * in a cache line. Call dma_init() once the MMU is on, before the
+ * secondaries start. Requires the kernel lock.
+ */
+
+#define DMA_POOL_SIZE 0x200000ull
+#define DMA_ALIGN 64u
+
+/* Returns 0 or -1 (no MMU or no memory: dma_alloc() then fails). */
+int dma_init(void);
+
+/* size bytes of DMA memory, or 0. */
+void *dma_alloc(size_t size);
+void dma_free(void *p, size_t size);
+
+/* Is p inside the DMA pool? */
+int dma_is_coherent(const void *p);
@@ -2,6 +2,7 @@
 
 #include "stddef.h"
 #include "stdint.h"
+#include "vm.h"
 
 /* Minimal ELF64 definitions for an AArch64 ET_EXEC loader (initramfs-backed). */
 
@@ -49,12 +50,47 @@ typedef struct {
 #define PT_LOAD 1
 #define PT_PHDR 6
 
-/* Returns 0 on success, -1 on invalid ELF or out-of-range segments. */
-int elf64_load_etexec(const uint8_t *img,
-                      size_t img_size,
-                      uint64_t user_va_base,
-                      uint64_t user_size,
-                      uint64_t user_pa_base,
-                      uint64_t *entry_out,
-                      uint64_t *min_loaded_va_out,
-                      uint64_t *max_loaded_va_out);
+#define PF_X 1
+#define PF_W 2
+#define PF_R 4
+
+/* At most this many PT_LOAD segments per image (ours have two). */
+#define ELF64_MAX_LOADS 8
+
+typedef struct {
+    uint64_t vaddr;
+    uint64_t memsz;
+    uint64_t offset;
+    uint64_t filesz;
+    uint32_t prot; /* MMU_PROT_* */
+} elf64_load_t;
+
+/* A validated executable: everything execve needs besides the file data. */
+typedef struct {
+    const uint8_t *img;
+    uint64_t img_size;
+    uint64_t entry;
+    uint64_t min_va;
+    uint64_t max_va;
+    /* auxv inputs; phdr_va is 0 if the headers are not in loaded memory. */
+    uint64_t phdr_va;
+    uint64_t phent;
+    uint64_t phnum;
+    uint32_t nloads;
+    elf64_load_t loads[ELF64_MAX_LOADS]; /* sorted by address */
+} elf64_image_t;
+
+/* Parse and validate img into *out (which keeps pointing at img).
+ * Returns 0 on success, -1 on invalid ELF or out-of-range segments.
+ */
+int elf64_parse(const uint8_t *img, size_t img_size, elf64_image_t *out);
+
+/* Map the PT_LOAD segments into vm (one VMA each, with the segment's
+ * permissions) with their file contents; the rest (bss) is committed
+ * zero-filled on first touch. With in_place, page-aligned file data is
+ * mapped directly rather than copied (see vm_map_data()), so read-only
+ * segments are shared by every process running the image and writable
+ * ones are copied page by page on first write.
+ * Returns 0 on success or a negative errno.
+ */
+int elf64_map(const elf64_image_t *im, vm_space_t *vm, int in_place);
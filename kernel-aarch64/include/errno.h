@@ -8,6 +8,7 @@
 #define ECHILD 10ull
 #define EAGAIN 11ull
 #define ENOMEM 12ull
+#define EACCES 13ull
 #define EFAULT 14ull
 #define EEXIST 17ull
 #define ENOTDIR 20ull
@@ -15,12 +16,15 @@
 #define EINVAL 22ull
 #define EMFILE 24ull
 #define ENOTTY 25ull
+#define EFBIG 27ull
+#define ENOSPC 28ull
 #define EROFS 30ull
 #define EPIPE 32ull
 #define ERANGE 34ull
 #define ENAMETOOLONG 36ull
 #define ENOENT 2ull
 #define ESRCH 3ull
+#define EINTR 4ull
 #define EIO 5ull
 #define ENOSYS 38ull
 #define ENOTEMPTY 39ull
@@ -29,6 +33,7 @@
 #define ENODEV 19ull
 #define EBUSY 16ull
 #define EMSGSIZE 90ull
+#define EOPNOTSUPP 95ull
 #define EAFNOSUPPORT 97ull
 #define EADDRINUSE 98ull
 #define ENOTCONN 107ull
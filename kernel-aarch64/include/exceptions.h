@@ -7,6 +7,9 @@ typedef struct trap_frame {
     uint64_t sp_el0;
 } trap_frame_t;
 
+/* Returns 0 to halt, 1 to resume the interrupted context, or, for a kernel
+ * fault in a user copy, the address to resume at instead (uaccess.h).
+ */
 uint64_t exception_handle(trap_frame_t *tf,
                           uint64_t kind,
                           uint64_t esr,
@@ -0,0 +1,22 @@
+#pragma once
+
+#include "elf64.h"
+
+/*
+ * Executable image cache.
+ *
+ * execve of the same few binaries (sh running ls, cat, grep, ...) would
+ * otherwise look the path up in the initramfs and parse its ELF headers
+ * every time. Parsed images are kept here keyed by resolved path; initramfs
+ * files never change, so entries stay valid and are only recycled (least
+ * recently used first) when the table is full.
+ *
+ * Since the initramfs is never freed either, the cached images are mapped
+ * in place by elf64_map(): every process running a binary shares its text
+ * pages, and only written data pages get private copies.
+ *
+ * Requires the kernel lock.
+ */
+
+/* Image for path. Returns 0, -ENOENT, -EISDIR or -ENOEXEC. */
+int exec_cache_lookup(const char *path, const elf64_image_t **out);
@@ -6,11 +6,11 @@
  *
  * - Each process has an fd table mapping fd -> "file description" index.
  * - File descriptions are refcounted and shared across dup/fork.
+ * - Descriptions are slab-allocated; the last desc_decref() frees them.
  */
 
 enum {
     MAX_FDS = 32,
-    MAX_FILEDESCS = 64,
 };
 
 typedef enum {
@@ -22,6 +22,7 @@ typedef enum {
     FDESC_PROC = 5,
     FDESC_UDP6 = 6,
     FDESC_TCP6 = 7,
+    FDESC_BLKDEV = 8,
 } fdesc_kind_t;
 
 typedef struct {
@@ -34,7 +35,8 @@ typedef struct {
             uint64_t off;
             uint32_t mode;
             uint8_t is_dir;
-            char dir_path[128];
+            struct vfs_dentry *dir; /* pinned, is_dir only */
+            struct vfs_dir *cursor; /* getdents64 position, made on first use */
         } initramfs;
         struct {
             uint32_t pipe_id;
@@ -46,10 +48,15 @@ typedef struct {
             uint64_t off;
         } ramfile;
         struct {
-            uint32_t node; /* 1=dir, 2=ps */
-            uint32_t _pad;
+            uint32_t node; /* 1=dir, 2=ps, 3=meminfo, 4=net, 5=<pid>/stat, 6=slabinfo, 7=diskstats */
+            uint32_t pid;  /* node 5 */
             uint64_t off;
         } proc;
+        struct {
+            uint32_t writable;
+            uint32_t _pad;
+            uint64_t off;
+        } blkdev;
         struct {
             uint32_t sock_id;
             uint32_t _pad;
@@ -68,11 +75,13 @@ typedef struct {
     int16_t fd_to_desc[MAX_FDS];
 } fd_table_t;
 
-extern file_desc_t g_descs[MAX_FILEDESCS];
-
 void fd_init(void);
 
+/* Description for an index from desc_alloc()/fd_get_desc_idx(), or 0. */
+file_desc_t *desc_get(int didx);
+
 void desc_clear(file_desc_t *d);
+/* New description with refs=1 (released with desc_decref()), or -1. */
 int desc_alloc(void);
 void desc_incref(int didx);
 void desc_decref(int didx);
@@ -0,0 +1,40 @@
+#pragma once
+
+#include "stdint.h"
+
+/*
+ * Small-integer id -> object pointer table.
+ *
+ * Kernel objects that userspace (or another table) refers to by index keep
+ * their ids here while the objects themselves come from slab caches. The
+ * slot array starts empty and doubles on demand (kmalloc), up to `max` ids.
+ * Freed ids are reused, preferring low ones.
+ *
+ * Requires the kernel lock.
+ */
+
+typedef struct {
+    void **slots;
+    uint32_t cap;
+    uint32_t max;
+    uint32_t hint;
+    uint32_t count;
+} idtab_t;
+
+#define IDTAB_INIT(maxids) { 0, 0, (maxids), 0, 0 }
+
+/* Store obj under a free id. Returns the id (>= 0) or -ENOMEM. */
+int idtab_alloc(idtab_t *t, void *obj);
+
+/* Object stored under id, or 0. */
+static inline void *idtab_get(const idtab_t *t, uint32_t id) {
+    return (id < t->cap) ? t->slots[id] : 0;
+}
+
+/* Forget id; returns the object that was stored there (or 0). */
+void *idtab_remove(idtab_t *t, uint32_t id);
+
+/* One past the highest id that may be in use (iteration bound). */
+static inline uint32_t idtab_limit(const idtab_t *t) {
+    return t->cap;
+}
@@ -5,6 +5,11 @@
 
 void initramfs_init(const void *archive, size_t archive_size);
 
+/* Is [p, p+len) inside the archive? Its file data can then be mapped into
+ * processes in place: it never changes or moves.
+ */
+int initramfs_contains(const void *p, uint64_t len);
+
 /* Returns 0 on success, -1 if not found. */
 int initramfs_lookup(const char *path, const uint8_t **out_data, uint64_t *out_size, uint32_t *out_mode);
 
@@ -14,3 +19,20 @@ int initramfs_lookup(const char *path, const uint8_t **out_data, uint64_t *out_s
  */
 typedef int (*initramfs_dir_cb_t)(const char *name, uint32_t mode, void *ctx);
 int initramfs_list_dir(const char *dir_path, initramfs_dir_cb_t cb, void *ctx);
+
+/*
+ * The boot-time index as a tree, for walking paths one component at a time
+ * (the VFS dentry cache). initramfs_root() is 0 if the archive could not be
+ * indexed; the path calls above still work then.
+ */
+typedef struct ird_node initramfs_node_t;
+
+const initramfs_node_t *initramfs_root(void);
+/* Child name[0, len) of dir, or 0. */
+const initramfs_node_t *initramfs_child(const initramfs_node_t *dir, const char *name, uint32_t len);
+/* Children in archive order. */
+const initramfs_node_t *initramfs_first_child(const initramfs_node_t *dir);
+const initramfs_node_t *initramfs_next_sibling(const initramfs_node_t *n);
+/* Last path component; not NUL-terminated. Returns its length. */
+uint32_t initramfs_node_name(const initramfs_node_t *n, const char **out_name);
+void initramfs_node_stat(const initramfs_node_t *n, const uint8_t **out_data, uint64_t *out_size, uint32_t *out_mode);
@@ -27,7 +27,14 @@ static inline void cpu_wfi(void) {
     __asm__ volatile("wfi" ::: "memory");
 }
 
+/* Like `wfi`, but also wakes on SEV from another core (used for SMP idle). */
+static inline void cpu_wfe(void) {
+    __asm__ volatile("wfe" ::: "memory");
+}
+
 void irq_init(void);
+/* Per-core setup for secondary cores: route and start this core's timer. */
+void irq_init_secondary(void);
 void irq_handle(void);
 
 int irq_regtest(void);
@@ -57,3 +57,54 @@ typedef struct {
 } linux_rlimit64_t;
 
 #define LINUX_RLIM64_INFINITY (~0ull)
+
+/* getrusage(2)/wait4(2) use struct rusage (struct timeval + 14 longs). */
+typedef struct {
+    int64_t tv_sec;
+    int64_t tv_usec;
+} linux_timeval_t;
+
+typedef struct {
+    linux_timeval_t ru_utime;
+    linux_timeval_t ru_stime;
+    int64_t ru_maxrss; /* KiB */
+    int64_t ru_ixrss;
+    int64_t ru_idrss;
+    int64_t ru_isrss;
+    int64_t ru_minflt;
+    int64_t ru_majflt;
+    int64_t ru_nswap;
+    int64_t ru_inblock;
+    int64_t ru_oublock;
+    int64_t ru_msgsnd;
+    int64_t ru_msgrcv;
+    int64_t ru_nsignals;
+    int64_t ru_nvcsw;
+    int64_t ru_nivcsw;
+} linux_rusage_t;
+
+#define LINUX_RUSAGE_SELF 0
+#define LINUX_RUSAGE_CHILDREN (-1)
+#define LINUX_RUSAGE_THREAD 1
+
+/* times(2) uses struct tms, in clock ticks of USER_HZ. */
+typedef struct {
+    int64_t tms_utime;
+    int64_t tms_stime;
+    int64_t tms_cutime;
+    int64_t tms_cstime;
+} linux_tms_t;
+
+#define LINUX_USER_HZ 100ull
+
+/* Signals the kernel raises itself (fatal: the exit status is 128 + sig). */
+#define LINUX_SIGILL 4
+#define LINUX_SIGSEGV 11
+
+/* fcntl(2) commands (only the pipe ones are implemented). */
+#define LINUX_F_SETPIPE_SZ 1031
+#define LINUX_F_GETPIPE_SZ 1032
+
+/* clone(2) flags (the only sharing we support is vfork's). */
+#define LINUX_CLONE_VM 0x00000100ull
+#define LINUX_CLONE_VFORK 0x00004000ull
@@ -13,15 +13,40 @@
 void mmu_init_identity(uint64_t ram_base, uint64_t ram_size);
 int mmu_is_enabled(void);
 
-/* Per-process TTBR0 support (early, minimal).
+/* Enable the MMU on a secondary core using the tables built by mmu_init_identity(). */
+void mmu_init_secondary(void);
+
+/* Per-process TTBR0.
  *
- * The kernel keeps a fixed user VA region at USER_REGION_BASE.
- * Each process gets its own TTBR0 tables which map USER_REGION_BASE
- * to a chosen physical 2MiB backing region.
+ * L1 entries 0 and 1 point at the shared kernel identity map (0..2GiB).
+ * The user window [USER_REGION_BASE, +USER_REGION_SIZE) above it is mapped
+ * per process with 4KiB pages; its L2/L3 tables are allocated on demand.
  */
 uint64_t mmu_ttbr0_read(void);
+/* Install tables and flush this core's TLB (boot/untagged use). */
 void mmu_ttbr0_write(uint64_t ttbr0_pa);
-uint64_t mmu_ttbr0_create_with_user_pa(uint64_t user_pa_base);
+/* New process tables with an empty user window, 0 on OOM. */
+uint64_t mmu_ttbr0_create(void);
+/* Free the tables of an address space no core uses any more. The pages
+ * mapped in its user window must have been unmapped (freed) already.
+ */
+void mmu_ttbr0_destroy(uint64_t ttbr0_pa);
+/* Load the boot tables (ASID 0), e.g. for an idle core, so no process
+ * tables stay live where nothing runs.
+ */
+void mmu_ttbr0_switch_kernel(void);
+
+/* Address space ids.
+ *
+ * The user mapping is non-global, so TLB entries are tagged with the ASID
+ * in TTBR0 and switching address spaces needs no TLB or cache flush.
+ * *asid is owned by the process (0 = none yet); mmu_ttbr0_switch() assigns
+ * or revalidates it (8- or 16-bit ASIDs with generation rollover).
+ * mmu_asid_release() drops it when the address space goes away.
+ */
+void mmu_ttbr0_switch(uint64_t ttbr0_pa, uint64_t *asid);
+void mmu_asid_release(uint64_t *asid);
+uint32_t mmu_asid_bits(void);
 
 /*
  * Mark a physical range as device memory in the shared identity mapping.
@@ -31,9 +56,60 @@ uint64_t mmu_ttbr0_create_with_user_pa(uint64_t user_pa_base);
  */
 int mmu_mark_region_device(uint64_t phys_start, uint64_t size_bytes);
 
+/* Likewise, but as normal non-cacheable memory: device-coherent without
+ * cache maintenance, yet still allowing unaligned accesses and write
+ * gathering (DMA buffers, the framebuffer). The range's cache lines are
+ * cleaned and invalidated. Boot only, before secondaries start.
+ */
+int mmu_mark_region_uncached(uint64_t phys_start, uint64_t size_bytes);
+
+/* User page permissions (the Linux PROT_* values). */
+enum {
+    MMU_PROT_READ = 1u << 0,
+    MMU_PROT_WRITE = 1u << 1,
+    MMU_PROT_EXEC = 1u << 2,
+};
+
+/* Software bit in a user page descriptor: the page is not reference counted
+ * and not owned by the address space (e.g. initramfs data mapped in place).
+ * It is never freed and never written through; a write takes a copy.
+ */
+#define MMU_PTE_NOREF (1ull << 55)
+
+/* Level-3 entry for user va in the tables at ttbr0_pa, allocating missing
+ * tables if alloc is set. Returns 0 if va is outside the user window, the
+ * L3 table does not exist (and !alloc) or on OOM.
+ */
+uint64_t *mmu_user_pte(uint64_t ttbr0_pa, uint64_t va, int alloc);
+/* Page descriptor mapping pa for EL0 with MMU_PROT_* permissions. */
+uint64_t mmu_user_page_desc(uint64_t pa, uint32_t prot);
+/* Fill an invalid entry (no TLB maintenance needed). */
+void mmu_user_pte_set(uint64_t *pte, uint64_t desc);
+/* Invalidate a live entry and its TLB entries for va in the address space
+ * tagged asid (a process' ASID value, 0 = never loaded).
+ */
+void mmu_user_pte_clear(uint64_t *pte, uint64_t va, uint64_t asid);
+/* Change the permissions of a live entry (same page, so no break-before-
+ * make). With asid 0 no TLB maintenance is done: the caller flushes the
+ * whole address space afterwards with mmu_asid_flush().
+ */
+void mmu_user_pte_update(uint64_t *pte, uint64_t desc, uint64_t va, uint64_t asid);
+/* Drop every TLB entry of an address space (0 = never loaded: no-op). */
+void mmu_asid_flush(uint64_t asid);
+
+static inline int mmu_pte_valid(uint64_t pte) {
+    return (pte & 1u) != 0;
+}
+
+static inline uint64_t mmu_pte_pa(uint64_t pte) {
+    return pte & 0x0000FFFFFFFFF000ull;
+}
+
 /* For 39-bit VA, the upper canonical half begins at 0xFFFFFFC000000000. */
 #define KERNEL_VA_BASE 0xFFFFFFC000000000ull
 
-/* Coarse EL0 sandbox region (identity-mapped) used for Phase 3 bring-up. */
-#define USER_REGION_BASE 0x0000000000400000ull
-#define USER_REGION_SIZE 0x0000000000200000ull
+/* EL0 address window: TTBR0 L1 entries 2 and 3, right above the 2GiB kernel
+ * identity map. User programs are linked at its base.
+ */
+#define USER_REGION_BASE 0x0000000080000000ull
+#define USER_REGION_SIZE 0x0000000080000000ull
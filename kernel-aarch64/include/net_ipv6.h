@@ -3,6 +3,7 @@
 #include "net.h"
 #include "stddef.h"
 #include "stdint.h"
+#include "wait.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -68,14 +69,29 @@ void net_ipv6_configure_netif(netif_t *nif);
 void net_ipv6_input(netif_t *nif, const uint8_t src_mac[6], const uint8_t *pkt, size_t len);
 
 /* Start an ICMPv6 echo exchange on behalf of a process.
- * Returns 0 on "started" (request sent or NDP started), negative errno on failure.
- * Completion is reported by the scheduler via the process's saved x0 return value.
+ * Returns 0 on "started" (request sent or NDP started), negative errno on failure
+ * (-EAGAIN: interface not configured yet, -EBUSY: another ping is in flight).
+ *
+ * The process then blocks on net_ipv6_ping6_waitq(). On completion the
+ * result is stored in its wait.arg[PING6_WAIT_*] slots and the queue is woken.
  */
 int net_ipv6_ping6_start(int proc_idx, netif_t *nif, const uint8_t dst_ip[16], uint16_t ident, uint16_t seq);
 
+enum {
+    PING6_WAIT_DONE = 0, /* set to 1 once RET/RTT are valid */
+    PING6_WAIT_RET = 1,
+    PING6_WAIT_RTT = 2,
+};
+
 /* Cancel an in-flight ping started for proc_idx (best-effort). */
 void net_ipv6_ping6_cancel(int proc_idx);
 
+/* Returns 1 if proc_idx owns the in-flight ping. */
+int net_ipv6_ping6_inflight_for(int proc_idx);
+
+/* Woken when the in-flight ping completes or is cancelled. */
+waitq_t *net_ipv6_ping6_waitq(void);
+
 #ifdef __cplusplus
 }
 #endif
@@ -2,6 +2,7 @@
 
 #include "stddef.h"
 #include "stdint.h"
+#include "wait.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -25,9 +26,12 @@ void net_tcp6_on_desc_decref(uint32_t conn_id);
 
 int net_tcp6_conn_alloc(uint32_t *out_conn_id);
 
+/* SYNs are retransmitted at most this often while connecting. */
+#define TCP6_SYN_RETRY_NS 200000000ull
+
 /* Start (or retry) connecting a connection.
- * Returns 0 if a SYN was sent or connection is already established.
- * Returns -EAGAIN if routing/NDP is not ready yet.
+ * Returns 0 if a SYN was sent (or is not due yet) or the connection is already
+ * established. Returns -EAGAIN if routing/NDP is not ready yet.
  */
 int net_tcp6_connect_start(uint32_t conn_id, const uint8_t dst_ip[16], uint16_t dst_port);
 
@@ -46,6 +50,11 @@ int net_tcp6_send(uint32_t conn_id, const uint8_t *buf, size_t len);
  */
 int net_tcp6_try_recv(uint32_t conn_id, uint8_t *buf, size_t len);
 
+/* Wait queue of tasks blocked on the connection (0 if the id is invalid).
+ * Woken when it becomes established, on new data, on FIN and when freed.
+ */
+waitq_t *net_tcp6_waitq(uint32_t conn_id);
+
 #ifdef __cplusplus
 }
 #endif
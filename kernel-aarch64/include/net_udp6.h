@@ -2,6 +2,7 @@
 
 #include "stddef.h"
 #include "stdint.h"
+#include "wait.h"
 
 #ifdef __cplusplus
 extern "C" {
@@ -50,6 +51,11 @@ int net_udp6_sendto(uint32_t sock_id,
  */
 int net_udp6_try_recv(uint32_t sock_id, udp6_dgram_t *out);
 
+/* Wait queue of receivers blocked on a socket (0 if the socket is invalid).
+ * One waiter is woken per queued datagram, all of them when the socket dies.
+ */
+waitq_t *net_udp6_rx_waitq(uint32_t sock_id);
+
 #ifdef __cplusplus
 }
 #endif
@@ -4,11 +4,29 @@
 
 /* Pipe implementation used by FDESC_PIPE.
  * The pipe buffer and refcounts are kernel-internal.
+ *
+ * Reads and writes block (on per-pipe wait queues) instead of failing with
+ * EAGAIN: a read waits until there is data or no writer is left, a write
+ * until all of it is queued or no reader is left. A reader sleeping on an
+ * empty pipe offers its buffer, and the next writer copies straight into
+ * it without going through the ring.
  */
 
 #define PIPE_END_READ 0u
 #define PIPE_END_WRITE 1u
 
+/* Writes of up to PIPE_BUF bytes are atomic: never interleaved with other
+ * writers' data.
+ */
+#define PIPE_BUF 4096u
+
+/* Ring capacity: PIPE_DEFAULT_SIZE, adjustable with fcntl(F_SETPIPE_SZ)
+ * up to PIPE_MAX_SIZE. The ring is only allocated once data has to wait
+ * in it.
+ */
+#define PIPE_DEFAULT_SIZE 4096u
+#define PIPE_MAX_SIZE 65536u
+
 void pipe_init(void);
 
 /* Allocate a new pipe. On success returns 0 and writes *out_pipe_id.
@@ -25,8 +43,15 @@ void pipe_abort(uint32_t pipe_id);
 void pipe_on_desc_incref(uint32_t pipe_id, uint32_t end);
 void pipe_on_desc_decref(uint32_t pipe_id, uint32_t end);
 
-/* Data movement primitives used by sys_read/sys_write.
- * Return >=0 bytes, or -errno.
+/* Data movement primitives used by sys_read/sys_write, on user buffers of
+ * the current process (a bad one gives -EFAULT). May block. Return >=0
+ * bytes, or -errno.
+ */
+int64_t pipe_read(uint32_t pipe_id, uint64_t dst_user, uint64_t len);
+int64_t pipe_write(uint32_t pipe_id, uint64_t src_user, uint64_t len);
+
+/* fcntl(F_GETPIPE_SZ / F_SETPIPE_SZ). Sizes are rounded up to a power of
+ * two of at least PIPE_DEFAULT_SIZE. Return the capacity or -errno.
  */
-int64_t pipe_read(uint32_t pipe_id, volatile uint8_t *dst, uint64_t len);
-int64_t pipe_write(uint32_t pipe_id, const volatile uint8_t *src, uint64_t len);
+int64_t pipe_get_size(uint32_t pipe_id);
+int64_t pipe_set_size(uint32_t pipe_id, uint64_t size);
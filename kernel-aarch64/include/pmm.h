@@ -2,18 +2,33 @@
 
 #include "stdint.h"
 
+/* Buddy orders: order k blocks are 2^k pages, 4KiB (order 0) to 2MiB (order 9). */
+enum {
+    PMM_MAX_ORDER = 9,
+    PMM_ORDERS = PMM_MAX_ORDER + 1,
+};
+
 typedef struct {
     uint64_t base;
     uint64_t size;
     uint64_t page_size;
     uint64_t total_pages;
     uint64_t free_pages;
+    /* Free blocks on each order's free list. */
+    uint64_t free_blocks[PMM_ORDERS];
 } pmm_info_t;
 
 void pmm_init(uint64_t mem_base, uint64_t mem_size, uint64_t kernel_start, uint64_t kernel_end, uint64_t dtb_ptr);
 uint64_t pmm_alloc_page(void);          /* returns physical address, 0 on OOM */
 void pmm_free_page(uint64_t pa);
 
+/* Allocate n physically contiguous 4KiB pages (e.g. kernel stacks), at most
+ * 2^PMM_MAX_ORDER. The block is aligned to n rounded up to a power of two.
+ * Returns the base physical address, or 0 on OOM. Free with the same n.
+ */
+uint64_t pmm_alloc_pages(uint64_t n);
+void pmm_free_pages(uint64_t pa, uint64_t n);
+
 /*
  * Reserve a physical address range so the allocator won't hand it out.
  * Safe to call after pmm_init(); ignored if PMM is uninitialized.
@@ -28,5 +43,29 @@ uint64_t pmm_alloc_2mib_aligned(void);
 /* Free a region previously returned by pmm_alloc_2mib_aligned(). */
 void pmm_free_2mib_aligned(uint64_t pa_base);
 
+/* Per-page metadata (one entry per managed page, like Linux' struct page). */
+typedef struct {
+    void *slab;     /* PMM_PAGE_SLAB: the slab this page belongs to */
+    uint32_t flags; /* PMM_PAGE_* */
+    uint32_t order; /* PMM_PAGE_KMALLOC: order of the block starting here */
+    uint32_t refs;  /* address spaces mapping this user page (COW sharing) */
+} pmm_page_t;
+
+enum {
+    PMM_PAGE_SLAB = 1u << 0,
+    PMM_PAGE_KMALLOC = 1u << 1,
+};
+
+/* Metadata of the page containing pa, or 0 if pa is not managed RAM. */
+pmm_page_t *pmm_page(uint64_t pa);
+
+/* Page reference counts, for user pages shared copy-on-write after fork().
+ * pmm_alloc_page() returns a page holding one reference; pmm_page_put()
+ * frees it when the last reference goes.
+ */
+void pmm_page_get(uint64_t pa);
+void pmm_page_put(uint64_t pa);
+uint32_t pmm_page_refs(uint64_t pa);
+
 pmm_info_t pmm_info(void);
 void pmm_dump(void);
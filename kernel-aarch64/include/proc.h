@@ -1,21 +1,26 @@
 #pragma once
 
+#include "context.h"
 #include "exceptions.h"
 #include "fd.h"
+#include "smp.h"
 #include "stdint.h"
+#include "timer.h"
+#include "vm.h"
+#include "wait.h"
 
 enum {
-    MAX_PROCS = 16,
-    MAX_VMAS = 32,
+    MAX_PROCS = 256,
     MAX_PATH = 256,
+    /* Command name as shown in /proc/<pid>/stat (incl. NUL). */
+    PROC_COMM_LEN = 16,
+    /* pid -> slot hash buckets (power of two). */
+    PROC_PID_HASH_SIZE = 64,
+    /* Per-task kernel stack (contiguous pages from the PMM). */
+    KSTACK_PAGES = 8,
+    KSTACK_SIZE = KSTACK_PAGES * 4096,
 };
 
-typedef struct {
-    uint8_t used;
-    uint64_t base;
-    uint64_t len;
-} vma_t;
-
 typedef enum {
     PROC_UNUSED = 0,
     PROC_RUNNABLE = 1,
@@ -23,63 +28,103 @@ typedef enum {
     PROC_ZOMBIE = 3,
     PROC_SLEEPING = 4,
     PROC_BLOCKED_IO = 5,
+    PROC_STATE_COUNT = 6,
 } proc_state_t;
 
-typedef struct {
+static inline int proc_state_is_blocked(proc_state_t st) {
+    return st == PROC_SLEEPING || st == PROC_BLOCKED_IO || st == PROC_WAITING;
+}
+
+typedef struct proc {
     uint64_t pid;
     uint64_t ppid;
     proc_state_t state;
-    uint64_t ttbr0_pa;
+    /* User address space: page tables, ASID and VMAs (see vm.h). */
+    vm_space_t vm;
+
+    /* Intrusive links (slot indices, -1 = none), maintained by proc.c.
+     * q_prev/q_next put the slot on the list for its current state: free
+     * list, per-core run queue, one list per blocked state, etc. (all FIFO).
+     */
+    int16_t q_prev;
+    int16_t q_next;
+    int16_t hash_next;
+    int16_t parent_idx;
+    int16_t child_head;
+    int16_t sib_prev;
+    int16_t sib_next;
+
+    /* SMP: run queue the task sits on while runnable, and the core it is
+     * running on (in user or kernel mode), -1 if none.
+     * Invariant: on_cpu >= 0 implies rq_cpu == on_cpu.
+     */
+    int8_t rq_cpu;
+    int8_t on_cpu;
 
-    uint64_t user_pa_base;
+    /* brk heap: [heap_base, heap_end), pages mapped up to the next page. */
     uint64_t heap_base;
     uint64_t heap_end;
-    uint64_t stack_low;
-    char cwd[MAX_PATH];
-    uint64_t mmap_next;
-    vma_t vmas[MAX_VMAS];
-    trap_frame_t tf;
+    struct vfs_dentry *cwd; /* pinned */
+    /* Kernel stack; exceptions from EL0 save the user registers in the
+     * trap frame at its top (tf), so they are never copied around.
+     */
+    uint64_t kstack_base;
+    trap_frame_t *tf;
+    /* Callee-saved kernel registers while switched out (see sched.c). */
+    cpu_context_t ctx;
     uint64_t elr;
     uint64_t exit_code;
     uint64_t clear_child_tid_user;
-    int64_t wait_target_pid;
-    uint64_t wait_status_user;
-    uint64_t sleep_deadline_ns;
-
-    /* Pending blocking IO (currently only stdin/console). */
-    uint8_t pending_console_read;
-    uint64_t pending_read_buf_user;
-    uint64_t pending_read_len;
-    uint64_t pending_read_fd;
-
-    /* Pending mona-specific UDP6 recvfrom syscall. */
-    uint8_t pending_udp6_recv;
-    uint32_t pending_udp6_sock_id;
-    uint64_t pending_udp6_fd;
-    uint64_t pending_udp6_buf_user;
-    uint64_t pending_udp6_len;
-    uint64_t pending_udp6_src_ip_user;
-    uint64_t pending_udp6_src_port_user;
-    uint64_t pending_udp6_ret;
-
-    /* Pending mona-specific ping6 syscall. */
-    uint8_t pending_ping6;
-    uint8_t ping6_done;
-    uint16_t ping6_ident;
-    uint16_t ping6_seq;
-    uint8_t ping6_dst_ip[16];
-    uint64_t ping6_start_ns;
-    uint64_t ping6_rtt_ns;
-    uint64_t ping6_rtt_user;
-    uint64_t ping6_ret;
+    /* Blocking syscall state (wait queue, deadline). */
+    wait_t wait;
+    /* Fires at wait.deadline_ns to wake a blocked task. */
+    ktimer_t sleep_timer;
+    /* wait4() and vfork() sleep here; woken when a child becomes a zombie
+     * or gives back a borrowed address space.
+     */
+    waitq_t child_wq;
+    /* End of the current time slice (see sched_preempt). */
+    uint64_t slice_end_ns;
+    /* kill() aimed at a task running on another core: exit at next kernel entry. */
+    uint8_t pending_kill;
+    uint64_t pending_kill_code;
+    /* vfork() child running on its parent's address space (moved to vm
+     * until it calls execve or exits).
+     */
+    uint8_t vfork_borrowed;
+    /* Resource accounting (getrusage, times, wait4, /proc/<pid>/stat).
+     * acct_stamp_ns is the time up to which CPU time has been charged: the
+     * time since then is user time at kernel entry from EL0 and system time
+     * on return to EL0 or when switched out.
+     */
+    uint64_t acct_stamp_ns;
+    uint64_t utime_ns;
+    uint64_t stime_ns;
+    /* Context switches: voluntary (blocked) and involuntary (preempted). */
+    uint64_t nvcsw;
+    uint64_t nivcsw;
+    uint64_t maxrss_kb;
+    /* Page faults resolved without I/O (demand-zero, copy-on-write). */
+    uint64_t minflt;
+    /* Totals of the reaped children (including their own reaped children). */
+    uint64_t cutime_ns;
+    uint64_t cstime_ns;
+    uint64_t cnvcsw;
+    uint64_t cnivcsw;
+    uint64_t cmaxrss_kb;
+    uint64_t cminflt;
+    uint64_t start_ns;
+    char comm[PROC_COMM_LEN];
     fd_table_t fdt;
 } proc_t;
 
 extern proc_t g_procs[MAX_PROCS];
-extern int g_cur_proc;
-extern int g_last_sched;
 extern uint64_t g_next_pid;
 
+/* Per-core scheduler state (see smp.h). */
+#define g_cur_proc (cpu_this()->cur_proc)
+#define g_last_sched (cpu_this()->last_sched)
+
 static inline proc_t *proc_current(void) {
     return &g_procs[g_cur_proc];
 }
@@ -87,10 +132,71 @@ static inline proc_t *proc_current(void) {
 void tf_copy(trap_frame_t *dst, const trap_frame_t *src);
 void tf_zero(trap_frame_t *tf);
 
+static inline int proc_idx(const proc_t *p) {
+    return (int)(p - g_procs);
+}
+
 void proc_clear(proc_t *p);
 void proc_close_all_fds(proc_t *p);
-void proc_init_if_needed(uint64_t elr, trap_frame_t *tf);
+/* Set up the process tables and pid 1: a flat image (copied to
+ * USER_REGION_BASE, with room for its bss) and a stack, entering EL0 at entry
+ * with user_sp. Switches to its address space and returns the kernel stack
+ * pointer to enter EL0 with, 0 on failure.
+ */
+uint64_t proc_init(const uint8_t *image, uint64_t image_size, uint64_t entry, uint64_t user_sp);
+
+/* Allocate p's kernel stack and clear its trap frame and context. */
+int proc_alloc_kstack(proc_t *p);
 int proc_find_free_slot(void);
 
+/* Move a process to a new state, keeping the per-state lists in sync.
+ * All state changes after init must go through here.
+ * Entering a blocked state (SLEEPING, BLOCKED_IO, WAITING) arms sleep_timer
+ * for wait.deadline_ns if set; leaving it (for any reason) cancels the timer
+ * and unlinks the task from its wait queue. Use wait_block() to block.
+ */
+void proc_set_state(proc_t *p, proc_state_t state);
+
+int proc_is_inited(void);
+
+/* Per-state list iteration: first slot in state, next slot after idx, or -1.
+ * Runnable tasks live on per-core run queues: use proc_runq_first() for them.
+ */
+int proc_state_first(proc_state_t state);
+int proc_state_next(int idx);
+uint32_t proc_state_count(proc_state_t state);
+int proc_runq_first(uint32_t cpu);
+uint32_t proc_runq_count(uint32_t cpu);
+
+/* Move a task to another core's run queue (used on switch-in and stealing). */
+void proc_runq_move(proc_t *p, uint32_t cpu);
+
+/* Assign a pid and make the slot findable by proc_find_idx_by_pid(). */
+void proc_set_pid(proc_t *p, uint64_t pid);
+int proc_find_idx_by_pid(uint64_t pid);
+
+/* Parent/child links (used by wait4 and exit). */
+void proc_link_child(int parent_idx, int child_idx);
+
+/* Free a dead process: release its user backing and clear the slot. */
+void proc_reap(proc_t *p);
+
+/* CPU time accounting. proc_acct_user() charges the time since the last
+ * stamp as user time (kernel entry from EL0), proc_acct_sys() as system time
+ * (return to EL0, switch out); proc_acct_start() restarts the clock when a
+ * task is switched in.
+ */
+void proc_acct_user(proc_t *p);
+void proc_acct_sys(proc_t *p);
+void proc_acct_start(proc_t *p);
+
+/* User memory in use (committed pages), in KiB. */
+uint64_t proc_rss_kb(const proc_t *p);
+/* Fold the current usage into maxrss_kb; call before memory is given back. */
+void proc_note_rss(proc_t *p);
+
+/* Set comm from the last component of path. */
+void proc_set_comm(proc_t *p, const char *path);
+
 /* Used by exception entry code: nested EL1 interrupts can clobber ELR_EL1. */
 uint64_t proc_current_elr_value(void);
@@ -1,7 +1,48 @@
 #pragma once
 
-#include "exceptions.h"
+#include "stdint.h"
 
+/*
+ * Scheduler.
+ *
+ * Every task has its own kernel stack. Switching tasks (or to a core's idle
+ * loop) saves only the callee-saved kernel registers (cpu_switch()); the
+ * user registers stay in the trap frame on the task's stack. A syscall that
+ * has to wait therefore blocks in place and continues where it left off.
+ *
+ * All of this runs under the kernel lock, which is handed over across a
+ * switch and released by whoever returns to EL0 or idles next.
+ */
+
+/* Pick the next task for this core (local round-robin, then stealing).
+ * Also polls console input and runs expired timers. -1 if none is runnable.
+ */
 int sched_pick_next_runnable(void);
-void proc_switch_to(int idx, trap_frame_t *tf);
-void sched_maybe_switch(trap_frame_t *tf);
+
+/* Let another runnable task on this core run (end of every syscall). */
+void sched_yield(void);
+
+/* Give up the CPU after wait_block() until the current task is woken, then
+ * return to the blocked syscall.
+ */
+void sched_block(void);
+
+/* Leave the current task for good once it is a zombie. */
+void sched_exit(void) __attribute__((noreturn));
+
+/* Called from the EL0 IRQ path: switch away if the current quantum expired. */
+void sched_preempt(void);
+
+/* Second half of a new task's first switch (from ret_from_fork). */
+void sched_ret_from_fork(void);
+
+/* Core 0 runs pid 1 straight from boot: run its idle loop on the boot stack
+ * (top at idle_stack_top) once pid 1 first gives up the CPU.
+ */
+void sched_init_boot_cpu(uint64_t idle_stack_top);
+
+/* Per-core idle loop: runs whatever becomes runnable, otherwise waits in
+ * `wfe` with the kernel lock released. Entered with the lock held (secondary
+ * cores after boot). Does not return.
+ */
+void sched_idle(void) __attribute__((noreturn));
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "stdint.h"
+
+/*
+ * SD card on the BCM2835 EMMC controller (Arasan SDHCI, QEMU `-sd`).
+ *
+ * One card, 512-byte sectors. Transfers are described by a list of memory
+ * segments so that the block layer can hand over a run of adjacent sectors
+ * spread over several buffers as one multi-block command. Where the
+ * controller offers ADMA2 the segments become its descriptor table and the
+ * controller moves the data itself; otherwise (the BCM2835 Arasan and QEMU's
+ * model of it do not advertise ADMA2) the CPU copies through the data port.
+ *
+ * Transfers are interrupt driven: sdhci_submit() queues one and returns, the
+ * controller interrupt (sdhci_irq()) moves PIO data a sector at a time and
+ * completes it, and a timer fails it if the card never answers. Nothing
+ * waits for the card with the kernel lock held, apart from bringing the card
+ * up at boot (sdhci_init(), polled, before there are tasks).
+ *
+ * Segment buffers are normal cacheable kernel memory, word aligned, with
+ * lengths that are multiples of the sector size; the driver does the cache
+ * maintenance. Requires the kernel lock.
+ */
+
+#ifndef RPI_PERIPH_BASE
+#define RPI_PERIPH_BASE 0x3F000000ull
+#endif
+
+#ifndef RPI_EMMC_BASE
+#define RPI_EMMC_BASE (RPI_PERIPH_BASE + 0x00300000ull)
+#endif
+
+#define SDHCI_SECTOR_SIZE 512u
+
+/* Most segments in one transfer. */
+#define SDHCI_MAX_SEGS 64u
+
+typedef struct {
+    void *buf;
+    uint32_t len; /* bytes */
+} sdhci_seg_t;
+
+/* Reset the controller and bring up the card. Returns 0, or -1 if there is
+ * no card (or it did not answer); the transfer calls then fail.
+ */
+int sdhci_init(void);
+
+/* Capacity in sectors, 0 without a card. */
+uint64_t sdhci_sectors(void);
+
+/* Does the controller move the data itself (ADMA2)? */
+int sdhci_uses_dma(void);
+
+/* One transfer: read or write the sectors starting at lba from/to the
+ * segments, in order, as one command. The caller sets the fields up to arg
+ * and keeps the request and its segments (and buffers) alone until done.
+ */
+typedef struct sdhci_req {
+    struct sdhci_req *next;
+    int write;
+    uint64_t lba;
+    const sdhci_seg_t *segs;
+    uint32_t nsegs;
+    /* Called with 0 or -EIO when the transfer is over, from the controller
+     * interrupt or the timeout timer (never from within sdhci_submit()).
+     */
+    void (*done)(struct sdhci_req *r, int rc);
+    void *arg;
+    /* Driver state. */
+    uint32_t count; /* sectors */
+    uint32_t seg;   /* PIO position */
+    uint32_t off;
+    uint8_t dma;
+} sdhci_req_t;
+
+/* Queue r behind the transfers already submitted. Returns 0, or -EINVAL or
+ * -EIO (no card) without queueing it.
+ */
+int sdhci_submit(sdhci_req_t *r);
+
+/* EMMC controller interrupt (BCM2835 IRQ 62, delivered to core 0). */
+void sdhci_irq(void);
@@ -0,0 +1,54 @@
+#pragma once
+
+#include "stdint.h"
+
+/*
+ * Slab allocator (kernel object caches on top of the buddy PMM).
+ *
+ * A cache hands out fixed-size objects carved from slabs of 2^order pages.
+ * Partially used slabs are preferred, fully free slabs beyond one spare per
+ * cache go back to the PMM, so memory follows actual use instead of
+ * compile-time maxima.
+ *
+ * If a cache has a constructor it runs once per object when its slab is
+ * created; objects must be returned to that constructed state before
+ * kmem_cache_free(), so allocation does not re-initialize them.
+ *
+ * kmalloc() serves power-of-two size classes (16 B .. 2 KiB) from built-in
+ * caches and larger requests (up to 2 MiB) straight from the PMM.
+ *
+ * All calls require the kernel lock.
+ */
+
+typedef struct kmem_cache kmem_cache_t;
+
+typedef void (*kmem_ctor_t)(void *obj);
+
+typedef struct {
+    const char *name;
+    uint32_t obj_size;
+    uint32_t objs_per_slab;
+    uint32_t pages_per_slab;
+    uint64_t active_objs;
+    uint64_t total_objs;
+    uint64_t slabs;
+    uint64_t allocs;
+    uint64_t frees;
+} kmem_cache_stats_t;
+
+void slab_init(void);
+
+/* Create a cache of size-byte objects (align: power of two, 0 = 16).
+ * Caches live forever. Returns 0 if the cache table is full.
+ */
+kmem_cache_t *kmem_cache_create(const char *name, uint32_t size, uint32_t align, kmem_ctor_t ctor);
+void *kmem_cache_alloc(kmem_cache_t *c);
+void kmem_cache_free(kmem_cache_t *c, void *obj);
+
+/* General purpose allocation; kzalloc() also zeroes. 0 on OOM. */
+void *kmalloc(uint64_t size);
+void *kzalloc(uint64_t size);
+void kfree(void *p);
+
+/* Per-cache statistics, for i = 0.. until it returns 0 (/proc/slabinfo). */
+int kmem_cache_stats(uint32_t i, kmem_cache_stats_t *out);
@@ -0,0 +1,82 @@
+#pragma once
+
+#include "context.h"
+#include "spinlock.h"
+#include "stdint.h"
+
+/*
+ * SMP support for the four Cortex-A53 cores of BCM2710/BCM2837 (QEMU raspi3b,
+ * Pi Zero 2 W).
+ *
+ * Secondary cores are parked by the firmware/QEMU boot stub in a spin-table
+ * loop; smp_init() releases them. Each core runs with its own timer and
+ * scheduler state (see cpu_t); its boot stack hosts its idle loop, tasks run
+ * kernel code on their own kernel stacks. Kernel entry is serialized by a single
+ * kernel lock, so user code runs in parallel while kernel data structures
+ * (g_procs, g_descs, pipes, the net stack) only ever see one core at a time.
+ *
+ * The big lock is a first step with little parallelism: every syscall, fault
+ * and IRQ on every core takes it, and a core entering the kernel spins while
+ * another holds it. Only user-mode work scales with the core count. Code that
+ * holds the lock must therefore never wait on hardware; it sleeps on a wait
+ * queue instead (see docs/plan.md, Track B).
+ *
+ * Build with -DSMP_NCPUS=1 to keep the secondaries parked.
+ */
+
+#ifndef SMP_NCPUS
+#define SMP_NCPUS 4
+#endif
+
+enum {
+    MAX_CPUS = 4,
+};
+
+typedef struct {
+    /* Process running on this core; -1 = in the idle loop. */
+    int cur_proc;
+    /* Last slot picked by the round-robin scheduler on this core. */
+    int last_sched;
+    /* Dead task to free once we are off its kernel stack, -1 = none. */
+    int reap_idx;
+    /* This core's idle loop while a task runs (on the core's boot stack). */
+    cpu_context_t idle_ctx;
+    /* ASID (with generation) in this core's TTBR0, and the one it held at
+     * the last ASID rollover (see mmu.c).
+     */
+    uint64_t asid_active;
+    uint64_t asid_reserved;
+    /* Flush the local TLB before loading the next ASID (after a rollover). */
+    uint8_t tlb_flush_pending;
+    uint8_t online;
+} cpu_t;
+
+extern cpu_t g_cpus[MAX_CPUS];
+
+static inline uint32_t cpu_id(void) {
+    uint64_t v;
+    __asm__ volatile("mrs %0, mpidr_el1" : "=r"(v));
+    return (uint32_t)(v & 3u);
+}
+
+static inline cpu_t *cpu_this(void) {
+    return &g_cpus[cpu_id()];
+}
+
+/* Wake cores idling in `wfe` (e.g. when new work becomes runnable). */
+static inline void smp_send_event(void) {
+    __asm__ volatile("dsb ish\n\tsev" ::: "memory");
+}
+
+/* Big kernel lock: held while a core executes kernel code on behalf of an
+ * exception, released only around low-power idle.
+ */
+void kernel_lock(void);
+void kernel_unlock(void);
+
+/* Release secondary cores from the spin-table (called once from kmain). */
+void smp_init(void);
+uint32_t smp_online_count(void);
+
+/* C entry for secondary cores (from arch/start.S). Does not return. */
+void smp_secondary_main(uint64_t core);
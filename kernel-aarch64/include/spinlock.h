@@ -0,0 +1,35 @@
+#pragma once
+
+#include "stdint.h"
+
+/*
+ * Minimal test-and-set spinlock (LDAXR/STXR).
+ *
+ * Waiters sleep in `wfe`; the releasing store clears the exclusive monitor,
+ * which generates the wake-up event. Requires the MMU and caches to be on
+ * (exclusives on Normal cacheable memory).
+ */
+
+typedef struct {
+    volatile uint32_t locked;
+} spinlock_t;
+
+#define SPINLOCK_INIT { 0 }
+
+static inline void spin_lock(spinlock_t *l) {
+    uint32_t tmp;
+    __asm__ volatile(
+        "   sevl\n"
+        "1: wfe\n"
+        "2: ldaxr   %w0, [%1]\n"
+        "   cbnz    %w0, 1b\n"
+        "   stxr    %w0, %w2, [%1]\n"
+        "   cbnz    %w0, 2b\n"
+        : "=&r"(tmp)
+        : "r"(&l->locked), "r"(1u)
+        : "memory");
+}
+
+static inline void spin_unlock(spinlock_t *l) {
+    __asm__ volatile("stlr wzr, [%0]" :: "r"(&l->locked) : "memory");
+}
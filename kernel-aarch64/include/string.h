@@ -0,0 +1,15 @@
+#pragma once
+
+#include "stddef.h"
+
+/*
+ * Kernel memcpy/memmove/memset (arch/string.S).
+ *
+ * Usable from the first instruction of C: before the MMU is on they only
+ * make naturally aligned accesses. GCC also emits calls to them for large
+ * struct copies and for loops it recognises as copies or fills.
+ */
+
+void *memcpy(void *dst, const void *src, size_t n);
+void *memmove(void *dst, const void *src, size_t n);
+void *memset(void *dst, int c, size_t n);
@@ -9,7 +9,16 @@ uint64_t cstr_len_u64(const char *s);
 uint64_t cstr_len(const char *s);
 int cstr_eq_u64(const char *a, const char *b);
 
+/* dirfd value for "relative to the current directory" (*at() syscalls). */
+#define AT_FDCWD ((int64_t)-100)
+
 int normalize_abs_path(const char *in, char *out, uint64_t outsz);
+
+/* Normalized absolute path for in: as is if absolute, else relative to the
+ * directory open as dirfd (AT_FDCWD: the cwd). Returns 0, -EBADF, -ENOTDIR,
+ * -ENAMETOOLONG or -EINVAL.
+ */
+int resolve_path_at(proc_t *p, int64_t dirfd, const char *in, char *out, uint64_t outsz);
 int resolve_path(proc_t *p, const char *in, char *out, uint64_t outsz);
 
 /*
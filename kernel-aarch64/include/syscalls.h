@@ -3,13 +3,13 @@
 #include "exceptions.h"
 #include "stdint.h"
 
-#define SYSCALL_SWITCHED 0xFFFFFFFFFFFFFFFFull
-
 uint64_t sys_getcwd(uint64_t buf_user, uint64_t size);
 uint64_t sys_ioctl(uint64_t fd, uint64_t req, uint64_t argp_user);
 uint64_t sys_brk(uint64_t newbrk);
 uint64_t sys_mmap(uint64_t addr, uint64_t len, uint64_t prot, uint64_t flags, int64_t fd, uint64_t off);
 uint64_t sys_munmap(uint64_t addr, uint64_t len);
+uint64_t sys_mremap(uint64_t old_addr, uint64_t old_len, uint64_t new_len, uint64_t flags, uint64_t new_addr);
+uint64_t sys_madvise(uint64_t addr, uint64_t len, uint64_t advice);
 
 uint64_t sys_getuid(void);
 uint64_t sys_geteuid(void);
@@ -19,18 +19,19 @@ uint64_t sys_gettid(void);
 
 uint64_t sys_uname(uint64_t buf_user);
 uint64_t sys_clock_gettime(uint64_t clockid, uint64_t tp_user);
-uint64_t sys_kill(trap_frame_t *tf, int64_t pid, uint64_t sig, uint64_t elr);
+uint64_t sys_kill(int64_t pid, uint64_t sig);
 uint64_t sys_reboot(uint64_t magic1, uint64_t magic2, uint64_t cmd, uint64_t arg);
 uint64_t sys_set_tid_address(uint64_t tidptr_user);
 uint64_t sys_set_robust_list(uint64_t head_user, uint64_t len);
 uint64_t sys_rt_sigaction(uint64_t sig, uint64_t act_user, uint64_t oldact_user, uint64_t sigsetsize);
 uint64_t sys_rt_sigprocmask(uint64_t how, uint64_t set_user, uint64_t oldset_user, uint64_t sigsetsize);
-uint64_t sys_nanosleep(trap_frame_t *tf, uint64_t req_user, uint64_t rem_user, uint64_t elr);
+uint64_t sys_nanosleep(uint64_t req_user, uint64_t rem_user);
 uint64_t sys_getrandom(uint64_t buf_user, uint64_t len, uint64_t flags);
 uint64_t sys_prlimit64(int64_t pid, uint64_t resource, uint64_t new_rlim_user, uint64_t old_rlim_user);
 
 uint64_t sys_chdir(uint64_t path_user);
 uint64_t sys_dup3(uint64_t oldfd, uint64_t newfd, uint64_t flags);
+uint64_t sys_fcntl(uint64_t fd, uint64_t cmd, uint64_t arg);
 uint64_t sys_mkdirat(int64_t dirfd, uint64_t pathname_user, uint64_t mode);
 uint64_t sys_openat(int64_t dirfd, uint64_t pathname_user, uint64_t flags, uint64_t mode);
 uint64_t sys_symlinkat(uint64_t target_user, int64_t newdirfd, uint64_t linkpath_user);
@@ -38,9 +39,14 @@ uint64_t sys_linkat(int64_t olddirfd, uint64_t oldpath_user, int64_t newdirfd, u
 uint64_t sys_unlinkat(int64_t dirfd, uint64_t pathname_user, uint64_t flags);
 uint64_t sys_close(uint64_t fd);
 uint64_t sys_pipe2(uint64_t pipefd_user, uint64_t flags);
-uint64_t sys_read(trap_frame_t *tf, uint64_t fd, uint64_t buf_user, uint64_t len, uint64_t elr);
+uint64_t sys_read(uint64_t fd, uint64_t buf_user, uint64_t len);
 uint64_t sys_getdents64(uint64_t fd, uint64_t dirp_user, uint64_t count);
 uint64_t sys_lseek(uint64_t fd, int64_t off, uint64_t whence);
+uint64_t sys_truncate(uint64_t path_user, int64_t length);
+uint64_t sys_ftruncate(uint64_t fd, int64_t length);
+uint64_t sys_fallocate(uint64_t fd, uint64_t mode, int64_t off, int64_t len);
+uint64_t sys_sync(void);
+uint64_t sys_fsync(uint64_t fd);
 uint64_t sys_write(uint64_t fd, const void *buf, uint64_t len);
 uint64_t sys_readlinkat(int64_t dirfd, uint64_t pathname_user, uint64_t buf_user, uint64_t bufsiz);
 uint64_t sys_newfstatat(int64_t dirfd, uint64_t pathname_user, uint64_t statbuf_user, uint64_t flags);
@@ -48,20 +54,21 @@ uint64_t sys_fchmodat(int64_t dirfd, uint64_t pathname_user, uint64_t mode, uint
 
 uint64_t sys_execve(trap_frame_t *tf, uint64_t pathname_user, uint64_t argv_user, uint64_t envp_user);
 uint64_t sys_clone(trap_frame_t *tf, uint64_t flags, uint64_t child_stack, uint64_t ptid, uint64_t ctid, uint64_t tls, uint64_t elr);
-uint64_t sys_wait4(trap_frame_t *tf, int64_t pid_req, uint64_t wstatus_user, uint64_t options, uint64_t rusage_user, uint64_t elr);
-int handle_exit_and_maybe_switch(trap_frame_t *tf, uint64_t code);
+uint64_t sys_wait4(int64_t pid_req, uint64_t wstatus_user, uint64_t options, uint64_t rusage_user);
+uint64_t sys_getrusage(int64_t who, uint64_t usage_user);
+uint64_t sys_times(uint64_t tms_user);
+/* Terminate the current process (exit, kill, pending kill). Does not return. */
+void proc_exit(uint64_t code) __attribute__((noreturn));
 
 /* mona-specific: read kernel log ring buffer (dmesg). */
 uint64_t sys_mona_dmesg(uint64_t buf_user, uint64_t len, uint64_t flags);
 
 /* mona-specific: ICMPv6 echo (ping6). */
-uint64_t sys_mona_ping6(trap_frame_t *tf,
-						uint64_t dst_ip_user,
+uint64_t sys_mona_ping6(uint64_t dst_ip_user,
 						uint64_t ident,
 						uint64_t seq,
 						uint64_t timeout_ms,
-						uint64_t rtt_ns_user,
-						uint64_t elr);
+						uint64_t rtt_ns_user);
 
 /* mona-specific: minimal UDP-over-IPv6 support. */
 uint64_t sys_mona_udp6_socket(void);
@@ -71,23 +78,47 @@ uint64_t sys_mona_udp6_sendto(uint64_t fd,
 							  uint64_t dst_port,
 							  uint64_t buf_user,
 							  uint64_t len);
-uint64_t sys_mona_udp6_recvfrom(trap_frame_t *tf,
-								uint64_t fd,
+uint64_t sys_mona_udp6_recvfrom(uint64_t fd,
 								uint64_t buf_user,
 								uint64_t len,
 								uint64_t src_ip_user,
 								uint64_t src_port_user,
-								uint64_t timeout_ms,
-								uint64_t elr);
+								uint64_t timeout_ms);
 
 /* mona-specific: read IPv6 DNS server (RDNSS) learned from RA into a 16-byte buffer. */
 uint64_t sys_mona_net6_get_dns(uint64_t out_ip_user);
 
 /* mona-specific: minimal TCP-over-IPv6 client support. */
-uint64_t sys_mona_tcp6_connect(trap_frame_t *tf,
-							  uint64_t dst_ip_user,
+uint64_t sys_mona_tcp6_connect(uint64_t dst_ip_user,
 							  uint64_t dst_port,
-							  uint64_t timeout_ms,
-							  uint64_t elr);
+							  uint64_t timeout_ms);
 uint64_t sys_mona_tcp6_send(uint64_t fd, uint64_t buf_user, uint64_t len);
-uint64_t sys_mona_tcp6_recv(uint64_t fd, uint64_t buf_user, uint64_t len, uint64_t timeout_ms);
+uint64_t sys_mona_tcp6_recv(uint64_t fd,
+							uint64_t buf_user,
+							uint64_t len,
+							uint64_t timeout_ms);
+
+/* mona-specific: posix_spawn-like fork+exec in one call. The child gets a
+ * fresh image of pathname (no copy of the caller's address space) and a copy
+ * of the caller's fd table, edited by the file actions in order. Returns
+ * the child's pid; failures (e.g. ENOENT) are reported to the caller.
+ */
+enum {
+    MONA_SPAWN_DUP2 = 1,  /* dup2(fd, newfd) */
+    MONA_SPAWN_CLOSE = 2, /* close(fd); not open is fine */
+    MONA_SPAWN_MAX_ACTIONS = 16,
+};
+
+typedef struct {
+    uint64_t op;
+    uint64_t fd;
+    uint64_t newfd;
+} mona_spawn_action_t;
+
+uint64_t sys_mona_spawn(trap_frame_t *tf,
+						uint64_t pathname_user,
+						uint64_t argv_user,
+						uint64_t envp_user,
+						uint64_t actions_user,
+						uint64_t nactions,
+						uint64_t elr);
@@ -16,20 +16,22 @@ void time_init(void);
 uint64_t time_freq_hz(void);
 uint64_t time_now_ns(void);
 
-/* Periodic tick using the AArch64 physical timer (CNTP).
+/* Per-core tick using the AArch64 physical timer (CNTP).
  *
- * The tick is used to wake the kernel out of `wfi` when there are sleeping
- * tasks or blocked stdin reads.
+ * The compare value is the earlier of the periodic tick (used for time-slice
+ * preemption while a task runs) and the earliest kernel timer deadline
+ * (timer.h), so idle cores only wake when something is due.
  */
 void time_tick_init(uint32_t hz);
-/* Ensure the timer is running in periodic mode (used when polling is needed). */
+/* Ensure the periodic tick is running (a task is about to run at EL0). */
 void time_tick_enable_periodic(void);
 
-/* Program a one-shot tick delta from now (used for tickless sleep-only idle). */
-void time_tick_schedule_oneshot_ns(uint64_t delta_ns);
+/* Set this core's kernel timer deadline (absolute ns, 0 = none). */
+void time_tick_set_deadline_ns(uint64_t deadline_ns);
+uint64_t time_tick_deadline_ns(void);
 
-/* Called from the timer IRQ handler to acknowledge and rearm/disable as needed. */
+/* Called from the timer IRQ handler to acknowledge and rearm as needed. */
 void time_tick_handle_irq(void);
 
-/* Disable the timer interrupt source (used when waiting only for IRQ-driven IO). */
+/* Stop the periodic tick; a pending kernel timer deadline stays armed. */
 void time_tick_disable(void);
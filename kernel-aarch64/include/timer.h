@@ -0,0 +1,52 @@
+#pragma once
+
+#include "stdint.h"
+
+/*
+ * Kernel timers (hierarchical timing wheel).
+ *
+ * A ktimer_t is embedded in its owner (e.g. proc_t) and fires a callback once
+ * its absolute monotonic deadline (time_now_ns()) has passed. Arming and
+ * cancelling are O(1); finding the next deadline is O(levels) via per-level
+ * occupancy bitmaps.
+ *
+ * Callbacks run with the kernel lock held and IRQs masked, from the timer IRQ
+ * or the scheduler loop (timer_run()). They may re-arm their own timer.
+ *
+ * The CNTP one-shot of the current core is kept programmed to the earliest
+ * pending deadline (see time_tick_set_deadline_ns()).
+ */
+
+typedef struct ktimer ktimer_t;
+
+typedef void (*ktimer_fn_t)(ktimer_t *t, void *arg);
+
+struct ktimer {
+    ktimer_t *next;
+    ktimer_t **pprev; /* 0 when not pending */
+    uint64_t expires_ns;
+    ktimer_fn_t fn;
+    void *arg;
+    uint16_t bucket;
+};
+
+void timer_init(ktimer_t *t, ktimer_fn_t fn, void *arg);
+
+/* Arm (or re-arm) t to fire at the absolute time expires_ns. */
+void timer_arm(ktimer_t *t, uint64_t expires_ns);
+
+/* Cancel t if pending (no-op otherwise). */
+void timer_cancel(ktimer_t *t);
+
+static inline int timer_pending(const ktimer_t *t) {
+    return t->pprev != 0;
+}
+
+/* Run the callbacks of all expired timers and reprogram this core's timer. */
+void timer_run(void);
+
+/* Earliest pending deadline (ns), or 0 if no timer is pending.
+ * Deadlines further out than the finest wheel level are reported as the
+ * (earlier) time they cascade down, which is always safe to wake at.
+ */
+uint64_t timer_next_deadline_ns(void);
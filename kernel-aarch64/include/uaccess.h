@@ -0,0 +1,48 @@
+#pragma once
+
+#include "errno.h"
+#include "mmu.h"
+#include "stdint.h"
+
+/*
+ * Copies between the kernel and the current process' user window.
+ *
+ * User pages are accessed directly and faulted in on first touch like from
+ * EL0 (see exceptions.c). An access that cannot be resolved (no VMA, a write
+ * to read-only memory) does not kill the process: the copy routine has an
+ * exception table entry for each user access, and the fault resumes at its
+ * fixup, which makes the copy fail with -EFAULT. So callers need no
+ * user_range_ok() walk over the VMAs beforehand, only the window check below
+ * that keeps user pointers off kernel memory.
+ *
+ * Requires the kernel lock (faults may commit pages).
+ */
+
+/* Exception table entry (section __ex_table, see link.ld). */
+typedef struct {
+    uint64_t insn;
+    uint64_t fixup;
+} ex_entry_t;
+
+/* arch/uaccess.S: memcpy() that survives faults on user addresses.
+ * Returns the bytes not copied (0 on success).
+ */
+uint64_t __copy_user(void *dst, const void *src, uint64_t len);
+
+static inline int user_window_ok(uint64_t user_ptr, uint64_t len) {
+    return user_ptr >= USER_REGION_BASE &&
+           len <= USER_REGION_BASE + USER_REGION_SIZE - user_ptr;
+}
+
+/* Returns 0 or -EFAULT (possibly after copying part of the range). */
+static inline int copy_to_user(uint64_t user_dst, const void *src, uint64_t len) {
+    if (!user_window_ok(user_dst, len)) return -(int)EFAULT;
+    if (__copy_user((void *)(uintptr_t)user_dst, src, len) != 0) return -(int)EFAULT;
+    return 0;
+}
+
+static inline int copy_from_user(void *dst, uint64_t user_src, uint64_t len) {
+    if (!user_window_ok(user_src, len)) return -(int)EFAULT;
+    if (__copy_user(dst, (const void *)(uintptr_t)user_src, len) != 0) return -(int)EFAULT;
+    return 0;
+}
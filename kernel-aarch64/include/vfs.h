@@ -7,10 +7,60 @@
 /* initramfs + overlay VFS helpers.
  * Paths passed to vfs_lookup_abs must be normalized absolute paths.
  * dir_path_no_slash is normalized, no leading slash; "" represents root.
+ *
+ * Names resolve through a dentry cache (one node per path component), so
+ * lookups cost O(components) rather than a scan of every entry.
  */
 
+/* A cached name. Dentries stay valid until the next VFS call unless pinned
+ * with vfs_dget() (a process' cwd, a directory fd).
+ */
+typedef struct vfs_dentry vfs_dentry_t;
+
+/* Call after initramfs_init(). */
 void vfs_init(void);
 
+vfs_dentry_t *vfs_root(void);
+vfs_dentry_t *vfs_dget(vfs_dentry_t *d);
+void vfs_dput(vfs_dentry_t *d);
+
+/* Resolve path from base (or from the root if it is absolute or base is 0).
+ * "." and ".." are handled per component. Sets *out to an existing entry
+ * and returns 0, or returns -ENOENT, -ENOTDIR, -ENAMETOOLONG or -ENOMEM.
+ */
+int vfs_walk(vfs_dentry_t *base, const char *path, vfs_dentry_t **out);
+
+/* Contents and mode of an existing entry. Returns 0 or -ENOENT. */
+int vfs_dentry_stat(const vfs_dentry_t *d, const uint8_t **out_data, uint64_t *out_size, uint32_t *out_mode);
+
+/* Absolute path of d ("/" for the root). Returns 0 or -ENAMETOOLONG. */
+int vfs_dentry_path(const vfs_dentry_t *d, char *out, uint64_t cap);
+
+/* List a directory: initramfs entries not shadowed by the overlay, then
+ * overlay entries. Returns -1 if d is not a directory, else 0 or the
+ * callback's non-zero return.
+ */
+int vfs_dentry_list(vfs_dentry_t *d, initramfs_dir_cb_t cb, void *ctx);
+
+/* Directory read position (getdents64): lists the same entries in the same
+ * order as vfs_dentry_list(), resuming where the previous read stopped in
+ * O(1). Entries created while the cursor is open may or may not show up;
+ * removed ones that were not returned yet do not.
+ */
+typedef struct vfs_dir vfs_dir_t;
+
+/* Cursor at the start of directory d (pinned while open), or 0 (OOM). */
+vfs_dir_t *vfs_dir_open(vfs_dentry_t *d);
+void vfs_dir_close(vfs_dir_t *c);
+vfs_dentry_t *vfs_dir_dentry(vfs_dir_t *c);
+void vfs_dir_rewind(vfs_dir_t *c);
+
+/* Call cb for the following entries until it returns non-zero; that entry
+ * is not consumed and is passed again by the next read. Returns 0 at the
+ * end of the directory or the callback's return.
+ */
+int vfs_dir_read(vfs_dir_t *c, initramfs_dir_cb_t cb, void *ctx);
+
 int vfs_lookup_abs(const char *abs_path,
                    const uint8_t **out_data,
                    uint64_t *out_size,
@@ -51,6 +101,38 @@ int vfs_ramfile_find_abs(const char *abs_path, uint32_t *out_id);
 int vfs_ramfile_set_mode_abs(const char *abs_path, uint32_t new_mode);
 int vfs_ramdir_set_mode_abs(const char *abs_path, uint32_t new_mode);
 
-/* Access ramfile storage by id (index). Returns 0 on success, or -errno. */
-int vfs_ramfile_get(uint32_t id, uint8_t **out_data, uint64_t *out_size, uint64_t *out_cap, uint32_t *out_mode);
+/* Ramfile contents, by id (index).
+ *
+ * Files are sparse and grow as they are written: the contents are pages
+ * allocated on first write, and holes read as zeros. Functions return 0 on
+ * success, or -errno.
+ */
+int vfs_ramfile_get(uint32_t id, uint64_t *out_size, uint64_t *out_pages, uint32_t *out_mode);
+
+/* Truncate or extend (with a hole). Pages past the new size are freed. */
 int vfs_ramfile_set_size(uint32_t id, uint64_t new_size);
+
+/* The bytes at off, up to the end of their page or of the file: returns
+ * how many *out points at (0 at or past the end), or -errno.
+ */
+int64_t vfs_ramfile_read_span(uint32_t id, uint64_t off, const uint8_t **out);
+
+/* Storage for writing at off, allocated if needed: returns how many bytes
+ * to the end of the page *out points at, or -ENOMEM / -EFBIG. The size is
+ * not changed (see vfs_ramfile_set_size()).
+ */
+int64_t vfs_ramfile_write_span(uint32_t id, uint64_t off, uint8_t **out);
+
+/* Physical address of page idx, 0 for a hole or past the end. Pages are
+ * refcounted PMM pages: a process mapping one takes its own reference, so
+ * it outlives a truncate or unlink (vm_map_page()).
+ */
+uint64_t vfs_ramfile_page(uint32_t id, uint64_t idx);
+
+/* fallocate(): allocate the pages of [off, off+len), growing the size to
+ * off+len unless keep_size. -ENOSPC when memory runs out.
+ */
+int vfs_ramfile_allocate(uint32_t id, uint64_t off, uint64_t len, int keep_size);
+
+/* FALLOC_FL_PUNCH_HOLE: zero [off, off+len) and free its whole pages. */
+int vfs_ramfile_punch(uint32_t id, uint64_t off, uint64_t len);
@@ -0,0 +1,144 @@
+#pragma once
+
+#include "mmu.h"
+#include "stdint.h"
+
+/*
+ * User address spaces.
+ *
+ * A process owns the user window of its TTBR0 (see mmu.h), mapped with 4KiB
+ * pages. What may be mapped there is described by a sorted list of VMAs;
+ * the pages behind them are committed (zero-filled) when first touched,
+ * from EL0 or by the kernel on a syscall's behalf, so a process only pays
+ * for the memory it uses.
+ *
+ * Layout: the program image at USER_REGION_BASE with the brk heap right
+ * above it, mmap() areas handed out top-down below the stack, and the stack
+ * at the top of the window.
+ *
+ * All calls require the kernel lock.
+ */
+
+#define VM_PAGE_SIZE 4096ull
+
+/* Initial stack: the top of the window, committed as it grows down. */
+#define USER_STACK_TOP (USER_REGION_BASE + USER_REGION_SIZE)
+#define USER_STACK_SIZE 0x0000000000800000ull
+
+enum {
+    VMA_HEAP = 1u << 0,
+    VMA_STACK = 1u << 1,
+    /* Backed by file data (file mmap, ELF segment), not just demand-zero. */
+    VMA_FILE = 1u << 2,
+};
+
+typedef struct vma {
+    struct vma *next;
+    uint64_t start;
+    uint64_t end;
+    uint32_t prot;  /* MMU_PROT_* */
+    uint32_t flags; /* VMA_* */
+} vma_t;
+
+typedef struct {
+    uint64_t ttbr0_pa; /* 0 = none */
+    /* ASID with allocator generation, 0 = none (see mmu.h). */
+    uint64_t asid;
+    vma_t *vmas;       /* sorted by address, non-overlapping */
+    uint64_t pages;    /* committed user pages */
+} vm_space_t;
+
+void vm_init(void);
+
+/* Zero one more page for the demand-zero pool, if it is not full. Called by
+ * idle cores; returns 1 if it did any work.
+ */
+int vm_zero_pool_refill(void);
+
+/* Empty address space. Returns 0 or -ENOMEM. */
+int vm_space_init(vm_space_t *vm);
+
+/* Free pages, VMAs and tables. No core may still use the tables, and the
+ * ASID must have been released (mmu_asid_release()).
+ */
+void vm_space_destroy(vm_space_t *vm);
+
+/* dst = copy of src (fork). Committed pages are not copied but shared
+ * copy-on-write: both sides map them read-only and the first write from
+ * either side takes a private copy (vm_fault()). dst must be empty; on
+ * failure it is left destroyed. Returns 0 or -ENOMEM.
+ */
+int vm_space_copy(vm_space_t *dst, vm_space_t *src);
+
+/* Bytes covered by VMAs. */
+uint64_t vm_space_size(const vm_space_t *vm);
+
+/* VMA containing va, or 0. */
+vma_t *vm_find(const vm_space_t *vm, uint64_t va);
+
+/* Is [va, va+len) covered by accessible VMAs? */
+int vm_range_ok(const vm_space_t *vm, uint64_t va, uint64_t len);
+
+/* Likewise, with VMAs that allow all of prot (MMU_PROT_*). */
+int vm_range_prot_ok(const vm_space_t *vm, uint64_t va, uint64_t len, uint32_t prot);
+
+/* Add a mapping of the page-aligned range [start, start+len), which must be
+ * free. Adjacent VMAs with the same prot and flags are merged.
+ * Returns 0, -EINVAL or -ENOMEM.
+ */
+int vm_map(vm_space_t *vm, uint64_t start, uint64_t len, uint32_t prot, uint32_t flags);
+
+/* Remove [start, start+len) from the mappings and free its pages.
+ * Returns 0 or -ENOMEM (a VMA had to be split).
+ */
+int vm_unmap(vm_space_t *vm, uint64_t start, uint64_t len);
+
+/* Free the committed pages of [start, start+len) but keep the mappings:
+ * the range is demand-zero again (MADV_DONTNEED). Returns 0, -EINVAL (also
+ * if it covers a VMA_FILE mapping) or -ENOMEM (part of it is not mapped).
+ */
+int vm_discard(vm_space_t *vm, uint64_t start, uint64_t len);
+
+/* Move the mapping [old, old+old_len), which must lie inside one VMA, to
+ * the free range [new_start, new_start+new_len), new_len >= old_len, with
+ * the rest demand-zero (mremap()). Committed pages move with their page
+ * table entries; nothing is copied. Returns 0, -EINVAL or -ENOMEM; on
+ * failure the old range still maps the same pages.
+ */
+int vm_move(vm_space_t *vm, uint64_t old, uint64_t old_len, uint64_t new_start, uint64_t new_len);
+
+/* Highest free page-aligned range of len bytes inside [lo, hi), or 0. */
+uint64_t vm_find_free(const vm_space_t *vm, uint64_t lo, uint64_t hi, uint64_t len);
+
+/* Resolve a fault at va for an access of MMU_PROT_* kind by committing the
+ * page, or by breaking copy-on-write sharing for a write. Returns 0 (retry
+ * the access), -EFAULT (no mapping or not allowed) or -ENOMEM.
+ */
+int vm_fault(vm_space_t *vm, uint64_t va, uint32_t access);
+
+/* Map [start, start+len) like vm_map(), as a VMA_FILE, with its first bytes
+ * taken from data[0, size) and the rest demand-zero. With in_place, whole pages of
+ * page-aligned data are mapped directly (the data must stay put and
+ * unchanged for good, like the initramfs); everything else is copied.
+ * Returns 0 or a negative errno.
+ */
+int vm_map_data(vm_space_t *vm,
+                uint64_t start,
+                uint64_t len,
+                uint32_t prot,
+                const uint8_t *data,
+                uint64_t size,
+                int in_place);
+
+/* Put the PMM page pa behind va, which must be mapped but not committed
+ * yet, shared with whoever else holds it (a ramfile): it is read-only until
+ * the first write takes a private copy. Takes a page reference (see
+ * pmm_page_get()). Returns 0, -EINVAL or -ENOMEM.
+ */
+int vm_map_page(vm_space_t *vm, uint64_t va, uint64_t pa);
+
+/* Copy into an address space (need not be the current one) through the
+ * kernel alias of its pages, committing them as needed and ignoring the
+ * VMA permissions (program loading). Returns 0 or a negative errno.
+ */
+int vm_copy_to(vm_space_t *vm, uint64_t va, const void *src, uint64_t len);
@@ -0,0 +1,73 @@
+#pragma once
+
+#include "stdint.h"
+
+/*
+ * Wait queues.
+ *
+ * A blocking syscall queues the current task on the wait queue of the object
+ * it waits for (console input, a socket, its children, ...) and calls
+ * sched_block(), which runs other tasks until it is woken. Producers wake
+ * exactly the tasks queued on their object instead of the scheduler polling
+ * every blocked task.
+ *
+ * Each task has its own kernel stack, so the syscall simply continues after
+ * sched_block() returns and re-checks its condition:
+ *
+ *     while (!ready()) {
+ *         wait_block(cur, PROC_BLOCKED_IO, q, deadline);
+ *         sched_block();
+ *         if (wait_timed_out(cur)) break;
+ *     }
+ *
+ * Each task sits on at most one wait queue. Queues are FIFO, linked through
+ * proc_t slot indices, and protected by the kernel lock.
+ */
+
+struct proc;
+
+typedef struct {
+    int16_t head;
+    int16_t tail;
+} waitq_t;
+
+#define WAITQ_INIT { -1, -1 }
+
+enum {
+    WAIT_NARGS = 4,
+};
+
+/* Per-task wait state, embedded in proc_t. */
+typedef struct {
+    waitq_t *q;          /* queue we are linked on, 0 if none */
+    int16_t prev;
+    int16_t next;
+    /* Absolute wake-up deadline (time_now_ns()), 0 = none. */
+    uint64_t deadline_ns;
+    /* Results a waker hands to the waiter (e.g. ping replies). */
+    uint64_t arg[WAIT_NARGS];
+} wait_t;
+
+void waitq_init(waitq_t *q);
+
+static inline int waitq_empty(const waitq_t *q) {
+    return q->head < 0;
+}
+
+/* Make the longest waiter (or every waiter) runnable again.
+ * Returns the number of tasks woken.
+ */
+uint32_t waitq_wake_one(waitq_t *q);
+uint32_t waitq_wake_all(waitq_t *q);
+
+/* Put p to sleep in `state` (SLEEPING, BLOCKED_IO or WAITING) on q (may be 0
+ * for a pure timeout), waking at deadline_ns if non-zero. The caller then
+ * gives up the CPU with sched_block().
+ */
+void wait_block(struct proc *p, int state, waitq_t *q, uint64_t deadline_ns);
+
+/* After waking: did the deadline pass? */
+int wait_timed_out(const struct proc *p);
+
+/* Unlink p from its wait queue (no-op if not queued). */
+void wait_dequeue(struct proc *p);
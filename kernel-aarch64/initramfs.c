@@ -1,10 +1,44 @@
 #include "initramfs.h"
 #include "cpio_newc.h"
+#include "slab.h"
 #include "stat_bits.h"
+#include "uart_pl011.h"
 
 static const void *g_archive;
 static size_t g_archive_size;
 
+/*
+ * Index built once by initramfs_init(): one node per archive entry plus the
+ * directories only implied by entry names, hashed by full path and linked
+ * into a parent/child tree. Lookups hash the path once and directory
+ * listings walk the children, instead of re-parsing the archive.
+ *
+ * A node's path points into the archive; for an implied directory it is a
+ * prefix of some entry's name, so it is not NUL-terminated at path_len.
+ */
+typedef struct ird_node ird_node_t;
+
+struct ird_node {
+    struct ird_node *hash_next;
+    struct ird_node *parent;
+    struct ird_node *child;   /* first child, in archive order */
+    struct ird_node *sibling;
+    const char *path;         /* no leading slashes; "" for the root */
+    uint32_t path_len;
+    uint32_t name_off;        /* last component: path + name_off */
+    uint32_t hash;
+    uint32_t mode;
+    uint8_t implied;          /* directory without an entry of its own */
+    const uint8_t *data;
+    uint64_t size;
+};
+
+static ird_node_t *g_nodes;   /* 0: no index, scan the archive */
+static uint32_t g_node_count;
+static uint32_t g_node_cap;
+static ird_node_t **g_hash;
+static uint32_t g_hash_mask;
+
 static void strip_leading_slashes(const char **p) {
     while (**p == '/') (*p)++;
 }
@@ -22,15 +56,246 @@ static uint32_t root_dir_mode(void) {
     return S_IFDIR | 0755u;
 }
 
+/* FNV-1a. */
+static uint32_t path_hash(const char *p, uint32_t len) {
+    uint32_t h = 2166136261u;
+    for (uint32_t i = 0; i < len; i++) {
+        h ^= (uint8_t)p[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+static ird_node_t *index_find(const char *p, uint32_t len, uint32_t h) {
+    for (ird_node_t *n = g_hash[h & g_hash_mask]; n; n = n->hash_next) {
+        if (n->hash != h || n->path_len != len) continue;
+        uint32_t i = 0;
+        while (i < len && n->path[i] == p[i]) i++;
+        if (i == len) return n;
+    }
+    return 0;
+}
+
+static ird_node_t *index_add(ird_node_t *parent, const char *p, uint32_t len, uint32_t name_off, uint32_t h) {
+    if (g_node_count >= g_node_cap) return 0;
+    ird_node_t *n = &g_nodes[g_node_count++];
+    n->parent = parent;
+    n->child = 0;
+    n->path = p;
+    n->path_len = len;
+    n->name_off = name_off;
+    n->hash = h;
+    n->mode = root_dir_mode();
+    n->implied = 1;
+    n->data = 0;
+    n->size = 0;
+    /* Children are prepended here and put back in order at the end. */
+    n->sibling = parent ? parent->child : 0;
+    if (parent) parent->child = n;
+    n->hash_next = g_hash[h & g_hash_mask];
+    g_hash[h & g_hash_mask] = n;
+    return n;
+}
+
+static const char *entry_path(const char *name) {
+    strip_leading_slashes(&name);
+    if (name[0] == '.' && name[1] == '/') {
+        name += 2;
+        strip_leading_slashes(&name);
+    }
+    return name;
+}
+
+/* Pass 1: size the index. Every '/' may imply a directory. */
+static int count_cb(const cpio_entry_t *e, void *ctx) {
+    uint32_t *n = (uint32_t *)ctx;
+    *n += 1;
+    for (const char *p = e->name; *p; p++) {
+        if (*p == '/') *n += 1;
+    }
+    return 0;
+}
+
+/* Pass 2: add the entry and every directory on its path. */
+static int index_cb(const cpio_entry_t *e, void *ctx) {
+    (void)ctx;
+    const char *path = entry_path(e->name);
+    if (path[0] == '\0' || str_eq(path, ".")) {
+        g_nodes[0].mode = e->mode;
+        return 0;
+    }
+
+    ird_node_t *dir = &g_nodes[0];
+    uint32_t start = 0;
+    uint32_t i = 0;
+    for (;;) {
+        if (path[i] != '/' && path[i] != '\0') {
+            i++;
+            continue;
+        }
+        /* Empty, "." or ".." components: not a name we could look up. */
+        uint32_t clen = i - start;
+        if (clen == 0 || (path[start] == '.' && (clen == 1 || (clen == 2 && path[start + 1] == '.')))) {
+            return 0;
+        }
+
+        uint32_t h = path_hash(path, i);
+        ird_node_t *n = index_find(path, i, h);
+        if (!n) {
+            n = index_add(dir, path, i, start, h);
+            if (!n) return -1;
+        }
+        if (path[i] == '\0') {
+            /* The first entry for a path wins, as with a linear scan. */
+            if (n->implied) {
+                n->implied = 0;
+                n->path = path;
+                n->mode = e->mode;
+                n->data = e->data;
+                n->size = (uint64_t)e->size;
+            }
+            return 0;
+        }
+        dir = n;
+        i++;
+        start = i;
+    }
+}
+
+static void index_build(void) {
+    uint32_t cap = 1;
+    if (cpio_newc_foreach(g_archive, g_archive_size, count_cb, &cap) != 0) {
+        uart_write("initramfs: archive damaged, not indexed\n");
+        return;
+    }
+
+    uint32_t buckets = 16;
+    while (buckets < cap * 2u) buckets <<= 1;
+    g_nodes = (ird_node_t *)kmalloc((uint64_t)cap * sizeof(ird_node_t));
+    g_hash = (ird_node_t **)kzalloc((uint64_t)buckets * sizeof(ird_node_t *));
+    if (!g_nodes || !g_hash) {
+        if (g_nodes) kfree(g_nodes);
+        if (g_hash) kfree(g_hash);
+        g_nodes = 0;
+        g_hash = 0;
+        uart_write("initramfs: no memory for the index\n");
+        return;
+    }
+    g_node_cap = cap;
+    g_node_count = 0;
+    g_hash_mask = buckets - 1u;
+    (void)index_add(0, "", 0, 0, path_hash("", 0));
+
+    if (cpio_newc_foreach(g_archive, g_archive_size, index_cb, 0) != 0) {
+        kfree(g_nodes);
+        kfree(g_hash);
+        g_nodes = 0;
+        g_hash = 0;
+        uart_write("initramfs: index failed\n");
+        return;
+    }
+
+    /* Back to archive order. */
+    for (uint32_t k = 0; k < g_node_count; k++) {
+        ird_node_t *rev = 0;
+        ird_node_t *c = g_nodes[k].child;
+        while (c) {
+            ird_node_t *next = c->sibling;
+            c->sibling = rev;
+            rev = c;
+            c = next;
+        }
+        g_nodes[k].child = rev;
+    }
+
+    uart_write("initramfs: indexed nodes=");
+    uart_write_hex_u64(g_node_count);
+    uart_write("\n");
+}
+
+static ird_node_t *index_lookup(const char *path) {
+    strip_leading_slashes(&path);
+    uint32_t len = 0;
+    while (path[len] != '\0') len++;
+    return index_find(path, len, path_hash(path, len));
+}
+
+const initramfs_node_t *initramfs_root(void) {
+    return g_nodes ? &g_nodes[0] : 0;
+}
+
+const initramfs_node_t *initramfs_child(const initramfs_node_t *dir, const char *name, uint32_t len) {
+    if (!dir || len == 0) return 0;
+
+    /* Hash of the child's full path without building it. */
+    uint32_t h = path_hash(dir->path, dir->path_len);
+    if (dir->path_len != 0) {
+        h ^= (uint8_t)'/';
+        h *= 16777619u;
+    }
+    for (uint32_t i = 0; i < len; i++) {
+        h ^= (uint8_t)name[i];
+        h *= 16777619u;
+    }
+
+    for (ird_node_t *n = g_hash[h & g_hash_mask]; n; n = n->hash_next) {
+        if (n->hash != h || n->parent != dir || n->path_len - n->name_off != len) continue;
+        const char *nn = n->path + n->name_off;
+        uint32_t i = 0;
+        while (i < len && nn[i] == name[i]) i++;
+        if (i == len) return n;
+    }
+    return 0;
+}
+
+const initramfs_node_t *initramfs_first_child(const initramfs_node_t *dir) {
+    return dir ? dir->child : 0;
+}
+
+const initramfs_node_t *initramfs_next_sibling(const initramfs_node_t *n) {
+    return n ? n->sibling : 0;
+}
+
+uint32_t initramfs_node_name(const initramfs_node_t *n, const char **out_name) {
+    *out_name = n->path + n->name_off;
+    return n->path_len - n->name_off;
+}
+
+void initramfs_node_stat(const initramfs_node_t *n, const uint8_t **out_data, uint64_t *out_size, uint32_t *out_mode) {
+    if (out_data) *out_data = n->data;
+    if (out_size) *out_size = n->size;
+    if (out_mode) *out_mode = n->mode;
+}
+
 void initramfs_init(const void *archive, size_t archive_size) {
     g_archive = archive;
     g_archive_size = archive_size;
+    if (archive && archive_size != 0) {
+        index_build();
+    }
+}
+
+int initramfs_contains(const void *p, uint64_t len) {
+    uintptr_t a = (uintptr_t)p;
+    uintptr_t base = (uintptr_t)g_archive;
+    if (!g_archive || a < base) return 0;
+    uint64_t off = (uint64_t)(a - base);
+    return off <= g_archive_size && len <= g_archive_size - off;
 }
 
 int initramfs_lookup(const char *path, const uint8_t **out_data, uint64_t *out_size, uint32_t *out_mode) {
     if (!g_archive || g_archive_size == 0) return -1;
 
-    /* Treat "/" as the root directory. */
+    if (g_nodes) {
+        const ird_node_t *n = index_lookup(path);
+        if (!n) return -1;
+        if (out_data) *out_data = n->data;
+        if (out_size) *out_size = n->size;
+        if (out_mode) *out_mode = n->mode;
+        return 0;
+    }
+
+    /* No index: scan the archive. Treat "/" as the root directory. */
     if (str_eq(path, "/")) {
         if (out_data) *out_data = 0;
         if (out_size) *out_size = 0;
@@ -138,9 +403,27 @@ static int list_cb(const cpio_entry_t *e, void *ctx) {
     return lc->cb(tmp, mode, lc->cb_ctx);
 }
 
+static int index_list_dir(const char *dir_path, initramfs_dir_cb_t cb, void *ctx) {
+    const ird_node_t *dir = index_lookup(dir_path);
+    if (!dir || !S_ISDIR(dir->mode)) return -1;
+
+    for (const ird_node_t *c = dir->child; c; c = c->sibling) {
+        char tmp[128];
+        uint32_t n = c->path_len - c->name_off;
+        if (n >= sizeof(tmp)) n = (uint32_t)sizeof(tmp) - 1;
+        for (uint32_t i = 0; i < n; i++) tmp[i] = c->path[c->name_off + i];
+        tmp[n] = '\0';
+
+        int rc = cb(tmp, c->mode, ctx);
+        if (rc != 0) return -1;
+    }
+    return 0;
+}
+
 int initramfs_list_dir(const char *dir_path, initramfs_dir_cb_t cb, void *ctx) {
     if (!g_archive || g_archive_size == 0) return -1;
     if (!cb) return -1;
+    if (g_nodes) return index_list_dir(dir_path, cb, ctx);
 
     if (str_eq(dir_path, "/")) dir_path = "";
     strip_leading_slashes(&dir_path);
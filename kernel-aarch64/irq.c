@@ -1,7 +1,10 @@
 #include "irq.h"
 
 #include "console_in.h"
+#include "sdhci.h"
+#include "smp.h"
 #include "time.h"
+#include "timer.h"
 #include "uart_pl011.h"
 
 #if defined(ENABLE_USB_KBD) || defined(ENABLE_USB_NET)
@@ -16,15 +19,15 @@
  */
 #define LOCAL_PERIPH_BASE 0x40000000ull
 
-/* Core 0 timer interrupt control:
+/* Core N timer interrupt control:
  * bit1 routes CNTPNSIRQ (non-secure physical timer) to IRQ.
  */
-#define CORE0_TIMER_IRQ_CTRL (*(volatile uint32_t *)(uintptr_t)(LOCAL_PERIPH_BASE + 0x40ull))
+#define CORE_TIMER_IRQ_CTRL(n) (*(volatile uint32_t *)(uintptr_t)(LOCAL_PERIPH_BASE + 0x40ull + 4ull * (n)))
 
-/* Core 0 IRQ source:
+/* Core N IRQ source:
  * bit1 indicates CNTPNSIRQ pending.
  */
-#define CORE0_IRQ_SOURCE (*(volatile uint32_t *)(uintptr_t)(LOCAL_PERIPH_BASE + 0x60ull))
+#define CORE_IRQ_SOURCE(n) (*(volatile uint32_t *)(uintptr_t)(LOCAL_PERIPH_BASE + 0x60ull + 4ull * (n)))
 
 /* BCM2835 interrupt controller (in the 0x3Fxxxxxx peripheral window).
  * Used for peripheral IRQs like PL011 UART.
@@ -37,39 +40,61 @@
 /* PL011 UART interrupt is IRQ 57 => pending2 bit 25. */
 #define IRQ2_UART_BIT (1u << 25)
 
+/* EMMC (Arasan SDHCI) interrupt is IRQ 62 => pending2 bit 30. */
+#define IRQ2_EMMC_BIT (1u << 30)
+
 #ifndef TICK_HZ
 #define TICK_HZ 100u
 #endif
 
 void irq_init(void) {
     /* Route the architectural timer interrupt to the core's IRQ line. */
-    CORE0_TIMER_IRQ_CTRL |= (1u << 1);
+    CORE_TIMER_IRQ_CTRL(0) |= (1u << 1);
 
     /* Start a periodic tick. */
     time_tick_init(TICK_HZ);
 
-    /* Enable PL011 UART interrupts (RX) so blocked stdin can wake without polling. */
-    ENABLE_IRQS_2 = IRQ2_UART_BIT;
+    /* Enable PL011 UART interrupts (RX) so blocked stdin can wake without polling,
+     * and the SD controller's, which completes its transfers.
+     * GPU peripheral IRQs are routed to core 0 only (the reset default).
+     */
+    ENABLE_IRQS_2 = IRQ2_UART_BIT | IRQ2_EMMC_BIT;
     uart_irq_enable_rx();
 }
 
+void irq_init_secondary(void) {
+    /* Each core has its own (banked) CNTP timer; route it to this core. */
+    CORE_TIMER_IRQ_CTRL(cpu_id()) |= (1u << 1);
+    time_tick_init(TICK_HZ);
+}
+
 void irq_handle(void) {
-    uint32_t src = CORE0_IRQ_SOURCE;
+    uint32_t cpu = cpu_id();
+    uint32_t src = CORE_IRQ_SOURCE(cpu);
     if (src & (1u << 1)) {
         /* AArch64 physical timer IRQ. Acknowledge and (re)arm as needed. */
         time_tick_handle_irq();
 
+        /* Fire expired kernel timers (this reprograms the next deadline). */
+        timer_run();
+
 #if defined(ENABLE_USB_KBD) || defined(ENABLE_USB_NET)
         /* USB devices are polled (QEMU DWC2 model). Poll from the timer IRQ so
          * we keep receiving packets/keys even when no syscall-driven polling is
          * happening.
          */
-        usb_poll();
+        if (cpu == 0) usb_poll();
 #endif
     }
 
-    /* Peripheral IRQs (e.g. UART RX). */
-    if (IRQ_PENDING_2 & IRQ2_UART_BIT) {
-        (void)uart_irq_handle_rx(console_in_inject_char);
+    /* Peripheral IRQs (e.g. UART RX) are only delivered to core 0. */
+    if (cpu == 0) {
+        uint32_t pending2 = IRQ_PENDING_2;
+        if (pending2 & IRQ2_UART_BIT) {
+            (void)uart_irq_handle_rx(console_in_inject_char);
+        }
+        if (pending2 & IRQ2_EMMC_BIT) {
+            sdhci_irq();
+        }
     }
 }
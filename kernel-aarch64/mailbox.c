@@ -1,6 +1,9 @@
 #include "mailbox.h"
 
+#include "cache.h"
+#include "dma.h"
 #include "stddef.h"
+#include "string.h"
 
 #define MBOX_READ   0x00u
 #define MBOX_STATUS 0x18u
@@ -59,6 +62,13 @@ static int mailbox_call(uint32_t channel, uintptr_t msg_phys) {
     }
 }
 
+/* Messages up to this size go through an uncached DMA buffer; larger ones
+ * (or any before dma_init()) are sent in place with cache maintenance.
+ */
+#define MBOX_DMA_BYTES 1024u
+
+static uint32_t *g_mbox_dma;
+
 int mailbox_property_call(uint32_t *msg, uint32_t msg_bytes) {
     if (!msg) return -1;
     if ((msg_bytes & 0xFu) != 0) return -1; /* message size must be 16-byte multiple */
@@ -76,8 +86,23 @@ int mailbox_property_call(uint32_t *msg, uint32_t msg_bytes) {
     msg[0] = msg_bytes;
     msg[1] = 0; /* request */
 
-    if (mailbox_call(MBOX_CH_PROP, (uintptr_t)msg) != 0) {
-        return -1;
+    if (!g_mbox_dma) g_mbox_dma = (uint32_t *)dma_alloc(MBOX_DMA_BYTES);
+
+    if (g_mbox_dma && msg_bytes <= MBOX_DMA_BYTES) {
+        memcpy(g_mbox_dma, msg, msg_bytes);
+        if (mailbox_call(MBOX_CH_PROP, (uintptr_t)g_mbox_dma) != 0) {
+            return -1;
+        }
+        memcpy(msg, g_mbox_dma, msg_bytes);
+    } else {
+        /* The VideoCore reads the request from memory and writes the reply
+         * back there, bypassing our caches.
+         */
+        cache_clean_invalidate_dcache_for_range((uint64_t)(uintptr_t)msg, msg_bytes);
+        if (mailbox_call(MBOX_CH_PROP, (uintptr_t)msg) != 0) {
+            return -1;
+        }
+        cache_invalidate_dcache_for_range((uint64_t)(uintptr_t)msg, msg_bytes);
     }
 
     /* msg[1] bit31 set indicates response; exact semantics handled by callers. */
@@ -2,8 +2,11 @@
 #include "arch.h"
 #include "fdt.h"
 #include "pmm.h"
+#include "slab.h"
 #include "mmu.h"
-#include "cache.h"
+#include "dma.h"
+#include "sdhci.h"
+#include "blk.h"
 #include "initramfs.h"
 #include "time.h"
 #include "fb.h"
@@ -11,6 +14,9 @@
 #include "console_in.h"
 #include "irq.h"
 #include "net.h"
+#include "proc.h"
+#include "sched.h"
+#include "smp.h"
 
 #if defined(ENABLE_USB_KBD) || defined(ENABLE_USB_NET)
 #include "usb.h"
@@ -35,7 +41,8 @@ extern unsigned char __kernel_end[];
 
 static volatile uint64_t g_mmu_test = 0x1122334455667788ull;
 
-extern void enter_el0(uint64_t entry, uint64_t user_sp);
+extern void enter_el0(uint64_t entry, uint64_t user_sp, uint64_t kernel_sp);
+extern unsigned char __stack_top[];
 extern unsigned char user_payload_start[];
 extern unsigned char user_payload_end[];
 
@@ -72,8 +79,11 @@ void kmain(unsigned long dtb_ptr) {
         uint64_t ke = (uint64_t)(unsigned long long)__kernel_end;
 
         pmm_init(info.mem_base, info.mem_size, ks, ke, (uint64_t)dtb_ptr);
+        slab_init();
 
         mmu_init_identity(info.mem_base, info.mem_size);
+        /* Uncached memory for device DMA (USB, mailbox). */
+        (void)dma_init();
 
         /* Enable periodic timer IRQs so the scheduler can truly idle with `wfi`. */
         irq_init();
@@ -83,6 +93,11 @@ void kmain(unsigned long dtb_ptr) {
         usb_init();
     #endif
 
+        /* SD card (QEMU `-sd`) behind the block cache. Needs time+MMU+DMA. */
+        if (sdhci_init() == 0) {
+            (void)blk_init();
+        }
+
     #ifdef DEBUG_IRQ_REGTEST
         uart_write("irq: regtest...\n");
         int irq_ok = irq_regtest();
@@ -132,22 +147,29 @@ void kmain(unsigned long dtb_ptr) {
         uart_write("pmm: selftest done\n");
         pmm_dump();
 
-        uart_write("el0: staging user payload\n");
-        uint64_t blob_sz = (uint64_t)(uintptr_t)(user_payload_end - user_payload_start);
-        volatile unsigned char *dst = (volatile unsigned char *)(uintptr_t)USER_REGION_BASE;
-        for (uint64_t i = 0; i < blob_sz; i++) {
-            dst[i] = user_payload_start[i];
-        }
-        cache_sync_icache_for_range(USER_REGION_BASE, blob_sz);
-
         uint64_t initramfs_sz = (uint64_t)(uintptr_t)(initramfs_end - initramfs_start);
         uart_write("initramfs: embedded size=");
         uart_write_hex_u64(initramfs_sz);
         uart_write("\n");
         initramfs_init(initramfs_start, (size_t)initramfs_sz);
 
-        uart_write("el0: entering\n");
-        enter_el0(USER_REGION_BASE, USER_REGION_BASE + USER_REGION_SIZE - 0x10ull);
+        /* Set up pid 1 with its own kernel stack and address space, staging
+         * the user payload into it; our boot stack becomes core 0's idle
+         * loop once pid 1 first blocks or yields.
+         */
+        uart_write("el0: staging user payload\n");
+        uint64_t blob_sz = (uint64_t)(uintptr_t)(user_payload_end - user_payload_start);
+        uint64_t user_sp = USER_STACK_TOP - 0x10ull;
+        uint64_t kernel_sp = proc_init(user_payload_start, blob_sz, USER_REGION_BASE, user_sp);
+        sched_init_boot_cpu((uint64_t)(uintptr_t)__stack_top);
+
+        /* Release cores 1..3; they idle until pid 1 starts forking work. */
+        smp_init();
+
+        if (kernel_sp != 0) {
+            uart_write("el0: entering\n");
+            enter_el0(USER_REGION_BASE, user_sp, kernel_sp);
+        }
 
         uart_write("el0: returned unexpectedly\n");
     } else {
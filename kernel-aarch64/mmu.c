@@ -2,13 +2,15 @@
 #include "uart_pl011.h"
 #include "pmm.h"
 #include "cache.h"
+#include "smp.h"
 
 /*
  * 4KB granule, 39-bit VA (T0SZ=25) with a single L0 entry.
  * With 4KB granule and T0SZ=25 (39-bit VA), TTBR0/TTBR1 each point to a Level-1 table.
- * We build:
+ * The kernel identity map is
  *   L1 -> L2
- * and use 2MB block mappings at Level-2.
+ * with 2MB block mappings at Level-2; the user window of each process goes
+ * down to Level-3 4KB pages.
  */
 
 #define PAGE_SIZE 4096ull
@@ -25,8 +27,12 @@
 
 #define PTE_TYPE_TABLE  (0b11ull)
 #define PTE_TYPE_BLOCK  (0b01ull)
+#define PTE_TYPE_PAGE   (0b11ull) /* level 3 */
+#define PTE_TYPE_MASK   (0b11ull)
 
 #define PTE_AF      (1ull << 10)
+/* Not global: TLB entries are tagged with the current ASID. */
+#define PTE_NG      (1ull << 11)
 
 /* SH[9:8] */
 #define PTE_SH_SHIFT 8
@@ -38,6 +44,7 @@
 #define PTE_AP_SHIFT 6
 #define PTE_AP_RW_EL1 (0ull << PTE_AP_SHIFT)
 #define PTE_AP_RW_EL0 (1ull << PTE_AP_SHIFT)
+#define PTE_AP_RO     (2ull << PTE_AP_SHIFT) /* AP[2]: read-only at EL1 and EL0 */
 
 /* AttrIndx[4:2] */
 #define PTE_ATTR_SHIFT 2
@@ -46,13 +53,49 @@
 #define PTE_PXN (1ull << 53)
 #define PTE_UXN (1ull << 54)
 
+#define TCR_AS (1ull << 36) /* 16-bit ASIDs */
+#define TTBR_ASID_SHIFT 48
+#define TTBR_BADDR_MASK 0x0000FFFFFFFFFFFEull
+
+#define DESC_ADDR_MASK 0x0000FFFFFFFFF000ull
+
+/* TTBR0 L1 entries of the user window. */
+#define USER_L1_FIRST (USER_REGION_BASE >> 30)
+#define USER_L1_END ((USER_REGION_BASE + USER_REGION_SIZE) >> 30)
+
+/*
+ * ASID allocation (generation scheme, as in Linux).
+ *
+ * A process' ASID value carries the allocator generation above the ASID
+ * bits. A value from an older generation is stale and gets a new ASID on
+ * the next switch (keeping its number when it is still free). When the
+ * ASID space runs out the generation is bumped: every ASID is free again
+ * except the ones loaded on some core, and each core flushes its TLB before
+ * it next loads an ASID. ASID 0 stays with the boot tables.
+ */
+#define ASID_MAX_BITS 16u
+#define ASID_GEN_STEP (1ull << ASID_MAX_BITS)
+#define ASID_GEN_MASK (~(ASID_GEN_STEP - 1ull))
+
+static uint32_t g_asid_bits = 8;
+static uint64_t g_asid_gen = ASID_GEN_STEP;
+static uint32_t g_asid_next = 1;
+static uint8_t g_asid_map[(1u << ASID_MAX_BITS) / 8u];
+
 /* MAIR attribute indices */
 #define ATTR_NORMAL 0
 #define ATTR_DEVICE 1
+#define ATTR_NORMAL_NC 2
 
 static uint64_t *g_l2_template0 = 0;
 static uint64_t *g_l2_template1 = 0;
 
+/* Boot configuration, replayed on secondary cores by mmu_init_secondary(). */
+static uint64_t g_boot_ttbr0 = 0;
+static uint64_t g_boot_ttbr1 = 0;
+static uint64_t g_boot_mair = 0;
+static uint64_t g_boot_tcr = 0;
+
 static inline uint64_t align_down(uint64_t v, uint64_t a);
 static inline uint64_t align_up(uint64_t v, uint64_t a);
 
@@ -104,7 +147,28 @@ static inline void tlbi_vmalle1(void) {
     __asm__ volatile("isb");
 }
 
-int mmu_mark_region_device(uint64_t phys_start, uint64_t size_bytes) {
+/* Invalidate the entries of one page of one ASID on all cores. */
+static inline void tlbi_vae1is(uint64_t asid, uint64_t va) {
+    __asm__ volatile("dsb ishst");
+    __asm__ volatile("tlbi vae1is, %0" :: "r"((asid << TTBR_ASID_SHIFT) | ((va >> 12) & 0xFFFFFFFFFFFull)));
+    __asm__ volatile("dsb ish");
+    __asm__ volatile("isb");
+}
+
+/* Invalidate one ASID's (non-global) entries on all cores. */
+static inline void tlbi_aside1is(uint64_t asid) {
+    __asm__ volatile("dsb ishst");
+    __asm__ volatile("tlbi aside1is, %0" :: "r"(asid << TTBR_ASID_SHIFT));
+    __asm__ volatile("dsb ish");
+    __asm__ volatile("isb");
+}
+
+/* Remap the 2MiB blocks covering a physical range with another memory
+ * type. Break-before-make: each block is unmapped and its TLB entries are
+ * flushed before the new descriptor goes in. Only this core's TLB is
+ * flushed, so this is for boot, before the secondaries run.
+ */
+static int mmu_mark_region(uint64_t phys_start, uint64_t size_bytes, int attr, int is_device) {
     if (!mmu_is_enabled()) {
         return -1;
     }
@@ -118,23 +182,43 @@ int mmu_mark_region_device(uint64_t phys_start, uint64_t size_bytes) {
     /* We only have L2 entries for VA/PA 0..1GiB in 2MiB blocks. */
     uint64_t start = align_down(phys_start, 0x200000ull);
     uint64_t end = align_up(phys_start + size_bytes, 0x200000ull);
-    if (end <= start) {
+    if (end <= start || end / 0x200000ull > TABLE_ENTRIES) {
         return -1;
     }
 
     __asm__ volatile("dsb ish");
     for (uint64_t pa = start; pa < end; pa += 0x200000ull) {
-        uint64_t idx = pa / 0x200000ull;
-        if (idx >= TABLE_ENTRIES) {
-            return -1;
-        }
-        g_l2_template0[idx] = make_block_desc(pa, ATTR_DEVICE, PTE_AP_RW_EL1, /*is_device=*/1);
+        g_l2_template0[pa / 0x200000ull] = 0;
+    }
+    tlbi_vmalle1();
+    for (uint64_t pa = start; pa < end; pa += 0x200000ull) {
+        g_l2_template0[pa / 0x200000ull] = make_block_desc(pa, attr, PTE_AP_RW_EL1, is_device);
     }
-
     tlbi_vmalle1();
     return 0;
 }
 
+int mmu_mark_region_device(uint64_t phys_start, uint64_t size_bytes) {
+    return mmu_mark_region(phys_start, size_bytes, ATTR_DEVICE, /*is_device=*/1);
+}
+
+int mmu_mark_region_uncached(uint64_t phys_start, uint64_t size_bytes) {
+    if (!mmu_is_enabled()) {
+        return -1;
+    }
+    /* No cached copy of the range may outlive the switch: push it out
+     * before, and drop whatever was speculatively refetched meanwhile after.
+     */
+    uint64_t start = align_down(phys_start, 0x200000ull);
+    uint64_t end = align_up(phys_start + size_bytes, 0x200000ull);
+    cache_clean_invalidate_dcache_for_range(start, end - start);
+    int rc = mmu_mark_region(phys_start, size_bytes, ATTR_NORMAL_NC, /*is_device=*/0);
+    if (rc == 0) {
+        cache_clean_invalidate_dcache_for_range(start, end - start);
+    }
+    return rc;
+}
+
 uint64_t mmu_ttbr0_read(void) {
     uint64_t v;
     __asm__ volatile("mrs %0, ttbr0_el1" : "=r"(v));
@@ -146,42 +230,253 @@ void mmu_ttbr0_write(uint64_t ttbr0_pa) {
     tlbi_vmalle1();
 }
 
-uint64_t mmu_ttbr0_create_with_user_pa(uint64_t user_pa_base) {
+static inline uint64_t asid_mask(void) {
+    return (1ull << g_asid_bits) - 1ull;
+}
+
+static inline int asid_test(uint64_t asid) {
+    return (g_asid_map[asid >> 3] >> (asid & 7u)) & 1u;
+}
+
+static inline void asid_set(uint64_t asid) {
+    g_asid_map[asid >> 3] |= (uint8_t)(1u << (asid & 7u));
+}
+
+static inline void asid_clear(uint64_t asid) {
+    g_asid_map[asid >> 3] &= (uint8_t)~(1u << (asid & 7u));
+}
+
+static void asid_rollover(void) {
+    g_asid_gen += ASID_GEN_STEP;
+    for (uint64_t i = 0; i < sizeof(g_asid_map); i++) g_asid_map[i] = 0;
+    asid_set(0);
+
+    /* ASIDs live in some core's TTBR0 (of a running task) stay
+     * taken: the owner keeps its number in the new generation.
+     */
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        uint64_t a = g_cpus[cpu].asid_active;
+        if (a == 0) a = g_cpus[cpu].asid_reserved;
+        if (a != 0) asid_set(a & asid_mask());
+        g_cpus[cpu].asid_reserved = a;
+        g_cpus[cpu].asid_active = 0;
+        g_cpus[cpu].tlb_flush_pending = 1;
+    }
+    g_asid_next = 1;
+}
+
+/* Was `old` kept through a rollover? Then move it to the new generation. */
+static int asid_update_reserved(uint64_t old, uint64_t newa) {
+    int hit = 0;
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        if (g_cpus[cpu].asid_reserved == old) {
+            g_cpus[cpu].asid_reserved = newa;
+            hit = 1;
+        }
+    }
+    return hit;
+}
+
+static uint64_t asid_new(uint64_t old) {
+    uint64_t mask = asid_mask();
+
+    if (old != 0) {
+        uint64_t newa = g_asid_gen | (old & mask);
+        if (asid_update_reserved(old, newa)) return newa;
+        if (!asid_test(old & mask)) {
+            asid_set(old & mask);
+            return newa;
+        }
+    }
+
+    for (int pass = 0; pass < 2; pass++) {
+        for (uint64_t n = 0; n < mask; n++) {
+            uint64_t a = g_asid_next + n;
+            if (a > mask) a -= mask;
+            if (!asid_test(a)) {
+                asid_set(a);
+                g_asid_next = (uint32_t)((a == mask) ? 1u : a + 1u);
+                return g_asid_gen | a;
+            }
+        }
+        asid_rollover();
+    }
+    /* Every ASID is pinned by a core: cannot happen with MAX_CPUS cores. */
+    return g_asid_gen;
+}
+
+void mmu_ttbr0_switch(uint64_t ttbr0_pa, uint64_t *asid) {
+    cpu_t *c = cpu_this();
+
+    if (!asid) {
+        mmu_ttbr0_write(ttbr0_pa);
+        c->asid_active = 0;
+        return;
+    }
+
+    uint64_t a = *asid;
+    if (a == 0 || (a & ASID_GEN_MASK) != g_asid_gen) {
+        a = asid_new(a);
+        *asid = a;
+    }
+
+    c->asid_active = a;
+    write_ttbr0_el1((ttbr0_pa & ~(0xFFFFull << TTBR_ASID_SHIFT)) | ((a & asid_mask()) << TTBR_ASID_SHIFT));
+
+    if (c->tlb_flush_pending) {
+        /* First switch on this core since a rollover. ASID-tagged
+         * (AIVIVT) instruction caches need the same treatment.
+         */
+        c->tlb_flush_pending = 0;
+        tlbi_vmalle1();
+        __asm__ volatile("ic iallu");
+        __asm__ volatile("dsb nsh");
+        __asm__ volatile("isb");
+    }
+}
+
+void mmu_asid_release(uint64_t *asid) {
+    if (!asid) return;
+    uint64_t a = *asid;
+    *asid = 0;
+    if (a == 0 || (a & ASID_GEN_MASK) != g_asid_gen) return;
+
+    /* Still in a core's TTBR0 (a task still running): leave it to the next
+     * rollover.
+     */
+    for (uint32_t cpu = 0; cpu < MAX_CPUS; cpu++) {
+        if (g_cpus[cpu].asid_active == a) return;
+    }
+
+    uint64_t n = a & asid_mask();
+    tlbi_aside1is(n);
+    asid_clear(n);
+}
+
+uint32_t mmu_asid_bits(void) {
+    return g_asid_bits;
+}
+
+void mmu_ttbr0_switch_kernel(void) {
+    cpu_t *c = cpu_this();
+    /* Only global kernel mappings: nothing to flush. */
+    write_ttbr0_el1(g_boot_ttbr0);
+    c->asid_active = 0;
+}
+
+uint64_t mmu_ttbr0_create(void) {
     if (!g_l2_template0) {
         return 0;
     }
-    if ((user_pa_base & 0x1FFFFFull) != 0) {
-        return 0; /* must be 2MiB-aligned (we map a 2MiB block) */
-    }
 
     uint64_t *l1 = alloc_table_page();
-    uint64_t *l2_0 = alloc_table_page();
-    uint64_t *l2_1 = alloc_table_page();
-    if (!l1 || !l2_0 || !l2_1) {
+    if (!l1) {
         return 0;
     }
 
-    /* Clone template L2[0..1GiB). */
-    for (uint64_t i = 0; i < TABLE_ENTRIES; i++) {
-        l2_0[i] = g_l2_template0[i];
+    /* The identity map (and later device remaps) is shared by everyone. */
+    l1[0] = make_table_desc((uint64_t)(uintptr_t)g_l2_template0);
+    l1[1] = make_table_desc((uint64_t)(uintptr_t)g_l2_template1);
+    return (uint64_t)(uintptr_t)l1;
+}
+
+static inline uint64_t *desc_table(uint64_t desc) {
+    /* Identity-mapped for now: VA==PA */
+    return (uint64_t *)(uintptr_t)(desc & DESC_ADDR_MASK);
+}
+
+void mmu_ttbr0_destroy(uint64_t ttbr0_pa) {
+    if (ttbr0_pa == 0) {
+        return;
     }
 
-    /* Clone template L2[1GiB..2GiB). */
-    if (g_l2_template1) {
-        for (uint64_t i = 0; i < TABLE_ENTRIES; i++) {
-            l2_1[i] = g_l2_template1[i];
+    uint64_t *l1 = (uint64_t *)(uintptr_t)(ttbr0_pa & TTBR_BADDR_MASK);
+    for (uint64_t i = USER_L1_FIRST; i < USER_L1_END; i++) {
+        if ((l1[i] & PTE_TYPE_MASK) != PTE_TYPE_TABLE) continue;
+        uint64_t *l2 = desc_table(l1[i]);
+        for (uint64_t j = 0; j < TABLE_ENTRIES; j++) {
+            if ((l2[j] & PTE_TYPE_MASK) == PTE_TYPE_TABLE) {
+                pmm_free_page((uint64_t)(uintptr_t)desc_table(l2[j]));
+            }
         }
+        pmm_free_page((uint64_t)(uintptr_t)l2);
     }
+    pmm_free_page((uint64_t)(uintptr_t)l1);
+}
 
-    /* Override the user block mapping to point at the chosen physical base.
-     * Keep it RW for EL0.
-     */
-    const uint64_t user_idx = (USER_REGION_BASE >> 21) & 0x1FFu;
-    l2_0[user_idx] = make_block_desc(user_pa_base, ATTR_NORMAL, PTE_AP_RW_EL0, 0);
+uint64_t *mmu_user_pte(uint64_t ttbr0_pa, uint64_t va, int alloc) {
+    if (va < USER_REGION_BASE || va - USER_REGION_BASE >= USER_REGION_SIZE) {
+        return 0;
+    }
 
-    l1[0] = make_table_desc((uint64_t)(uintptr_t)l2_0);
-    l1[1] = make_table_desc((uint64_t)(uintptr_t)l2_1);
-    return (uint64_t)(uintptr_t)l1;
+    uint64_t *table = (uint64_t *)(uintptr_t)(ttbr0_pa & TTBR_BADDR_MASK);
+    for (uint32_t shift = 30; shift > 12; shift -= 9) {
+        uint64_t *e = &table[(va >> shift) & (TABLE_ENTRIES - 1ull)];
+        if ((*e & PTE_TYPE_MASK) != PTE_TYPE_TABLE) {
+            if (!alloc) {
+                return 0;
+            }
+            uint64_t *next = alloc_table_page();
+            if (!next) {
+                return 0;
+            }
+            /* The walker must see the zeroed table before the link. */
+            __asm__ volatile("dsb ishst");
+            *e = make_table_desc((uint64_t)(uintptr_t)next);
+        }
+        table = desc_table(*e);
+    }
+    return &table[(va >> 12) & (TABLE_ENTRIES - 1ull)];
+}
+
+uint64_t mmu_user_page_desc(uint64_t pa, uint32_t prot) {
+    uint64_t desc = 0;
+    desc |= (pa & DESC_ADDR_MASK);
+    desc |= PTE_TYPE_PAGE;
+    desc |= PTE_AF;
+    desc |= PTE_NG;
+    desc |= PTE_SH_INNER;
+    desc |= PTE_ATTR(ATTR_NORMAL);
+    desc |= PTE_AP_RW_EL0;
+    if ((prot & MMU_PROT_WRITE) == 0) {
+        desc |= PTE_AP_RO;
+    }
+    /* The kernel never runs user code. */
+    desc |= PTE_PXN;
+    if ((prot & MMU_PROT_EXEC) == 0) {
+        desc |= PTE_UXN;
+    }
+    return desc;
+}
+
+void mmu_user_pte_set(uint64_t *pte, uint64_t desc) {
+    *pte = desc;
+    /* Invalid entries are never cached: publishing the entry is enough. */
+    __asm__ volatile("dsb ishst");
+    __asm__ volatile("isb");
+}
+
+void mmu_user_pte_clear(uint64_t *pte, uint64_t va, uint64_t asid) {
+    *pte = 0;
+    if (asid != 0) {
+        tlbi_vae1is(asid & asid_mask(), va);
+    } else {
+        __asm__ volatile("dsb ishst");
+    }
+}
+
+void mmu_user_pte_update(uint64_t *pte, uint64_t desc, uint64_t va, uint64_t asid) {
+    *pte = desc;
+    if (asid != 0) {
+        tlbi_vae1is(asid & asid_mask(), va);
+    } else {
+        __asm__ volatile("dsb ishst");
+    }
+}
+
+void mmu_asid_flush(uint64_t asid) {
+    if (asid == 0) return;
+    tlbi_aside1is(asid & asid_mask());
 }
 
 static inline uint64_t align_down(uint64_t v, uint64_t a) {
@@ -281,11 +576,7 @@ void mmu_init_identity(uint64_t ram_base, uint64_t ram_size) {
         uint64_t pa = va;
         int is_dev = (va >= PERIPH_BASE && va < PERIPH_END);
         int attr = is_dev ? ATTR_DEVICE : ATTR_NORMAL;
-        uint64_t ap = PTE_AP_RW_EL1;
-        if (!is_dev && va == USER_REGION_BASE) {
-            ap = PTE_AP_RW_EL0;
-        }
-        l2_0[i] = make_block_desc(pa, attr, ap, is_dev);
+        l2_0[i] = make_block_desc(pa, attr, PTE_AP_RW_EL1, is_dev);
     }
 
     /* Map 1GB..2GB in 2MB blocks.
@@ -300,10 +591,11 @@ void mmu_init_identity(uint64_t ram_base, uint64_t ram_size) {
         l2_1[i] = make_block_desc(pa, attr, PTE_AP_RW_EL1, is_dev);
     }
 
-    /* MAIR: Attr0=Normal WBWA, Attr1=Device-nGnRE */
+    /* MAIR: Attr0=Normal WBWA, Attr1=Device-nGnRE, Attr2=Normal non-cacheable */
     uint64_t mair = 0;
     mair |= 0xFFull << 0;  /* normal */
     mair |= 0x04ull << 8;  /* device */
+    mair |= 0x44ull << 16; /* normal, non-cacheable */
     write_mair_el1(mair);
 
     /* Install TTBR0/TTBR1 then configure TCR.
@@ -341,8 +633,23 @@ void mmu_init_identity(uint64_t ram_base, uint64_t ram_size) {
 
     tcr |= (2ull << 32);          /* IPS=0b010: 40-bit physical address size */
 
+    /* ASID size: 16 bits if ID_AA64MMFR0_EL1.ASIDBits says so (A1=0: the
+     * ASID comes from TTBR0).
+     */
+    uint64_t mmfr0;
+    __asm__ volatile("mrs %0, id_aa64mmfr0_el1" : "=r"(mmfr0));
+    if (((mmfr0 >> 4) & 0xFu) == 2u) {
+        tcr |= TCR_AS;
+        g_asid_bits = 16;
+    }
+
     write_tcr_el1(tcr);
 
+    g_boot_ttbr0 = l1_low_pa;
+    g_boot_ttbr1 = l1_high_pa;
+    g_boot_mair = mair;
+    g_boot_tcr = tcr;
+
     uart_write("mmu: enabling\n");
 
     /* Flush TLBs */
@@ -368,3 +675,29 @@ void mmu_init_identity(uint64_t ram_base, uint64_t ram_size) {
     (void)ram_start;
     (void)ram_end;
 }
+
+void mmu_init_secondary(void) {
+    if (g_boot_tcr == 0 || mmu_is_enabled()) {
+        return;
+    }
+
+    write_mair_el1(g_boot_mair);
+    write_ttbr0_el1(g_boot_ttbr0);
+    write_ttbr1_el1(g_boot_ttbr1);
+    write_tcr_el1(g_boot_tcr);
+    tlbi_vmalle1();
+
+    /* Only this core's I-cache needs invalidating. Set/way D-cache
+     * invalidation is not safe here: it would hit the L2 shared with the
+     * cores already running.
+     */
+    __asm__ volatile("ic iallu");
+    __asm__ volatile("dsb nsh");
+    __asm__ volatile("isb");
+
+    uint64_t sctlr = read_sctlr_el1();
+    sctlr |= (1ull << 0);   /* M */
+    sctlr |= (1ull << 2);   /* C */
+    sctlr |= (1ull << 12);  /* I */
+    write_sctlr_el1(sctlr);
+}
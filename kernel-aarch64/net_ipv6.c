@@ -1,11 +1,14 @@
 #include "net_ipv6.h"
 
 #include "errno.h"
+#include "idtab.h"
 #include "net_tcp6.h"
 #include "net_udp6.h"
 #include "proc.h"
+#include "slab.h"
 #include "time.h"
 #include "uart_pl011.h"
+#include "wait.h"
 
 #ifdef ENABLE_IPV6_DEBUG_RX
 #define IPV6_DEBUG_RX 1
@@ -303,26 +306,34 @@ static uint16_t g_ping_ident = 0;
 static uint16_t g_ping_seq = 0;
 static uint8_t g_ping_phase = 0; /* 0 idle, 1 waiting NA, 2 waiting echo */
 static uint8_t g_ping_debug_once = 0;
+static uint64_t g_ping_start_ns = 0;
+/* The in-flight pinger, plus anyone who got EBUSY and waits for the slot. */
+static waitq_t g_ping_wq = WAITQ_INIT;
+
+static void ping_clear(void) {
+    g_ping_inflight = 0;
+    g_ping_proc_idx = -1;
+    g_ping_nif = 0;
+    g_ping_phase = 0;
+    g_ping_start_ns = 0;
+}
 
 static void ping_complete(uint64_t ret, uint64_t rtt_ns) {
     if (!g_ping_inflight || g_ping_proc_idx < 0) return;
     if (g_ping_proc_idx >= (int)MAX_PROCS) return;
 
+    /* Hand the result to the owner, which is still inside its ping6 syscall
+     * (possibly already runnable again after a retry timeout) unless killed.
+     */
     proc_t *p = &g_procs[g_ping_proc_idx];
-    if (!p->pending_ping6) return;
-
-    p->ping6_done = 1;
-    p->ping6_ret = ret;
-    p->ping6_rtt_ns = rtt_ns;
-    p->sleep_deadline_ns = 0;
-    if (p->state == PROC_SLEEPING) {
-        p->state = PROC_RUNNABLE;
+    if (p->state != PROC_UNUSED && p->state != PROC_ZOMBIE) {
+        p->wait.arg[PING6_WAIT_DONE] = 1;
+        p->wait.arg[PING6_WAIT_RET] = ret;
+        p->wait.arg[PING6_WAIT_RTT] = rtt_ns;
     }
 
-    g_ping_inflight = 0;
-    g_ping_proc_idx = -1;
-    g_ping_nif = 0;
-    g_ping_phase = 0;
+    ping_clear();
+    waitq_wake_all(&g_ping_wq);
 }
 
 void net_ipv6_ping6_cancel(int proc_idx) {
@@ -330,10 +341,17 @@ void net_ipv6_ping6_cancel(int proc_idx) {
     if (g_ping_proc_idx < 0 || g_ping_proc_idx >= (int)MAX_PROCS) return;
     if (g_ping_proc_idx != proc_idx) return;
 
-    g_ping_inflight = 0;
-    g_ping_proc_idx = -1;
-    g_ping_nif = 0;
-    g_ping_phase = 0;
+    ping_clear();
+    /* The slot is free again: let EBUSY waiters retry. */
+    waitq_wake_all(&g_ping_wq);
+}
+
+int net_ipv6_ping6_inflight_for(int proc_idx) {
+    return g_ping_inflight && g_ping_proc_idx == proc_idx;
+}
+
+waitq_t *net_ipv6_ping6_waitq(void) {
+    return &g_ping_wq;
 }
 
 /* Forward declarations for helpers used by UDP6 (defined later in this file). */
@@ -357,6 +375,9 @@ typedef struct {
     uint8_t q_tail;
     uint8_t q_count;
     udp6_dgram_t q[8];
+
+    /* Tasks blocked in recvfrom() on this socket. */
+    waitq_t rx_wq;
 } udp6_sock_t;
 
 static udp6_sock_t g_udp6[8];
@@ -406,6 +427,7 @@ void net_udp6_init(void) {
         g_udp6[i].q_head = 0;
         g_udp6[i].q_tail = 0;
         g_udp6[i].q_count = 0;
+        waitq_init(&g_udp6[i].rx_wq);
     }
     g_udp6_ephemeral_next = 49152u;
 }
@@ -429,6 +451,8 @@ void net_udp6_on_desc_decref(uint32_t sock_id) {
         s->q_head = 0;
         s->q_tail = 0;
         s->q_count = 0;
+        /* Let any receiver still parked here fail with EBADF. */
+        waitq_wake_all(&s->rx_wq);
     }
 }
 
@@ -613,16 +637,11 @@ int net_udp6_try_recv(uint32_t sock_id, udp6_dgram_t *out) {
     return 0;
 }
 
-static void udp6_wake_waiters(uint32_t sock_id) {
-    for (int i = 0; i < (int)MAX_PROCS; i++) {
-        proc_t *p = &g_procs[i];
-        if (!p->pending_udp6_recv) continue;
-        if (p->pending_udp6_sock_id != sock_id) continue;
-        if (p->state == PROC_SLEEPING || p->state == PROC_BLOCKED_IO) {
-            p->state = PROC_RUNNABLE;
-            p->sleep_deadline_ns = 0;
-        }
-    }
+waitq_t *net_udp6_rx_waitq(uint32_t sock_id) {
+    if (!udp6_sock_id_ok(sock_id)) return 0;
+    udp6_sock_t *s = &g_udp6[sock_id];
+    if (!s->used) return 0;
+    return &s->rx_wq;
 }
 
 static void udp6_deliver(const uint8_t src_ip[16], uint16_t src_port,
@@ -651,7 +670,8 @@ static void udp6_deliver(const uint8_t src_ip[16], uint16_t src_port,
         s->q_tail = (uint8_t)((s->q_tail + 1u) % (uint8_t)(sizeof(s->q) / sizeof(s->q[0])));
         s->q_count++;
 
-        udp6_wake_waiters(sid);
+        /* One datagram satisfies one receiver. */
+        waitq_wake_one(&s->rx_wq);
     }
 }
 
@@ -971,12 +991,10 @@ static void maybe_kick_ping_after_nd_update(const uint8_t updated_ip[16]) {
     if (nd_lookup_mac(g_ping_nh_ip, mac) != 0) return;
 
     if (g_ping_proc_idx < 0 || g_ping_proc_idx >= (int)MAX_PROCS) return;
-    proc_t *p = &g_procs[g_ping_proc_idx];
-    if (!p->pending_ping6) return;
 
     /* Send echo now. */
     if (send_echo_request(g_ping_nif, g_ping_dst_ip, mac, g_ping_ident, g_ping_seq) == 0) {
-        p->ping6_start_ns = time_now_ns();
+        g_ping_start_ns = time_now_ns();
         g_ping_phase = 2;
     }
 }
@@ -986,10 +1004,8 @@ void net_ipv6_init(void) {
         ((uint8_t *)&g_ipv6_dbg)[i] = 0;
     }
     for (int i = 0; i < ND_CACHE_SIZE; i++) g_nd[i].used = 0;
-    g_ping_inflight = 0;
-    g_ping_proc_idx = -1;
-    g_ping_nif = 0;
-    g_ping_phase = 0;
+    ping_clear();
+    waitq_init(&g_ping_wq);
 
     net_udp6_init();
     net_tcp6_init();
@@ -998,7 +1014,7 @@ void net_ipv6_init(void) {
 /* --- Minimal TCP-over-IPv6 client (Phase 0 for TLS bringup) --- */
 
 enum {
-    TCP6_MAX_CONNS = 8,
+    TCP6_MAX_CONNS = 256,
     TCP6_RX_CAP = 8192,
     TCP6_MSS = 1200,
 };
@@ -1011,7 +1027,6 @@ typedef enum {
 } tcp6_state_t;
 
 typedef struct {
-    uint8_t used;
     uint8_t state;
     uint16_t refs;
 
@@ -1026,15 +1041,20 @@ typedef struct {
     uint32_t irs;
     uint32_t rcv_nxt;
 
-    uint8_t rx[TCP6_RX_CAP];
+    uint8_t *rx; /* TCP6_RX_CAP bytes, kmalloc'ed with the connection */
     uint32_t rx_head;
     uint32_t rx_tail;
     uint32_t rx_count;
 
     uint64_t last_syn_tx_ns;
+
+    /* Tasks blocked in connect()/recv() on this connection. */
+    waitq_t wq;
 } tcp6_conn_t;
 
-static tcp6_conn_t g_tcp6[TCP6_MAX_CONNS];
+/* Connections are slab objects; descriptors refer to them by id. */
+static idtab_t g_tcp6 = IDTAB_INIT(TCP6_MAX_CONNS);
+static kmem_cache_t *g_tcp6_cache;
 static uint16_t g_tcp6_ephemeral = 40000;
 
 typedef struct __attribute__((packed)) {
@@ -1064,9 +1084,10 @@ static uint16_t tcp6_next_ephemeral_port(void) {
         if (p == 0) continue;
 
         int in_use = 0;
-        for (int i = 0; i < (int)(sizeof(g_tcp6) / sizeof(g_tcp6[0])); i++) {
-            if (!g_tcp6[i].used) continue;
-            if (g_tcp6[i].local_port == p) {
+        for (uint32_t i = 0; i < idtab_limit(&g_tcp6); i++) {
+            tcp6_conn_t *c = (tcp6_conn_t *)idtab_get(&g_tcp6, i);
+            if (!c) continue;
+            if (c->local_port == p) {
                 in_use = 1;
                 break;
             }
@@ -1077,30 +1098,12 @@ static uint16_t tcp6_next_ephemeral_port(void) {
 }
 
 static tcp6_conn_t *tcp6_get(uint32_t conn_id) {
-    if (conn_id >= (uint32_t)(sizeof(g_tcp6) / sizeof(g_tcp6[0]))) return 0;
-    tcp6_conn_t *c = &g_tcp6[conn_id];
-    if (!c->used) return 0;
-    return c;
+    return (tcp6_conn_t *)idtab_get(&g_tcp6, conn_id);
 }
 
 void net_tcp6_init(void) {
-    for (uint32_t i = 0; i < (uint32_t)(sizeof(g_tcp6) / sizeof(g_tcp6[0])); i++) {
-        tcp6_conn_t *c = &g_tcp6[i];
-        c->used = 0;
-        c->state = TCP6_CLOSED;
-        c->refs = 0;
-        c->local_port = 0;
-        c->remote_port = 0;
-        for (int k = 0; k < 16; k++) c->remote_ip[k] = 0;
-        c->iss = 0;
-        c->snd_una = 0;
-        c->snd_nxt = 0;
-        c->irs = 0;
-        c->rcv_nxt = 0;
-        c->rx_head = 0;
-        c->rx_tail = 0;
-        c->rx_count = 0;
-        c->last_syn_tx_ns = 0;
+    if (!g_tcp6_cache) {
+        g_tcp6_cache = kmem_cache_create("tcp6_conn", sizeof(tcp6_conn_t), 0, 0);
     }
 }
 
@@ -1116,35 +1119,48 @@ void net_tcp6_on_desc_decref(uint32_t conn_id) {
     if (c->refs == 0) return;
     c->refs--;
     if (c->refs == 0) {
-        c->used = 0;
         c->state = TCP6_CLOSED;
+        waitq_wake_all(&c->wq);
+        idtab_remove(&g_tcp6, conn_id);
+        kfree(c->rx);
+        kmem_cache_free(g_tcp6_cache, c);
     }
 }
 
 int net_tcp6_conn_alloc(uint32_t *out_conn_id) {
     if (!out_conn_id) return -(int)EINVAL;
-    for (uint32_t i = 0; i < (uint32_t)(sizeof(g_tcp6) / sizeof(g_tcp6[0])); i++) {
-        tcp6_conn_t *c = &g_tcp6[i];
-        if (c->used) continue;
-        c->used = 1;
-        c->state = TCP6_CLOSED;
-        c->refs = 1;
-        c->local_port = 0;
-        c->remote_port = 0;
-        for (int k = 0; k < 16; k++) c->remote_ip[k] = 0;
-        c->iss = 0;
-        c->snd_una = 0;
-        c->snd_nxt = 0;
-        c->irs = 0;
-        c->rcv_nxt = 0;
-        c->rx_head = 0;
-        c->rx_tail = 0;
-        c->rx_count = 0;
-        c->last_syn_tx_ns = 0;
-        *out_conn_id = i;
-        return 0;
-    }
-    return -(int)ENOMEM;
+
+    tcp6_conn_t *c = (tcp6_conn_t *)kmem_cache_alloc(g_tcp6_cache);
+    if (!c) return -(int)ENOMEM;
+    c->rx = (uint8_t *)kmalloc(TCP6_RX_CAP);
+    if (!c->rx) {
+        kmem_cache_free(g_tcp6_cache, c);
+        return -(int)ENOMEM;
+    }
+    int id = idtab_alloc(&g_tcp6, c);
+    if (id < 0) {
+        kfree(c->rx);
+        kmem_cache_free(g_tcp6_cache, c);
+        return -(int)ENOMEM;
+    }
+
+    c->state = TCP6_CLOSED;
+    c->refs = 1;
+    c->local_port = 0;
+    c->remote_port = 0;
+    for (int k = 0; k < 16; k++) c->remote_ip[k] = 0;
+    c->iss = 0;
+    c->snd_una = 0;
+    c->snd_nxt = 0;
+    c->irs = 0;
+    c->rcv_nxt = 0;
+    c->rx_head = 0;
+    c->rx_tail = 0;
+    c->rx_count = 0;
+    c->last_syn_tx_ns = 0;
+    waitq_init(&c->wq);
+    *out_conn_id = (uint32_t)id;
+    return 0;
 }
 
 static int tcp6_prepare_l2(netif_t *nif, const uint8_t dst_ip[16], uint8_t nh_ip[16], uint8_t dst_mac[6]) {
@@ -1293,7 +1309,7 @@ int net_tcp6_connect_start(uint32_t conn_id, const uint8_t dst_ip[16], uint16_t
     if (c->state != TCP6_SYN_SENT) return -(int)EINVAL;
 
     uint64_t now = time_now_ns();
-    if (c->last_syn_tx_ns != 0 && now != 0 && now - c->last_syn_tx_ns < 200000000ull) {
+    if (c->last_syn_tx_ns != 0 && now != 0 && now - c->last_syn_tx_ns < TCP6_SYN_RETRY_NS) {
         return 0;
     }
 
@@ -1324,6 +1340,12 @@ int net_tcp6_connect_start(uint32_t conn_id, const uint8_t dst_ip[16], uint16_t
     return rc;
 }
 
+waitq_t *net_tcp6_waitq(uint32_t conn_id) {
+    tcp6_conn_t *c = tcp6_get(conn_id);
+    if (!c) return 0;
+    return &c->wq;
+}
+
 int net_tcp6_is_established(uint32_t conn_id) {
     tcp6_conn_t *c = tcp6_get(conn_id);
     if (!c) return 0;
@@ -1394,9 +1416,9 @@ int net_tcp6_try_recv(uint32_t conn_id, uint8_t *buf, size_t len) {
 }
 
 static tcp6_conn_t *tcp6_find_incoming(const uint8_t src_ip[16], uint16_t src_port, uint16_t dst_port) {
-    for (uint32_t i = 0; i < (uint32_t)(sizeof(g_tcp6) / sizeof(g_tcp6[0])); i++) {
-        tcp6_conn_t *c = &g_tcp6[i];
-        if (!c->used) continue;
+    for (uint32_t i = 0; i < idtab_limit(&g_tcp6); i++) {
+        tcp6_conn_t *c = (tcp6_conn_t *)idtab_get(&g_tcp6, i);
+        if (!c) continue;
         if (c->local_port != dst_port) continue;
         if (c->remote_port != src_port) continue;
         if (!memeq(c->remote_ip, src_ip, 16)) continue;
@@ -1450,6 +1472,7 @@ static void tcp6_input(netif_t *nif, const uint8_t src_mac[6], const ipv6_hdr_t
                 c->rcv_nxt = seq + 1u;
                 c->snd_una = ack;
                 c->state = TCP6_ESTABLISHED;
+                waitq_wake_all(&c->wq);
 
                 uint8_t nh_ip[16];
                 uint8_t dst_mac[6];
@@ -1485,6 +1508,8 @@ static void tcp6_input(netif_t *nif, const uint8_t src_mac[6], const ipv6_hdr_t
         if (seq == c->rcv_nxt) {
             c->rcv_nxt += 1u;
             c->state = TCP6_CLOSE_WAIT;
+            /* Readers see EOF once the queue drains. */
+            waitq_wake_all(&c->wq);
         }
 
         uint8_t nh_ip[16];
@@ -1542,6 +1567,9 @@ static void tcp6_input(netif_t *nif, const uint8_t src_mac[6], const ipv6_hdr_t
     }
     c->rx_count += to_copy;
     c->rcv_nxt += to_copy;
+    if (to_copy != 0) {
+        waitq_wake_all(&c->wq);
+    }
 
     uint8_t nh_ip[16];
     uint8_t dst_mac[6];
@@ -1626,10 +1654,7 @@ int net_ipv6_ping6_start(int proc_idx, netif_t *nif, const uint8_t dst_ip[16], u
     } else {
         int rc = ipv6_select_next_hop(nif, dst_ip, nh_ip);
         if (rc < 0) {
-            g_ping_inflight = 0;
-            g_ping_proc_idx = -1;
-            g_ping_nif = 0;
-            g_ping_phase = 0;
+            ping_clear();
             return rc;
         }
     }
@@ -1657,8 +1682,7 @@ int net_ipv6_ping6_start(int proc_idx, netif_t *nif, const uint8_t dst_ip[16], u
     uint8_t mac[6];
     if (dst_is_mcast) {
         ipv6_multicast_to_eth(dst_ip, mac);
-        proc_t *p = &g_procs[proc_idx];
-        p->ping6_start_ns = time_now_ns();
+        g_ping_start_ns = time_now_ns();
         g_ping_phase = 2;
         g_ipv6_dbg.ping6_start_sent_echo++;
         return send_echo_request(nif, dst_ip, mac, ident, seq);
@@ -1677,8 +1701,7 @@ int net_ipv6_ping6_start(int proc_idx, netif_t *nif, const uint8_t dst_ip[16], u
 
     if (nd_lookup_mac(nh_ip, mac) == 0) {
         /* Next hop known: send echo immediately. */
-        proc_t *p = &g_procs[proc_idx];
-        p->ping6_start_ns = time_now_ns();
+        g_ping_start_ns = time_now_ns();
         g_ping_phase = 2;
         g_ipv6_dbg.ping6_start_sent_echo++;
         return send_echo_request(nif, dst_ip, mac, ident, seq);
@@ -2051,9 +2074,8 @@ void net_ipv6_input(netif_t *nif, const uint8_t src_mac[6], const uint8_t *pkt,
         if (ident != g_ping_ident || seq != g_ping_seq) return;
 
         if (g_ping_proc_idx < 0 || g_ping_proc_idx >= (int)MAX_PROCS) return;
-        proc_t *p = &g_procs[g_ping_proc_idx];
         uint64_t now = time_now_ns();
-        uint64_t start = p->ping6_start_ns;
+        uint64_t start = g_ping_start_ns;
         uint64_t rtt = (start != 0 && now >= start) ? (now - start) : 0;
 
         ping_complete(0, rtt);
@@ -1,152 +1,273 @@
 #include "pipe.h"
 
-/* Keep errno values consistent with exceptions.c. */
-#define EBADF 9
-#define EAGAIN 11
-#define EPIPE 32
-#define ENOMEM 12
+#include "errno.h"
+#include "idtab.h"
+#include "proc.h"
+#include "sched.h"
+#include "slab.h"
+#include "string.h"
+#include "sys_util.h"
+#include "uaccess.h"
+#include "vm.h"
+#include "wait.h"
 
 enum {
-    MAX_PIPES = 16,
-    PIPE_BUF = 1024,
+    MAX_PIPES = 1024,
 };
 
 typedef struct {
-    uint8_t used;
-    uint8_t buf[PIPE_BUF];
+    uint8_t *buf;  /* cap bytes, 0 until first needed */
+    uint32_t cap;  /* power of two */
     uint32_t rpos;
-    uint32_t wpos;
     uint32_t count;
     uint32_t read_refs;
     uint32_t write_refs;
+    /* Reader sleeping on the empty pipe with its buffer in wait.arg[0..1]
+     * (see pipe_read()), -1 if none.
+     */
+    int16_t reader;
+    waitq_t readers; /* waiting for data or EOF */
+    waitq_t writers; /* waiting for space or EPIPE */
 } pipe_t;
 
-static pipe_t g_pipes[MAX_PIPES];
+/* Pipes are slab objects, looked up by id from their file descriptions. */
+static idtab_t g_pipes = IDTAB_INIT(MAX_PIPES);
+static kmem_cache_t *g_pipe_cache;
+
+static inline pipe_t *pipe_get(uint32_t pipe_id) {
+    return (pipe_t *)idtab_get(&g_pipes, pipe_id);
+}
 
 void pipe_init(void) {
-    for (uint32_t i = 0; i < (uint32_t)MAX_PIPES; i++) {
-        g_pipes[i].used = 0;
-        g_pipes[i].rpos = 0;
-        g_pipes[i].wpos = 0;
-        g_pipes[i].count = 0;
-        g_pipes[i].read_refs = 0;
-        g_pipes[i].write_refs = 0;
+    if (!g_pipe_cache) {
+        g_pipe_cache = kmem_cache_create("pipe", sizeof(pipe_t), 0, 0);
     }
 }
 
 int pipe_create(uint32_t *out_pipe_id) {
     if (!out_pipe_id) return -(int)EBADF;
 
-    int pid = -1;
-    for (int i = 0; i < (int)MAX_PIPES; i++) {
-        if (!g_pipes[i].used) {
-            pid = i;
-            break;
-        }
-    }
-    if (pid < 0) return -(int)ENOMEM;
+    pipe_t *pp = (pipe_t *)kmem_cache_alloc(g_pipe_cache);
+    if (!pp) return -(int)ENOMEM;
+    pp->buf = 0;
+    pp->cap = PIPE_DEFAULT_SIZE;
+    pp->rpos = 0;
+    pp->count = 0;
+    pp->read_refs = 0;
+    pp->write_refs = 0;
+    pp->reader = -1;
+    waitq_init(&pp->readers);
+    waitq_init(&pp->writers);
 
-    g_pipes[pid].used = 1;
-    g_pipes[pid].rpos = 0;
-    g_pipes[pid].wpos = 0;
-    g_pipes[pid].count = 0;
-    g_pipes[pid].read_refs = 0;
-    g_pipes[pid].write_refs = 0;
+    int pid = idtab_alloc(&g_pipes, pp);
+    if (pid < 0) {
+        kmem_cache_free(g_pipe_cache, pp);
+        return -(int)ENOMEM;
+    }
 
     *out_pipe_id = (uint32_t)pid;
     return 0;
 }
 
 void pipe_abort(uint32_t pipe_id) {
-    if (pipe_id >= (uint32_t)MAX_PIPES) return;
-    g_pipes[pipe_id].used = 0;
-    g_pipes[pipe_id].rpos = 0;
-    g_pipes[pipe_id].wpos = 0;
-    g_pipes[pipe_id].count = 0;
-    g_pipes[pipe_id].read_refs = 0;
-    g_pipes[pipe_id].write_refs = 0;
+    pipe_t *pp = (pipe_t *)idtab_remove(&g_pipes, pipe_id);
+    if (!pp) return;
+    /* Only tasks being killed can still be queued (everyone else holds a
+     * reference): do not leave them linked to freed memory.
+     */
+    waitq_wake_all(&pp->readers);
+    waitq_wake_all(&pp->writers);
+    if (pp->buf) kfree(pp->buf);
+    kmem_cache_free(g_pipe_cache, pp);
 }
 
 static inline void pipe_maybe_free(uint32_t pipe_id) {
-    if (pipe_id >= (uint32_t)MAX_PIPES) return;
-    pipe_t *pp = &g_pipes[pipe_id];
-    if (!pp->used) return;
+    pipe_t *pp = pipe_get(pipe_id);
+    if (!pp) return;
     if (pp->read_refs == 0 && pp->write_refs == 0) {
-        pp->used = 0;
-        pp->rpos = 0;
-        pp->wpos = 0;
-        pp->count = 0;
+        pipe_abort(pipe_id);
     }
 }
 
 void pipe_on_desc_incref(uint32_t pipe_id, uint32_t end) {
-    if (pipe_id >= (uint32_t)MAX_PIPES) return;
-    pipe_t *pp = &g_pipes[pipe_id];
-    if (!pp->used) return;
+    pipe_t *pp = pipe_get(pipe_id);
+    if (!pp) return;
 
     if (end == PIPE_END_READ) pp->read_refs++;
     else if (end == PIPE_END_WRITE) pp->write_refs++;
 }
 
 void pipe_on_desc_decref(uint32_t pipe_id, uint32_t end) {
-    if (pipe_id >= (uint32_t)MAX_PIPES) return;
-    pipe_t *pp = &g_pipes[pipe_id];
-    if (!pp->used) return;
+    pipe_t *pp = pipe_get(pipe_id);
+    if (!pp) return;
 
+    /* The last reader (writer) gone: writers get EPIPE, readers EOF. */
     if (end == PIPE_END_READ) {
         if (pp->read_refs > 0) pp->read_refs--;
+        if (pp->read_refs == 0) waitq_wake_all(&pp->writers);
     } else if (end == PIPE_END_WRITE) {
         if (pp->write_refs > 0) pp->write_refs--;
+        if (pp->write_refs == 0) waitq_wake_all(&pp->readers);
     }
 
     pipe_maybe_free(pipe_id);
 }
 
-int64_t pipe_read(uint32_t pipe_id, volatile uint8_t *dst, uint64_t len) {
-    if (pipe_id >= (uint32_t)MAX_PIPES) return -(int64_t)EBADF;
-    pipe_t *pp = &g_pipes[pipe_id];
-    if (!pp->used) return -(int64_t)EBADF;
+/* Copy n queued bytes from the ring to the user, in at most two pieces
+ * around the wrap. Returns 0 or -EFAULT; the bytes stay queued either way.
+ */
+static int ring_to_user(const pipe_t *pp, uint64_t dst_user, uint64_t n) {
+    uint64_t first = (uint64_t)(pp->cap - pp->rpos);
+    if (first > n) first = n;
+    if (copy_to_user(dst_user, pp->buf + pp->rpos, first) != 0) return -(int)EFAULT;
+    return copy_to_user(dst_user + first, pp->buf, n - first);
+}
+
+/* Append n user bytes at wpos, likewise. Nothing is queued on -EFAULT. */
+static int ring_from_user(pipe_t *pp, uint32_t wpos, uint64_t src_user, uint64_t n) {
+    uint64_t first = (uint64_t)(pp->cap - wpos);
+    if (first > n) first = n;
+    if (copy_from_user(pp->buf + wpos, src_user, first) != 0) return -(int)EFAULT;
+    return copy_from_user(pp->buf, src_user + first, n - first);
+}
 
+int64_t pipe_read(uint32_t pipe_id, uint64_t dst_user, uint64_t len) {
     if (len == 0) return 0;
-    if (!dst) return -(int64_t)EBADF;
+    if (!dst_user) return -(int64_t)EFAULT;
+
+    proc_t *cur = proc_current();
+    for (;;) {
+        /* Look the pipe up again after sleeping. */
+        pipe_t *pp = pipe_get(pipe_id);
+        if (!pp) return -(int64_t)EBADF;
+        if (pp->reader == proc_idx(cur)) pp->reader = -1;
 
-    if (pp->count == 0) {
+        if (pp->count != 0) {
+            uint64_t n = (len < (uint64_t)pp->count) ? len : (uint64_t)pp->count;
+            uint32_t mask = pp->cap - 1u;
+            if (ring_to_user(pp, dst_user, n) != 0) return -(int64_t)EFAULT;
+            pp->rpos = (uint32_t)((pp->rpos + n) & mask);
+            pp->count -= (uint32_t)n;
+            waitq_wake_all(&pp->writers);
+            return (int64_t)n;
+        }
         if (pp->write_refs == 0) return 0; /* EOF */
-        return -(int64_t)EAGAIN;
-    }
 
-    uint64_t n = (len < (uint64_t)pp->count) ? len : (uint64_t)pp->count;
-    for (uint64_t i = 0; i < n; i++) {
-        dst[i] = pp->buf[pp->rpos];
-        pp->rpos = (pp->rpos + 1u) % PIPE_BUF;
+        /* Empty: sleep, offering our buffer to the next writer. */
+        if (pp->reader < 0) pp->reader = (int16_t)proc_idx(cur);
+        cur->wait.arg[0] = dst_user;
+        cur->wait.arg[1] = len;
+        cur->wait.arg[2] = 0;
+        wait_block(cur, PROC_BLOCKED_IO, &pp->readers, 0);
+        sched_block();
+        if (cur->wait.arg[2] != 0) return (int64_t)cur->wait.arg[2];
     }
-    pp->count -= (uint32_t)n;
-    return (int64_t)n;
 }
 
-int64_t pipe_write(uint32_t pipe_id, const volatile uint8_t *src, uint64_t len) {
-    if (pipe_id >= (uint32_t)MAX_PIPES) return -(int64_t)EBADF;
-    pipe_t *pp = &g_pipes[pipe_id];
-    if (!pp->used) return -(int64_t)EBADF;
+/* Copy from the writer's buffer straight into the sleeping reader's, if
+ * there is one, and wake it. Returns the bytes handed over.
+ */
+static uint64_t pipe_handoff(pipe_t *pp, uint64_t src_user, uint64_t len) {
+    if (pp->reader < 0) return 0;
+    proc_t *r = &g_procs[pp->reader];
+    pp->reader = -1;
+    if (r->state != PROC_BLOCKED_IO || r->wait.q != &pp->readers) return 0;
 
+    uint64_t n = (len < r->wait.arg[1]) ? len : r->wait.arg[1];
+    /* vm_copy_to() reads the source with plain loads, which have no fault
+     * fixup: a bad buffer takes the ring path and fails there.
+     */
+    if (!user_range_ok(src_user, n)) return 0;
+    /* Nor does vm_copy_to() check the VMA permissions: a reader buffer it
+     * may not write takes the ring path too, and gets EFAULT there.
+     */
+    if (!vm_range_prot_ok(&r->vm, r->wait.arg[0], n, MMU_PROT_WRITE)) return 0;
+    if (vm_copy_to(&r->vm, r->wait.arg[0], (const void *)(uintptr_t)src_user, n) != 0) return 0;
+    r->wait.arg[2] = n;
+    proc_set_state(r, PROC_RUNNABLE);
+    return n;
+}
+
+int64_t pipe_write(uint32_t pipe_id, uint64_t src_user, uint64_t len) {
     if (len == 0) return 0;
-    if (!src) return -(int64_t)EBADF;
+    if (!src_user) return -(int64_t)EFAULT;
 
-    if (pp->read_refs == 0) {
-        return -(int64_t)EPIPE;
-    }
+    proc_t *cur = proc_current();
+    uint64_t done = 0;
+    while (done < len) {
+        pipe_t *pp = pipe_get(pipe_id);
+        if (!pp) return -(int64_t)EBADF;
+        if (pp->read_refs == 0) {
+            return done ? (int64_t)done : -(int64_t)EPIPE;
+        }
 
-    if (pp->count == PIPE_BUF) {
-        return -(int64_t)EAGAIN;
+        uint64_t left = len - done;
+        if (pp->count == 0) {
+            uint64_t n = pipe_handoff(pp, src_user + done, left);
+            if (n != 0) {
+                done += n;
+                continue;
+            }
+        }
+
+        /* Up to PIPE_BUF bytes go in at once or not at all (the ring is at
+         * least that big); larger writes may be split.
+         */
+        uint64_t space = (uint64_t)(pp->cap - pp->count);
+        uint64_t need = (left <= PIPE_BUF) ? left : 1u;
+        if (space >= need) {
+            if (!pp->buf) {
+                pp->buf = (uint8_t *)kmalloc(pp->cap);
+                if (!pp->buf) return done ? (int64_t)done : -(int64_t)ENOMEM;
+            }
+            uint64_t n = (left < space) ? left : space;
+            uint32_t mask = pp->cap - 1u;
+            uint32_t wpos = (pp->rpos + pp->count) & mask;
+            if (ring_from_user(pp, wpos, src_user + done, n) != 0) {
+                return done ? (int64_t)done : -(int64_t)EFAULT;
+            }
+            pp->count += (uint32_t)n;
+            done += n;
+            waitq_wake_all(&pp->readers);
+            continue;
+        }
+
+        wait_block(cur, PROC_BLOCKED_IO, &pp->writers, 0);
+        sched_block();
     }
+    return (int64_t)done;
+}
+
+int64_t pipe_get_size(uint32_t pipe_id) {
+    pipe_t *pp = pipe_get(pipe_id);
+    if (!pp) return -(int64_t)EBADF;
+    return (int64_t)pp->cap;
+}
+
+int64_t pipe_set_size(uint32_t pipe_id, uint64_t size) {
+    pipe_t *pp = pipe_get(pipe_id);
+    if (!pp) return -(int64_t)EBADF;
+    if (size > PIPE_MAX_SIZE) return -(int64_t)EPERM;
 
-    uint64_t space = (uint64_t)(PIPE_BUF - pp->count);
-    uint64_t n = (len < space) ? len : space;
+    uint32_t cap = PIPE_DEFAULT_SIZE;
+    while (cap < size) cap <<= 1;
+    if (cap < pp->count) return -(int64_t)EBUSY;
+    if (cap == pp->cap) return (int64_t)cap;
 
-    for (uint64_t i = 0; i < n; i++) {
-        pp->buf[pp->wpos] = src[i];
-        pp->wpos = (pp->wpos + 1u) % PIPE_BUF;
+    /* Move the queued bytes to the front of the new ring. */
+    uint8_t *buf = 0;
+    if (pp->buf) {
+        buf = (uint8_t *)kmalloc(cap);
+        if (!buf) return -(int64_t)ENOMEM;
+        uint32_t first = pp->cap - pp->rpos;
+        if (first > pp->count) first = pp->count;
+        memcpy(buf, pp->buf + pp->rpos, first);
+        memcpy(buf + first, pp->buf, pp->count - first);
+        kfree(pp->buf);
     }
-    pp->count += (uint32_t)n;
-    return (int64_t)n;
+    pp->buf = buf;
+    pp->cap = cap;
+    pp->rpos = 0;
+    waitq_wake_all(&pp->writers);
+    return (int64_t)cap;
 }
@@ -3,27 +3,59 @@
 
 #define PMM_PAGE_SIZE 4096ull
 
-/* Phase 3: reserve a coarse 2MiB EL0 user sandbox region (identity-mapped). */
-#define USER_REGION_BASE 0x00400000ull
-#define USER_REGION_SIZE 0x00200000ull
-
 /*
- * Simple bitmap PMM.
+ * Buddy PMM.
+ *
+ * - Manages a contiguous RAM range [base, base+size), 4KiB pages
+ * - Free memory is kept as naturally aligned blocks of 2^order pages,
+ *   order 0 (4KiB) to PMM_MAX_ORDER (2MiB), one free list per order
+ * - Allocation splits the smallest large-enough block; free merges a block
+ *   with its buddy as long as the buddy is free too. Both are O(orders).
+ *
+ * Free lists are linked through the free pages themselves (RAM is identity
+ * mapped). Per order, a bitmap marks which block heads are free so a buddy
+ * can be checked without touching its memory.
  *
- * - Manages a contiguous RAM range [base, base+size)
- * - 4KiB pages
- * - 1 bit per page: 0=free, 1=used
+ * The per-page metadata array (pmm_page_t) is carved out of the top of RAM
+ * at init.
  *
  * For now this assumes a single RAM range (sufficient for QEMU raspi3b).
  */
 
 /* Clamp to ~1GiB worth of pages for now (enough for raspi3b QEMU). */
 #define PMM_MAX_PAGES  (262144ull) /* 262144 * 4096 = 1 GiB */
-#define PMM_BITMAP_BYTES (PMM_MAX_PAGES / 8ull)
 
-static uint8_t g_bitmap[PMM_BITMAP_BYTES];
+/* Order k has PMM_MAX_PAGES >> k block heads; all orders need < 2 bits/page. */
+#define PMM_MAP_BITS (2ull * PMM_MAX_PAGES)
+#define PMM_BOOT_RESERVED_MAX 8
+
+/* Free list node, stored at the start of each free block. */
+typedef struct {
+    uint64_t next;
+    uint64_t prev;
+} pmm_free_node_t;
+
+static uint8_t g_free_map[PMM_MAP_BITS / 8ull];
+static uint64_t g_map_off[PMM_ORDERS];
+/* List heads (physical addresses; 0 = empty). Page 0 is never free: the
+ * low 2MiB of RAM stay reserved.
+ */
+static uint64_t g_free_head[PMM_ORDERS];
 static pmm_info_t g_info;
 
+/* Blocks are aligned relative to the 2MiB-aligned origin at or below base, so
+ * that order-9 blocks are 2MiB aligned physically.
+ */
+static uint64_t g_origin;
+static uint64_t g_npages; /* pages from g_origin to the end of RAM */
+static pmm_page_t *g_pages;
+
+static struct {
+    uint64_t start;
+    uint64_t end;
+} g_boot_reserved[PMM_BOOT_RESERVED_MAX];
+static uint32_t g_boot_reserved_count;
+
 static inline uint64_t align_up_u64(uint64_t v, uint64_t a) {
     return (v + (a - 1)) & ~(a - 1);
 }
@@ -32,40 +64,201 @@ static inline uint64_t align_down_u64(uint64_t v, uint64_t a) {
     return v & ~(a - 1);
 }
 
-static inline void bit_set(uint64_t idx) {
-    g_bitmap[idx >> 3] |= (uint8_t)(1u << (idx & 7));
+static inline uint64_t idx_to_pa(uint64_t idx) {
+    return g_origin + idx * PMM_PAGE_SIZE;
 }
 
-static inline void bit_clear(uint64_t idx) {
-    g_bitmap[idx >> 3] &= (uint8_t)~(1u << (idx & 7));
+static inline pmm_free_node_t *idx_node(uint64_t idx) {
+    return (pmm_free_node_t *)(uintptr_t)idx_to_pa(idx);
 }
 
-static inline int bit_test(uint64_t idx) {
-    return (g_bitmap[idx >> 3] >> (idx & 7)) & 1u;
+static inline int map_test(uint32_t order, uint64_t idx) {
+    uint64_t bit = g_map_off[order] + (idx >> order);
+    return (g_free_map[bit >> 3] >> (bit & 7)) & 1u;
 }
 
-static void bitmap_clear_all(uint64_t total_pages) {
-    uint64_t bytes = (total_pages + 7) / 8;
-    if (bytes > PMM_BITMAP_BYTES) {
-        bytes = PMM_BITMAP_BYTES;
+static inline void map_set(uint32_t order, uint64_t idx) {
+    uint64_t bit = g_map_off[order] + (idx >> order);
+    g_free_map[bit >> 3] |= (uint8_t)(1u << (bit & 7));
+}
+
+static inline void map_clear(uint32_t order, uint64_t idx) {
+    uint64_t bit = g_map_off[order] + (idx >> order);
+    g_free_map[bit >> 3] &= (uint8_t)~(1u << (bit & 7));
+}
+
+static void free_list_push(uint32_t order, uint64_t idx) {
+    uint64_t pa = idx_to_pa(idx);
+    pmm_free_node_t *n = idx_node(idx);
+    n->next = g_free_head[order];
+    n->prev = 0;
+    if (n->next) {
+        ((pmm_free_node_t *)(uintptr_t)n->next)->prev = pa;
     }
-    for (uint64_t i = 0; i < bytes; i++) {
-        g_bitmap[i] = 0;
+    g_free_head[order] = pa;
+    map_set(order, idx);
+    g_info.free_blocks[order]++;
+}
+
+static void free_list_remove(uint32_t order, uint64_t idx) {
+    pmm_free_node_t *n = idx_node(idx);
+    if (n->prev) {
+        ((pmm_free_node_t *)(uintptr_t)n->prev)->next = n->next;
+    } else {
+        g_free_head[order] = n->next;
+    }
+    if (n->next) {
+        ((pmm_free_node_t *)(uintptr_t)n->next)->prev = n->prev;
     }
+    map_clear(order, idx);
+    g_info.free_blocks[order]--;
+}
+
+static inline uint64_t pa_to_idx(uint64_t pa) {
+    return (pa - g_origin) / PMM_PAGE_SIZE;
 }
 
-static void bitmap_set_all(uint64_t total_pages) {
-    uint64_t bytes = (total_pages + 7) / 8;
-    if (bytes > PMM_BITMAP_BYTES) {
-        bytes = PMM_BITMAP_BYTES;
+/* Is the block of 2^order pages at idx inside the managed range? */
+static inline int block_in_range(uint32_t order, uint64_t idx) {
+    uint64_t first = pa_to_idx(g_info.base);
+    return idx >= first && idx + (1ull << order) <= g_npages;
+}
+
+static uint64_t alloc_order(uint32_t order) {
+    uint32_t k = order;
+    while (k <= PMM_MAX_ORDER && g_free_head[k] == 0) {
+        k++;
     }
-    for (uint64_t i = 0; i < bytes; i++) {
-        g_bitmap[i] = 0xFF;
+    if (k > PMM_MAX_ORDER) {
+        return 0;
     }
+
+    uint64_t idx = pa_to_idx(g_free_head[k]);
+    free_list_remove(k, idx);
+
+    /* Split: keep the lower half, hand the upper halves back. */
+    while (k > order) {
+        k--;
+        free_list_push(k, idx + (1ull << k));
+    }
+
+    g_info.free_pages -= 1ull << order;
+    return idx_to_pa(idx);
 }
 
-static void reserve_range(uint64_t start, uint64_t end) {
-    if (end <= start) {
+static void free_order(uint64_t idx, uint32_t order) {
+    g_info.free_pages += 1ull << order;
+
+    while (order < PMM_MAX_ORDER) {
+        uint64_t buddy = idx ^ (1ull << order);
+        if (!block_in_range(order, buddy) || !map_test(order, buddy)) {
+            break;
+        }
+        free_list_remove(order, buddy);
+        if (buddy < idx) idx = buddy;
+        order++;
+    }
+    free_list_push(order, idx);
+}
+
+/* Validate pa as the start of an allocated 2^order block; returns its index or ~0. */
+static uint64_t check_free_arg(uint64_t pa, uint32_t order) {
+    if (g_info.total_pages == 0 || order > PMM_MAX_ORDER) {
+        return ~0ull;
+    }
+    if (pa < g_info.base || pa >= (g_info.base + g_info.size)) {
+        return ~0ull;
+    }
+    if ((pa & (PMM_PAGE_SIZE - 1)) != 0) {
+        return ~0ull;
+    }
+    uint64_t idx = pa_to_idx(pa);
+    if ((idx & ((1ull << order) - 1ull)) != 0 || !block_in_range(order, idx)) {
+        return ~0ull;
+    }
+    /* Cheap double-free check: the block (or one containing it) is free. */
+    for (uint32_t k = order; k <= PMM_MAX_ORDER; k++) {
+        if (map_test(k, align_down_u64(idx, 1ull << k))) {
+            return ~0ull;
+        }
+    }
+    return idx;
+}
+
+/* Take one page out of whichever free block contains it (post-init reserve). */
+static void carve_page(uint64_t idx) {
+    for (uint32_t k = 0; k <= PMM_MAX_ORDER; k++) {
+        uint64_t head = align_down_u64(idx, 1ull << k);
+        if (!map_test(k, head)) {
+            continue;
+        }
+
+        free_list_remove(k, head);
+        /* Split down to the page, returning the halves it is not in. */
+        while (k > 0) {
+            k--;
+            uint64_t half = 1ull << k;
+            if (idx >= head + half) {
+                free_list_push(k, head);
+                head += half;
+            } else {
+                free_list_push(k, head + half);
+            }
+        }
+        g_info.free_pages--;
+        return;
+    }
+    /* Not free: already allocated or reserved. */
+}
+
+static void boot_reserve(uint64_t start, uint64_t end) {
+    if (end <= start || g_boot_reserved_count >= PMM_BOOT_RESERVED_MAX) {
+        return;
+    }
+    g_boot_reserved[g_boot_reserved_count].start = align_down_u64(start, PMM_PAGE_SIZE);
+    g_boot_reserved[g_boot_reserved_count].end = align_up_u64(end, PMM_PAGE_SIZE);
+    g_boot_reserved_count++;
+}
+
+static int boot_reserved_overlaps(uint64_t start, uint64_t end) {
+    for (uint32_t i = 0; i < g_boot_reserved_count; i++) {
+        if (start < g_boot_reserved[i].end && g_boot_reserved[i].start < end) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Place the page metadata array: the highest page-aligned range below end
+ * that avoids the boot reservations. Returns its base, 0 if none fits.
+ */
+static uint64_t place_page_array(uint64_t base, uint64_t end, uint64_t bytes) {
+    uint64_t top = end;
+    while (top >= base + bytes) {
+        uint64_t start = align_down_u64(top - bytes, PMM_PAGE_SIZE);
+        if (start < base) break;
+        int moved = 0;
+        for (uint32_t i = 0; i < g_boot_reserved_count; i++) {
+            if (start < g_boot_reserved[i].end && g_boot_reserved[i].start < top) {
+                top = g_boot_reserved[i].start;
+                moved = 1;
+                break;
+            }
+        }
+        if (!moved) return start;
+    }
+    return 0;
+}
+
+pmm_page_t *pmm_page(uint64_t pa) {
+    if (!g_pages || pa < g_info.base || pa >= g_info.base + g_info.size) {
+        return 0;
+    }
+    return &g_pages[pa_to_idx(pa)];
+}
+
+void pmm_reserve_range(uint64_t start, uint64_t end) {
+    if (g_info.total_pages == 0 || end <= start) {
         return;
     }
 
@@ -79,34 +272,25 @@ static void reserve_range(uint64_t start, uint64_t end) {
 
     uint64_t s = align_down_u64(start, PMM_PAGE_SIZE);
     uint64_t e = align_up_u64(end, PMM_PAGE_SIZE);
-
     for (uint64_t pa = s; pa < e; pa += PMM_PAGE_SIZE) {
-        uint64_t idx = (pa - base) / PMM_PAGE_SIZE;
-        if (idx >= g_info.total_pages) {
-            break;
-        }
-        if (!bit_test(idx)) {
-            bit_set(idx);
-            if (g_info.free_pages > 0) {
-                g_info.free_pages--;
-            }
-        }
+        carve_page(pa_to_idx(pa));
     }
 }
 
-void pmm_reserve_range(uint64_t start, uint64_t end) {
-    if (g_info.total_pages == 0) {
-        return;
+static void pmm_reset(void) {
+    g_info = (pmm_info_t){0};
+    g_pages = 0;
+    for (uint32_t k = 0; k < PMM_ORDERS; k++) {
+        g_free_head[k] = 0;
     }
-    reserve_range(start, end);
 }
 
 void pmm_init(uint64_t mem_base, uint64_t mem_size, uint64_t kernel_start, uint64_t kernel_end, uint64_t dtb_ptr) {
+    pmm_reset();
+
     /* Basic sanity */
     if (mem_size < PMM_PAGE_SIZE * 16) {
         uart_write("pmm: mem too small\n");
-        bitmap_set_all(PMM_MAX_PAGES);
-        g_info = (pmm_info_t){0};
         return;
     }
 
@@ -114,133 +298,195 @@ void pmm_init(uint64_t mem_base, uint64_t mem_size, uint64_t kernel_start, uint6
     uint64_t end = align_down_u64(mem_base + mem_size, PMM_PAGE_SIZE);
     if (end <= base) {
         uart_write("pmm: bad mem range\n");
-        bitmap_set_all(PMM_MAX_PAGES);
-        g_info = (pmm_info_t){0};
         return;
     }
 
-    uint64_t total_pages = (end - base) / PMM_PAGE_SIZE;
-    if (total_pages > PMM_MAX_PAGES) {
-        total_pages = PMM_MAX_PAGES;
-        end = base + total_pages * PMM_PAGE_SIZE;
+    g_origin = align_down_u64(base, PMM_PAGE_SIZE << PMM_MAX_ORDER);
+    if ((end - g_origin) / PMM_PAGE_SIZE > PMM_MAX_PAGES) {
+        end = g_origin + PMM_MAX_PAGES * PMM_PAGE_SIZE;
     }
+    g_npages = (end - g_origin) / PMM_PAGE_SIZE;
 
-    g_info = (pmm_info_t){
-        .base = base,
-        .size = end - base,
-        .page_size = PMM_PAGE_SIZE,
-        .total_pages = total_pages,
-        .free_pages = total_pages,
-    };
+    uint64_t off = 0;
+    for (uint32_t k = 0; k < PMM_ORDERS; k++) {
+        g_map_off[k] = off;
+        off += (g_npages >> k) + 1u;
+    }
+    for (uint64_t i = 0; i < (off + 7u) / 8u && i < sizeof(g_free_map); i++) {
+        g_free_map[i] = 0;
+    }
 
-    bitmap_clear_all(total_pages);
+    g_info.base = base;
+    g_info.size = end - base;
+    g_info.page_size = PMM_PAGE_SIZE;
+    g_info.total_pages = (end - base) / PMM_PAGE_SIZE;
+    g_info.free_pages = 0;
+
+    g_boot_reserved_count = 0;
 
     /* Reserve low memory conservatively (vectors/firmware/whatever). */
-    reserve_range(base, base + 0x200000ull); /* 2 MiB */
+    boot_reserve(base, base + 0x200000ull); /* 2 MiB */
 
     /* Reserve the kernel image range. */
-    reserve_range(kernel_start, kernel_end);
+    boot_reserve(kernel_start, kernel_end);
 
     /* Reserve DTB blob region conservatively (64 KiB) around pointer. */
     if (dtb_ptr != 0) {
-        reserve_range(dtb_ptr, dtb_ptr + 0x10000ull);
+        boot_reserve(dtb_ptr, dtb_ptr + 0x10000ull);
     }
 
-    /* Reserve a user region for EL0 bring-up. */
-    reserve_range(USER_REGION_BASE, USER_REGION_BASE + USER_REGION_SIZE);
-
-    uart_write("pmm: initialized\n");
-    pmm_dump();
-}
-
-uint64_t pmm_alloc_2mib_aligned(void) {
-    /* 2MiB = 512 * 4KiB pages. Require 2MiB alignment. */
-    const uint64_t pages = 512ull;
-    if (g_info.free_pages < pages || g_info.total_pages == 0) {
-        return 0;
+    /* Page metadata, indexed from the origin like the free maps. */
+    uint64_t meta_bytes = g_npages * (uint64_t)sizeof(pmm_page_t);
+    uint64_t meta = place_page_array(base, end, meta_bytes);
+    if (meta == 0) {
+        uart_write("pmm: no room for page metadata\n");
+        pmm_reset();
+        return;
+    }
+    boot_reserve(meta, meta + meta_bytes);
+    g_pages = (pmm_page_t *)(uintptr_t)meta;
+    for (uint64_t i = 0; i < g_npages; i++) {
+        g_pages[i].slab = 0;
+        g_pages[i].flags = 0;
+        g_pages[i].order = 0;
+        g_pages[i].refs = 0;
     }
 
-    for (uint64_t start = 0; start + pages <= g_info.total_pages; ) {
-        /* Align candidate start index to 2MiB boundary in page units. */
-        uint64_t aligned = (start + (pages - 1)) & ~(pages - 1);
-        start = aligned;
-
-        if (start + pages > g_info.total_pages) {
-            break;
-        }
-
-        int ok = 1;
-        for (uint64_t i = 0; i < pages; i++) {
-            if (bit_test(start + i)) {
-                ok = 0;
+    /* Hand out everything else as the largest aligned blocks that fit. */
+    uint64_t idx = pa_to_idx(base);
+    while (idx < g_npages) {
+        uint32_t k = PMM_MAX_ORDER;
+        for (;;) {
+            uint64_t n = 1ull << k;
+            if ((idx & (n - 1u)) == 0 && idx + n <= g_npages &&
+                !boot_reserved_overlaps(idx_to_pa(idx), idx_to_pa(idx + n))) {
                 break;
             }
+            if (k == 0) break;
+            k--;
         }
 
-        if (ok) {
-            for (uint64_t i = 0; i < pages; i++) {
-                bit_set(start + i);
-            }
-            g_info.free_pages -= pages;
-            return g_info.base + start * PMM_PAGE_SIZE;
+        if (k == 0 && boot_reserved_overlaps(idx_to_pa(idx), idx_to_pa(idx + 1u))) {
+            idx++;
+            continue;
         }
-
-        /* Advance to next 2MiB boundary. */
-        start += pages;
+        free_order(idx, k);
+        idx += 1ull << k;
     }
 
-    return 0;
+    uart_write("pmm: initialized\n");
+    pmm_dump();
+}
+
+uint64_t pmm_alloc_2mib_aligned(void) {
+    /* 2MiB = one order-9 block; buddy blocks are naturally aligned. */
+    if (g_info.total_pages == 0) {
+        return 0;
+    }
+    return alloc_order(PMM_MAX_ORDER);
 }
 
 void pmm_free_2mib_aligned(uint64_t pa_base) {
     if (pa_base == 0) {
         return;
     }
-    if ((pa_base & 0x1FFFFFull) != 0) {
+    uint64_t idx = check_free_arg(pa_base, PMM_MAX_ORDER);
+    if (idx == ~0ull) {
         return;
     }
+    free_order(idx, PMM_MAX_ORDER);
+}
 
-    for (uint64_t i = 0; i < 512ull; i++) {
-        pmm_free_page(pa_base + i * PMM_PAGE_SIZE);
+static uint32_t order_for_pages(uint64_t n) {
+    uint32_t k = 0;
+    while ((1ull << k) < n) {
+        k++;
     }
+    return k;
 }
 
-uint64_t pmm_alloc_page(void) {
-    if (g_info.free_pages == 0 || g_info.total_pages == 0) {
+uint64_t pmm_alloc_pages(uint64_t n) {
+    if (n == 0 || g_info.total_pages == 0) {
+        return 0;
+    }
+    uint32_t order = order_for_pages(n);
+    if (order > PMM_MAX_ORDER) {
         return 0;
     }
 
-    for (uint64_t idx = 0; idx < g_info.total_pages; idx++) {
-        if (!bit_test(idx)) {
-            bit_set(idx);
-            g_info.free_pages--;
-            return g_info.base + idx * PMM_PAGE_SIZE;
-        }
+    uint64_t pa = alloc_order(order);
+    if (pa == 0) {
+        return 0;
     }
 
-    return 0;
+    /* Give back the tail beyond n pages (it re-merges on its own). */
+    uint64_t idx = pa_to_idx(pa);
+    for (uint64_t i = n; i < (1ull << order); i++) {
+        free_order(idx + i, 0);
+    }
+    return pa;
 }
 
-void pmm_free_page(uint64_t pa) {
-    if (g_info.total_pages == 0) {
+void pmm_free_pages(uint64_t pa, uint64_t n) {
+    if (check_free_arg(pa, 0) == ~0ull) {
         return;
     }
-    if (pa < g_info.base || pa >= (g_info.base + g_info.size)) {
-        return;
+
+    /* Free as the largest aligned blocks that fit (the tail of a rounded-up
+     * allocation was already given back by pmm_alloc_pages()).
+     */
+    uint64_t idx = pa_to_idx(pa);
+    while (n > 0) {
+        uint32_t k = 0;
+        while (k < PMM_MAX_ORDER && (idx & ((2ull << k) - 1ull)) == 0 && (2ull << k) <= n) {
+            k++;
+        }
+        if (check_free_arg(idx_to_pa(idx), k) != ~0ull) {
+            free_order(idx, k);
+        }
+        idx += 1ull << k;
+        n -= 1ull << k;
     }
-    if ((pa & (PMM_PAGE_SIZE - 1)) != 0) {
-        return;
+}
+
+uint64_t pmm_alloc_page(void) {
+    if (g_info.total_pages == 0) {
+        return 0;
     }
+    uint64_t pa = alloc_order(0);
+    if (pa != 0) {
+        g_pages[pa_to_idx(pa)].refs = 1;
+    }
+    return pa;
+}
 
-    uint64_t idx = (pa - g_info.base) / PMM_PAGE_SIZE;
-    if (idx >= g_info.total_pages) {
+void pmm_free_page(uint64_t pa) {
+    uint64_t idx = check_free_arg(pa, 0);
+    if (idx == ~0ull) {
         return;
     }
+    g_pages[idx].refs = 0;
+    free_order(idx, 0);
+}
 
-    if (bit_test(idx)) {
-        bit_clear(idx);
-        g_info.free_pages++;
+void pmm_page_get(uint64_t pa) {
+    pmm_page_t *pg = pmm_page(pa);
+    if (pg) pg->refs++;
+}
+
+void pmm_page_put(uint64_t pa) {
+    pmm_page_t *pg = pmm_page(pa);
+    if (!pg) return;
+    if (pg->refs > 1) {
+        pg->refs--;
+        return;
     }
+    pmm_free_page(pa);
+}
+
+uint32_t pmm_page_refs(uint64_t pa) {
+    pmm_page_t *pg = pmm_page(pa);
+    return pg ? pg->refs : 0;
 }
 
 pmm_info_t pmm_info(void) {
@@ -257,4 +503,11 @@ void pmm_dump(void) {
     uart_write(" free=");
     uart_write_hex_u64(g_info.free_pages);
     uart_write("\n");
+
+    uart_write("pmm: free blocks by order:");
+    for (uint32_t k = 0; k < PMM_ORDERS; k++) {
+        uart_write(" ");
+        uart_write_hex_u64(g_info.free_blocks[k]);
+    }
+    uart_write("\n");
 }
@@ -2,15 +2,248 @@
 
 #include "mmu.h"
 #include "pipe.h"
+#include "pmm.h"
+#include "smp.h"
+#include "time.h"
+#include "timer.h"
 #include "vfs.h"
+#include "vm.h"
+#include "wait.h"
 
 uint64_t g_next_pid = 1;
 proc_t g_procs[MAX_PROCS];
-int g_cur_proc = 0;
-int g_last_sched = 0;
 
 static int g_proc_inited = 0;
 
+/* pid 1's flat payload image (code, data and bss). */
+#define PROC_INIT_IMAGE_SIZE 0x200000ull
+
+/* Doubly-linked lists threaded through proc_t.q_prev/q_next: one per state,
+ * except PROC_RUNNABLE which has one run queue per core (proc_t.rq_cpu).
+ */
+enum {
+    PROC_LIST_RUNQ0 = PROC_STATE_COUNT,
+    PROC_LIST_COUNT = PROC_STATE_COUNT + MAX_CPUS,
+};
+
+static int16_t g_list_head[PROC_LIST_COUNT];
+static int16_t g_list_tail[PROC_LIST_COUNT];
+static uint32_t g_list_count[PROC_LIST_COUNT];
+static uint32_t g_state_count[PROC_STATE_COUNT];
+
+static int16_t g_pid_hash[PROC_PID_HASH_SIZE];
+
+static inline uint32_t pid_hash(uint64_t pid) {
+    return (uint32_t)(pid & (uint64_t)(PROC_PID_HASH_SIZE - 1));
+}
+
+static inline int proc_list_id(const proc_t *p) {
+    if (p->state == PROC_RUNNABLE) return PROC_LIST_RUNQ0 + (int)p->rq_cpu;
+    return (int)p->state;
+}
+
+static void list_remove(int idx) {
+    proc_t *p = &g_procs[idx];
+    int l = proc_list_id(p);
+
+    if (p->q_prev >= 0) g_procs[p->q_prev].q_next = p->q_next;
+    else g_list_head[l] = p->q_next;
+    if (p->q_next >= 0) g_procs[p->q_next].q_prev = p->q_prev;
+    else g_list_tail[l] = p->q_prev;
+
+    p->q_prev = -1;
+    p->q_next = -1;
+    g_list_count[l]--;
+    g_state_count[p->state]--;
+}
+
+/* Append at the tail: every list is FIFO. */
+static void list_insert(int idx) {
+    proc_t *p = &g_procs[idx];
+    int l = proc_list_id(p);
+
+    p->q_prev = g_list_tail[l];
+    p->q_next = -1;
+    if (p->q_prev >= 0) g_procs[p->q_prev].q_next = (int16_t)idx;
+    else g_list_head[l] = (int16_t)idx;
+    g_list_tail[l] = (int16_t)idx;
+
+    g_list_count[l]++;
+    g_state_count[p->state]++;
+}
+
+static void proc_sleep_timer_fn(ktimer_t *t, void *arg) {
+    (void)t;
+    proc_t *p = (proc_t *)arg;
+    /* The sleeping syscall sees the timeout via wait_timed_out(). */
+    if (proc_state_is_blocked(p->state)) {
+        proc_set_state(p, PROC_RUNNABLE);
+    }
+}
+
+static void proc_tables_init(void) {
+    for (int l = 0; l < (int)PROC_LIST_COUNT; l++) {
+        g_list_head[l] = -1;
+        g_list_tail[l] = -1;
+        g_list_count[l] = 0;
+    }
+    for (int st = 0; st < (int)PROC_STATE_COUNT; st++) {
+        g_state_count[st] = 0;
+    }
+    for (int i = 0; i < (int)PROC_PID_HASH_SIZE; i++) {
+        g_pid_hash[i] = -1;
+    }
+    for (int i = 0; i < (int)MAX_PROCS; i++) {
+        proc_t *p = &g_procs[i];
+        p->pid = 0;
+        p->state = PROC_UNUSED;
+        p->rq_cpu = 0;
+        p->on_cpu = -1;
+        p->hash_next = -1;
+        p->parent_idx = -1;
+        p->child_head = -1;
+        p->sib_prev = -1;
+        p->sib_next = -1;
+        p->wait.q = 0;
+        p->wait.prev = -1;
+        p->wait.next = -1;
+        p->kstack_base = 0;
+        p->tf = 0;
+        waitq_init(&p->child_wq);
+        timer_init(&p->sleep_timer, proc_sleep_timer_fn, p);
+        list_insert(i);
+    }
+}
+
+int proc_is_inited(void) {
+    return g_proc_inited;
+}
+
+void proc_set_state(proc_t *p, proc_state_t state) {
+    if (p->state == state) return;
+    int idx = proc_idx(p);
+    list_remove(idx);
+    if (proc_state_is_blocked(p->state)) {
+        /* Woken (data arrived, timed out, killed, ...): the deadline is moot
+         * and the task must not be woken through its wait queue again.
+         */
+        timer_cancel(&p->sleep_timer);
+        wait_dequeue(p);
+    }
+    if (p->state == PROC_UNUSED) {
+        /* New processes start on the run queue of the core that created them. */
+        p->rq_cpu = (int8_t)cpu_id();
+    }
+    p->state = state;
+    list_insert(idx);
+
+    if (proc_state_is_blocked(state) && p->wait.deadline_ns != 0) {
+        timer_arm(&p->sleep_timer, p->wait.deadline_ns);
+    }
+
+    if (state == PROC_RUNNABLE) {
+        /* Idle cores wait in `wfe`: let them look for (or steal) the new work. */
+        smp_send_event();
+    }
+}
+
+void proc_runq_move(proc_t *p, uint32_t cpu) {
+    if ((uint32_t)p->rq_cpu == cpu) return;
+    if (p->state != PROC_RUNNABLE) {
+        p->rq_cpu = (int8_t)cpu;
+        return;
+    }
+    int idx = proc_idx(p);
+    list_remove(idx);
+    p->rq_cpu = (int8_t)cpu;
+    list_insert(idx);
+}
+
+int proc_state_first(proc_state_t state) {
+    return g_list_head[state];
+}
+
+int proc_state_next(int idx) {
+    return g_procs[idx].q_next;
+}
+
+uint32_t proc_state_count(proc_state_t state) {
+    return g_state_count[state];
+}
+
+int proc_runq_first(uint32_t cpu) {
+    return g_list_head[PROC_LIST_RUNQ0 + (int)cpu];
+}
+
+uint32_t proc_runq_count(uint32_t cpu) {
+    return g_list_count[PROC_LIST_RUNQ0 + (int)cpu];
+}
+
+static void pid_hash_remove(proc_t *p) {
+    if (p->pid == 0) return;
+    int idx = proc_idx(p);
+    int16_t *link = &g_pid_hash[pid_hash(p->pid)];
+    while (*link >= 0) {
+        if (*link == idx) {
+            *link = p->hash_next;
+            break;
+        }
+        link = &g_procs[*link].hash_next;
+    }
+    p->hash_next = -1;
+}
+
+void proc_set_pid(proc_t *p, uint64_t pid) {
+    pid_hash_remove(p);
+    p->pid = pid;
+    if (pid == 0) return;
+    uint32_t b = pid_hash(pid);
+    p->hash_next = g_pid_hash[b];
+    g_pid_hash[b] = (int16_t)proc_idx(p);
+}
+
+int proc_find_idx_by_pid(uint64_t pid) {
+    if (pid == 0) return -1;
+    for (int i = g_pid_hash[pid_hash(pid)]; i >= 0; i = g_procs[i].hash_next) {
+        if (g_procs[i].pid == pid && g_procs[i].state != PROC_UNUSED) return i;
+    }
+    return -1;
+}
+
+void proc_link_child(int parent_idx, int child_idx) {
+    proc_t *c = &g_procs[child_idx];
+    proc_t *parent = &g_procs[parent_idx];
+    c->parent_idx = (int16_t)parent_idx;
+    c->sib_prev = -1;
+    c->sib_next = parent->child_head;
+    if (parent->child_head >= 0) g_procs[parent->child_head].sib_prev = (int16_t)child_idx;
+    parent->child_head = (int16_t)child_idx;
+}
+
+static void proc_unlink_child(proc_t *c) {
+    if (c->parent_idx < 0) return;
+    proc_t *parent = &g_procs[c->parent_idx];
+    if (c->sib_prev >= 0) g_procs[c->sib_prev].sib_next = c->sib_next;
+    else parent->child_head = c->sib_next;
+    if (c->sib_next >= 0) g_procs[c->sib_next].sib_prev = c->sib_prev;
+    c->parent_idx = -1;
+    c->sib_prev = -1;
+    c->sib_next = -1;
+}
+
+/* Detach all children of p. Nobody can wait for them any more: zombies are
+ * reaped right away, live children are reaped when they exit.
+ */
+static void proc_orphan_children(proc_t *p) {
+    while (p->child_head >= 0) {
+        proc_t *c = &g_procs[p->child_head];
+        proc_unlink_child(c);
+        if (c->state == PROC_ZOMBIE) {
+            proc_reap(c);
+        }
+    }
+}
+
 void tf_copy(trap_frame_t *dst, const trap_frame_t *src) {
     for (uint64_t i = 0; i < 31; i++) {
         dst->x[i] = src->x[i];
@@ -30,52 +263,48 @@ void tf_zero(trap_frame_t *tf) {
 }
 
 void proc_clear(proc_t *p) {
+    pid_hash_remove(p);
+    proc_unlink_child(p);
+    proc_orphan_children(p);
+    proc_set_state(p, PROC_UNUSED);
+
     p->pid = 0;
     p->ppid = 0;
-    p->state = PROC_UNUSED;
-    p->ttbr0_pa = 0;
-    p->user_pa_base = 0;
+    p->vm.ttbr0_pa = 0;
+    p->vm.asid = 0;
+    p->vm.vmas = 0;
+    p->vm.pages = 0;
     p->heap_base = 0;
     p->heap_end = 0;
-    p->stack_low = 0;
-    p->cwd[0] = '/';
-    p->cwd[1] = '\0';
-    p->mmap_next = 0;
-    for (uint64_t i = 0; i < MAX_VMAS; i++) {
-        p->vmas[i].used = 0;
-        p->vmas[i].base = 0;
-        p->vmas[i].len = 0;
-    }
-    tf_zero(&p->tf);
+    p->cwd = 0;
+    p->kstack_base = 0;
+    p->tf = 0;
     p->elr = 0;
     p->exit_code = 0;
     p->clear_child_tid_user = 0;
-    p->wait_target_pid = 0;
-    p->wait_status_user = 0;
-    p->sleep_deadline_ns = 0;
-    p->pending_console_read = 0;
-    p->pending_read_buf_user = 0;
-    p->pending_read_len = 0;
-    p->pending_read_fd = 0;
-
-    p->pending_udp6_recv = 0;
-    p->pending_udp6_sock_id = 0;
-    p->pending_udp6_fd = 0;
-    p->pending_udp6_buf_user = 0;
-    p->pending_udp6_len = 0;
-    p->pending_udp6_src_ip_user = 0;
-    p->pending_udp6_src_port_user = 0;
-    p->pending_udp6_ret = 0;
-
-    p->pending_ping6 = 0;
-    p->ping6_done = 0;
-    p->ping6_ident = 0;
-    p->ping6_seq = 0;
-    for (uint64_t i = 0; i < 16; i++) p->ping6_dst_ip[i] = 0;
-    p->ping6_start_ns = 0;
-    p->ping6_rtt_ns = 0;
-    p->ping6_rtt_user = 0;
-    p->ping6_ret = 0;
+    p->wait.deadline_ns = 0;
+    for (uint64_t i = 0; i < WAIT_NARGS; i++) p->wait.arg[i] = 0;
+    waitq_init(&p->child_wq);
+    p->slice_end_ns = 0;
+    p->on_cpu = -1;
+    p->pending_kill = 0;
+    p->pending_kill_code = 0;
+    p->vfork_borrowed = 0;
+    p->acct_stamp_ns = 0;
+    p->utime_ns = 0;
+    p->stime_ns = 0;
+    p->nvcsw = 0;
+    p->nivcsw = 0;
+    p->maxrss_kb = 0;
+    p->minflt = 0;
+    p->cutime_ns = 0;
+    p->cstime_ns = 0;
+    p->cnvcsw = 0;
+    p->cnivcsw = 0;
+    p->cmaxrss_kb = 0;
+    p->cminflt = 0;
+    p->start_ns = 0;
+    p->comm[0] = '\0';
     for (uint64_t i = 0; i < MAX_FDS; i++) {
         p->fdt.fd_to_desc[i] = -1;
     }
@@ -89,44 +318,133 @@ void proc_close_all_fds(proc_t *p) {
 }
 
 int proc_find_free_slot(void) {
-    for (int i = 0; i < (int)MAX_PROCS; i++) {
-        if (g_procs[i].state == PROC_UNUSED) return i;
+    return proc_state_first(PROC_UNUSED);
+}
+
+static uint64_t proc_acct_delta(proc_t *p) {
+    uint64_t now = time_now_ns();
+    uint64_t d = 0;
+    /* No stamp yet (or no clock): nothing to charge. */
+    if (p->acct_stamp_ns != 0 && now > p->acct_stamp_ns) {
+        d = now - p->acct_stamp_ns;
     }
-    return -1;
+    p->acct_stamp_ns = now;
+    return d;
+}
+
+void proc_acct_user(proc_t *p) {
+    p->utime_ns += proc_acct_delta(p);
+}
+
+void proc_acct_sys(proc_t *p) {
+    p->stime_ns += proc_acct_delta(p);
+}
+
+void proc_acct_start(proc_t *p) {
+    p->acct_stamp_ns = time_now_ns();
+}
+
+uint64_t proc_rss_kb(const proc_t *p) {
+    return p->vm.pages * (VM_PAGE_SIZE / 1024u);
+}
+
+void proc_note_rss(proc_t *p) {
+    uint64_t kb = proc_rss_kb(p);
+    if (kb > p->maxrss_kb) p->maxrss_kb = kb;
+}
+
+void proc_set_comm(proc_t *p, const char *path) {
+    const char *base = path;
+    for (uint64_t i = 0; path[i] != '\0'; i++) {
+        if (path[i] == '/' && path[i + 1] != '\0') base = &path[i + 1];
+    }
+    uint64_t n = 0;
+    for (; n + 1 < PROC_COMM_LEN && base[n] != '\0' && base[n] != '/'; n++) {
+        p->comm[n] = base[n];
+    }
+    p->comm[n] = '\0';
+}
+
+int proc_alloc_kstack(proc_t *p) {
+    uint64_t base = pmm_alloc_pages(KSTACK_PAGES);
+    if (base == 0) return -1;
+
+    p->kstack_base = base;
+    /* Exceptions from EL0 push their frame right below the stack top. */
+    p->tf = (trap_frame_t *)(uintptr_t)(base + KSTACK_SIZE - sizeof(trap_frame_t));
+    tf_zero(p->tf);
+
+    uint64_t *ctx = (uint64_t *)&p->ctx;
+    for (uint64_t i = 0; i < sizeof(p->ctx) / 8u; i++) {
+        ctx[i] = 0;
+    }
+    return 0;
 }
 
-void proc_init_if_needed(uint64_t elr, trap_frame_t *tf) {
-    if (g_proc_inited) return;
+void proc_reap(proc_t *p) {
+    /* No core has the tables loaded any more (idle cores switch to the
+     * kernel tables), so they can go once the ASID is flushed.
+     */
+    mmu_asid_release(&p->vm.asid);
+    vm_space_destroy(&p->vm);
+    /* Never called on the stack being freed: a dead task is reaped only
+     * after its core switched away (see sched.c).
+     */
+    if (p->kstack_base != 0) {
+        pmm_free_pages(p->kstack_base, KSTACK_PAGES);
+    }
+    vfs_dput(p->cwd);
+    proc_clear(p);
+}
+
+uint64_t proc_init(const uint8_t *image, uint64_t image_size, uint64_t entry, uint64_t user_sp) {
+    if (g_proc_inited) return 0;
 
+    vm_init();
     pipe_init();
     fd_init();
+    proc_tables_init();
     for (uint64_t i = 0; i < MAX_PROCS; i++) {
         proc_clear(&g_procs[i]);
     }
 
     vfs_init();
 
-    /* Init process (pid 1) runs in the initial identity TTBR0. */
     g_cur_proc = 0;
     g_last_sched = 0;
     proc_clear(&g_procs[0]);
-    g_procs[0].pid = g_next_pid++;
+    g_procs[0].cwd = vfs_dget(vfs_root());
+    if (proc_alloc_kstack(&g_procs[0]) != 0) {
+        return 0;
+    }
+    proc_set_pid(&g_procs[0], g_next_pid++);
     g_procs[0].ppid = 0;
-    g_procs[0].state = PROC_RUNNABLE;
-    g_procs[0].ttbr0_pa = mmu_ttbr0_read();
-    g_procs[0].user_pa_base = USER_REGION_BASE;
-    /* Heap is initialized on first execve(). */
-    g_procs[0].heap_base = 0;
-    g_procs[0].heap_end = 0;
-    g_procs[0].stack_low = tf->sp_el0;
-    tf_copy(&g_procs[0].tf, tf);
-    g_procs[0].elr = elr;
+    proc_set_state(&g_procs[0], PROC_RUNNABLE);
+    g_procs[0].on_cpu = (int8_t)cpu_id();
+
+    /* The flat image carries no segment sizes: give it the window the
+     * payload always had and start the heap above it.
+     */
+    vm_space_t *vm = &g_procs[0].vm;
+    if (vm_space_init(vm) != 0 ||
+        vm_map(vm, USER_REGION_BASE, PROC_INIT_IMAGE_SIZE, MMU_PROT_READ | MMU_PROT_WRITE | MMU_PROT_EXEC, 0) != 0 ||
+        vm_map(vm, USER_STACK_TOP - USER_STACK_SIZE, USER_STACK_SIZE, MMU_PROT_READ | MMU_PROT_WRITE, VMA_STACK) != 0 ||
+        image_size > PROC_INIT_IMAGE_SIZE ||
+        vm_copy_to(vm, USER_REGION_BASE, image, image_size) != 0) {
+        return 0;
+    }
+    g_procs[0].heap_base = USER_REGION_BASE + PROC_INIT_IMAGE_SIZE;
+    g_procs[0].heap_end = g_procs[0].heap_base;
+    g_procs[0].tf->sp_el0 = user_sp;
+    g_procs[0].elr = entry;
+    g_procs[0].start_ns = time_now_ns();
+    proc_acct_start(&g_procs[0]);
+    proc_set_comm(&g_procs[0], "init");
 
     /* Create a shared UART file description and install it as fd 0/1/2. */
     int uart_desc = desc_alloc();
     if (uart_desc >= 0) {
-        g_descs[uart_desc].kind = FDESC_UART;
-        g_descs[uart_desc].refs = 1;
+        desc_get(uart_desc)->kind = FDESC_UART;
 
         for (int i = 0; i < 3; i++) {
             g_procs[0].fdt.fd_to_desc[i] = (int16_t)uart_desc;
@@ -137,4 +455,6 @@ void proc_init_if_needed(uint64_t elr, trap_frame_t *tf) {
     }
 
     g_proc_inited = 1;
+    mmu_ttbr0_switch(vm->ttbr0_pa, &vm->asid);
+    return g_procs[0].kstack_base + KSTACK_SIZE;
 }
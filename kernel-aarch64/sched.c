@@ -1,321 +1,263 @@
 #include "sched.h"
 
-#include "cache.h"
 #include "console_in.h"
-#include "errno.h"
 #include "irq.h"
 #include "mmu.h"
-#include "net_udp6.h"
 #include "proc.h"
-#include "regs.h"
-#include "sys_util.h"
+#include "smp.h"
 #include "time.h"
-
-static void sched_wake_sleepers(void) {
-    uint64_t now = time_now_ns();
-    for (int i = 0; i < (int)MAX_PROCS; i++) {
-        if (g_procs[i].state != PROC_SLEEPING) continue;
-        if (now >= g_procs[i].sleep_deadline_ns) {
-            g_procs[i].state = PROC_RUNNABLE;
-        }
+#include "timer.h"
+#include "vm.h"
+
+/* Time slice for CPU-bound tasks (two ticks at the default 100 Hz). */
+#ifndef SCHED_QUANTUM_NS
+#define SCHED_QUANTUM_NS 20000000ull
+#endif
+
+/* Round-robin over this core's run queue: take the task queued after the one
+ * we picked last, or the head if that one is no longer queued here.
+ */
+static int sched_pick_local(uint32_t cpu) {
+    int last = g_last_sched;
+    int idx = -1;
+    if (last >= 0 && g_procs[last].state == PROC_RUNNABLE && (uint32_t)g_procs[last].rq_cpu == cpu) {
+        idx = proc_state_next(last);
     }
+    if (idx < 0) {
+        idx = proc_runq_first(cpu);
+    }
+    return idx;
 }
 
-static int sched_wake_one_console_reader_if_ready(void) {
-    if (!console_in_has_data()) {
-        return -1;
+/* Work stealing: take a waiting (not running) task from the busiest other core. */
+static int sched_steal(uint32_t cpu) {
+    int victim = -1;
+    uint32_t best = 0;
+    for (uint32_t c = 0; c < MAX_CPUS; c++) {
+        if (c == cpu) continue;
+        uint32_t n = proc_runq_count(c);
+        if (n > best) {
+            best = n;
+            victim = (int)c;
+        }
     }
+    if (victim < 0) return -1;
 
-    /* Wake at most one blocked reader per pass to avoid stampedes. */
-    for (int step = 1; step <= (int)MAX_PROCS; step++) {
-        int idx = (g_last_sched + step) % (int)MAX_PROCS;
-        if (g_procs[idx].state == PROC_BLOCKED_IO && g_procs[idx].pending_console_read) {
-            g_procs[idx].state = PROC_RUNNABLE;
-            return idx;
-        }
+    for (int idx = proc_runq_first((uint32_t)victim); idx >= 0; idx = proc_state_next(idx)) {
+        if (g_procs[idx].on_cpu >= 0) continue;
+        proc_runq_move(&g_procs[idx], cpu);
+        return idx;
     }
     return -1;
 }
 
-static void sched_complete_console_read_if_needed(proc_t *p) {
-    if (!p) return;
-    if (!p->pending_console_read) return;
-    if (p->pending_read_len == 0) {
-        p->tf.x[0] = 0;
-        p->pending_console_read = 0;
-        p->pending_read_fd = 0;
-        p->pending_read_buf_user = 0;
-        p->pending_read_len = 0;
-        return;
-    }
+int sched_pick_next_runnable(void) {
+    uint32_t cpu = cpu_id();
 
-    volatile char *dst = (volatile char *)(uintptr_t)p->pending_read_buf_user;
-    uint64_t len = p->pending_read_len;
+    /* Bring in any new input (UART, optional USB kbd). */
+    console_in_poll();
 
-    char c;
-    if (!console_in_pop(&c)) {
-        /* Nothing to complete yet: keep it pending and block again. */
-        p->state = PROC_BLOCKED_IO;
-        return;
-    }
+    /* Run expired kernel timers (wakes sleepers, drives USB polling). */
+    timer_run();
 
-    dst[0] = c;
-    uint64_t n = 1;
-    for (; n < len; n++) {
-        char t;
-        if (!console_in_pop(&t)) break;
-        dst[n] = t;
+    int idx = sched_pick_local(cpu);
+    if (idx < 0) {
+        idx = sched_steal(cpu);
+    }
+    if (idx >= 0) {
+        g_last_sched = idx;
     }
+    return idx;
+}
 
-    p->tf.x[0] = n;
-    p->pending_console_read = 0;
-    p->pending_read_fd = 0;
-    p->pending_read_buf_user = 0;
-    p->pending_read_len = 0;
+/* Runs first in every context switched to: free a task that exited on this
+ * core, now that nothing runs on its kernel stack any more.
+ */
+static void sched_finish_switch(void) {
+    cpu_t *c = cpu_this();
+    int dead = c->reap_idx;
+    if (dead >= 0) {
+        c->reap_idx = -1;
+        proc_reap(&g_procs[dead]);
+    }
 }
 
-static void sched_complete_ping6_if_needed(proc_t *p) {
-    if (!p) return;
-    if (!p->pending_ping6) return;
-
-    if (!p->ping6_done) {
-        /* If we're runnable but still marked pending, the sleep deadline fired. */
-        uint64_t now = time_now_ns();
-        if (p->sleep_deadline_ns != 0 && now >= p->sleep_deadline_ns) {
-            p->ping6_done = 1;
-            p->ping6_ret = (uint64_t)(-(int64_t)ETIMEDOUT);
-            p->ping6_rtt_ns = 0;
-            p->sleep_deadline_ns = 0;
-        } else {
-            /* Still waiting; keep it pending. */
-            return;
-        }
+/* Charge the kernel time of a task being switched out and count the switch:
+ * voluntary if it blocked, involuntary if it was still runnable (preempted
+ * or yielding at the end of a syscall). Exiting tasks count neither.
+ */
+static void sched_account_switch_out(proc_t *p) {
+    proc_acct_sys(p);
+    if (p->state == PROC_RUNNABLE) {
+        p->nivcsw++;
+    } else if (proc_state_is_blocked(p->state)) {
+        p->nvcsw++;
     }
+}
 
-    /* Complete the syscall return value and optional RTT writeback. */
-    if (p->ping6_ret == 0 && p->ping6_rtt_user != 0) {
-        (void)write_u64_to_user(p->ping6_rtt_user, p->ping6_rtt_ns);
+/* Switch this core from the current context (a task, or the idle loop if no
+ * task runs here) to task idx. Returns when the current context is switched
+ * back in, possibly on another core. The kernel lock stays held throughout:
+ * whoever runs next releases it.
+ */
+static void sched_switch_to(int idx) {
+    uint32_t cpu = cpu_id();
+    cpu_t *c = &g_cpus[cpu];
+    int old = c->cur_proc;
+    cpu_context_t *from = &c->idle_ctx;
+    if (old >= 0) {
+        sched_account_switch_out(&g_procs[old]);
+        g_procs[old].on_cpu = -1;
+        from = &g_procs[old].ctx;
     }
+    proc_runq_move(&g_procs[idx], cpu);
+    g_procs[idx].on_cpu = (int8_t)cpu;
+    proc_acct_start(&g_procs[idx]);
 
-    p->tf.x[0] = p->ping6_ret;
-
-    p->pending_ping6 = 0;
-    p->ping6_done = 0;
-    p->ping6_ident = 0;
-    p->ping6_seq = 0;
-    for (uint64_t i = 0; i < 16; i++) p->ping6_dst_ip[i] = 0;
-    p->ping6_start_ns = 0;
-    p->ping6_rtt_ns = 0;
-    p->ping6_rtt_user = 0;
-    p->ping6_ret = 0;
+    c->cur_proc = idx;
+    g_procs[idx].slice_end_ns = time_now_ns() + SCHED_QUANTUM_NS;
+
+    /* The task runs at EL0 with IRQs unmasked: keep the tick running so its
+     * quantum can expire without a syscall.
+     */
+    time_tick_enable_periodic();
+
+    /* ASID-tagged TTBR0: no TLB or cache maintenance needed (the data
+     * caches are physically tagged).
+     */
+    mmu_ttbr0_switch(g_procs[idx].vm.ttbr0_pa, &g_procs[idx].vm.asid);
+
+    cpu_switch(from, &g_procs[idx].ctx);
+    sched_finish_switch();
 }
 
-static void sched_complete_udp6_recv_if_needed(proc_t *p) {
-    if (!p) return;
-    if (!p->pending_udp6_recv) return;
-
-    udp6_dgram_t dg;
-    int rc = net_udp6_try_recv(p->pending_udp6_sock_id, &dg);
-    if (rc == 0) {
-        uint64_t n = p->pending_udp6_len;
-        if (n > (uint64_t)dg.len) n = (uint64_t)dg.len;
-
-        if (n != 0) {
-            if (write_bytes_to_user(p->pending_udp6_buf_user, dg.data, n) != 0) {
-                p->tf.x[0] = (uint64_t)(-(int64_t)EFAULT);
-            } else {
-                p->tf.x[0] = n;
-            }
-        } else {
-            p->tf.x[0] = 0;
-        }
+/* Nothing else to run: leave the current task for this core's idle loop. */
+static void sched_switch_to_idle(void) {
+    cpu_t *c = cpu_this();
+    int old = c->cur_proc;
+    sched_account_switch_out(&g_procs[old]);
+    g_procs[old].on_cpu = -1;
+    c->cur_proc = -1;
 
-        if (p->pending_udp6_src_ip_user != 0) {
-            (void)write_bytes_to_user(p->pending_udp6_src_ip_user, dg.src_ip, 16);
-        }
-        if (p->pending_udp6_src_port_user != 0) {
-            (void)write_u16_to_user(p->pending_udp6_src_port_user, dg.src_port);
-        }
+    /* Do not leave the task's tables loaded: it may exit and free them
+     * while this core idles.
+     */
+    mmu_ttbr0_switch_kernel();
+
+    cpu_switch(&g_procs[old].ctx, &c->idle_ctx);
+    sched_finish_switch();
+}
 
-        p->pending_udp6_recv = 0;
-        p->pending_udp6_sock_id = 0;
-        p->pending_udp6_fd = 0;
-        p->pending_udp6_buf_user = 0;
-        p->pending_udp6_len = 0;
-        p->pending_udp6_src_ip_user = 0;
-        p->pending_udp6_src_port_user = 0;
-        p->pending_udp6_ret = 0;
-        p->sleep_deadline_ns = 0;
+void sched_yield(void) {
+    int next = sched_pick_next_runnable();
+    if (next >= 0 && next != g_cur_proc) {
+        sched_switch_to(next);
+    }
+}
+
+void sched_block(void) {
+    int cur = g_cur_proc;
+    int next = sched_pick_next_runnable();
+    if (next == cur) {
+        /* Already woken again (e.g. the deadline passed meanwhile). */
         return;
     }
+    if (next >= 0) {
+        sched_switch_to(next);
+    } else {
+        sched_switch_to_idle();
+    }
+}
+
+void sched_exit(void) {
+    cpu_t *c = cpu_this();
+    int cur = c->cur_proc;
+    if (g_procs[cur].parent_idx < 0) {
+        /* Nobody waits for it: free it as soon as we are off its stack. */
+        c->reap_idx = cur;
+    }
 
-    if (rc == -(int)EAGAIN) {
-        uint64_t now = time_now_ns();
-        if (p->sleep_deadline_ns != 0 && now >= p->sleep_deadline_ns) {
-            p->tf.x[0] = (uint64_t)(-(int64_t)ETIMEDOUT);
-            p->pending_udp6_recv = 0;
-            p->pending_udp6_sock_id = 0;
-            p->pending_udp6_fd = 0;
-            p->pending_udp6_buf_user = 0;
-            p->pending_udp6_len = 0;
-            p->pending_udp6_src_ip_user = 0;
-            p->pending_udp6_src_port_user = 0;
-            p->pending_udp6_ret = 0;
-            p->sleep_deadline_ns = 0;
-            return;
-        }
+    int next = sched_pick_next_runnable();
+    if (next >= 0) {
+        sched_switch_to(next);
+    } else {
+        sched_switch_to_idle();
+    }
 
-        /* Still waiting; keep blocked. */
-        if (p->sleep_deadline_ns != 0) p->state = PROC_SLEEPING;
-        else p->state = PROC_BLOCKED_IO;
+    /* A zombie is never switched back in. */
+    for (;;) {
+        cpu_wfe();
+    }
+}
+
+void sched_preempt(void) {
+    proc_t *cur = proc_current();
+    uint64_t now = time_now_ns();
+    if (cur->state == PROC_RUNNABLE && now < cur->slice_end_ns) {
         return;
     }
 
-    /* Error: complete with errno. */
-    p->tf.x[0] = (uint64_t)(int64_t)rc;
-    p->pending_udp6_recv = 0;
-    p->pending_udp6_sock_id = 0;
-    p->pending_udp6_fd = 0;
-    p->pending_udp6_buf_user = 0;
-    p->pending_udp6_len = 0;
-    p->pending_udp6_src_ip_user = 0;
-    p->pending_udp6_src_port_user = 0;
-    p->pending_udp6_ret = 0;
-    p->sleep_deadline_ns = 0;
+    /* Quantum used up: round-robin to the next runnable task (which also wakes
+     * sleepers and console readers). If we keep running, start a new slice.
+     */
+    cur->slice_end_ns = now + SCHED_QUANTUM_NS;
+    sched_yield();
 }
 
-static int sched_any_sleepers(uint64_t *out_earliest_deadline_ns) {
-    uint64_t earliest = 0;
-    int any = 0;
+void sched_ret_from_fork(void) {
+    sched_finish_switch();
+    proc_acct_sys(proc_current());
+    kernel_unlock();
+}
 
-    for (int i = 0; i < (int)MAX_PROCS; i++) {
-        if (g_procs[i].state != PROC_SLEEPING) continue;
-        uint64_t d = g_procs[i].sleep_deadline_ns;
-        if (!any || d < earliest) {
-            earliest = d;
-            any = 1;
-        }
+void sched_init_boot_cpu(uint64_t idle_stack_top) {
+    cpu_context_t *ctx = &g_cpus[0].idle_ctx;
+    uint64_t *r = (uint64_t *)ctx;
+    for (uint64_t i = 0; i < sizeof(*ctx) / 8u; i++) {
+        r[i] = 0;
     }
-
-    if (any && out_earliest_deadline_ns) *out_earliest_deadline_ns = earliest;
-    return any;
+    /* The first switch away from pid 1 "returns" into sched_idle(). */
+    ctx->lr = (uint64_t)(uintptr_t)sched_idle;
+    ctx->sp = idle_stack_top;
 }
 
-int sched_pick_next_runnable(void) {
+void sched_idle(void) {
     for (;;) {
-        /* Bring in any new input (UART, optional USB kbd). */
-        console_in_poll();
+        sched_finish_switch();
 
-        /* Wake any sleepers whose deadline has passed. */
-        sched_wake_sleepers();
-
-        /* Wake one console reader if buffered input exists. */
-        int woke = sched_wake_one_console_reader_if_ready();
-        if (woke >= 0 && g_procs[woke].state == PROC_RUNNABLE) {
-            g_last_sched = woke;
-            return woke;
-        }
-
-        for (int step = 1; step <= (int)MAX_PROCS; step++) {
-            int idx = (g_last_sched + step) % (int)MAX_PROCS;
-            if (g_procs[idx].state == PROC_RUNNABLE) {
-                g_last_sched = idx;
-                return idx;
-            }
+        int next = sched_pick_next_runnable();
+        if (next >= 0) {
+            sched_switch_to(next);
+            continue;
         }
 
-        /* No runnable tasks. If there are sleepers or blocked IO, enter low-power
-         * idle and wait for the periodic timer tick to wake us.
+        /* Nothing to run: zero pages for future faults first, one at a
+         * time so new work is still picked up promptly.
          */
-        uint64_t earliest = 0;
-        int has_sleepers = sched_any_sleepers(&earliest);
-        int has_blocked_io = 0;
-        for (int i = 0; i < (int)MAX_PROCS; i++) {
-            if (g_procs[i].state == PROC_BLOCKED_IO) {
-                has_blocked_io = 1;
-                break;
-            }
+        if (vm_zero_pool_refill()) {
+            continue;
         }
 
-        if (!has_sleepers && !has_blocked_io) {
-            return -1;
-        }
-
-        /* Tickless idle policy:
-         * - If sleepers exist: wake at the earliest sleep deadline.
-         * - If any polling-based devices exist (USB kbd/net): also wake at the
-         *   next poll deadline so we can receive packets/keys and wake sleepers.
-         *
-         * Note: network RX is polled (usb-net). Without periodic wakeups while
-         * tasks are sleeping, ping/udp replies and RAs cannot be received to
-         * wake those sleepers early.
+        /* Tickless idle: stop the periodic tick. timer_run() left CNTP armed
+         * for the earliest kernel timer (sleep deadlines, ping/udp timeouts,
+         * the USB poll cadence), if any; otherwise only IRQ-driven input or
+         * another core's SEV wakes us.
          */
-        if (!has_sleepers && has_blocked_io && !console_in_needs_polling()) {
-            /* Only IRQ-driven input can wake us; no tick required. */
-            time_tick_disable();
+        if (time_now_ns() == 0) {
+            /* If we can't compute deadlines, keep a periodic tick. */
+            time_tick_enable_periodic();
         } else {
-            uint64_t now = time_now_ns();
-            if (now == 0) {
-                /* If we can't compute deadlines, keep a periodic tick. */
-                time_tick_enable_periodic();
-            } else {
-                uint64_t wake_ns = 0;
-                if (has_sleepers) {
-                    wake_ns = earliest;
-                }
-
-                if (console_in_needs_polling()) {
-                    uint64_t next_poll = console_in_next_poll_deadline_ns();
-                    if (next_poll == 0) {
-                        /* No deadline yet; wake immediately to establish one. */
-                        next_poll = now;
-                    }
-                    if (wake_ns == 0 || next_poll < wake_ns) {
-                        wake_ns = next_poll;
-                    }
-                }
-
-                if (wake_ns > now) {
-                    time_tick_schedule_oneshot_ns(wake_ns - now);
-                } else {
-                    /* Deadline already passed; handle it on the next loop. */
-                    time_tick_schedule_oneshot_ns(1);
-                }
-            }
+            time_tick_disable();
         }
 
+        /* Drop the kernel lock while idle so other cores can enter the
+         * kernel. `wfe` also wakes on SEV when another core makes work
+         * runnable.
+         */
+        kernel_unlock();
         irq_enable();
-        cpu_wfi();
+        cpu_wfe();
         irq_disable();
-    }
-}
-
-void proc_switch_to(int idx, trap_frame_t *tf) {
-    g_cur_proc = idx;
-
-    /* With per-process TTBR0 but no ASIDs, user VA caching can alias across
-     * processes. Flush caches on switch to avoid stale instructions/data.
-     */
-    cache_clean_invalidate_all();
-
-    mmu_ttbr0_write(g_procs[idx].ttbr0_pa);
-
-    /* Complete any pending console read now that this process address space is active. */
-    sched_complete_console_read_if_needed(&g_procs[idx]);
-
-    /* Complete any pending ping6 syscall now that this process address space is active. */
-    sched_complete_ping6_if_needed(&g_procs[idx]);
-
-    /* Complete any pending udp6 recvfrom syscall now that this process address space is active. */
-    sched_complete_udp6_recv_if_needed(&g_procs[idx]);
-
-    write_elr_el1(g_procs[idx].elr);
-    tf_copy(tf, &g_procs[idx].tf);
-}
-
-void sched_maybe_switch(trap_frame_t *tf) {
-    int next = sched_pick_next_runnable();
-    if (next >= 0 && next != g_cur_proc) {
-        proc_switch_to(next, tf);
+        kernel_lock();
     }
 }
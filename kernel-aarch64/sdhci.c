@@ -0,0 +1,625 @@
+#include "sdhci.h"
+
+#include "cache.h"
+#include "dma.h"
+#include "errno.h"
+#include "mailbox.h"
+#include "mmu.h"
+#include "time.h"
+#include "timer.h"
+#include "uart_pl011.h"
+
+/*
+ * SDHCI register model (subset, BCM2835 names). The Arasan block only takes
+ * 32-bit accesses, so the byte and halfword fields of the standard layout
+ * are always read-modify-written as whole words.
+ */
+
+static inline volatile uint32_t *emmc_reg(uint32_t off) {
+    return (volatile uint32_t *)(uintptr_t)(RPI_EMMC_BASE + (uint64_t)off);
+}
+
+#define EMMC_BLKSIZECNT 0x04u
+#define EMMC_ARG1       0x08u
+#define EMMC_CMDTM      0x0Cu
+#define EMMC_RESP0      0x10u
+#define EMMC_DATA       0x20u
+#define EMMC_STATUS     0x24u
+#define EMMC_CONTROL0   0x28u
+#define EMMC_CONTROL1   0x2Cu
+#define EMMC_INTERRUPT  0x30u
+#define EMMC_IRPT_MASK  0x34u
+#define EMMC_IRPT_EN    0x38u
+#define EMMC_CONTROL2   0x3Cu
+#define EMMC_CAPS0      0x40u
+#define EMMC_ADMA_ADDR  0x58u
+#define EMMC_SLOTISR_VER 0xFCu
+
+#define STATUS_CMD_INHIBIT (1u << 0)
+#define STATUS_DAT_INHIBIT (1u << 1)
+
+#define CONTROL0_DWIDTH4   (1u << 1)
+#define CONTROL0_DMA_MASK  (3u << 3)
+#define CONTROL0_ADMA2_32  (2u << 3)
+#define CONTROL0_POWER_33V (0xFu << 8) /* bus power on, 3.3V */
+
+#define CONTROL1_CLK_INTLEN (1u << 0)
+#define CONTROL1_CLK_STABLE (1u << 1)
+#define CONTROL1_CLK_EN     (1u << 2)
+#define CONTROL1_DIV_MASK   0xFFC0u
+#define CONTROL1_TOUNIT_MASK (0xFu << 16)
+#define CONTROL1_TOUNIT_MAX  (0xEu << 16)
+#define CONTROL1_SRST_HC    (1u << 24)
+#define CONTROL1_SRST_CMD   (1u << 25)
+#define CONTROL1_SRST_DATA  (1u << 26)
+
+#define INT_CMD_DONE  (1u << 0)
+#define INT_DATA_DONE (1u << 1)
+#define INT_WRITE_RDY (1u << 4)
+#define INT_READ_RDY  (1u << 5)
+#define INT_ERR       (1u << 15)
+#define INT_CTO_ERR   (1u << 16)
+#define INT_DTO_ERR   (1u << 20)
+#define INT_ERROR_MASK 0xFFFF8000u
+
+/* What a transfer is driven by. */
+#define INT_XFER_MASK (INT_CMD_DONE | INT_DATA_DONE | INT_WRITE_RDY | INT_READ_RDY | INT_ERROR_MASK)
+
+#define CAPS0_BASE_CLK_SHIFT 8
+#define CAPS0_ADMA2 (1u << 19)
+
+/* CMDTM: transfer mode (low half), command (high half). */
+#define TM_DMA_EN     (1u << 0)
+#define TM_BLKCNT_EN  (1u << 1)
+#define TM_AUTO_CMD12 (1u << 2)
+#define TM_DAT_DIR_RD (1u << 4)
+#define TM_MULTI_BLK  (1u << 5)
+#define CMD_RSPNS_136 (1u << 16)
+#define CMD_RSPNS_48  (2u << 16)
+#define CMD_RSPNS_48B (3u << 16)
+#define CMD_RSPNS_MASK (3u << 16)
+#define CMD_CRCCHK_EN (1u << 19)
+#define CMD_IXCHK_EN  (1u << 20)
+#define CMD_ISDATA    (1u << 21)
+
+#define RESP_NONE 0u
+#define RESP_R1  (CMD_RSPNS_48 | CMD_CRCCHK_EN | CMD_IXCHK_EN)
+#define RESP_R1B (CMD_RSPNS_48B | CMD_CRCCHK_EN | CMD_IXCHK_EN)
+#define RESP_R2  (CMD_RSPNS_136 | CMD_CRCCHK_EN)
+#define RESP_R3  CMD_RSPNS_48
+
+#define SD_CMD(idx, resp) (((uint32_t)(idx) << 24) | (resp))
+
+#define CMD_GO_IDLE       SD_CMD(0, RESP_NONE)
+#define CMD_ALL_SEND_CID  SD_CMD(2, RESP_R2)
+#define CMD_SEND_REL_ADDR SD_CMD(3, RESP_R1)
+#define CMD_SELECT_CARD   SD_CMD(7, RESP_R1B)
+#define CMD_SEND_IF_COND  SD_CMD(8, RESP_R1)
+#define CMD_SEND_CSD      SD_CMD(9, RESP_R2)
+#define CMD_SET_BLOCKLEN  SD_CMD(16, RESP_R1)
+#define CMD_READ_SINGLE   SD_CMD(17, RESP_R1 | CMD_ISDATA)
+#define CMD_READ_MULTI    SD_CMD(18, RESP_R1 | CMD_ISDATA)
+#define CMD_WRITE_SINGLE  SD_CMD(24, RESP_R1 | CMD_ISDATA)
+#define CMD_WRITE_MULTI   SD_CMD(25, RESP_R1 | CMD_ISDATA)
+#define CMD_APP_CMD       SD_CMD(55, RESP_R1)
+#define ACMD_SET_BUS_WIDTH SD_CMD(6, RESP_R1)
+#define ACMD_SEND_OP_COND SD_CMD(41, RESP_R3)
+
+#define OCR_BUSY  (1u << 31) /* set once power-up is done */
+#define OCR_HCS   (1u << 30) /* high capacity: block addressing */
+#define OCR_VOLTS 0x00FF8000u
+
+#define SD_CLOCK_ID_HZ   400000u
+#define SD_CLOCK_XFER_HZ 25000000u
+
+#define CMD_TIMEOUT_NS  100000000ull  /* 100ms */
+#define DATA_TIMEOUT_NS 2000000000ull /* 2s */
+#define INIT_TIMEOUT_NS 1000000000ull /* ACMD41 power-up */
+#define RESET_TIMEOUT_NS 1000000ull   /* 1ms: a line reset takes a few clocks */
+#define INHIBIT_RETRY_NS 1000000ull   /* 1ms */
+
+/* ADMA2 (32-bit) descriptors: attributes and length, then the address. */
+#define ADMA_VALID    (1u << 0)
+#define ADMA_END      (1u << 1)
+#define ADMA_ACT_TRAN (2u << 4)
+#define ADMA_CHUNK    0x8000u /* bytes per descriptor (the length field is 16 bits) */
+#define ADMA_DESCS    256u
+
+typedef struct {
+    uint32_t attr_len;
+    uint32_t addr;
+} adma_desc_t;
+
+static struct {
+    uint8_t present;
+    uint8_t high_capacity;
+    uint16_t _pad;
+    uint32_t rca;
+    uint32_t base_hz;
+    uint32_t version; /* SDHCI spec: 0=1.0, 1=2.0, 2=3.0 */
+    uint64_t sectors;
+    adma_desc_t *adma; /* uncached; 0 = PIO */
+    /* Transfer queue; the head is the one on the controller. */
+    sdhci_req_t *head;
+    sdhci_req_t *tail;
+    uint8_t issued;    /* the head's command has been sent */
+    uint64_t deadline; /* for the head, to be issued and done */
+    ktimer_t timer;    /* inhibit retry / deadline */
+} g_sd;
+
+static inline void dsb_sy(void) {
+    __asm__ volatile("dsb sy" ::: "memory");
+}
+
+static uint64_t deadline_ns(uint64_t delta_ns) {
+    uint64_t now = time_now_ns();
+    if (now == 0) return 0;
+    return now + delta_ns;
+}
+
+static int time_before_deadline(uint64_t dl) {
+    if (dl == 0) return 1;
+    return time_now_ns() < dl;
+}
+
+static void udelay_ns(uint64_t ns) {
+    uint64_t dl = deadline_ns(ns);
+    while (time_before_deadline(dl)) {
+        /* spin */
+    }
+}
+
+static int emmc_wait_clear(uint32_t off, uint32_t bits, uint64_t timeout_ns) {
+    uint64_t dl = deadline_ns(timeout_ns);
+    while ((*emmc_reg(off) & bits) != 0) {
+        if (!time_before_deadline(dl)) return -(int)ETIMEDOUT;
+    }
+    return 0;
+}
+
+/* Wait for one of the INTERRUPT bits in mask and acknowledge it.
+ * Returns 0, -ETIMEDOUT (no response from the card) or -EIO.
+ */
+static int emmc_wait_int(uint32_t mask, uint64_t timeout_ns) {
+    uint64_t dl = deadline_ns(timeout_ns);
+    for (;;) {
+        uint32_t v = *emmc_reg(EMMC_INTERRUPT);
+        if ((v & INT_ERROR_MASK) != 0) {
+            *emmc_reg(EMMC_INTERRUPT) = v;
+            return (v & (INT_CTO_ERR | INT_DTO_ERR)) ? -(int)ETIMEDOUT : -(int)EIO;
+        }
+        if ((v & mask) != 0) {
+            *emmc_reg(EMMC_INTERRUPT) = v & mask;
+            return 0;
+        }
+        if (!time_before_deadline(dl)) return -(int)ETIMEDOUT;
+    }
+}
+
+/* After an error the command and data state machines must be reset before
+ * the next command.
+ */
+static void emmc_reset_lines(void) {
+    *emmc_reg(EMMC_CONTROL1) |= CONTROL1_SRST_CMD | CONTROL1_SRST_DATA;
+    (void)emmc_wait_clear(EMMC_CONTROL1, CONTROL1_SRST_CMD | CONTROL1_SRST_DATA, RESET_TIMEOUT_NS);
+    *emmc_reg(EMMC_INTERRUPT) = 0xFFFFFFFFu;
+}
+
+/* Issue cmd (CMDTM value, transfer mode included) and wait for its
+ * response; resp gets 1 word (4 for R2) if non-null. Polled: only for the
+ * card bring-up at boot, transfers are interrupt driven.
+ */
+static int sd_cmd(uint32_t cmd, uint32_t arg, uint32_t *resp) {
+    uint32_t inhibit = STATUS_CMD_INHIBIT;
+    if ((cmd & CMD_ISDATA) != 0 || (cmd & CMD_RSPNS_MASK) == CMD_RSPNS_48B) {
+        inhibit |= STATUS_DAT_INHIBIT;
+    }
+    if (emmc_wait_clear(EMMC_STATUS, inhibit, DATA_TIMEOUT_NS) != 0) {
+        emmc_reset_lines();
+        return -(int)EIO;
+    }
+
+    *emmc_reg(EMMC_INTERRUPT) = 0xFFFFFFFFu;
+    *emmc_reg(EMMC_ARG1) = arg;
+    *emmc_reg(EMMC_CMDTM) = cmd;
+
+    int rc = emmc_wait_int(INT_CMD_DONE, CMD_TIMEOUT_NS);
+    if (rc != 0) {
+        emmc_reset_lines();
+        return rc;
+    }
+
+    if (resp) {
+        resp[0] = *emmc_reg(EMMC_RESP0);
+        if ((cmd & CMD_RSPNS_MASK) == CMD_RSPNS_136) {
+            for (uint32_t i = 1; i < 4u; i++) resp[i] = *emmc_reg(EMMC_RESP0 + 4u * i);
+        }
+    }
+
+    if ((cmd & CMD_RSPNS_MASK) == CMD_RSPNS_48B) {
+        /* Busy signalling on DAT0 ends with "data done". */
+        rc = emmc_wait_int(INT_DATA_DONE, DATA_TIMEOUT_NS);
+        if (rc != 0) {
+            emmc_reset_lines();
+            return rc;
+        }
+    }
+    return 0;
+}
+
+static int sd_app_cmd(uint32_t cmd, uint32_t arg, uint32_t *resp) {
+    int rc = sd_cmd(CMD_APP_CMD, g_sd.rca << 16, 0);
+    if (rc != 0) return rc;
+    return sd_cmd(cmd, arg, resp);
+}
+
+/* EMMC base clock: from the capabilities, else from the firmware. */
+static uint32_t emmc_base_clock_hz(void) {
+    uint32_t mhz = (*emmc_reg(EMMC_CAPS0) >> CAPS0_BASE_CLK_SHIFT) & 0xFFu;
+    if (mhz != 0) return mhz * 1000000u;
+
+    static uint32_t msg[8] __attribute__((aligned(16)));
+    msg[2] = 0x00030002u; /* get clock rate */
+    msg[3] = 8;
+    msg[4] = 0;
+    msg[5] = 1;           /* EMMC */
+    msg[6] = 0;
+    msg[7] = 0;
+    if (mailbox_property_call(msg, sizeof(msg)) == 0 && msg[6] != 0) return msg[6];
+
+    return 50000000u;
+}
+
+static int emmc_set_clock(uint32_t hz) {
+    if (emmc_wait_clear(EMMC_STATUS, STATUS_CMD_INHIBIT | STATUS_DAT_INHIBIT, CMD_TIMEOUT_NS) != 0) {
+        return -(int)EIO;
+    }
+
+    uint32_t c1 = *emmc_reg(EMMC_CONTROL1);
+    c1 &= ~CONTROL1_CLK_EN;
+    *emmc_reg(EMMC_CONTROL1) = c1;
+
+    /* SD clock = base / (2 * div), div = 0 meaning undivided. Before
+     * SDHCI 3.0 div must be a power of two and fit 8 bits.
+     */
+    uint32_t div = 0;
+    if (g_sd.base_hz > hz) {
+        div = (g_sd.base_hz + 2u * hz - 1u) / (2u * hz);
+        if (g_sd.version < 2u) {
+            uint32_t p = 1;
+            while (p < div && p < 0x80u) p <<= 1;
+            div = p;
+        }
+        if (div > 0x3FFu) div = 0x3FFu;
+    }
+
+    c1 &= ~(CONTROL1_DIV_MASK | CONTROL1_TOUNIT_MASK);
+    c1 |= ((div & 0xFFu) << 8) | (((div >> 8) & 3u) << 6);
+    c1 |= CONTROL1_CLK_INTLEN | CONTROL1_TOUNIT_MAX;
+    *emmc_reg(EMMC_CONTROL1) = c1;
+
+    uint64_t dl = deadline_ns(CMD_TIMEOUT_NS);
+    while ((*emmc_reg(EMMC_CONTROL1) & CONTROL1_CLK_STABLE) == 0) {
+        if (!time_before_deadline(dl)) return -(int)ETIMEDOUT;
+    }
+
+    *emmc_reg(EMMC_CONTROL1) = c1 | CONTROL1_CLK_EN;
+    udelay_ns(2000000ull);
+    return 0;
+}
+
+/* CSD field at CSD bit start; the response registers hold CSD[127:8]. */
+static uint32_t csd_bits(const uint32_t *r, uint32_t start, uint32_t width) {
+    uint32_t v = 0;
+    for (uint32_t i = 0; i < width; i++) {
+        uint32_t b = start + i - 8u;
+        v |= ((r[b / 32u] >> (b % 32u)) & 1u) << i;
+    }
+    return v;
+}
+
+static uint64_t csd_sectors(const uint32_t *csd) {
+    if (csd_bits(csd, 126, 2) == 1u) {
+        /* CSD 2.0 (SDHC/SDXC): (C_SIZE + 1) * 512KiB. */
+        return ((uint64_t)csd_bits(csd, 48, 22) + 1u) * 1024u;
+    }
+    uint64_t c_size = csd_bits(csd, 62, 12);
+    uint32_t mult = csd_bits(csd, 47, 3);
+    uint32_t bl_len = csd_bits(csd, 80, 4);
+    return ((c_size + 1u) << (mult + 2u + bl_len)) / SDHCI_SECTOR_SIZE;
+}
+
+static int sd_card_init(void) {
+    uint32_t r[4];
+
+    if (sd_cmd(CMD_GO_IDLE, 0, 0) != 0) return -1;
+
+    /* CMD8 (voltage check, echo pattern) is only answered by v2.0+ cards. */
+    int v2 = 0;
+    int rc = sd_cmd(CMD_SEND_IF_COND, 0x1AAu, r);
+    if (rc == 0) {
+        if ((r[0] & 0xFFFu) != 0x1AAu) return -1;
+        v2 = 1;
+    } else if (rc != -(int)ETIMEDOUT) {
+        return -1;
+    }
+
+    g_sd.rca = 0;
+    uint64_t dl = deadline_ns(INIT_TIMEOUT_NS);
+    for (;;) {
+        if (sd_app_cmd(ACMD_SEND_OP_COND, OCR_VOLTS | (v2 ? OCR_HCS : 0u), r) != 0) return -1;
+        if ((r[0] & OCR_BUSY) != 0) break;
+        if (!time_before_deadline(dl)) return -1;
+        udelay_ns(10000000ull);
+    }
+    g_sd.high_capacity = (r[0] & OCR_HCS) ? 1u : 0u;
+
+    if (sd_cmd(CMD_ALL_SEND_CID, 0, r) != 0) return -1;
+    if (sd_cmd(CMD_SEND_REL_ADDR, 0, r) != 0) return -1;
+    g_sd.rca = r[0] >> 16;
+
+    if (sd_cmd(CMD_SEND_CSD, g_sd.rca << 16, r) != 0) return -1;
+    g_sd.sectors = csd_sectors(r);
+
+    if (sd_cmd(CMD_SELECT_CARD, g_sd.rca << 16, 0) != 0) return -1;
+    if (!g_sd.high_capacity && sd_cmd(CMD_SET_BLOCKLEN, SDHCI_SECTOR_SIZE, 0) != 0) return -1;
+
+    /* 4-bit bus; stay on 1 bit if the card refuses. */
+    if (sd_app_cmd(ACMD_SET_BUS_WIDTH, 2u, 0) == 0) {
+        *emmc_reg(EMMC_CONTROL0) |= CONTROL0_DWIDTH4;
+    }
+
+    return emmc_set_clock(SD_CLOCK_XFER_HZ);
+}
+
+static void sd_timer_fn(ktimer_t *t, void *arg);
+
+int sdhci_init(void) {
+    g_sd.present = 0;
+    g_sd.sectors = 0;
+    g_sd.version = (*emmc_reg(EMMC_SLOTISR_VER) >> 16) & 0xFFu;
+
+    *emmc_reg(EMMC_CONTROL1) = CONTROL1_SRST_HC;
+    if (emmc_wait_clear(EMMC_CONTROL1, CONTROL1_SRST_HC, CMD_TIMEOUT_NS) != 0) {
+        uart_write("sd: controller reset timed out\n");
+        return -1;
+    }
+
+    *emmc_reg(EMMC_CONTROL0) = CONTROL0_POWER_33V;
+    *emmc_reg(EMMC_CONTROL2) = 0;
+    /* Latch every status bit; signal none while the card is brought up
+     * polled (transfers enable their interrupts below).
+     */
+    *emmc_reg(EMMC_IRPT_MASK) = 0xFFFFFFFFu;
+    *emmc_reg(EMMC_IRPT_EN) = 0;
+    *emmc_reg(EMMC_INTERRUPT) = 0xFFFFFFFFu;
+
+    g_sd.base_hz = emmc_base_clock_hz();
+    if (emmc_set_clock(SD_CLOCK_ID_HZ) != 0) {
+        uart_write("sd: clock did not stabilise\n");
+        return -1;
+    }
+
+    if (sd_card_init() != 0) {
+        uart_write("sd: no card\n");
+        return -1;
+    }
+
+    if ((*emmc_reg(EMMC_CAPS0) & CAPS0_ADMA2) != 0 && !g_sd.adma) {
+        g_sd.adma = (adma_desc_t *)dma_alloc(ADMA_DESCS * sizeof(adma_desc_t));
+    }
+
+    g_sd.head = g_sd.tail = 0;
+    g_sd.issued = 0;
+    timer_init(&g_sd.timer, sd_timer_fn, 0);
+    *emmc_reg(EMMC_INTERRUPT) = 0xFFFFFFFFu;
+    *emmc_reg(EMMC_IRPT_EN) = INT_XFER_MASK;
+
+    g_sd.present = 1;
+    uart_write("sd: card sectors=");
+    uart_write_hex_u64(g_sd.sectors);
+    uart_write(g_sd.adma ? " (ADMA2)\n" : " (PIO)\n");
+    return 0;
+}
+
+uint64_t sdhci_sectors(void) {
+    return g_sd.present ? g_sd.sectors : 0;
+}
+
+int sdhci_uses_dma(void) {
+    return g_sd.adma != 0;
+}
+
+static uint64_t sd_virt_to_phys(const void *p) {
+    uint64_t va = (uint64_t)(uintptr_t)p;
+    if (va >= KERNEL_VA_BASE) return va - KERNEL_VA_BASE;
+    return va;
+}
+
+/* Fill the descriptor table; 0 if a segment is out of the controller's
+ * 32-bit reach or the table is too small (the caller then uses PIO).
+ */
+static int adma_build(const sdhci_seg_t *segs, uint32_t nsegs) {
+    uint32_t n = 0;
+    for (uint32_t s = 0; s < nsegs; s++) {
+        uint64_t pa = sd_virt_to_phys(segs[s].buf);
+        if (pa + segs[s].len > 0x100000000ull) return 0;
+        for (uint32_t off = 0; off < segs[s].len; off += ADMA_CHUNK) {
+            if (n == ADMA_DESCS) return 0;
+            uint32_t len = segs[s].len - off;
+            if (len > ADMA_CHUNK) len = ADMA_CHUNK;
+            g_sd.adma[n].attr_len = (len << 16) | ADMA_ACT_TRAN | ADMA_VALID;
+            g_sd.adma[n].addr = (uint32_t)(pa + off);
+            n++;
+        }
+    }
+    g_sd.adma[n - 1u].attr_len |= ADMA_END;
+    return 1;
+}
+
+/* Move one sector through the data port, a word at a time. */
+static void pio_block(int write, uint32_t *words) {
+    volatile uint32_t *port = emmc_reg(EMMC_DATA);
+    for (uint32_t i = 0; i < SDHCI_SECTOR_SIZE / 4u; i++) {
+        if (write) *port = words[i];
+        else words[i] = *port;
+    }
+}
+
+static void sd_start(void);
+
+/* The head request becomes current: it has DATA_TIMEOUT_NS to get through. */
+static void sd_next(void) {
+    g_sd.issued = 0;
+    if (!g_sd.head) return;
+    g_sd.deadline = time_now_ns() + DATA_TIMEOUT_NS;
+    sd_start();
+}
+
+/* Complete the head request and start the next one. */
+static void sd_finish(int rc) {
+    sdhci_req_t *r = g_sd.head;
+    timer_cancel(&g_sd.timer);
+    if (rc != 0) emmc_reset_lines();
+
+    if (rc == 0 && r->dma && !r->write) {
+        for (uint32_t s = 0; s < r->nsegs; s++) {
+            cache_invalidate_dcache_for_range((uint64_t)(uintptr_t)r->segs[s].buf, r->segs[s].len);
+        }
+    }
+
+    g_sd.head = r->next;
+    if (!g_sd.head) g_sd.tail = 0;
+    r->next = 0;
+    sd_next();
+    r->done(r, rc);
+}
+
+/* Send the head request's command. The controller then interrupts for each
+ * sector the data port is ready for (PIO) and once the data is through.
+ */
+static void sd_start(void) {
+    sdhci_req_t *r = g_sd.head;
+
+    /* The card may still be busy with the previous command (programming
+     * a write): look again shortly rather than spin.
+     */
+    if ((*emmc_reg(EMMC_STATUS) & (STATUS_CMD_INHIBIT | STATUS_DAT_INHIBIT)) != 0) {
+        timer_arm(&g_sd.timer, time_now_ns() + INHIBIT_RETRY_NS);
+        return;
+    }
+
+    /* Standard capacity cards are byte addressed. */
+    uint64_t addr = g_sd.high_capacity ? r->lba : r->lba * SDHCI_SECTOR_SIZE;
+
+    r->dma = g_sd.adma && adma_build(r->segs, r->nsegs);
+    for (uint32_t s = 0; s < r->nsegs && r->dma; s++) {
+        /* Write: the controller reads memory. Read: drop any lines that
+         * could be evicted over the incoming data.
+         */
+        uint64_t va = (uint64_t)(uintptr_t)r->segs[s].buf;
+        if (r->write) cache_clean_dcache_for_range(va, r->segs[s].len);
+        else cache_invalidate_dcache_for_range(va, r->segs[s].len);
+    }
+
+    uint32_t cmd;
+    if (r->count > 1u) {
+        cmd = (r->write ? CMD_WRITE_MULTI : CMD_READ_MULTI) | TM_MULTI_BLK | TM_AUTO_CMD12;
+    } else {
+        cmd = r->write ? CMD_WRITE_SINGLE : CMD_READ_SINGLE;
+    }
+    cmd |= TM_BLKCNT_EN;
+    if (!r->write) cmd |= TM_DAT_DIR_RD;
+
+    uint32_t c0 = *emmc_reg(EMMC_CONTROL0) & ~CONTROL0_DMA_MASK;
+    if (r->dma) {
+        cmd |= TM_DMA_EN;
+        *emmc_reg(EMMC_CONTROL0) = c0 | CONTROL0_ADMA2_32;
+        *emmc_reg(EMMC_ADMA_ADDR) = (uint32_t)sd_virt_to_phys(g_sd.adma);
+        dsb_sy();
+    } else {
+        *emmc_reg(EMMC_CONTROL0) = c0;
+    }
+    *emmc_reg(EMMC_BLKSIZECNT) = SDHCI_SECTOR_SIZE | (r->count << 16);
+
+    *emmc_reg(EMMC_INTERRUPT) = 0xFFFFFFFFu;
+    *emmc_reg(EMMC_ARG1) = (uint32_t)addr;
+    *emmc_reg(EMMC_CMDTM) = cmd;
+    g_sd.issued = 1;
+    timer_arm(&g_sd.timer, g_sd.deadline);
+}
+
+static void sd_timer_fn(ktimer_t *t, void *arg) {
+    (void)t;
+    (void)arg;
+    if (!g_sd.head) return;
+    if (g_sd.issued || time_now_ns() >= g_sd.deadline) {
+        /* Not even a timeout error from the controller. */
+        sd_finish(-(int)EIO);
+        return;
+    }
+    sd_start();
+}
+
+int sdhci_submit(sdhci_req_t *r) {
+    if (!g_sd.present) return -(int)EIO;
+    if (!r || !r->done || !r->segs || r->nsegs == 0 || r->nsegs > SDHCI_MAX_SEGS) {
+        return -(int)EINVAL;
+    }
+
+    uint64_t bytes = 0;
+    for (uint32_t s = 0; s < r->nsegs; s++) {
+        const sdhci_seg_t *sg = &r->segs[s];
+        if (!sg->buf || sg->len == 0 || (sg->len % SDHCI_SECTOR_SIZE) != 0 ||
+            ((uintptr_t)sg->buf & 3u) != 0) {
+            return -(int)EINVAL;
+        }
+        bytes += sg->len;
+    }
+    uint64_t count = bytes / SDHCI_SECTOR_SIZE;
+    if (count > 0xFFFFu || r->lba + count > g_sd.sectors) return -(int)EINVAL;
+    if ((g_sd.high_capacity ? r->lba : r->lba * SDHCI_SECTOR_SIZE) > 0xFFFFFFFFull) {
+        return -(int)EINVAL;
+    }
+
+    r->next = 0;
+    r->count = (uint32_t)count;
+    r->seg = 0;
+    r->off = 0;
+    r->dma = 0;
+    if (g_sd.tail) g_sd.tail->next = r;
+    else g_sd.head = r;
+    g_sd.tail = r;
+    if (g_sd.head == r) sd_next();
+    return 0;
+}
+
+void sdhci_irq(void) {
+    uint32_t v = *emmc_reg(EMMC_INTERRUPT);
+    sdhci_req_t *r = g_sd.head;
+    if (!r || !g_sd.issued) {
+        /* Nothing on the controller (e.g. left over from the firmware). */
+        *emmc_reg(EMMC_INTERRUPT) = v;
+        return;
+    }
+
+    if ((v & INT_ERROR_MASK) != 0) {
+        sd_finish(-(int)EIO);
+        return;
+    }
+    *emmc_reg(EMMC_INTERRUPT) = v & (INT_CMD_DONE | INT_DATA_DONE | INT_WRITE_RDY | INT_READ_RDY);
+
+    /* One sector per "ready": the next one's is raised once it has moved. */
+    if ((v & (INT_WRITE_RDY | INT_READ_RDY)) != 0 && !r->dma && r->seg < r->nsegs) {
+        pio_block(r->write, (uint32_t *)(void *)((uint8_t *)r->segs[r->seg].buf + r->off));
+        r->off += SDHCI_SECTOR_SIZE;
+        if (r->off == r->segs[r->seg].len) {
+            r->seg++;
+            r->off = 0;
+        }
+    }
+
+    if ((v & INT_DATA_DONE) != 0) {
+        sd_finish((r->dma || r->seg == r->nsegs) ? 0 : -(int)EIO);
+    }
+}
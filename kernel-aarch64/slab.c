@@ -0,0 +1,306 @@
+#include "slab.h"
+
+#include "pmm.h"
+
+#define SLAB_PAGE_SIZE 4096ull
+#define SLAB_MAX_CACHES 32u
+/* Grow slabs until they hold at least this many objects (bounded by order). */
+#define SLAB_MIN_OBJS 8u
+#define SLAB_MAX_ORDER 3u
+/* Fully free slabs kept per cache before returning them to the PMM. */
+#define SLAB_KEEP_EMPTY 1u
+
+#define KMALLOC_MIN_SHIFT 4u  /* 16 B */
+#define KMALLOC_MAX_SHIFT 11u /* 2 KiB */
+#define KMALLOC_CLASSES (KMALLOC_MAX_SHIFT - KMALLOC_MIN_SHIFT + 1u)
+
+/* Slab header, at the start of the slab's first page. */
+typedef struct slab {
+    kmem_cache_t *cache;
+    struct slab *prev;
+    struct slab *next;
+    void *freelist;
+    uint32_t inuse;
+} slab_t;
+
+struct kmem_cache {
+    const char *name;
+    uint32_t obj_size;
+    /* Distance between objects; the free-list link sits at free_off. */
+    uint32_t stride;
+    uint32_t free_off;
+    uint32_t order;
+    uint32_t objs_per_slab;
+    uint32_t first_off;
+    kmem_ctor_t ctor;
+
+    slab_t *partial;
+    slab_t *full;
+    slab_t *empty;
+    uint32_t nr_empty;
+
+    uint64_t active_objs;
+    uint64_t slabs;
+    uint64_t allocs;
+    uint64_t frees;
+};
+
+static kmem_cache_t g_caches[SLAB_MAX_CACHES];
+static uint32_t g_cache_count;
+
+static kmem_cache_t *g_kmalloc[KMALLOC_CLASSES];
+static const char *const g_kmalloc_names[KMALLOC_CLASSES] = {
+    "kmalloc-16", "kmalloc-32", "kmalloc-64", "kmalloc-128",
+    "kmalloc-256", "kmalloc-512", "kmalloc-1024", "kmalloc-2048",
+};
+
+static inline uint64_t align_up_u64(uint64_t v, uint64_t a) {
+    return (v + (a - 1)) & ~(a - 1);
+}
+
+static void mem_zero(void *p, uint64_t n) {
+    uint8_t *d = (uint8_t *)p;
+    for (uint64_t i = 0; i < n; i++) d[i] = 0;
+}
+
+static inline void **obj_link(const kmem_cache_t *c, void *obj) {
+    return (void **)((uint8_t *)obj + c->free_off);
+}
+
+static void list_push(slab_t **head, slab_t *s) {
+    s->prev = 0;
+    s->next = *head;
+    if (*head) (*head)->prev = s;
+    *head = s;
+}
+
+static void list_remove(slab_t **head, slab_t *s) {
+    if (s->prev) s->prev->next = s->next;
+    else *head = s->next;
+    if (s->next) s->next->prev = s->prev;
+    s->prev = 0;
+    s->next = 0;
+}
+
+kmem_cache_t *kmem_cache_create(const char *name, uint32_t size, uint32_t align, kmem_ctor_t ctor) {
+    if (g_cache_count >= SLAB_MAX_CACHES || size == 0) {
+        return 0;
+    }
+    if (align < 16u) align = 16u;
+
+    kmem_cache_t *c = &g_caches[g_cache_count++];
+    mem_zero(c, sizeof(*c));
+    c->name = name;
+    c->obj_size = size;
+    c->ctor = ctor;
+
+    /* A constructed object must survive being free: keep the free-list link
+     * past its end instead of in its first word.
+     */
+    uint64_t stride = size < sizeof(void *) ? sizeof(void *) : size;
+    c->free_off = 0;
+    if (ctor) {
+        c->free_off = (uint32_t)align_up_u64(size, sizeof(void *));
+        stride = c->free_off + sizeof(void *);
+    }
+    c->stride = (uint32_t)align_up_u64(stride, align);
+    c->first_off = (uint32_t)align_up_u64(sizeof(slab_t), align);
+
+    uint32_t order = 0;
+    for (;;) {
+        uint64_t bytes = SLAB_PAGE_SIZE << order;
+        uint64_t n = (bytes > c->first_off) ? (bytes - c->first_off) / c->stride : 0;
+        if ((n >= SLAB_MIN_OBJS || order >= SLAB_MAX_ORDER) && n > 0) {
+            c->objs_per_slab = (uint32_t)n;
+            break;
+        }
+        if (order >= PMM_MAX_ORDER) {
+            break;
+        }
+        order++;
+    }
+    c->order = order;
+    return c;
+}
+
+static slab_t *slab_grow(kmem_cache_t *c) {
+    if (c->objs_per_slab == 0) {
+        return 0;
+    }
+    uint64_t pages = 1ull << c->order;
+    uint64_t pa = pmm_alloc_pages(pages);
+    if (pa == 0) {
+        return 0;
+    }
+
+    slab_t *s = (slab_t *)(uintptr_t)pa;
+    s->cache = c;
+    s->prev = 0;
+    s->next = 0;
+    s->inuse = 0;
+    s->freelist = 0;
+
+    for (uint64_t i = 0; i < pages; i++) {
+        pmm_page_t *pg = pmm_page(pa + i * SLAB_PAGE_SIZE);
+        if (pg) {
+            pg->slab = s;
+            pg->flags = PMM_PAGE_SLAB;
+        }
+    }
+
+    /* Thread the free list in address order. */
+    uint8_t *base = (uint8_t *)s + c->first_off;
+    for (uint32_t i = c->objs_per_slab; i > 0; i--) {
+        void *obj = base + (uint64_t)(i - 1u) * c->stride;
+        if (c->ctor) c->ctor(obj);
+        *obj_link(c, obj) = s->freelist;
+        s->freelist = obj;
+    }
+
+    c->slabs++;
+    return s;
+}
+
+static void slab_release(kmem_cache_t *c, slab_t *s) {
+    uint64_t pages = 1ull << c->order;
+    uint64_t pa = (uint64_t)(uintptr_t)s;
+    for (uint64_t i = 0; i < pages; i++) {
+        pmm_page_t *pg = pmm_page(pa + i * SLAB_PAGE_SIZE);
+        if (pg) {
+            pg->slab = 0;
+            pg->flags = 0;
+        }
+    }
+    c->slabs--;
+    pmm_free_pages(pa, pages);
+}
+
+void *kmem_cache_alloc(kmem_cache_t *c) {
+    if (!c) return 0;
+
+    slab_t *s = c->partial;
+    if (!s) {
+        s = c->empty;
+        if (s) {
+            list_remove(&c->empty, s);
+            c->nr_empty--;
+        } else {
+            s = slab_grow(c);
+            if (!s) return 0;
+        }
+        list_push(&c->partial, s);
+    }
+
+    void *obj = s->freelist;
+    s->freelist = *obj_link(c, obj);
+    s->inuse++;
+    if (s->inuse == c->objs_per_slab) {
+        list_remove(&c->partial, s);
+        list_push(&c->full, s);
+    }
+
+    c->active_objs++;
+    c->allocs++;
+    return obj;
+}
+
+void kmem_cache_free(kmem_cache_t *c, void *obj) {
+    if (!c || !obj) return;
+    pmm_page_t *pg = pmm_page((uint64_t)(uintptr_t)obj);
+    if (!pg || !(pg->flags & PMM_PAGE_SLAB)) return;
+    slab_t *s = (slab_t *)pg->slab;
+    if (!s || s->cache != c) return;
+
+    if (s->inuse == c->objs_per_slab) {
+        list_remove(&c->full, s);
+        list_push(&c->partial, s);
+    }
+    *obj_link(c, obj) = s->freelist;
+    s->freelist = obj;
+    s->inuse--;
+
+    if (s->inuse == 0) {
+        list_remove(&c->partial, s);
+        if (c->nr_empty < SLAB_KEEP_EMPTY) {
+            list_push(&c->empty, s);
+            c->nr_empty++;
+        } else {
+            slab_release(c, s);
+        }
+    }
+
+    c->active_objs--;
+    c->frees++;
+}
+
+void slab_init(void) {
+    for (uint32_t i = 0; i < KMALLOC_CLASSES; i++) {
+        g_kmalloc[i] = kmem_cache_create(g_kmalloc_names[i], 1u << (KMALLOC_MIN_SHIFT + i), 0, 0);
+    }
+}
+
+void *kmalloc(uint64_t size) {
+    if (size == 0) return 0;
+
+    if (size <= (1ull << KMALLOC_MAX_SHIFT)) {
+        uint32_t shift = KMALLOC_MIN_SHIFT;
+        while ((1ull << shift) < size) shift++;
+        return kmem_cache_alloc(g_kmalloc[shift - KMALLOC_MIN_SHIFT]);
+    }
+
+    /* Large: whole buddy blocks. */
+    uint64_t pages = (size + SLAB_PAGE_SIZE - 1u) / SLAB_PAGE_SIZE;
+    uint32_t order = 0;
+    while ((1ull << order) < pages) order++;
+    if (order > PMM_MAX_ORDER) return 0;
+
+    uint64_t pa = pmm_alloc_pages(1ull << order);
+    if (pa == 0) return 0;
+    pmm_page_t *pg = pmm_page(pa);
+    if (pg) {
+        pg->slab = 0;
+        pg->flags = PMM_PAGE_KMALLOC;
+        pg->order = order;
+    }
+    return (void *)(uintptr_t)pa;
+}
+
+void *kzalloc(uint64_t size) {
+    void *p = kmalloc(size);
+    if (p) mem_zero(p, size);
+    return p;
+}
+
+void kfree(void *p) {
+    if (!p) return;
+    uint64_t pa = (uint64_t)(uintptr_t)p;
+    pmm_page_t *pg = pmm_page(pa);
+    if (!pg) return;
+
+    if (pg->flags & PMM_PAGE_SLAB) {
+        slab_t *s = (slab_t *)pg->slab;
+        kmem_cache_free(s->cache, p);
+        return;
+    }
+    if ((pg->flags & PMM_PAGE_KMALLOC) && (pa & (SLAB_PAGE_SIZE - 1u)) == 0) {
+        uint32_t order = pg->order;
+        pg->flags = 0;
+        pg->order = 0;
+        pmm_free_pages(pa, 1ull << order);
+    }
+}
+
+int kmem_cache_stats(uint32_t i, kmem_cache_stats_t *out) {
+    if (i >= g_cache_count || !out) return 0;
+    const kmem_cache_t *c = &g_caches[i];
+    out->name = c->name;
+    out->obj_size = c->obj_size;
+    out->objs_per_slab = c->objs_per_slab;
+    out->pages_per_slab = 1u << c->order;
+    out->active_objs = c->active_objs;
+    out->total_objs = c->slabs * c->objs_per_slab;
+    out->slabs = c->slabs;
+    out->allocs = c->allocs;
+    out->frees = c->frees;
+    return 1;
+}
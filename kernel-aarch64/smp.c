@@ -0,0 +1,96 @@
+#include "smp.h"
+
+#include "cache.h"
+#include "irq.h"
+#include "mmu.h"
+#include "sched.h"
+#include "time.h"
+#include "uart_pl011.h"
+
+/*
+ * Spin-table release addresses used by the Raspberry Pi armstub (and QEMU's
+ * raspi3b boot stub): core N polls the 64-bit word at 0xd8 + 8*N and jumps to
+ * it once it becomes non-zero.
+ */
+#define SPIN_TABLE_BASE 0xd8ull
+
+/* Give secondaries this long to report in before we carry on without them. */
+#define SMP_ONLINE_TIMEOUT_NS 100000000ull
+
+extern unsigned char _secondary_start[];
+
+cpu_t g_cpus[MAX_CPUS] = {
+    { .cur_proc = 0, .last_sched = 0, .reap_idx = -1, .online = 1 },
+    { .cur_proc = -1, .last_sched = -1, .reap_idx = -1, .online = 0 },
+    { .cur_proc = -1, .last_sched = -1, .reap_idx = -1, .online = 0 },
+    { .cur_proc = -1, .last_sched = -1, .reap_idx = -1, .online = 0 },
+};
+
+static spinlock_t g_kernel_lock = SPINLOCK_INIT;
+
+void kernel_lock(void) {
+    spin_lock(&g_kernel_lock);
+}
+
+void kernel_unlock(void) {
+    spin_unlock(&g_kernel_lock);
+}
+
+static void spin_table_write(uint64_t core, uint64_t entry_pa) {
+    uint64_t addr = SPIN_TABLE_BASE + core * 8ull;
+    /* Plain stores to such a low constant address trip GCC's null-page checks. */
+    __asm__ volatile("str %0, [%1]" :: "r"(entry_pa), "r"(addr) : "memory");
+}
+
+uint32_t smp_online_count(void) {
+    uint32_t n = 0;
+    for (uint32_t i = 0; i < MAX_CPUS; i++) {
+        if (((volatile cpu_t *)&g_cpus[i])->online) n++;
+    }
+    return n;
+}
+
+void smp_init(void) {
+    if (SMP_NCPUS <= 1) {
+        uart_write("smp: secondaries disabled\n");
+        return;
+    }
+
+    uint64_t entry = (uint64_t)(uintptr_t)_secondary_start;
+    for (uint64_t core = 1; core < SMP_NCPUS && core < MAX_CPUS; core++) {
+        spin_table_write(core, entry);
+    }
+
+    /* Secondaries start with caches off: push the spin-table entries and
+     * everything they read before enabling their MMU (page tables, mmu.c
+     * boot state) out to memory.
+     */
+    cache_clean_invalidate_all();
+    smp_send_event();
+
+    uint32_t want = (SMP_NCPUS < MAX_CPUS) ? SMP_NCPUS : MAX_CPUS;
+    uint64_t deadline = time_now_ns() + SMP_ONLINE_TIMEOUT_NS;
+    while (smp_online_count() < want && time_now_ns() < deadline) {
+        /* Secondaries take the kernel lock to report in. */
+    }
+
+    uart_write("smp: cores online=");
+    uart_write_hex_u64(smp_online_count());
+    uart_write("\n");
+}
+
+void smp_secondary_main(uint64_t core) {
+    mmu_init_secondary();
+
+    kernel_lock();
+    irq_init_secondary();
+    g_cpus[core].cur_proc = -1;
+    g_cpus[core].last_sched = -1;
+    g_cpus[core].online = 1;
+    uart_write("smp: core ");
+    uart_write_hex_u64(core);
+    uart_write(" online\n");
+
+    /* This boot stack becomes the core's idle context. */
+    sched_idle();
+}
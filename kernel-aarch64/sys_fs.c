@@ -1,14 +1,18 @@
 #include "syscalls.h"
 
+#include "blk.h"
 #include "errno.h"
 #include "fd.h"
 #include "initramfs.h"
 #include "linux_abi.h"
+#include "mmu.h"
 #include "pipe.h"
 #include "proc.h"
 #include "sched.h"
 #include "sys_util.h"
 #include "stat_bits.h"
+#include "string.h"
+#include "uaccess.h"
 #include "uart_pl011.h"
 #include "console_in.h"
 #include "net.h"
@@ -16,8 +20,8 @@
 #include "usb_net.h"
 #include "vfs.h"
 
-#define AT_FDCWD ((int64_t)-100)
 #include "pmm.h"
+#include "slab.h"
 
 /* openat(2) flags (minimal subset). */
 #define O_RDONLY 0u
@@ -28,6 +32,9 @@
 #define O_EXCL 0200u
 #define O_TRUNC 01000u
 
+/* Raw SD card, through the block cache (blk.h). */
+#define BLKDEV_PATH "/dev/mmcblk0"
+
 /* unlinkat(2) flags (subset). */
 #define AT_REMOVEDIR 0x200u
 
@@ -175,13 +182,84 @@ static void buf_put_mac(char *buf, uint64_t cap, uint64_t *pos, const uint8_t ma
     }
 }
 
+/* "/proc/<pid>/stat" or "/proc/self/stat": the pid named, 0 if path is neither. */
+static uint64_t procfs_stat_path_pid(const char *path) {
+    static const char prefix[] = "/proc/";
+    uint64_t i = 0;
+    for (; prefix[i] != '\0'; i++) {
+        if (path[i] != prefix[i]) return 0;
+    }
+
+    const char *s = path + i;
+    uint64_t pid = 0;
+    if (s[0] == 's' && s[1] == 'e' && s[2] == 'l' && s[3] == 'f') {
+        pid = g_procs[g_cur_proc].pid;
+        s += 4;
+    } else {
+        if (*s < '0' || *s > '9') return 0;
+        while (*s >= '0' && *s <= '9') {
+            pid = pid * 10u + (uint64_t)(*s - '0');
+            if (pid > 0xffffffffull) return 0;
+            s++;
+        }
+    }
+    return cstr_eq_u64(s, "/stat") ? pid : 0;
+}
+
+static inline uint64_t ns_to_clock_ticks(uint64_t ns) {
+    return ns / (1000000000ull / LINUX_USER_HZ);
+}
+
+/* /proc/<pid>/stat: the leading fields of the Linux format (through rss),
+ * times in clock ticks. Fields we do not track are 0.
+ */
+static uint64_t procfs_format_pid_stat(const proc_t *p, char *out, uint64_t cap) {
+    uint64_t pos = 0;
+    char st = 'S';
+    if (p->state == PROC_RUNNABLE) st = 'R';
+    else if (p->state == PROC_ZOMBIE) st = 'Z';
+
+    buf_put_u64(out, cap, &pos, p->pid);
+    buf_puts(out, cap, &pos, " (");
+    buf_puts(out, cap, &pos, p->comm);
+    buf_puts(out, cap, &pos, ") ");
+    buf_putc(out, cap, &pos, st);
+    buf_putc(out, cap, &pos, ' ');
+    buf_put_u64(out, cap, &pos, p->ppid);
+    /* pgrp session tty_nr tpgid flags */
+    buf_puts(out, cap, &pos, " 0 0 0 0 0 ");
+    /* minflt cminflt majflt cmajflt (no backing store: never major) */
+    buf_put_u64(out, cap, &pos, p->minflt);
+    buf_putc(out, cap, &pos, ' ');
+    buf_put_u64(out, cap, &pos, p->cminflt);
+    buf_puts(out, cap, &pos, " 0 0 ");
+    buf_put_u64(out, cap, &pos, ns_to_clock_ticks(p->utime_ns));
+    buf_putc(out, cap, &pos, ' ');
+    buf_put_u64(out, cap, &pos, ns_to_clock_ticks(p->stime_ns));
+    buf_putc(out, cap, &pos, ' ');
+    buf_put_u64(out, cap, &pos, ns_to_clock_ticks(p->cutime_ns));
+    buf_putc(out, cap, &pos, ' ');
+    buf_put_u64(out, cap, &pos, ns_to_clock_ticks(p->cstime_ns));
+    /* priority nice num_threads itrealvalue */
+    buf_puts(out, cap, &pos, " 20 0 1 0 ");
+    buf_put_u64(out, cap, &pos, ns_to_clock_ticks(p->start_ns));
+    buf_putc(out, cap, &pos, ' ');
+    buf_put_u64(out, cap, &pos, vm_space_size(&p->vm));
+    buf_putc(out, cap, &pos, ' ');
+    buf_put_u64(out, cap, &pos, proc_rss_kb(p) / 4u);
+    buf_putc(out, cap, &pos, '\n');
+    return pos;
+}
+
 uint64_t sys_getcwd(uint64_t buf_user, uint64_t size) {
     proc_t *cur = &g_procs[g_cur_proc];
-    uint64_t n = cstr_len_u64(cur->cwd);
+    char cwd[MAX_PATH];
     if (size == 0) return (uint64_t)(-(int64_t)EINVAL);
+    if (!cur->cwd || vfs_dentry_path(cur->cwd, cwd, sizeof(cwd)) != 0) return (uint64_t)(-(int64_t)ENOENT);
+    uint64_t n = cstr_len_u64(cwd);
     if (n + 1 > size) return (uint64_t)(-(int64_t)ERANGE);
     if (!user_range_ok(buf_user, n + 1)) return (uint64_t)(-(int64_t)EFAULT);
-    if (write_bytes_to_user(buf_user, cur->cwd, n + 1) != 0) return (uint64_t)(-(int64_t)EFAULT);
+    if (write_bytes_to_user(buf_user, cwd, n + 1) != 0) return (uint64_t)(-(int64_t)EFAULT);
     return buf_user;
 }
 
@@ -201,30 +279,25 @@ uint64_t sys_chdir(uint64_t path_user) {
         return (uint64_t)(-(int64_t)EINVAL);
     }
 
-    const uint8_t *data = 0;
-    uint64_t size = 0;
-    uint32_t mode = 0;
-    if (vfs_lookup_abs(path, &data, &size, &mode) != 0) {
-        return (uint64_t)(-(int64_t)ENOENT);
+    vfs_dentry_t *dir = 0;
+    int wrc = vfs_walk(0, path, &dir);
+    if (wrc != 0) {
+        return (uint64_t)(int64_t)wrc;
     }
-        if (!S_ISDIR(mode)) {
+    uint32_t mode = 0;
+    (void)vfs_dentry_stat(dir, 0, 0, &mode);
+    if (!S_ISDIR(mode)) {
         return (uint64_t)(-(int64_t)ENOTDIR);
     }
 
-    uint64_t n = cstr_len_u64(path);
-    if (n + 1 > sizeof(cur->cwd)) {
-        return (uint64_t)(-(int64_t)ENAMETOOLONG);
-    }
-    for (uint64_t i = 0; i <= n; i++) {
-        cur->cwd[i] = path[i];
-    }
+    /* The cwd pins its dentry: relative lookups start there. */
+    vfs_dentry_t *old = cur->cwd;
+    cur->cwd = vfs_dget(dir);
+    vfs_dput(old);
     return 0;
 }
 
 uint64_t sys_symlinkat(uint64_t target_user, int64_t newdirfd, uint64_t linkpath_user) {
-    if (newdirfd != AT_FDCWD) {
-        return (uint64_t)(-(int64_t)ENOSYS);
-    }
     if (target_user == 0 || linkpath_user == 0) {
         return (uint64_t)(-(int64_t)EFAULT);
     }
@@ -241,8 +314,9 @@ uint64_t sys_symlinkat(uint64_t target_user, int64_t newdirfd, uint64_t linkpath
     proc_t *cur = &g_procs[g_cur_proc];
 
     char link_abs[MAX_PATH];
-    if (resolve_path(cur, link_in, link_abs, sizeof(link_abs)) != 0) {
-        return (uint64_t)(-(int64_t)EINVAL);
+    {
+        int rrc = resolve_path_at(cur, newdirfd, link_in, link_abs, sizeof(link_abs));
+        if (rrc != 0) return (uint64_t)(int64_t)rrc;
     }
 
     char link_no_slash[MAX_PATH];
@@ -285,17 +359,16 @@ uint64_t sys_symlinkat(uint64_t target_user, int64_t newdirfd, uint64_t linkpath
         return (uint64_t)(-(int64_t)ENOENT);
     }
 
+    /* The target is shorter than a page: one span holds it. */
     uint8_t *data = 0;
-    uint64_t size = 0;
-    uint64_t cap = 0;
-    uint32_t mode = 0;
-    if (vfs_ramfile_get(file_id, &data, &size, &cap, &mode) != 0) {
+    int64_t space = vfs_ramfile_write_span(file_id, 0, &data);
+    if (space < 0) {
         (void)vfs_ramfile_unlink(link_no_slash);
-        return (uint64_t)(-(int64_t)ENOENT);
+        return (uint64_t)space;
     }
 
     uint64_t tlen = cstr_len_u64(target_in);
-    if (tlen > cap) {
+    if (tlen > (uint64_t)space) {
         (void)vfs_ramfile_unlink(link_no_slash);
         return (uint64_t)(-(int64_t)ENAMETOOLONG);
     }
@@ -308,9 +381,6 @@ uint64_t sys_symlinkat(uint64_t target_user, int64_t newdirfd, uint64_t linkpath
 }
 
 uint64_t sys_mkdirat(int64_t dirfd, uint64_t pathname_user, uint64_t mode) {
-    if (dirfd != AT_FDCWD) {
-        return (uint64_t)(-(int64_t)ENOSYS);
-    }
     if (pathname_user == 0) {
         return (uint64_t)(-(int64_t)EFAULT);
     }
@@ -322,8 +392,9 @@ uint64_t sys_mkdirat(int64_t dirfd, uint64_t pathname_user, uint64_t mode) {
 
     proc_t *cur = &g_procs[g_cur_proc];
     char abs_path[MAX_PATH];
-    if (resolve_path(cur, in, abs_path, sizeof(abs_path)) != 0) {
-        return (uint64_t)(-(int64_t)EINVAL);
+    {
+        int rrc = resolve_path_at(cur, dirfd, in, abs_path, sizeof(abs_path));
+        if (rrc != 0) return (uint64_t)(int64_t)rrc;
     }
 
     char p[MAX_PATH];
@@ -369,9 +440,6 @@ uint64_t sys_mkdirat(int64_t dirfd, uint64_t pathname_user, uint64_t mode) {
 }
 
 uint64_t sys_linkat(int64_t olddirfd, uint64_t oldpath_user, int64_t newdirfd, uint64_t newpath_user, uint64_t flags) {
-    if (olddirfd != AT_FDCWD || newdirfd != AT_FDCWD) {
-        return (uint64_t)(-(int64_t)EINVAL);
-    }
     if (flags != 0) {
         return (uint64_t)(-(int64_t)EINVAL);
     }
@@ -391,12 +459,14 @@ uint64_t sys_linkat(int64_t olddirfd, uint64_t oldpath_user, int64_t newdirfd, u
     proc_t *cur = &g_procs[g_cur_proc];
 
     char old_abs[MAX_PATH];
-    if (resolve_path(cur, old_in, old_abs, sizeof(old_abs)) != 0) {
-        return (uint64_t)(-(int64_t)EINVAL);
+    {
+        int rrc = resolve_path_at(cur, olddirfd, old_in, old_abs, sizeof(old_abs));
+        if (rrc != 0) return (uint64_t)(int64_t)rrc;
     }
     char new_abs[MAX_PATH];
-    if (resolve_path(cur, new_in, new_abs, sizeof(new_abs)) != 0) {
-        return (uint64_t)(-(int64_t)EINVAL);
+    {
+        int rrc = resolve_path_at(cur, newdirfd, new_in, new_abs, sizeof(new_abs));
+        if (rrc != 0) return (uint64_t)(int64_t)rrc;
     }
 
     char old_no_slash[MAX_PATH];
@@ -466,7 +536,7 @@ uint64_t sys_ioctl(uint64_t fd, uint64_t req, uint64_t argp_user) {
         return (uint64_t)(-(int64_t)EBADF);
     }
 
-    file_desc_t *d = &g_descs[didx];
+    file_desc_t *d = desc_get(didx);
     if (d->kind != FDESC_UART) {
         return (uint64_t)(-(int64_t)ENOTTY);
     }
@@ -518,9 +588,6 @@ uint64_t sys_ioctl(uint64_t fd, uint64_t req, uint64_t argp_user) {
 }
 
 uint64_t sys_openat(int64_t dirfd, uint64_t pathname_user, uint64_t flags, uint64_t mode) {
-    if (dirfd != AT_FDCWD) {
-        return (uint64_t)(-(int64_t)ENOSYS);
-    }
 
     char in[MAX_PATH];
     if (copy_cstr_from_user(in, sizeof(in), pathname_user) != 0) {
@@ -529,15 +596,18 @@ uint64_t sys_openat(int64_t dirfd, uint64_t pathname_user, uint64_t flags, uint6
 
     proc_t *cur = &g_procs[g_cur_proc];
     char path[MAX_PATH];
-    if (resolve_path(cur, in, path, sizeof(path)) != 0) {
-        return (uint64_t)(-(int64_t)EINVAL);
+    {
+        int rrc = resolve_path_at(cur, dirfd, in, path, sizeof(path));
+        if (rrc != 0) return (uint64_t)(int64_t)rrc;
     }
 
     if (resolve_final_symlink(path, sizeof(path)) != 0) {
         return (uint64_t)(-(int64_t)EINVAL);
     }
 
-    /* Minimal procfs: /proc (dir), /proc/ps, /proc/meminfo, /proc/net (files). */
+    /* Minimal procfs: /proc (dir), /proc/ps, /proc/meminfo, /proc/net,
+     * /proc/slabinfo, /proc/diskstats, /proc/<pid>/stat (files).
+     */
     if (cstr_eq_u64(path, "/proc") || cstr_eq_u64(path, "/proc/")) {
         uint64_t acc = flags & (uint64_t)O_ACCMODE;
         if (acc != (uint64_t)O_RDONLY) {
@@ -548,7 +618,7 @@ uint64_t sys_openat(int64_t dirfd, uint64_t pathname_user, uint64_t flags, uint6
         if (didx < 0) {
             return (uint64_t)(-(int64_t)EMFILE);
         }
-        file_desc_t *d = &g_descs[didx];
+        file_desc_t *d = desc_get(didx);
         desc_clear(d);
         d->kind = FDESC_PROC;
         d->refs = 1;
@@ -573,7 +643,7 @@ uint64_t sys_openat(int64_t dirfd, uint64_t pathname_user, uint64_t flags, uint6
         if (didx < 0) {
             return (uint64_t)(-(int64_t)EMFILE);
         }
-        file_desc_t *d = &g_descs[didx];
+        file_desc_t *d = desc_get(didx);
         desc_clear(d);
         d->kind = FDESC_PROC;
         d->refs = 1;
@@ -598,7 +668,7 @@ uint64_t sys_openat(int64_t dirfd, uint64_t pathname_user, uint64_t flags, uint6
         if (didx < 0) {
             return (uint64_t)(-(int64_t)EMFILE);
         }
-        file_desc_t *d = &g_descs[didx];
+        file_desc_t *d = desc_get(didx);
         desc_clear(d);
         d->kind = FDESC_PROC;
         d->refs = 1;
@@ -623,7 +693,7 @@ uint64_t sys_openat(int64_t dirfd, uint64_t pathname_user, uint64_t flags, uint6
         if (didx < 0) {
             return (uint64_t)(-(int64_t)EMFILE);
         }
-        file_desc_t *d = &g_descs[didx];
+        file_desc_t *d = desc_get(didx);
         desc_clear(d);
         d->kind = FDESC_PROC;
         d->refs = 1;
@@ -638,6 +708,110 @@ uint64_t sys_openat(int64_t dirfd, uint64_t pathname_user, uint64_t flags, uint6
         return (uint64_t)fd;
     }
 
+    if (cstr_eq_u64(path, "/proc/slabinfo")) {
+        uint64_t acc = flags & (uint64_t)O_ACCMODE;
+        if (acc != (uint64_t)O_RDONLY) {
+            return (uint64_t)(-(int64_t)EROFS);
+        }
+
+        int didx = desc_alloc();
+        if (didx < 0) {
+            return (uint64_t)(-(int64_t)EMFILE);
+        }
+        file_desc_t *d = desc_get(didx);
+        desc_clear(d);
+        d->kind = FDESC_PROC;
+        d->refs = 1;
+        d->u.proc.node = 6u;
+        d->u.proc.off = 0;
+
+        int fd = fd_alloc_into(&cur->fdt, 3, didx);
+        desc_decref(didx);
+        if (fd < 0) {
+            return (uint64_t)(-(int64_t)EMFILE);
+        }
+        return (uint64_t)fd;
+    }
+
+    if (cstr_eq_u64(path, "/proc/diskstats")) {
+        uint64_t acc = flags & (uint64_t)O_ACCMODE;
+        if (acc != (uint64_t)O_RDONLY) {
+            return (uint64_t)(-(int64_t)EROFS);
+        }
+
+        int didx = desc_alloc();
+        if (didx < 0) {
+            return (uint64_t)(-(int64_t)EMFILE);
+        }
+        file_desc_t *d = desc_get(didx);
+        desc_clear(d);
+        d->kind = FDESC_PROC;
+        d->refs = 1;
+        d->u.proc.node = 7u;
+        d->u.proc.off = 0;
+
+        int fd = fd_alloc_into(&cur->fdt, 3, didx);
+        desc_decref(didx);
+        if (fd < 0) {
+            return (uint64_t)(-(int64_t)EMFILE);
+        }
+        return (uint64_t)fd;
+    }
+
+    if (cstr_eq_u64(path, BLKDEV_PATH)) {
+        if (blk_size() == 0) {
+            return (uint64_t)(-(int64_t)ENOENT);
+        }
+
+        int didx = desc_alloc();
+        if (didx < 0) {
+            return (uint64_t)(-(int64_t)EMFILE);
+        }
+        file_desc_t *d = desc_get(didx);
+        desc_clear(d);
+        d->kind = FDESC_BLKDEV;
+        d->refs = 1;
+        d->u.blkdev.writable = ((flags & (uint64_t)O_ACCMODE) != (uint64_t)O_RDONLY) ? 1u : 0u;
+        d->u.blkdev.off = 0;
+
+        int fd = fd_alloc_into(&cur->fdt, 3, didx);
+        desc_decref(didx);
+        if (fd < 0) {
+            return (uint64_t)(-(int64_t)EMFILE);
+        }
+        return (uint64_t)fd;
+    }
+
+    uint64_t stat_pid = procfs_stat_path_pid(path);
+    if (stat_pid != 0) {
+        uint64_t acc = flags & (uint64_t)O_ACCMODE;
+        if (acc != (uint64_t)O_RDONLY) {
+            return (uint64_t)(-(int64_t)EROFS);
+        }
+        if (proc_find_idx_by_pid(stat_pid) < 0) {
+            return (uint64_t)(-(int64_t)ENOENT);
+        }
+
+        int didx = desc_alloc();
+        if (didx < 0) {
+            return (uint64_t)(-(int64_t)EMFILE);
+        }
+        file_desc_t *d = desc_get(didx);
+        desc_clear(d);
+        d->kind = FDESC_PROC;
+        d->refs = 1;
+        d->u.proc.node = 5u;
+        d->u.proc.pid = (uint32_t)stat_pid;
+        d->u.proc.off = 0;
+
+        int fd = fd_alloc_into(&cur->fdt, 3, didx);
+        desc_decref(didx);
+        if (fd < 0) {
+            return (uint64_t)(-(int64_t)EMFILE);
+        }
+        return (uint64_t)fd;
+    }
+
     /* First: if a ramfile already exists at this path, open it. */
     uint32_t ramfile_id = 0;
     if (vfs_ramfile_find_abs(path, &ramfile_id) == 0) {
@@ -655,7 +829,7 @@ uint64_t sys_openat(int64_t dirfd, uint64_t pathname_user, uint64_t flags, uint6
             return (uint64_t)(-(int64_t)EMFILE);
         }
 
-        file_desc_t *d = &g_descs[didx];
+        file_desc_t *d = desc_get(didx);
         desc_clear(d);
         d->kind = FDESC_RAMFILE;
         d->refs = 1;
@@ -724,7 +898,7 @@ uint64_t sys_openat(int64_t dirfd, uint64_t pathname_user, uint64_t flags, uint6
         if (didx < 0) {
             return (uint64_t)(-(int64_t)EMFILE);
         }
-        file_desc_t *d = &g_descs[didx];
+        file_desc_t *d = desc_get(didx);
         desc_clear(d);
         d->kind = FDESC_RAMFILE;
         d->refs = 1;
@@ -757,7 +931,7 @@ uint64_t sys_openat(int64_t dirfd, uint64_t pathname_user, uint64_t flags, uint6
         return (uint64_t)(-(int64_t)EMFILE);
     }
 
-    file_desc_t *d = &g_descs[didx];
+    file_desc_t *d = desc_get(didx);
     desc_clear(d);
     d->kind = FDESC_INITRAMFS;
     d->refs = 1;
@@ -766,16 +940,13 @@ uint64_t sys_openat(int64_t dirfd, uint64_t pathname_user, uint64_t flags, uint6
     d->u.initramfs.off = 0;
     d->u.initramfs.mode = imode;
     d->u.initramfs.is_dir = S_ISDIR(imode) ? 1u : 0u;
-    d->u.initramfs.dir_path[0] = '\0';
+    d->u.initramfs.dir = 0;
     if (d->u.initramfs.is_dir) {
-        /* Store normalized path (leading slashes stripped, "/" -> ""). */
-        const char *pp = path;
-        while (*pp == '/') pp++;
-        uint64_t i;
-        for (i = 0; i + 1 < sizeof(d->u.initramfs.dir_path) && pp[i] != '\0'; i++) {
-            d->u.initramfs.dir_path[i] = pp[i];
+        /* Pin the directory: getdents64 and *at() calls start from it. */
+        vfs_dentry_t *dir = 0;
+        if (vfs_walk(0, path, &dir) == 0) {
+            d->u.initramfs.dir = vfs_dget(dir);
         }
-        d->u.initramfs.dir_path[i] = '\0';
     }
 
     int fd = fd_alloc_into(&cur->fdt, 3, didx);
@@ -799,102 +970,162 @@ uint64_t sys_close(uint64_t fd) {
     return 0;
 }
 
-uint64_t sys_read(trap_frame_t *tf, uint64_t fd, uint64_t buf_user, uint64_t len, uint64_t elr) {
+/* Copy buffered console input to the (current) user buffer, polling once. */
+static uint64_t console_read_avail(uint64_t buf_user, uint64_t len) {
+    volatile char *dst = (volatile char *)(uintptr_t)buf_user;
+
+    char c;
+    if (!console_in_try_getc(&c)) return 0;
+    dst[0] = c;
+
+    /* Drain any buffered bytes without extra polling. */
+    uint64_t n = 1;
+    for (; n < len; n++) {
+        char t;
+        if (!console_in_pop(&t)) break;
+        dst[n] = t;
+    }
+    return n;
+}
+
+uint64_t sys_read(uint64_t fd, uint64_t buf_user, uint64_t len) {
     proc_t *cur = &g_procs[g_cur_proc];
     int didx = fd_get_desc_idx(&cur->fdt, fd);
     if (didx < 0) {
         return (uint64_t)(-(int64_t)EBADF);
     }
-    if (!user_range_ok(buf_user, len)) {
-        return (uint64_t)(-(int64_t)EFAULT);
-    }
     if (len == 0) return 0;
 
-    file_desc_t *d = &g_descs[didx];
+    file_desc_t *d = desc_get(didx);
     if (d->kind == FDESC_UART) {
-        volatile char *dst = (volatile char *)(uintptr_t)buf_user;
-
-        char c;
-
-retry_first_byte:
-        /* Try to get one byte without blocking. */
-        if (!console_in_try_getc(&c)) {
-            /* True blocking read: park the task until input arrives. */
-            tf_copy(&cur->tf, tf);
-            cur->elr = elr;
-
-            cur->pending_console_read = 1;
-            cur->pending_read_fd = fd;
-            cur->pending_read_buf_user = buf_user;
-            cur->pending_read_len = len;
-
-            cur->state = PROC_BLOCKED_IO;
-
-            int next = sched_pick_next_runnable();
-            if (next >= 0 && next != g_cur_proc) {
-                proc_switch_to(next, tf);
-                return SYSCALL_SWITCHED;
-            }
-
-            /* No other runnable tasks; sched_pick_next_runnable may have idled
-             * until input arrived and made us runnable again.
-             */
-            if (cur->state == PROC_BLOCKED_IO) {
-                cur->state = PROC_RUNNABLE;
-            }
-            goto retry_first_byte;
+        /* Console bytes are gone once popped: check the buffer first. */
+        if (!user_range_ok(buf_user, len)) {
+            return (uint64_t)(-(int64_t)EFAULT);
         }
-
-        /* If we had parked in this syscall (no other runnable tasks), clear the
-         * pending read bookkeeping now that we're completing it inline.
+        /* True blocking read: sleep until input arrives. Another reader may
+         * take it first, in which case we simply wait for more.
          */
-        if (cur->pending_console_read) {
-            cur->pending_console_read = 0;
-            cur->pending_read_fd = 0;
-            cur->pending_read_buf_user = 0;
-            cur->pending_read_len = 0;
+        uint64_t n;
+        while ((n = console_read_avail(buf_user, len)) == 0) {
+            wait_block(cur, PROC_BLOCKED_IO, console_in_waitq(), 0);
+            sched_block();
         }
-
-        dst[0] = c;
-
-        /* Drain any buffered bytes without extra polling. */
-        uint64_t n = 1;
-        for (; n < len; n++) {
-            char t;
-            if (!console_in_pop(&t)) break;
-            dst[n] = t;
+        if (console_in_has_data()) {
+            waitq_wake_one(console_in_waitq());
         }
         return n;
     }
 
     if (d->kind == FDESC_PIPE && d->u.pipe.end == PIPE_END_READ) {
-        int64_t rc = pipe_read(d->u.pipe.pipe_id, (volatile uint8_t *)(uintptr_t)buf_user, len);
+        int64_t rc = pipe_read(d->u.pipe.pipe_id, buf_user, len);
         if (rc < 0) return (uint64_t)rc;
         return (uint64_t)rc;
     }
 
     if (d->kind == FDESC_RAMFILE) {
-        uint8_t *data = 0;
-        uint64_t size = 0;
-        uint64_t cap = 0;
-        uint32_t mode = 0;
-        if (vfs_ramfile_get(d->u.ramfile.file_id, &data, &size, &cap, &mode) != 0) {
+        if (vfs_ramfile_get(d->u.ramfile.file_id, 0, 0, 0) != 0) {
             return (uint64_t)(-(int64_t)EBADF);
         }
-        (void)cap;
-        (void)mode;
 
-        if (d->u.ramfile.off >= size) return 0;
-        uint64_t remain = size - d->u.ramfile.off;
-        uint64_t n = (len < remain) ? len : remain;
+        /* A page (or hole) at a time. */
+        uint64_t done = 0;
+        while (done < len) {
+            const uint8_t *src = 0;
+            int64_t span = vfs_ramfile_read_span(d->u.ramfile.file_id, d->u.ramfile.off, &src);
+            if (span <= 0) break;
+            uint64_t n = len - done;
+            if (n > (uint64_t)span) n = (uint64_t)span;
+            if (copy_to_user(buf_user + done, src, n) != 0) {
+                if (done == 0) return (uint64_t)(-(int64_t)EFAULT);
+                break;
+            }
+            d->u.ramfile.off += n;
+            done += n;
+        }
+        return done;
+    }
+
+    if (d->kind == FDESC_BLKDEV) {
+        /* A cached block at a time; misses read ahead. */
+        uint64_t done = 0;
+        int64_t err = 0;
+        while (done < len) {
+            const uint8_t *src = 0;
+            int64_t span = blk_read_span(d->u.blkdev.off, &src);
+            if (span <= 0) {
+                err = span;
+                break;
+            }
+            uint64_t n = len - done;
+            if (n > (uint64_t)span) n = (uint64_t)span;
+            if (copy_to_user(buf_user + done, src, n) != 0) {
+                err = -(int64_t)EFAULT;
+                break;
+            }
+            d->u.blkdev.off += n;
+            done += n;
+        }
+        if (done == 0 && err != 0) {
+            return (uint64_t)err;
+        }
+        return done;
+    }
+
+    if (d->kind == FDESC_PROC && d->u.proc.node == 7u) {
+        /* /proc/diskstats: the Linux line for the card, then throughput
+         * while the device was busy and the buffer cache counters.
+         */
+        char out[512];
+        uint64_t pos = 0;
+
+        if (blk_size() != 0) {
+            blk_stats_t bs;
+            blk_get_stats(&bs);
+            uint64_t rd_ms = bs.rd_ns / 1000000ull;
+            uint64_t wr_ms = bs.wr_ns / 1000000ull;
+
+            buf_puts(out, sizeof(out), &pos, "179 0 mmcblk0");
+            const uint64_t fields[] = {
+                bs.rd_ios, bs.rd_merges, bs.rd_sectors, rd_ms,
+                bs.wr_ios, bs.wr_merges, bs.wr_sectors, wr_ms,
+                0, rd_ms + wr_ms, rd_ms + wr_ms,
+            };
+            for (uint32_t i = 0; i < sizeof(fields) / sizeof(fields[0]); i++) {
+                buf_putc(out, sizeof(out), &pos, ' ');
+                buf_put_u64(out, sizeof(out), &pos, fields[i]);
+            }
+            buf_putc(out, sizeof(out), &pos, '\n');
 
-        volatile uint8_t *dst = (volatile uint8_t *)(uintptr_t)buf_user;
-        const uint8_t *src = data + d->u.ramfile.off;
-        for (uint64_t i = 0; i < n; i++) {
-            dst[i] = src[i];
+            buf_puts(out, sizeof(out), &pos, "ReadKBps: ");
+            buf_put_u64(out, sizeof(out), &pos, rd_ms ? bs.rd_sectors / 2u * 1000u / rd_ms : 0);
+            buf_puts(out, sizeof(out), &pos, "\nReadIOPS: ");
+            buf_put_u64(out, sizeof(out), &pos, rd_ms ? bs.rd_ios * 1000u / rd_ms : 0);
+            buf_puts(out, sizeof(out), &pos, "\nWriteKBps: ");
+            buf_put_u64(out, sizeof(out), &pos, wr_ms ? bs.wr_sectors / 2u * 1000u / wr_ms : 0);
+            buf_puts(out, sizeof(out), &pos, "\nWriteIOPS: ");
+            buf_put_u64(out, sizeof(out), &pos, wr_ms ? bs.wr_ios * 1000u / wr_ms : 0);
+            buf_puts(out, sizeof(out), &pos, "\nErrors: ");
+            buf_put_u64(out, sizeof(out), &pos, bs.errors);
+            buf_puts(out, sizeof(out), &pos, "\nCacheHits: ");
+            buf_put_u64(out, sizeof(out), &pos, bs.hits);
+            buf_puts(out, sizeof(out), &pos, "\nCacheMisses: ");
+            buf_put_u64(out, sizeof(out), &pos, bs.misses);
+            buf_puts(out, sizeof(out), &pos, "\nReadahead: ");
+            buf_put_u64(out, sizeof(out), &pos, bs.readahead);
+            buf_puts(out, sizeof(out), &pos, "\nCached: ");
+            buf_put_u64(out, sizeof(out), &pos, (uint64_t)bs.cached * (BLK_SIZE / 1024u));
+            buf_puts(out, sizeof(out), &pos, " kB\nDirty: ");
+            buf_put_u64(out, sizeof(out), &pos, (uint64_t)bs.dirty * (BLK_SIZE / 1024u));
+            buf_puts(out, sizeof(out), &pos, " kB\n");
         }
 
-        d->u.ramfile.off += n;
+        if (d->u.proc.off >= pos) return 0;
+        uint64_t remain = pos - d->u.proc.off;
+        uint64_t n = (len < remain) ? len : remain;
+        if (copy_to_user(buf_user, out + d->u.proc.off, n) != 0) {
+            return (uint64_t)(-(int64_t)EFAULT);
+        }
+        d->u.proc.off += n;
         return n;
     }
 
@@ -912,7 +1143,12 @@ retry_first_byte:
             buf_putc(out, sizeof(out), &pos, ' ');
             buf_putc(out, sizeof(out), &pos, proc_state_char(g_procs[i].state));
             buf_putc(out, sizeof(out), &pos, ' ');
-            buf_puts(out, sizeof(out), &pos, g_procs[i].cwd);
+            char cwd[MAX_PATH];
+            if (!g_procs[i].cwd || vfs_dentry_path(g_procs[i].cwd, cwd, sizeof(cwd)) != 0) {
+                cwd[0] = '?';
+                cwd[1] = '\0';
+            }
+            buf_puts(out, sizeof(out), &pos, cwd);
             buf_putc(out, sizeof(out), &pos, '\n');
         }
 
@@ -922,10 +1158,8 @@ retry_first_byte:
         if (d->u.proc.off >= pos) return 0;
         uint64_t remain = pos - d->u.proc.off;
         uint64_t n = (len < remain) ? len : remain;
-        volatile uint8_t *dst = (volatile uint8_t *)(uintptr_t)buf_user;
-        const uint8_t *src = (const uint8_t *)out + d->u.proc.off;
-        for (uint64_t i = 0; i < n; i++) {
-            dst[i] = src[i];
+        if (copy_to_user(buf_user, out + d->u.proc.off, n) != 0) {
+            return (uint64_t)(-(int64_t)EFAULT);
         }
         d->u.proc.off += n;
         return n;
@@ -933,7 +1167,7 @@ retry_first_byte:
 
     if (d->kind == FDESC_PROC && d->u.proc.node == 3u) {
         /* /proc/meminfo: minimal Linux-like snapshot backed by PMM stats. */
-        char out[256];
+        char out[384];
         uint64_t pos = 0;
 
         pmm_info_t pi = pmm_info();
@@ -955,15 +1189,78 @@ retry_first_byte:
         buf_put_u64(out, sizeof(out), &pos, free_kb);
         buf_puts(out, sizeof(out), &pos, " kB\n");
 
+        /* Free buddy blocks per order (4 kB .. 2048 kB), like /proc/buddyinfo. */
+        buf_puts(out, sizeof(out), &pos, "BuddyFree:");
+        for (uint32_t k = 0; k < PMM_ORDERS; k++) {
+            buf_putc(out, sizeof(out), &pos, ' ');
+            buf_put_u64(out, sizeof(out), &pos, pi.free_blocks[k]);
+        }
+        buf_putc(out, sizeof(out), &pos, '\n');
+
         if (pos < sizeof(out)) out[pos] = '\0';
 
         if (d->u.proc.off >= pos) return 0;
         uint64_t remain = pos - d->u.proc.off;
         uint64_t n = (len < remain) ? len : remain;
-        volatile uint8_t *dst = (volatile uint8_t *)(uintptr_t)buf_user;
-        const uint8_t *src = (const uint8_t *)out + d->u.proc.off;
-        for (uint64_t i = 0; i < n; i++) {
-            dst[i] = src[i];
+        if (copy_to_user(buf_user, out + d->u.proc.off, n) != 0) {
+            return (uint64_t)(-(int64_t)EFAULT);
+        }
+        d->u.proc.off += n;
+        return n;
+    }
+
+    if (d->kind == FDESC_PROC && d->u.proc.node == 6u) {
+        /* /proc/slabinfo: one line per slab cache. */
+        char out[2048];
+        uint64_t pos = 0;
+
+        buf_puts(out, sizeof(out), &pos, "# name active_objs num_objs objsize objperslab pagesperslab slabs allocs frees\n");
+        kmem_cache_stats_t cs;
+        for (uint32_t i = 0; kmem_cache_stats(i, &cs); i++) {
+            buf_puts(out, sizeof(out), &pos, cs.name);
+            buf_putc(out, sizeof(out), &pos, ' ');
+            buf_put_u64(out, sizeof(out), &pos, cs.active_objs);
+            buf_putc(out, sizeof(out), &pos, ' ');
+            buf_put_u64(out, sizeof(out), &pos, cs.total_objs);
+            buf_putc(out, sizeof(out), &pos, ' ');
+            buf_put_u64(out, sizeof(out), &pos, cs.obj_size);
+            buf_putc(out, sizeof(out), &pos, ' ');
+            buf_put_u64(out, sizeof(out), &pos, cs.objs_per_slab);
+            buf_putc(out, sizeof(out), &pos, ' ');
+            buf_put_u64(out, sizeof(out), &pos, cs.pages_per_slab);
+            buf_putc(out, sizeof(out), &pos, ' ');
+            buf_put_u64(out, sizeof(out), &pos, cs.slabs);
+            buf_putc(out, sizeof(out), &pos, ' ');
+            buf_put_u64(out, sizeof(out), &pos, cs.allocs);
+            buf_putc(out, sizeof(out), &pos, ' ');
+            buf_put_u64(out, sizeof(out), &pos, cs.frees);
+            buf_putc(out, sizeof(out), &pos, '\n');
+        }
+
+        if (d->u.proc.off >= pos) return 0;
+        uint64_t remain = pos - d->u.proc.off;
+        uint64_t n = (len < remain) ? len : remain;
+        if (copy_to_user(buf_user, out + d->u.proc.off, n) != 0) {
+            return (uint64_t)(-(int64_t)EFAULT);
+        }
+        d->u.proc.off += n;
+        return n;
+    }
+
+    if (d->kind == FDESC_PROC && d->u.proc.node == 5u) {
+        /* /proc/<pid>/stat: snapshot of the process' accounting. */
+        int idx = proc_find_idx_by_pid(d->u.proc.pid);
+        if (idx < 0) {
+            return (uint64_t)(-(int64_t)ESRCH);
+        }
+        char out[256];
+        uint64_t pos = procfs_format_pid_stat(&g_procs[idx], out, sizeof(out));
+
+        if (d->u.proc.off >= pos) return 0;
+        uint64_t remain = pos - d->u.proc.off;
+        uint64_t n = (len < remain) ? len : remain;
+        if (copy_to_user(buf_user, out + d->u.proc.off, n) != 0) {
+            return (uint64_t)(-(int64_t)EFAULT);
         }
         d->u.proc.off += n;
         return n;
@@ -1127,10 +1424,8 @@ retry_first_byte:
         if (d->u.proc.off >= pos) return 0;
         uint64_t remain = pos - d->u.proc.off;
         uint64_t n = (len < remain) ? len : remain;
-        volatile uint8_t *dst = (volatile uint8_t *)(uintptr_t)buf_user;
-        const uint8_t *src = (const uint8_t *)out + d->u.proc.off;
-        for (uint64_t i = 0; i < n; i++) {
-            dst[i] = src[i];
+        if (copy_to_user(buf_user, out + d->u.proc.off, n) != 0) {
+            return (uint64_t)(-(int64_t)EFAULT);
         }
         d->u.proc.off += n;
         return n;
@@ -1149,10 +1444,8 @@ retry_first_byte:
     uint64_t remain = d->u.initramfs.size - d->u.initramfs.off;
     uint64_t n = (len < remain) ? len : remain;
 
-    volatile uint8_t *dst = (volatile uint8_t *)(uintptr_t)buf_user;
-    const uint8_t *src = d->u.initramfs.data + d->u.initramfs.off;
-    for (uint64_t i = 0; i < n; i++) {
-        dst[i] = src[i];
+    if (copy_to_user(buf_user, d->u.initramfs.data + d->u.initramfs.off, n) != 0) {
+        return (uint64_t)(-(int64_t)EFAULT);
     }
 
     d->u.initramfs.off += n;
@@ -1166,7 +1459,7 @@ uint64_t sys_write(uint64_t fd, const void *buf, uint64_t len) {
         return (uint64_t)(-(int64_t)EBADF);
     }
 
-    file_desc_t *d = &g_descs[didx];
+    file_desc_t *d = desc_get(didx);
     if (d->kind == FDESC_UART) {
         const volatile char *p = (const volatile char *)buf;
         for (uint64_t i = 0; i < len; i++) {
@@ -1176,44 +1469,80 @@ uint64_t sys_write(uint64_t fd, const void *buf, uint64_t len) {
     }
 
     if (d->kind == FDESC_PIPE && d->u.pipe.end == PIPE_END_WRITE) {
-        int64_t rc = pipe_write(d->u.pipe.pipe_id, (const volatile uint8_t *)buf, len);
+        int64_t rc = pipe_write(d->u.pipe.pipe_id, (uint64_t)(uintptr_t)buf, len);
         if (rc < 0) return (uint64_t)rc;
         return (uint64_t)rc;
     }
 
     if (d->kind == FDESC_RAMFILE) {
         uint64_t src_user = (uint64_t)(uintptr_t)buf;
-        if (!user_range_ok(src_user, len)) {
-            return (uint64_t)(-(int64_t)EFAULT);
-        }
         if (len == 0) return 0;
 
-        uint8_t *data = 0;
         uint64_t size = 0;
-        uint64_t cap = 0;
-        uint32_t mode = 0;
-        if (vfs_ramfile_get(d->u.ramfile.file_id, &data, &size, &cap, &mode) != 0) {
+        if (vfs_ramfile_get(d->u.ramfile.file_id, &size, 0, 0) != 0) {
             return (uint64_t)(-(int64_t)EBADF);
         }
-        (void)mode;
 
-        if (d->u.ramfile.off >= cap) {
-            return (uint64_t)(-(int64_t)EINVAL);
-        }
-        uint64_t space = cap - d->u.ramfile.off;
-        uint64_t n = (len < space) ? len : space;
-
-        const volatile uint8_t *src = (const volatile uint8_t *)(uintptr_t)src_user;
-        uint8_t *dst = data + d->u.ramfile.off;
-        for (uint64_t i = 0; i < n; i++) {
-            dst[i] = src[i];
+        /* A page at a time, allocating pages as the file grows. */
+        uint64_t done = 0;
+        int64_t err = 0;
+        while (done < len) {
+            uint8_t *dst = 0;
+            int64_t span = vfs_ramfile_write_span(d->u.ramfile.file_id, d->u.ramfile.off, &dst);
+            if (span < 0) {
+                err = span;
+                break;
+            }
+            uint64_t n = len - done;
+            if (n > (uint64_t)span) n = (uint64_t)span;
+            if (copy_from_user(dst, src_user + done, n) != 0) {
+                err = -(int64_t)EFAULT;
+                break;
+            }
+            d->u.ramfile.off += n;
+            done += n;
         }
 
-        d->u.ramfile.off += n;
         if (d->u.ramfile.off > size) {
             (void)vfs_ramfile_set_size(d->u.ramfile.file_id, d->u.ramfile.off);
         }
-        return n;
+        if (done == 0 && err != 0) {
+            return (uint64_t)err;
+        }
+        return done;
+    }
+
+    if (d->kind == FDESC_BLKDEV) {
+        uint64_t src_user = (uint64_t)(uintptr_t)buf;
+        if (!d->u.blkdev.writable) {
+            return (uint64_t)(-(int64_t)EBADF);
+        }
+        if (len == 0) return 0;
+
+        /* Into the cache a block at a time; the flusher writes it back. */
+        uint64_t done = 0;
+        int64_t err = 0;
+        while (done < len) {
+            uint8_t *dst = 0;
+            struct blk_buf *b = 0;
+            int64_t span = blk_write_begin(d->u.blkdev.off, len - done, &dst, &b);
+            if (span <= 0) {
+                err = (span == 0) ? -(int64_t)ENOSPC : span;
+                break;
+            }
+            int filled = copy_from_user(dst, src_user + done, (uint64_t)span) == 0;
+            blk_write_end(b, filled);
+            if (!filled) {
+                err = -(int64_t)EFAULT;
+                break;
+            }
+            d->u.blkdev.off += (uint64_t)span;
+            done += (uint64_t)span;
+        }
+        if (done == 0 && err != 0) {
+            return (uint64_t)err;
+        }
+        return done;
     }
 
     return (uint64_t)(-(int64_t)EBADF);
@@ -1283,7 +1612,7 @@ uint64_t sys_getdents64(uint64_t fd, uint64_t dirp_user, uint64_t count) {
     if (didx < 0) {
         return (uint64_t)(-(int64_t)EBADF);
     }
-    file_desc_t *d = &g_descs[didx];
+    file_desc_t *d = desc_get(didx);
     if (d->kind == FDESC_PROC && d->u.proc.node == 1u) {
         if (!user_range_ok(dirp_user, count)) {
             return (uint64_t)(-(int64_t)EFAULT);
@@ -1301,6 +1630,8 @@ uint64_t sys_getdents64(uint64_t fd, uint64_t dirp_user, uint64_t count) {
         (void)dents_emit_cb("ps", S_IFREG, &dc);
         (void)dents_emit_cb("meminfo", S_IFREG, &dc);
         (void)dents_emit_cb("net", S_IFREG, &dc);
+        (void)dents_emit_cb("slabinfo", S_IFREG, &dc);
+        (void)dents_emit_cb("diskstats", S_IFREG, &dc);
 
         if (dc.emitted > dc.skip) {
             d->u.proc.off = dc.emitted;
@@ -1315,9 +1646,22 @@ uint64_t sys_getdents64(uint64_t fd, uint64_t dirp_user, uint64_t count) {
         return (uint64_t)(-(int64_t)EFAULT);
     }
 
+    if (!d->u.initramfs.dir) {
+        return (uint64_t)(-(int64_t)ENOENT);
+    }
+    if (!d->u.initramfs.cursor) {
+        d->u.initramfs.cursor = vfs_dir_open(d->u.initramfs.dir);
+        if (!d->u.initramfs.cursor) {
+            return (uint64_t)(-(int64_t)ENOMEM);
+        }
+    }
+
+    /* The cursor remembers where the last call stopped: no entries are
+     * skipped again. off only numbers the records (d_off).
+     */
     dents_ctx_t dc;
-    dc.skip = d->u.initramfs.off;
-    dc.emitted = 0;
+    dc.skip = 0;
+    dc.emitted = d->u.initramfs.off;
     dc.buf_user = dirp_user;
     dc.buf_len = count;
     dc.pos = 0;
@@ -1325,20 +1669,19 @@ uint64_t sys_getdents64(uint64_t fd, uint64_t dirp_user, uint64_t count) {
     /* Make procfs discoverable under the root directory.
      * The actual /proc handling is implemented via path special-cases in sys_openat/newfstatat.
      */
-    if (d->u.initramfs.dir_path[0] == '\0') {
-        (void)dents_emit_cb("proc", S_IFDIR, &dc);
+    int rc = 0;
+    if (d->u.initramfs.off == 0 && d->u.initramfs.dir == vfs_root()) {
+        rc = dents_emit_cb("proc", S_IFDIR, &dc);
     }
-
-    int rc = vfs_list_dir(d->u.initramfs.dir_path, dents_emit_cb, &dc);
-    if (rc != 0) {
-        return (uint64_t)(-(int64_t)ENOENT);
+    if (rc == 0) {
+        rc = vfs_dir_read(d->u.initramfs.cursor, dents_emit_cb, &dc);
     }
+    d->u.initramfs.off = dc.emitted;
 
-    /* Advance directory position by entries emitted in this call. */
-    if (dc.emitted > dc.skip) {
-        d->u.initramfs.off = dc.emitted;
+    if (rc != 0 && dc.pos == 0) {
+        /* Not even one record fits. */
+        return (uint64_t)(-(int64_t)EINVAL);
     }
-
     return dc.pos;
 }
 
@@ -1348,7 +1691,7 @@ uint64_t sys_lseek(uint64_t fd, int64_t off, uint64_t whence) {
     if (didx < 0) {
         return (uint64_t)(-(int64_t)EBADF);
     }
-    file_desc_t *d = &g_descs[didx];
+    file_desc_t *d = desc_get(didx);
     if (d->kind == FDESC_PROC) {
         /* Minimal support: SEEK_SET/SEEK_CUR only (used rarely). */
         uint64_t cur_off = d->u.proc.off;
@@ -1369,17 +1712,34 @@ uint64_t sys_lseek(uint64_t fd, int64_t off, uint64_t whence) {
         return newoff;
     }
 
+    if (d->kind == FDESC_BLKDEV) {
+        uint64_t size = blk_size();
+        uint64_t base;
+        switch (whence) {
+            case 0: /* SEEK_SET */
+                base = 0;
+                break;
+            case 1: /* SEEK_CUR */
+                base = d->u.blkdev.off;
+                break;
+            case 2: /* SEEK_END */
+                base = size;
+                break;
+            default:
+                return (uint64_t)(-(int64_t)EINVAL);
+        }
+        if (off < 0 && (uint64_t)(-off) > base) return (uint64_t)(-(int64_t)EINVAL);
+        uint64_t newoff = (uint64_t)((int64_t)base + off);
+        if (newoff > size) return (uint64_t)(-(int64_t)EINVAL);
+        d->u.blkdev.off = newoff;
+        return newoff;
+    }
+
     if (d->kind == FDESC_RAMFILE) {
-        uint8_t *data = 0;
         uint64_t size = 0;
-        uint64_t cap = 0;
-        uint32_t mode = 0;
-        if (vfs_ramfile_get(d->u.ramfile.file_id, &data, &size, &cap, &mode) != 0) {
+        if (vfs_ramfile_get(d->u.ramfile.file_id, &size, 0, 0) != 0) {
             return (uint64_t)(-(int64_t)EBADF);
         }
-        (void)data;
-        (void)cap;
-        (void)mode;
 
         uint64_t newoff;
         switch (whence) {
@@ -1398,12 +1758,28 @@ uint64_t sys_lseek(uint64_t fd, int64_t off, uint64_t whence) {
             default:
                 return (uint64_t)(-(int64_t)EINVAL);
         }
-        if (newoff > size) return (uint64_t)(-(int64_t)EINVAL);
+        /* Past the end is fine: a write there leaves a hole. */
+        if ((int64_t)newoff < 0) return (uint64_t)(-(int64_t)EINVAL);
         d->u.ramfile.off = newoff;
         return newoff;
     }
 
-    if (d->kind != FDESC_INITRAMFS || d->u.initramfs.is_dir) {
+    if (d->kind == FDESC_INITRAMFS && d->u.initramfs.is_dir) {
+        /* Directories: rewinddir() and telldir()-style queries only. */
+        if (whence == 0 /* SEEK_SET */ && off == 0) {
+            if (d->u.initramfs.cursor) {
+                vfs_dir_rewind(d->u.initramfs.cursor);
+            }
+            d->u.initramfs.off = 0;
+            return 0;
+        }
+        if (whence == 1 /* SEEK_CUR */ && off == 0) {
+            return d->u.initramfs.off;
+        }
+        return (uint64_t)(-(int64_t)EINVAL);
+    }
+
+    if (d->kind != FDESC_INITRAMFS) {
         return (uint64_t)(-(int64_t)EBADF);
     }
 
@@ -1430,6 +1806,111 @@ uint64_t sys_lseek(uint64_t fd, int64_t off, uint64_t whence) {
     return newoff;
 }
 
+/* Why fd cannot be resized or allocated: only ramfiles can. */
+static uint64_t ramfile_only_err(const file_desc_t *d) {
+    if (d->kind == FDESC_INITRAMFS && !d->u.initramfs.is_dir) {
+        return (uint64_t)(-(int64_t)EROFS);
+    }
+    return (uint64_t)(-(int64_t)EINVAL);
+}
+
+uint64_t sys_ftruncate(uint64_t fd, int64_t length) {
+    proc_t *cur = &g_procs[g_cur_proc];
+    int didx = fd_get_desc_idx(&cur->fdt, fd);
+    if (didx < 0) {
+        return (uint64_t)(-(int64_t)EBADF);
+    }
+    file_desc_t *d = desc_get(didx);
+    if (d->kind != FDESC_RAMFILE) {
+        return ramfile_only_err(d);
+    }
+    if (length < 0) {
+        return (uint64_t)(-(int64_t)EINVAL);
+    }
+    return (uint64_t)(int64_t)vfs_ramfile_set_size(d->u.ramfile.file_id, (uint64_t)length);
+}
+
+uint64_t sys_truncate(uint64_t path_user, int64_t length) {
+    char in[MAX_PATH];
+    if (copy_cstr_from_user(in, sizeof(in), path_user) != 0) {
+        return (uint64_t)(-(int64_t)EFAULT);
+    }
+    if (length < 0) {
+        return (uint64_t)(-(int64_t)EINVAL);
+    }
+
+    proc_t *cur = &g_procs[g_cur_proc];
+    char path[MAX_PATH];
+    {
+        int rrc = resolve_path(cur, in, path, sizeof(path));
+        if (rrc != 0) return (uint64_t)(int64_t)rrc;
+    }
+    if (resolve_final_symlink(path, sizeof(path)) != 0) {
+        return (uint64_t)(-(int64_t)EINVAL);
+    }
+
+    uint32_t file_id = 0;
+    if (vfs_ramfile_find_abs(path, &file_id) == 0) {
+        return (uint64_t)(int64_t)vfs_ramfile_set_size(file_id, (uint64_t)length);
+    }
+    uint32_t mode = 0;
+    if (vfs_lookup_abs(path, 0, 0, &mode) != 0) {
+        return (uint64_t)(-(int64_t)ENOENT);
+    }
+    return S_ISDIR(mode) ? (uint64_t)(-(int64_t)EISDIR) : (uint64_t)(-(int64_t)EROFS);
+}
+
+uint64_t sys_fallocate(uint64_t fd, uint64_t mode, int64_t off, int64_t len) {
+    const uint64_t FALLOC_FL_KEEP_SIZE = 0x01u;
+    const uint64_t FALLOC_FL_PUNCH_HOLE = 0x02u;
+
+    proc_t *cur = &g_procs[g_cur_proc];
+    int didx = fd_get_desc_idx(&cur->fdt, fd);
+    if (didx < 0) {
+        return (uint64_t)(-(int64_t)EBADF);
+    }
+    if (off < 0 || len <= 0) {
+        return (uint64_t)(-(int64_t)EINVAL);
+    }
+    if ((mode & ~(FALLOC_FL_KEEP_SIZE | FALLOC_FL_PUNCH_HOLE)) != 0) {
+        return (uint64_t)(-(int64_t)EOPNOTSUPP);
+    }
+    file_desc_t *d = desc_get(didx);
+    if (d->kind != FDESC_RAMFILE) {
+        return (d->kind == FDESC_INITRAMFS) ? ramfile_only_err(d) : (uint64_t)(-(int64_t)ENODEV);
+    }
+
+    uint32_t id = d->u.ramfile.file_id;
+    if ((mode & FALLOC_FL_PUNCH_HOLE) != 0) {
+        /* Like Linux: punching a hole never changes the size. */
+        if ((mode & FALLOC_FL_KEEP_SIZE) == 0) {
+            return (uint64_t)(-(int64_t)EOPNOTSUPP);
+        }
+        return (uint64_t)(int64_t)vfs_ramfile_punch(id, (uint64_t)off, (uint64_t)len);
+    }
+    return (uint64_t)(int64_t)vfs_ramfile_allocate(id, (uint64_t)off, (uint64_t)len, (mode & FALLOC_FL_KEEP_SIZE) != 0);
+}
+
+uint64_t sys_fsync(uint64_t fd) {
+    proc_t *cur = &g_procs[g_cur_proc];
+    int didx = fd_get_desc_idx(&cur->fdt, fd);
+    if (didx < 0) {
+        return (uint64_t)(-(int64_t)EBADF);
+    }
+    /* Only the block device holds back writes; everything else lives in
+     * memory anyway.
+     */
+    if (desc_get(didx)->kind == FDESC_BLKDEV) {
+        return (uint64_t)(int64_t)blk_sync();
+    }
+    return 0;
+}
+
+uint64_t sys_sync(void) {
+    (void)blk_sync();
+    return 0;
+}
+
 uint64_t sys_dup3(uint64_t oldfd, uint64_t newfd, uint64_t flags) {
     if (flags != 0) {
         return (uint64_t)(-(int64_t)EINVAL);
@@ -1456,6 +1937,26 @@ uint64_t sys_dup3(uint64_t oldfd, uint64_t newfd, uint64_t flags) {
     return newfd;
 }
 
+uint64_t sys_fcntl(uint64_t fd, uint64_t cmd, uint64_t arg) {
+    proc_t *cur = &g_procs[g_cur_proc];
+    int didx = fd_get_desc_idx(&cur->fdt, fd);
+    if (didx < 0) {
+        return (uint64_t)(-(int64_t)EBADF);
+    }
+
+    file_desc_t *d = desc_get(didx);
+    if (cmd == LINUX_F_GETPIPE_SZ || cmd == LINUX_F_SETPIPE_SZ) {
+        if (d->kind != FDESC_PIPE) {
+            return (uint64_t)(-(int64_t)EBADF);
+        }
+        if (cmd == LINUX_F_GETPIPE_SZ) {
+            return (uint64_t)pipe_get_size(d->u.pipe.pipe_id);
+        }
+        return (uint64_t)pipe_set_size(d->u.pipe.pipe_id, arg);
+    }
+    return (uint64_t)(-(int64_t)EINVAL);
+}
+
 uint64_t sys_pipe2(uint64_t pipefd_user, uint64_t flags) {
     if (flags != 0) {
         return (uint64_t)(-(int64_t)ENOSYS);
@@ -1475,24 +1976,26 @@ uint64_t sys_pipe2(uint64_t pipefd_user, uint64_t flags) {
     int rdesc = desc_alloc();
     int wdesc = desc_alloc();
     if (rdesc < 0 || wdesc < 0) {
-        if (rdesc >= 0) desc_clear(&g_descs[rdesc]);
-        if (wdesc >= 0) desc_clear(&g_descs[wdesc]);
+        if (rdesc >= 0) desc_decref(rdesc);
+        if (wdesc >= 0) desc_decref(wdesc);
         pipe_abort(pid);
         return (uint64_t)(-(int64_t)EMFILE);
     }
 
-    desc_clear(&g_descs[rdesc]);
-    g_descs[rdesc].kind = FDESC_PIPE;
-    g_descs[rdesc].refs = 1;
-    g_descs[rdesc].u.pipe.pipe_id = (uint32_t)pid;
-    g_descs[rdesc].u.pipe.end = PIPE_END_READ;
+    file_desc_t *rd = desc_get(rdesc);
+    desc_clear(rd);
+    rd->kind = FDESC_PIPE;
+    rd->refs = 1;
+    rd->u.pipe.pipe_id = (uint32_t)pid;
+    rd->u.pipe.end = PIPE_END_READ;
     pipe_on_desc_incref((uint32_t)pid, PIPE_END_READ);
 
-    desc_clear(&g_descs[wdesc]);
-    g_descs[wdesc].kind = FDESC_PIPE;
-    g_descs[wdesc].refs = 1;
-    g_descs[wdesc].u.pipe.pipe_id = (uint32_t)pid;
-    g_descs[wdesc].u.pipe.end = PIPE_END_WRITE;
+    file_desc_t *wd = desc_get(wdesc);
+    desc_clear(wd);
+    wd->kind = FDESC_PIPE;
+    wd->refs = 1;
+    wd->u.pipe.pipe_id = (uint32_t)pid;
+    wd->u.pipe.end = PIPE_END_WRITE;
     pipe_on_desc_incref((uint32_t)pid, PIPE_END_WRITE);
 
     /* Install into current process FD table. */
@@ -1527,9 +2030,6 @@ uint64_t sys_pipe2(uint64_t pipefd_user, uint64_t flags) {
 uint64_t sys_newfstatat(int64_t dirfd, uint64_t pathname_user, uint64_t statbuf_user, uint64_t flags) {
     (void)flags;
 
-    if (dirfd != AT_FDCWD) {
-        return (uint64_t)(-(int64_t)ENOSYS);
-    }
     if (!user_range_ok(statbuf_user, (uint64_t)sizeof(linux_stat_t))) {
         return (uint64_t)(-(int64_t)EFAULT);
     }
@@ -1541,8 +2041,9 @@ uint64_t sys_newfstatat(int64_t dirfd, uint64_t pathname_user, uint64_t statbuf_
 
     proc_t *cur = &g_procs[g_cur_proc];
     char path[MAX_PATH];
-    if (resolve_path(cur, in, path, sizeof(path)) != 0) {
-        return (uint64_t)(-(int64_t)EINVAL);
+    {
+        int rrc = resolve_path_at(cur, dirfd, in, path, sizeof(path));
+        if (rrc != 0) return (uint64_t)(int64_t)rrc;
     }
 
     if (resolve_final_symlink(path, sizeof(path)) != 0) {
@@ -1570,7 +2071,19 @@ uint64_t sys_newfstatat(int64_t dirfd, uint64_t pathname_user, uint64_t statbuf_
         st->st_size = 0;
         return 0;
     }
-    if (cstr_eq_u64(path, "/proc/net")) {
+    if (cstr_eq_u64(path, "/proc/net") || cstr_eq_u64(path, "/proc/slabinfo") ||
+        cstr_eq_u64(path, "/proc/diskstats")) {
+        linux_stat_t *st = (linux_stat_t *)(uintptr_t)statbuf_user;
+        st->st_mode = S_IFREG | 0444u;
+        st->st_nlink = 1;
+        st->st_size = 0;
+        return 0;
+    }
+    uint64_t stat_pid = procfs_stat_path_pid(path);
+    if (stat_pid != 0) {
+        if (proc_find_idx_by_pid(stat_pid) < 0) {
+            return (uint64_t)(-(int64_t)ENOENT);
+        }
         linux_stat_t *st = (linux_stat_t *)(uintptr_t)statbuf_user;
         st->st_mode = S_IFREG | 0444u;
         st->st_nlink = 1;
@@ -1578,6 +2091,20 @@ uint64_t sys_newfstatat(int64_t dirfd, uint64_t pathname_user, uint64_t statbuf_
         return 0;
     }
 
+    if (cstr_eq_u64(path, BLKDEV_PATH) && blk_size() != 0) {
+        linux_stat_t st;
+        memset(&st, 0, sizeof(st));
+        st.st_mode = S_IFBLK | 0660u;
+        st.st_nlink = 1;
+        st.st_rdev = 179u << 8; /* major 179 (mmc), minor 0 */
+        st.st_size = (int64_t)blk_size();
+        st.st_blksize = BLK_SIZE;
+        if (copy_to_user(statbuf_user, &st, sizeof(st)) != 0) {
+            return (uint64_t)(-(int64_t)EFAULT);
+        }
+        return 0;
+    }
+
     const uint8_t *data = 0;
     uint64_t size = 0;
     uint32_t mode = 0;
@@ -1587,9 +2114,7 @@ uint64_t sys_newfstatat(int64_t dirfd, uint64_t pathname_user, uint64_t statbuf_
 
     (void)data;
     linux_stat_t st;
-    /* Zero-init without libc */
-    volatile uint8_t *zp = (volatile uint8_t *)&st;
-    for (uint64_t i = 0; i < sizeof(st); i++) zp[i] = 0;
+    memset(&st, 0, sizeof(st));
 
     st.st_dev = 0;
     st.st_ino = 1;
@@ -1601,18 +2126,23 @@ uint64_t sys_newfstatat(int64_t dirfd, uint64_t pathname_user, uint64_t statbuf_
     st.st_size = (int64_t)size;
     st.st_blksize = 4096;
     st.st_blocks = (int64_t)((size + 511u) / 512u);
+    {
+        /* Ramfiles are sparse: count the pages they really use. */
+        uint32_t file_id = 0;
+        uint64_t pages = 0;
+        if (vfs_ramfile_find_abs(path, &file_id) == 0 &&
+            vfs_ramfile_get(file_id, 0, &pages, 0) == 0) {
+            st.st_blocks = (int64_t)(pages * 8u);
+        }
+    }
 
-    /* Copy out */
-    volatile uint8_t *dst = (volatile uint8_t *)(uintptr_t)statbuf_user;
-    const volatile uint8_t *src = (const volatile uint8_t *)&st;
-    for (uint64_t i = 0; i < sizeof(st); i++) dst[i] = src[i];
+    if (copy_to_user(statbuf_user, &st, sizeof(st)) != 0) {
+        return (uint64_t)(-(int64_t)EFAULT);
+    }
     return 0;
 }
 
 uint64_t sys_fchmodat(int64_t dirfd, uint64_t pathname_user, uint64_t mode, uint64_t flags) {
-    if (dirfd != AT_FDCWD) {
-        return (uint64_t)(-(int64_t)ENOSYS);
-    }
     if (flags != 0) {
         return (uint64_t)(-(int64_t)ENOSYS);
     }
@@ -1627,8 +2157,9 @@ uint64_t sys_fchmodat(int64_t dirfd, uint64_t pathname_user, uint64_t mode, uint
 
     proc_t *cur = &g_procs[g_cur_proc];
     char path[MAX_PATH];
-    if (resolve_path(cur, in, path, sizeof(path)) != 0) {
-        return (uint64_t)(-(int64_t)EINVAL);
+    {
+        int rrc = resolve_path_at(cur, dirfd, in, path, sizeof(path));
+        if (rrc != 0) return (uint64_t)(int64_t)rrc;
     }
 
     if (resolve_final_symlink(path, sizeof(path)) != 0) {
@@ -1637,7 +2168,8 @@ uint64_t sys_fchmodat(int64_t dirfd, uint64_t pathname_user, uint64_t mode, uint
 
     /* procfs is read-only. */
     if (cstr_eq_u64(path, "/proc") || cstr_eq_u64(path, "/proc/") || cstr_eq_u64(path, "/proc/ps") ||
-        cstr_eq_u64(path, "/proc/meminfo") || cstr_eq_u64(path, "/proc/net")) {
+        cstr_eq_u64(path, "/proc/meminfo") || cstr_eq_u64(path, "/proc/net") || cstr_eq_u64(path, "/proc/slabinfo") ||
+        cstr_eq_u64(path, "/proc/diskstats") || procfs_stat_path_pid(path) != 0) {
         return (uint64_t)(-(int64_t)EROFS);
     }
 
@@ -1662,9 +2194,6 @@ uint64_t sys_fchmodat(int64_t dirfd, uint64_t pathname_user, uint64_t mode, uint
 }
 
 uint64_t sys_readlinkat(int64_t dirfd, uint64_t pathname_user, uint64_t buf_user, uint64_t bufsiz) {
-    if (dirfd != AT_FDCWD) {
-        return (uint64_t)(-(int64_t)ENOSYS);
-    }
     if (pathname_user == 0 || buf_user == 0) {
         return (uint64_t)(-(int64_t)EFAULT);
     }
@@ -1682,8 +2211,9 @@ uint64_t sys_readlinkat(int64_t dirfd, uint64_t pathname_user, uint64_t buf_user
 
     proc_t *cur = &g_procs[g_cur_proc];
     char abs_path[MAX_PATH];
-    if (resolve_path(cur, in, abs_path, sizeof(abs_path)) != 0) {
-        return (uint64_t)(-(int64_t)EINVAL);
+    {
+        int rrc = resolve_path_at(cur, dirfd, in, abs_path, sizeof(abs_path));
+        if (rrc != 0) return (uint64_t)(int64_t)rrc;
     }
 
     const uint8_t *data = 0;
@@ -1704,9 +2234,6 @@ uint64_t sys_readlinkat(int64_t dirfd, uint64_t pathname_user, uint64_t buf_user
 }
 
 uint64_t sys_unlinkat(int64_t dirfd, uint64_t pathname_user, uint64_t flags) {
-    if (dirfd != AT_FDCWD) {
-        return (uint64_t)(-(int64_t)ENOSYS);
-    }
     if (flags != 0 && flags != (uint64_t)AT_REMOVEDIR) {
         return (uint64_t)(-(int64_t)ENOSYS);
     }
@@ -1721,8 +2248,9 @@ uint64_t sys_unlinkat(int64_t dirfd, uint64_t pathname_user, uint64_t flags) {
 
     proc_t *cur = &g_procs[g_cur_proc];
     char abs_path[MAX_PATH];
-    if (resolve_path(cur, in, abs_path, sizeof(abs_path)) != 0) {
-        return (uint64_t)(-(int64_t)EINVAL);
+    {
+        int rrc = resolve_path_at(cur, dirfd, in, abs_path, sizeof(abs_path));
+        if (rrc != 0) return (uint64_t)(int64_t)rrc;
     }
 
     if (cstr_eq_u64(abs_path, "/")) {
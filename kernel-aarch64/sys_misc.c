@@ -7,6 +7,7 @@
 #include "sched.h"
 #include "sys_util.h"
 #include "time.h"
+#include "wait.h"
 
 uint64_t sys_getuid(void) { return 0; }
 uint64_t sys_geteuid(void) { return 0; }
@@ -188,7 +189,7 @@ uint64_t sys_clock_gettime(uint64_t clockid, uint64_t tp_user) {
     return 0;
 }
 
-uint64_t sys_nanosleep(trap_frame_t *tf, uint64_t req_user, uint64_t rem_user, uint64_t elr) {
+uint64_t sys_nanosleep(uint64_t req_user, uint64_t rem_user) {
     if (req_user == 0) return (uint64_t)(-(int64_t)EFAULT);
     if (!user_range_ok(req_user, (uint64_t)sizeof(linux_timespec_t))) {
         return (uint64_t)(-(int64_t)EFAULT);
@@ -239,33 +240,11 @@ uint64_t sys_nanosleep(trap_frame_t *tf, uint64_t req_user, uint64_t rem_user, u
         deadline = 0xFFFFFFFFFFFFFFFFull;
     }
 
-    /* Save current state and mark the task sleeping. When it resumes, nanosleep
-     * should return 0.
-     */
-    tf_copy(&cur->tf, tf);
-    cur->elr = elr;
-    cur->tf.x[0] = 0;
-    cur->state = PROC_SLEEPING;
-    cur->sleep_deadline_ns = deadline;
-
-    int next = sched_pick_next_runnable();
-    if (next >= 0 && next != g_cur_proc) {
-        proc_switch_to(next, tf);
-        return SYSCALL_SWITCHED;
-    }
-
-    /* No other runnable tasks; sched_pick_next_runnable may have waited for our
-     * own deadline and woken us. Ensure we're runnable again and return.
-     */
-    if (cur->state == PROC_SLEEPING) {
-        cur->state = PROC_RUNNABLE;
+    /* Sleep on no queue: only the deadline wakes us. */
+    while (time_now_ns() < deadline) {
+        wait_block(cur, PROC_SLEEPING, 0, deadline);
+        sched_block();
     }
-
-    /* Clear the sleep deadline regardless of whether the scheduler already
-     * transitioned us back to runnable.
-     */
-    cur->sleep_deadline_ns = 0;
-
     return 0;
 }
 
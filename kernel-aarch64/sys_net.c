@@ -31,7 +31,7 @@ static int get_udp6_sock_id_from_fd(proc_t *p, uint64_t fd, uint32_t *out_sock_i
     if (!p || !out_sock_id) return -(int)EINVAL;
     int didx = fd_get_desc_idx(&p->fdt, fd);
     if (didx < 0) return -(int)EBADF;
-    file_desc_t *d = &g_descs[didx];
+    file_desc_t *d = desc_get(didx);
     if (d->kind != FDESC_UDP6) return -(int)EBADF;
     *out_sock_id = d->u.udp6.sock_id;
     return 0;
@@ -41,12 +41,21 @@ static int get_tcp6_conn_id_from_fd(proc_t *p, uint64_t fd, uint32_t *out_conn_i
     if (!p || !out_conn_id) return -(int)EINVAL;
     int didx = fd_get_desc_idx(&p->fdt, fd);
     if (didx < 0) return -(int)EBADF;
-    file_desc_t *d = &g_descs[didx];
+    file_desc_t *d = desc_get(didx);
     if (d->kind != FDESC_TCP6) return -(int)EBADF;
     *out_conn_id = d->u.tcp6.conn_id;
     return 0;
 }
 
+/* Absolute deadline for a millisecond timeout, 0 for none (or no clock). */
+static uint64_t net_timeout_deadline(uint64_t timeout_ms) {
+    uint64_t now = time_now_ns();
+    if (timeout_ms == 0 || now == 0) return 0;
+    uint64_t d = now + timeout_ms * 1000000ull;
+    if (d < now) d = 0xFFFFFFFFFFFFFFFFull;
+    return d;
+}
+
 uint64_t sys_mona_udp6_socket(void) {
     proc_t *cur = &g_procs[g_cur_proc];
 
@@ -60,10 +69,11 @@ uint64_t sys_mona_udp6_socket(void) {
         return (uint64_t)(-(int64_t)EMFILE);
     }
 
-    desc_clear(&g_descs[didx]);
-    g_descs[didx].kind = FDESC_UDP6;
-    g_descs[didx].refs = 1;
-    g_descs[didx].u.udp6.sock_id = sock_id;
+    file_desc_t *d = desc_get(didx);
+    desc_clear(d);
+    d->kind = FDESC_UDP6;
+    d->refs = 1;
+    d->u.udp6.sock_id = sock_id;
 
     int fd = fd_alloc_into(&cur->fdt, 0, didx);
     /* fd_alloc_into() increments refs; drop our creation ref. */
@@ -116,20 +126,38 @@ uint64_t sys_mona_udp6_sendto(uint64_t fd,
     return (uint64_t)(int64_t)rc;
 }
 
-uint64_t sys_mona_udp6_recvfrom(trap_frame_t *tf,
-                                uint64_t fd,
+/* Copy a received datagram out to the (current) user buffers.
+ * Returns bytes copied or negative errno.
+ */
+static int64_t udp6_copy_out(const udp6_dgram_t *dg,
+                             uint64_t buf_user,
+                             uint64_t len,
+                             uint64_t src_ip_user,
+                             uint64_t src_port_user) {
+    uint64_t n = len;
+    if (n > (uint64_t)dg->len) n = (uint64_t)dg->len;
+    if (n != 0) {
+        if (write_bytes_to_user(buf_user, dg->data, n) != 0) {
+            return -(int64_t)EFAULT;
+        }
+    }
+    if (src_ip_user != 0) {
+        (void)write_bytes_to_user(src_ip_user, dg->src_ip, 16);
+    }
+    if (src_port_user != 0) {
+        (void)write_u16_to_user(src_port_user, dg->src_port);
+    }
+    return (int64_t)n;
+}
+
+uint64_t sys_mona_udp6_recvfrom(uint64_t fd,
                                 uint64_t buf_user,
                                 uint64_t len,
                                 uint64_t src_ip_user,
                                 uint64_t src_port_user,
-                                uint64_t timeout_ms,
-                                uint64_t elr) {
+                                uint64_t timeout_ms) {
     proc_t *cur = &g_procs[g_cur_proc];
 
-    if (cur->pending_udp6_recv) {
-        return (uint64_t)(-(int64_t)EBUSY);
-    }
-
     if (len != 0 && !user_range_ok(buf_user, len)) {
         return (uint64_t)(-(int64_t)EFAULT);
     }
@@ -144,162 +172,62 @@ uint64_t sys_mona_udp6_recvfrom(trap_frame_t *tf,
     int rc = get_udp6_sock_id_from_fd(cur, fd, &sock_id);
     if (rc < 0) return (uint64_t)(int64_t)rc;
 
-    udp6_dgram_t dg;
-    rc = net_udp6_try_recv(sock_id, &dg);
-    if (rc == 0) {
-        uint64_t n = len;
-        if (n > (uint64_t)dg.len) n = (uint64_t)dg.len;
-        if (n != 0) {
-            if (write_bytes_to_user(buf_user, dg.data, n) != 0) {
-                return (uint64_t)(-(int64_t)EFAULT);
-            }
-        }
-        if (src_ip_user != 0) {
-            (void)write_bytes_to_user(src_ip_user, dg.src_ip, 16);
-        }
-        if (src_port_user != 0) {
-            (void)write_u16_to_user(src_port_user, dg.src_port);
-        }
-        return n;
-    }
-
-    if (rc != -(int)EAGAIN) {
-        return (uint64_t)(int64_t)rc;
-    }
-
-    /* Arm pending recv state and block. */
-    tf_copy(&cur->tf, tf);
-    cur->elr = elr;
-
-    cur->pending_udp6_recv = 1;
-    cur->pending_udp6_sock_id = sock_id;
-    cur->pending_udp6_fd = fd;
-    cur->pending_udp6_buf_user = buf_user;
-    cur->pending_udp6_len = len;
-    cur->pending_udp6_src_ip_user = src_ip_user;
-    cur->pending_udp6_src_port_user = src_port_user;
-    cur->pending_udp6_ret = 0;
-
-    if (timeout_ms != 0) {
-        uint64_t now = time_now_ns();
-        uint64_t timeout_ns = timeout_ms * 1000000ull;
-        uint64_t deadline = now + timeout_ns;
-        if (deadline < now) deadline = 0xFFFFFFFFFFFFFFFFull;
-        cur->sleep_deadline_ns = deadline;
-        cur->state = PROC_SLEEPING;
-    } else {
-        cur->sleep_deadline_ns = 0;
-        cur->state = PROC_BLOCKED_IO;
-    }
-
-    /* Like ping6, ensure forward progress even if the system is otherwise idle.
-     * USB net RX is polled; without explicit polling here, a task blocked in
-     * recvfrom can time out even though the host replied.
-     */
-    uint64_t start_ns = time_now_ns();
-    uint64_t deadline_ns = cur->sleep_deadline_ns;
-    if (timeout_ms != 0) {
-        /* If time isn't available, we can't enforce a deadline; treat as blocking. */
-        if (start_ns == 0) deadline_ns = 0;
-    }
-
-retry_wait:
-    /* Pull in any pending USB net traffic before trying to sleep/yield.
+    /* Pull in any pending USB net traffic before deciding to block.
      * This reduces the chance of missing a fast DNS reply.
      */
 #if defined(ENABLE_USB_KBD) || defined(ENABLE_USB_NET)
     usb_poll();
 #endif
 
-    int next = sched_pick_next_runnable();
-    if (next >= 0 && next != g_cur_proc) {
-        proc_switch_to(next, tf);
-        return SYSCALL_SWITCHED;
-    }
-
-    /* No other runnable tasks: wait (idle) and retry inline completion. */
-    udp6_dgram_t dg2;
-    int trc = net_udp6_try_recv(sock_id, &dg2);
-    if (trc == 0) {
-        uint64_t n = len;
-        if (n > (uint64_t)dg2.len) n = (uint64_t)dg2.len;
-        if (n != 0) {
-            if (write_bytes_to_user(buf_user, dg2.data, n) != 0) {
-                n = 0;
-                trc = -(int)EFAULT;
-            }
-        }
-        if (trc == 0) {
-            if (src_ip_user != 0) {
-                (void)write_bytes_to_user(src_ip_user, dg2.src_ip, 16);
-            }
-            if (src_port_user != 0) {
-                (void)write_u16_to_user(src_port_user, dg2.src_port);
-            }
-        }
+    /* If time isn't available, we can't enforce a deadline; treat as blocking. */
+    uint64_t deadline = net_timeout_deadline(timeout_ms);
 
-        cur->pending_udp6_recv = 0;
-        cur->pending_udp6_sock_id = 0;
-        cur->pending_udp6_fd = 0;
-        cur->pending_udp6_buf_user = 0;
-        cur->pending_udp6_len = 0;
-        cur->pending_udp6_src_ip_user = 0;
-        cur->pending_udp6_src_port_user = 0;
-        cur->pending_udp6_ret = 0;
-        cur->sleep_deadline_ns = 0;
-        cur->state = PROC_RUNNABLE;
-
-        if (trc != 0) return (uint64_t)(int64_t)trc;
-        return n;
-    }
-
-    if (trc == -(int)EAGAIN) {
-        if (deadline_ns != 0) {
-            uint64_t now = time_now_ns();
-            if (now != 0 && now >= deadline_ns) {
-                cur->pending_udp6_recv = 0;
-                cur->pending_udp6_sock_id = 0;
-                cur->pending_udp6_fd = 0;
-                cur->pending_udp6_buf_user = 0;
-                cur->pending_udp6_len = 0;
-                cur->pending_udp6_src_ip_user = 0;
-                cur->pending_udp6_src_port_user = 0;
-                cur->pending_udp6_ret = 0;
-                cur->sleep_deadline_ns = 0;
-                cur->state = PROC_RUNNABLE;
-                return (uint64_t)(-(int64_t)ETIMEDOUT);
-            }
+    /* Block on the socket until a datagram arrives (one receiver is woken
+     * per datagram) or the deadline passes. USB net RX is polled from a
+     * kernel timer, so this makes progress on an otherwise idle system.
+     * Woken without data (another reader got it): just wait again.
+     */
+    udp6_dgram_t dg;
+    int timed_out = 0;
+    while ((rc = net_udp6_try_recv(sock_id, &dg)) == -(int)EAGAIN) {
+        if (timed_out) {
+            return (uint64_t)(-(int64_t)ETIMEDOUT);
         }
-        goto retry_wait;
-    }
-
-    /* Error. */
-    cur->pending_udp6_recv = 0;
-    cur->pending_udp6_sock_id = 0;
-    cur->pending_udp6_fd = 0;
-    cur->pending_udp6_buf_user = 0;
-    cur->pending_udp6_len = 0;
-    cur->pending_udp6_src_ip_user = 0;
-    cur->pending_udp6_src_port_user = 0;
-    cur->pending_udp6_ret = 0;
-    cur->sleep_deadline_ns = 0;
-    cur->state = PROC_RUNNABLE;
-    return (uint64_t)(int64_t)trc;
+        wait_block(cur, PROC_BLOCKED_IO, net_udp6_rx_waitq(sock_id), deadline);
+        sched_block();
+        timed_out = wait_timed_out(cur);
+    }
+    if (rc < 0) {
+        return (uint64_t)(int64_t)rc;
+    }
+    return (uint64_t)udp6_copy_out(&dg, buf_user, len, src_ip_user, src_port_user);
 }
 
-uint64_t sys_mona_ping6(trap_frame_t *tf,
-                        uint64_t dst_ip_user,
+/* While the interface is still unconfigured (SLAAC/RA pending), retry the
+ * start on this cadence until the caller's timeout.
+ */
+#define PING6_RETRY_NS 50000000ull
+
+/* Block p after a ping6 start attempt that returned rc (0, -EAGAIN or -EBUSY). */
+static void ping6_block(proc_t *p, int rc, uint64_t deadline) {
+    if (rc == -(int)EAGAIN) {
+        /* Not configured yet: nothing to wait on, come back to retry. */
+        uint64_t retry = time_now_ns() + PING6_RETRY_NS;
+        if (retry < deadline) deadline = retry;
+        wait_block(p, PROC_BLOCKED_IO, 0, deadline);
+        return;
+    }
+    /* Our own request is out, or we wait for the in-flight one to finish. */
+    wait_block(p, PROC_BLOCKED_IO, net_ipv6_ping6_waitq(), deadline);
+}
+
+uint64_t sys_mona_ping6(uint64_t dst_ip_user,
                         uint64_t ident,
                         uint64_t seq,
                         uint64_t timeout_ms,
-                        uint64_t rtt_ns_user,
-                        uint64_t elr) {
+                        uint64_t rtt_ns_user) {
     proc_t *cur = &g_procs[g_cur_proc];
 
-    if (cur->pending_ping6) {
-        return (uint64_t)(-(int64_t)EBUSY);
-    }
-
     uint8_t dst_ip[16];
     if (read_bytes_from_user(dst_ip, sizeof(dst_ip), dst_ip_user) != 0) {
         return (uint64_t)(-(int64_t)EFAULT);
@@ -317,93 +245,42 @@ uint64_t sys_mona_ping6(trap_frame_t *tf,
     uint64_t now = time_now_ns();
     uint64_t timeout_ns = timeout_ms * 1000000ull;
     if (timeout_ns == 0) timeout_ns = 1000000000ull;
-
-    /* Save user return state in case we block/switch. */
-    tf_copy(&cur->tf, tf);
-    cur->elr = elr;
-
-    /* Arm pending ping6 state. */
-    cur->pending_ping6 = 1;
-    cur->ping6_done = 0;
-    cur->ping6_ident = (uint16_t)ident;
-    cur->ping6_seq = (uint16_t)seq;
-    for (int i = 0; i < 16; i++) cur->ping6_dst_ip[i] = dst_ip[i];
-    cur->ping6_start_ns = 0;
-    cur->ping6_rtt_ns = 0;
-    cur->ping6_rtt_user = rtt_ns_user;
-    cur->ping6_ret = 0;
-
     uint64_t deadline = now + timeout_ns;
     if (deadline < now) deadline = 0xFFFFFFFFFFFFFFFFull;
-    cur->sleep_deadline_ns = deadline;
-    cur->state = PROC_SLEEPING;
 
-    int rc = net_ipv6_ping6_start(g_cur_proc, nif, dst_ip, (uint16_t)ident, (uint16_t)seq);
-    if (rc < 0) {
-        /* If the network isn't configured yet (SLAAC/RA pending), wait/retry within the timeout. */
-        if (rc != -(int)EAGAIN && rc != -(int)EBUSY) {
-            cur->pending_ping6 = 0;
-            cur->state = PROC_RUNNABLE;
-            cur->sleep_deadline_ns = 0;
-            return (uint64_t)(int64_t)rc;
-        }
-    }
+    cur->wait.arg[PING6_WAIT_DONE] = 0;
+    cur->wait.arg[PING6_WAIT_RET] = 0;
+    cur->wait.arg[PING6_WAIT_RTT] = 0;
 
-    /* Busy-wait polling path:
-     * Userland runs with IRQs masked, so timer-driven USB polling may not run.
-     * For early bring-up and tests, explicitly poll USB here until completion
-     * or timeout.
+    /* Start the request (retrying while the interface is unconfigured or
+     * another ping holds the slot), then sleep until ping_complete() hands
+     * us the result or the deadline passes.
      */
     for (;;) {
-        if (!cur->pending_ping6) {
-            return cur->tf.x[0];
-        }
-
-        if (!cur->ping6_done && cur->ping6_start_ns == 0) {
-            int trc = net_ipv6_ping6_start(g_cur_proc, nif, dst_ip, (uint16_t)ident, (uint16_t)seq);
-            if (trc < 0 && trc != -(int)EAGAIN && trc != -(int)EBUSY) {
-                cur->ping6_done = 1;
-                cur->ping6_ret = (uint64_t)(int64_t)trc;
-                net_ipv6_ping6_cancel(g_cur_proc);
+        if (cur->wait.arg[PING6_WAIT_DONE]) {
+            uint64_t rv = cur->wait.arg[PING6_WAIT_RET];
+            if (rv == 0 && rtt_ns_user != 0) {
+                (void)write_u64_to_user(rtt_ns_user, cur->wait.arg[PING6_WAIT_RTT]);
             }
+            return rv;
         }
 
-#if defined(ENABLE_USB_KBD) || defined(ENABLE_USB_NET)
-        usb_poll();
-#endif
-
-        if (cur->ping6_done) {
-            break;
+        now = time_now_ns();
+        if (now != 0 && now >= deadline) {
+            net_ipv6_ping6_cancel(proc_idx(cur));
+            return (uint64_t)(-(int64_t)ETIMEDOUT);
         }
 
-        uint64_t tnow = time_now_ns();
-        if (cur->sleep_deadline_ns != 0 && tnow != 0 && tnow >= cur->sleep_deadline_ns) {
-            cur->ping6_done = 1;
-            cur->ping6_ret = (uint64_t)(-(int64_t)ETIMEDOUT);
-            cur->ping6_rtt_ns = 0;
-            net_ipv6_ping6_cancel(g_cur_proc);
-            break;
+        int rc = 0;
+        if (!net_ipv6_ping6_inflight_for(proc_idx(cur))) {
+            rc = net_ipv6_ping6_start(proc_idx(cur), nif, dst_ip, (uint16_t)ident, (uint16_t)seq);
+            if (rc < 0 && rc != -(int)EAGAIN && rc != -(int)EBUSY) {
+                return (uint64_t)(int64_t)rc;
+            }
         }
+        ping6_block(cur, rc, deadline);
+        sched_block();
     }
-
-    if (cur->ping6_ret == 0 && cur->ping6_rtt_user != 0) {
-        (void)write_u64_to_user(cur->ping6_rtt_user, cur->ping6_rtt_ns);
-    }
-
-    uint64_t ret = cur->ping6_ret;
-
-    cur->pending_ping6 = 0;
-    cur->ping6_done = 0;
-    cur->ping6_ident = 0;
-    cur->ping6_seq = 0;
-    for (int i = 0; i < 16; i++) cur->ping6_dst_ip[i] = 0;
-    cur->ping6_start_ns = 0;
-    cur->ping6_rtt_ns = 0;
-    cur->ping6_rtt_user = 0;
-    cur->ping6_ret = 0;
-    cur->sleep_deadline_ns = 0;
-
-    return ret;
 }
 
 uint64_t sys_mona_net6_get_dns(uint64_t out_ip_user) {
@@ -427,14 +304,9 @@ uint64_t sys_mona_net6_get_dns(uint64_t out_ip_user) {
     return 0;
 }
 
-uint64_t sys_mona_tcp6_connect(trap_frame_t *tf,
-                              uint64_t dst_ip_user,
+uint64_t sys_mona_tcp6_connect(uint64_t dst_ip_user,
                               uint64_t dst_port,
-                              uint64_t timeout_ms,
-                              uint64_t elr) {
-    (void)elr;
-    (void)tf;
-
+                              uint64_t timeout_ms) {
     proc_t *cur = &g_procs[g_cur_proc];
 
     if (dst_port == 0 || dst_port > 65535ull) {
@@ -457,10 +329,11 @@ uint64_t sys_mona_tcp6_connect(trap_frame_t *tf,
         return (uint64_t)(-(int64_t)EMFILE);
     }
 
-    desc_clear(&g_descs[didx]);
-    g_descs[didx].kind = FDESC_TCP6;
-    g_descs[didx].refs = 1;
-    g_descs[didx].u.tcp6.conn_id = conn_id;
+    file_desc_t *d = desc_get(didx);
+    desc_clear(d);
+    d->kind = FDESC_TCP6;
+    d->refs = 1;
+    d->u.tcp6.conn_id = conn_id;
 
     int fd = fd_alloc_into(&cur->fdt, 0, didx);
     /* fd_alloc_into() increments refs; drop our creation ref. */
@@ -470,39 +343,35 @@ uint64_t sys_mona_tcp6_connect(trap_frame_t *tf,
         return (uint64_t)(-(int64_t)EMFILE);
     }
 
-    uint64_t start_ns = time_now_ns();
-    uint64_t deadline_ns = 0;
-    if (timeout_ms != 0) {
-        uint64_t timeout_ns = timeout_ms * 1000000ull;
-        uint64_t d = start_ns + timeout_ns;
-        if (d < start_ns) d = 0xFFFFFFFFFFFFFFFFull;
-        deadline_ns = d;
-        /* If time isn't available, treat as blocking. */
-        if (start_ns == 0) deadline_ns = 0;
-    }
-
+    /* Retransmit the SYN (or retry NDP) on a fixed cadence until the
+     * connection is established, fails, or the deadline passes.
+     */
+    uint64_t deadline = net_timeout_deadline(timeout_ms);
     for (;;) {
         if (net_tcp6_is_established(conn_id)) {
             return (uint64_t)fd;
         }
 
+        uint64_t now = time_now_ns();
+        if (deadline != 0 && now != 0 && now >= deadline) {
+            fd_close(&cur->fdt, (uint64_t)fd);
+            return (uint64_t)(-(int64_t)ETIMEDOUT);
+        }
+
         int trc = net_tcp6_connect_start(conn_id, dst_ip, (uint16_t)dst_port);
         if (trc < 0 && trc != -(int)EAGAIN) {
             fd_close(&cur->fdt, (uint64_t)fd);
             return (uint64_t)(int64_t)trc;
         }
 
-#if defined(ENABLE_USB_KBD) || defined(ENABLE_USB_NET)
-        usb_poll();
-#endif
-
-        if (deadline_ns != 0) {
-            uint64_t now = time_now_ns();
-            if (now != 0 && now >= deadline_ns) {
-                fd_close(&cur->fdt, (uint64_t)fd);
-                return (uint64_t)(-(int64_t)ETIMEDOUT);
-            }
+        /* Come back for the SYN retransmit (or NDP retry) if nothing wakes us. */
+        uint64_t wake = 0;
+        if (now != 0) {
+            wake = now + TCP6_SYN_RETRY_NS;
+            if (deadline != 0 && deadline < wake) wake = deadline;
         }
+        wait_block(cur, PROC_BLOCKED_IO, net_tcp6_waitq(conn_id), wake);
+        sched_block();
     }
 }
 
@@ -536,7 +405,25 @@ uint64_t sys_mona_tcp6_send(uint64_t fd, uint64_t buf_user, uint64_t len) {
     return off;
 }
 
-uint64_t sys_mona_tcp6_recv(uint64_t fd, uint64_t buf_user, uint64_t len, uint64_t timeout_ms) {
+/* Returns bytes copied to the (current) user buffer or negative errno. */
+static int64_t tcp6_recv_copy_out(uint32_t conn_id, uint64_t buf_user, uint64_t len) {
+    uint8_t tmp[2048];
+    size_t want = (size_t)len;
+    if (want > sizeof(tmp)) want = sizeof(tmp);
+
+    int trc = net_tcp6_try_recv(conn_id, tmp, want);
+    if (trc > 0) {
+        if (write_bytes_to_user(buf_user, tmp, (uint64_t)trc) != 0) {
+            return -(int64_t)EFAULT;
+        }
+    }
+    return (int64_t)trc;
+}
+
+uint64_t sys_mona_tcp6_recv(uint64_t fd,
+                            uint64_t buf_user,
+                            uint64_t len,
+                            uint64_t timeout_ms) {
     proc_t *cur = &g_procs[g_cur_proc];
 
     if (len != 0 && !user_range_ok(buf_user, len)) {
@@ -547,44 +434,21 @@ uint64_t sys_mona_tcp6_recv(uint64_t fd, uint64_t buf_user, uint64_t len, uint64
     int rc = get_tcp6_conn_id_from_fd(cur, fd, &conn_id);
     if (rc < 0) return (uint64_t)(int64_t)rc;
 
-    uint64_t start_ns = time_now_ns();
-    uint64_t deadline_ns = 0;
-    if (timeout_ms != 0) {
-        uint64_t timeout_ns = timeout_ms * 1000000ull;
-        uint64_t d = start_ns + timeout_ns;
-        if (d < start_ns) d = 0xFFFFFFFFFFFFFFFFull;
-        deadline_ns = d;
-        if (start_ns == 0) deadline_ns = 0;
-    }
-
-    uint8_t tmp[2048];
-    for (;;) {
-        size_t want = (size_t)len;
-        if (want > sizeof(tmp)) want = sizeof(tmp);
-
-        int trc = net_tcp6_try_recv(conn_id, tmp, want);
-        if (trc >= 0) {
-            if (trc != 0) {
-                if (write_bytes_to_user(buf_user, tmp, (uint64_t)trc) != 0) {
-                    return (uint64_t)(-(int64_t)EFAULT);
-                }
-            }
-            return (uint64_t)trc;
-        }
-
-        if (trc != -(int)EAGAIN) {
-            return (uint64_t)(int64_t)trc;
-        }
-
 #if defined(ENABLE_USB_KBD) || defined(ENABLE_USB_NET)
-        usb_poll();
+    usb_poll();
 #endif
 
-        if (deadline_ns != 0) {
-            uint64_t now = time_now_ns();
-            if (now != 0 && now >= deadline_ns) {
-                return (uint64_t)(-(int64_t)ETIMEDOUT);
-            }
+    /* Block until data, FIN or the deadline. */
+    uint64_t deadline = net_timeout_deadline(timeout_ms);
+    int timed_out = 0;
+    int64_t n;
+    while ((n = tcp6_recv_copy_out(conn_id, buf_user, len)) == -(int64_t)EAGAIN) {
+        if (timed_out) {
+            return (uint64_t)(-(int64_t)ETIMEDOUT);
         }
+        wait_block(cur, PROC_BLOCKED_IO, net_tcp6_waitq(conn_id), deadline);
+        sched_block();
+        timed_out = wait_timed_out(cur);
     }
+    return (uint64_t)n;
 }
@@ -1,238 +1,205 @@
 #include "syscalls.h"
 
-#include "cache.h"
 #include "elf64.h"
 #include "errno.h"
+#include "exec_cache.h"
+#include "fd.h"
 #include "initramfs.h"
 #include "linux_abi.h"
 #include "mmu.h"
-#include "pmm.h"
 #include "power.h"
 #include "proc.h"
 #include "regs.h"
 #include "sched.h"
 #include "stat_bits.h"
+#include "string.h"
 #include "sys_util.h"
+#include "time.h"
+#include "uaccess.h"
 #include "uart_pl011.h"
+#include "vfs.h"
+#include "vm.h"
 
-static void byte_copy(void *dst, const uint8_t *src, uint64_t n) {
-    uint8_t *d = (uint8_t *)dst;
-    for (uint64_t i = 0; i < n; i++) {
-        d[i] = src[i];
-    }
-}
+/* Keep this much unmapped below the stack and above the brk heap. */
+#define STACK_GUARD (256u * 1024u)
+#define HEAP_GUARD (64u * 1024u)
 
 uint64_t sys_brk(uint64_t newbrk) {
+    const uint64_t PAGE = VM_PAGE_SIZE;
     proc_t *cur = &g_procs[g_cur_proc];
 
-    /* Lazy init for pre-execve callers: keep it within user region. */
-    if (cur->heap_base == 0) {
-        cur->heap_base = align_up_u64(USER_REGION_BASE, 16);
-        cur->heap_end = cur->heap_base;
-    }
-    if (cur->stack_low == 0) {
-        cur->stack_low = cur->tf.sp_el0;
-    }
-
     if (newbrk == 0) {
         return cur->heap_end;
     }
 
-    /* Simple safety gap to reduce heap/stack collisions without full VM. */
-    const uint64_t STACK_GUARD = 256u * 1024u;
-    uint64_t max_brk = USER_REGION_BASE + USER_REGION_SIZE;
-    if (cur->stack_low > USER_REGION_BASE + STACK_GUARD) {
-        uint64_t lim = cur->stack_low - STACK_GUARD;
-        if (lim < max_brk) max_brk = lim;
-    }
-
+    uint64_t max_brk = USER_STACK_TOP - USER_STACK_SIZE - STACK_GUARD;
     newbrk = align_up_u64(newbrk, 16);
     if (newbrk < cur->heap_base || newbrk > max_brk) {
         /* Linux brk returns the current program break on failure. */
         return cur->heap_end;
     }
 
+    /* The heap VMA covers whole pages up to the break. */
+    uint64_t old_top = align_up_u64(cur->heap_end, PAGE);
+    uint64_t new_top = align_up_u64(newbrk, PAGE);
+    if (new_top > old_top) {
+        if (vm_map(&cur->vm, old_top, new_top - old_top, MMU_PROT_READ | MMU_PROT_WRITE, VMA_HEAP) != 0) {
+            /* Ran into a mapping (or out of memory). */
+            return cur->heap_end;
+        }
+    } else if (new_top < old_top) {
+        /* Shrinking: remember the peak first. */
+        proc_note_rss(cur);
+        if (vm_unmap(&cur->vm, new_top, old_top - new_top) != 0) {
+            return cur->heap_end;
+        }
+    }
     cur->heap_end = newbrk;
     return cur->heap_end;
 }
 
-static int vma_overlaps(proc_t *p, uint64_t base, uint64_t len, uint64_t *out_overlap_base) {
-    uint64_t end = base + len;
-    for (uint64_t i = 0; i < MAX_VMAS; i++) {
-        if (!p->vmas[i].used) continue;
-        uint64_t b = p->vmas[i].base;
-        uint64_t e = b + p->vmas[i].len;
-        if (!(end <= b || base >= e)) {
-            if (out_overlap_base) *out_overlap_base = b;
-            return 1;
-        }
+/* Where an mmap() of fd gets its bytes. Initramfs data is mapped in place.
+ * Ramfiles are pages of their own: *ramfile is set to the file id, and its
+ * pages are shared with the mapping copy-on-write (vm_map_page()). Neither
+ * can be written back to.
+ */
+static int mmap_file_source(proc_t *p,
+                            int64_t fd,
+                            int shared_write,
+                            const uint8_t **data,
+                            uint64_t *size,
+                            int *in_place,
+                            int64_t *ramfile) {
+    *ramfile = -1;
+    if (fd < 0) return -(int)EBADF;
+    file_desc_t *d = desc_get(fd_get_desc_idx(&p->fdt, (uint64_t)fd));
+    if (!d) return -(int)EBADF;
+
+    if (d->kind == FDESC_INITRAMFS) {
+        if (d->u.initramfs.is_dir) return -(int)ENODEV;
+        if (shared_write) return -(int)EACCES;
+        *data = d->u.initramfs.data;
+        *size = d->u.initramfs.size;
+        *in_place = initramfs_contains(*data, *size);
+        return 0;
     }
-    return 0;
-}
-
-static uint64_t proc_mmap_hi(proc_t *p) {
-    const uint64_t PAGE = 4096u;
-    const uint64_t STACK_GUARD = 256u * 1024u;
-    uint64_t hi = USER_REGION_BASE + USER_REGION_SIZE;
-    if (p->stack_low > USER_REGION_BASE + STACK_GUARD) {
-        uint64_t lim = p->stack_low - STACK_GUARD;
-        if (lim < hi) hi = lim;
-    }
-    hi = align_down_u64(hi, PAGE);
-    if (hi < USER_REGION_BASE) hi = USER_REGION_BASE;
-    return hi;
-}
-
-static uint64_t proc_recompute_mmap_next(proc_t *p) {
-    uint64_t top = proc_mmap_hi(p);
-    for (;;) {
-        int found = 0;
-        for (uint64_t i = 0; i < MAX_VMAS; i++) {
-            if (!p->vmas[i].used) continue;
-            uint64_t end = p->vmas[i].base + p->vmas[i].len;
-            if (end == top) {
-                top = p->vmas[i].base;
-                found = 1;
-                break;
-            }
+    if (d->kind == FDESC_RAMFILE) {
+        if (shared_write) return -(int)ENOSYS;
+        if (vfs_ramfile_get(d->u.ramfile.file_id, size, 0, 0) != 0) {
+            return -(int)EBADF;
         }
-        if (!found) break;
+        *data = 0;
+        *in_place = 0;
+        *ramfile = (int64_t)d->u.ramfile.file_id;
+        return 0;
     }
-    return top;
+    return -(int)ENODEV;
 }
 
 uint64_t sys_mmap(uint64_t addr, uint64_t len, uint64_t prot, uint64_t flags, int64_t fd, uint64_t off) {
-    (void)prot;
-    (void)off;
-
-    const uint64_t PAGE = 4096u;
+    const uint64_t PAGE = VM_PAGE_SIZE;
+    const uint64_t MAP_SHARED = 0x01u;
     const uint64_t MAP_PRIVATE = 0x02u;
     const uint64_t MAP_FIXED = 0x10u;
     const uint64_t MAP_ANONYMOUS = 0x20u;
     const uint64_t MAP_STACK = 0x20000u;
-    const uint64_t HEAP_GUARD = 64u * 1024u;
+    const uint64_t PROT_ALL = MMU_PROT_READ | MMU_PROT_WRITE | MMU_PROT_EXEC;
 
     if (len == 0) return (uint64_t)(-(int64_t)EINVAL);
-    if (fd != -1) return (uint64_t)(-(int64_t)ENOSYS);
-    if (off != 0) return (uint64_t)(-(int64_t)ENOSYS);
+    if ((prot & ~PROT_ALL) != 0) return (uint64_t)(-(int64_t)EINVAL);
 
-    /* Support only anonymous private mappings for now.
-     * Allow MAP_STACK as a hint (commonly used by runtimes for thread stacks).
+    /* Exactly one of MAP_SHARED/MAP_PRIVATE. Allow MAP_STACK as a hint
+     * (commonly used by runtimes for thread stacks).
      */
-    if ((flags & (MAP_PRIVATE | MAP_ANONYMOUS)) != (MAP_PRIVATE | MAP_ANONYMOUS)) {
-        return (uint64_t)(-(int64_t)ENOSYS);
+    uint64_t share = flags & (MAP_SHARED | MAP_PRIVATE);
+    if (share != MAP_SHARED && share != MAP_PRIVATE) {
+        return (uint64_t)(-(int64_t)EINVAL);
     }
     if ((flags & MAP_FIXED) != 0) {
-        /* Fixed mappings need real VM and are easy to get wrong. */
+        /* Fixed mappings would replace existing ones: not supported yet. */
         return (uint64_t)(-(int64_t)ENOSYS);
     }
-    if ((flags & ~(MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK)) != 0) {
+    if ((flags & ~(MAP_SHARED | MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK)) != 0) {
         return (uint64_t)(-(int64_t)ENOSYS);
     }
 
     proc_t *p = &g_procs[g_cur_proc];
     uint64_t alen = align_up_u64(len, PAGE);
+    if (alen < len) return (uint64_t)(-(int64_t)ENOMEM);
 
-    /* Ensure heap/stack bounds are initialized for gap checks. */
-    if (p->heap_base == 0) {
-        p->heap_base = align_up_u64(USER_REGION_BASE, 16);
-        p->heap_end = p->heap_base;
-    }
-    if (p->stack_low == 0) {
-        p->stack_low = p->tf.sp_el0;
+    /* File mappings: read-only sources, so MAP_SHARED is only possible
+     * without PROT_WRITE; MAP_PRIVATE copies a page on its first write.
+     */
+    int anon = (flags & MAP_ANONYMOUS) != 0;
+    const uint8_t *data = 0;
+    uint64_t size = 0;
+    int in_place = 0;
+    int64_t ramfile = -1;
+    if (anon) {
+        if (share != MAP_PRIVATE) return (uint64_t)(-(int64_t)ENOSYS);
+    } else {
+        if ((off & (PAGE - 1u)) != 0) return (uint64_t)(-(int64_t)EINVAL);
+        int shared_write = share == MAP_SHARED && (prot & MMU_PROT_WRITE) != 0;
+        int rc = mmap_file_source(p, fd, shared_write, &data, &size, &in_place, &ramfile);
+        if (rc != 0) return (uint64_t)(int64_t)rc;
+        if (off >= size) {
+            size = 0;
+        } else {
+            if (data) data += off;
+            size -= off;
+        }
     }
 
-    /* If the caller provided an address, treat it as a hint (Linux behavior).
-     * We try it first; if it doesn't fit, fall back to choosing an address.
+    /* Between the brk heap (with room to grow) and the stack. */
+    uint64_t lo = align_up_u64(p->heap_end, PAGE) + HEAP_GUARD;
+    uint64_t hi = USER_STACK_TOP - USER_STACK_SIZE - STACK_GUARD;
+
+    /* If the caller provided an address, treat it as a hint (Linux behavior):
+     * use it if that range is free, otherwise choose top-down, like Linux.
      */
+    uint64_t base = 0;
     if (addr != 0) {
         if ((addr & (PAGE - 1u)) != 0) {
             return (uint64_t)(-(int64_t)EINVAL);
         }
-
-        uint64_t base = addr;
-        uint64_t end_hint = base + alen;
-        if (end_hint >= base) {
-            uint64_t hi = proc_mmap_hi(p);
-
-            uint64_t heap_lim = p->heap_end;
-            if (heap_lim < p->heap_base) heap_lim = p->heap_base;
-            heap_lim = align_up_u64(heap_lim, PAGE);
-
-            if (base >= USER_REGION_BASE && end_hint <= hi && base >= heap_lim + HEAP_GUARD) {
-                uint64_t ovb = 0;
-                if (!vma_overlaps(p, base, alen, &ovb)) {
-                    int slot = -1;
-                    for (uint64_t i = 0; i < MAX_VMAS; i++) {
-                        if (!p->vmas[i].used) {
-                            slot = (int)i;
-                            break;
-                        }
-                    }
-                    if (slot >= 0) {
-                        p->vmas[slot].used = 1;
-                        p->vmas[slot].base = base;
-                        p->vmas[slot].len = alen;
-                        return base;
-                    }
-                }
-            }
+        if (addr >= lo && addr + alen > addr && addr + alen <= hi &&
+            vm_find_free(&p->vm, addr, addr + alen, alen) == addr) {
+            base = addr;
         }
-        /* Hint failed: continue with allocator-chosen address. */
     }
-
-    /* Lazy init. */
-    if (p->mmap_next == 0) {
-        p->mmap_next = proc_mmap_hi(p);
-    } else {
-        /* Stack may have moved; tighten the ceiling if needed. */
-        uint64_t hi = proc_mmap_hi(p);
-        if (p->mmap_next > hi) p->mmap_next = hi;
+    if (base == 0) {
+        base = vm_find_free(&p->vm, lo, hi, alen);
+    }
+    if (base == 0) {
+        return (uint64_t)(-(int64_t)ENOMEM);
     }
 
-    uint64_t end = align_down_u64(p->mmap_next, PAGE);
-    for (;;) {
-        if (end < USER_REGION_BASE + alen) {
-            return (uint64_t)(-(int64_t)ENOMEM);
-        }
-        uint64_t base = align_down_u64(end - alen, PAGE);
-
-        /* Keep mmap area above the current brk heap (simple split). */
-        uint64_t heap_lim = p->heap_end;
-        if (heap_lim < p->heap_base) heap_lim = p->heap_base;
-        heap_lim = align_up_u64(heap_lim, PAGE);
-        if (base < heap_lim + HEAP_GUARD) {
-            return (uint64_t)(-(int64_t)ENOMEM);
-        }
-
-        uint64_t ovb = 0;
-        if (vma_overlaps(p, base, alen, &ovb)) {
-            /* Move below the overlapping region and retry. */
-            end = align_down_u64(ovb, PAGE);
-            continue;
-        }
-
-        int slot = -1;
-        for (uint64_t i = 0; i < MAX_VMAS; i++) {
-            if (!p->vmas[i].used) {
-                slot = (int)i;
-                break;
+    int rc;
+    if (ramfile >= 0) {
+        rc = vm_map(&p->vm, base, alen, (uint32_t)prot, VMA_FILE);
+        /* Holes and the tail past the end stay demand-zero. */
+        for (uint64_t va = 0; rc == 0 && va < size && va < alen; va += PAGE) {
+            uint64_t pa = vfs_ramfile_page((uint32_t)ramfile, (off + va) / PAGE);
+            if (pa != 0) {
+                rc = vm_map_page(&p->vm, base + va, pa);
+                if (rc != 0) (void)vm_unmap(&p->vm, base, alen);
             }
         }
-        if (slot < 0) {
-            return (uint64_t)(-(int64_t)ENOMEM);
-        }
-
-        p->vmas[slot].used = 1;
-        p->vmas[slot].base = base;
-        p->vmas[slot].len = alen;
-        p->mmap_next = base;
-        return base;
+    } else {
+        rc = anon ? vm_map(&p->vm, base, alen, (uint32_t)prot, 0)
+                  : vm_map_data(&p->vm, base, alen, (uint32_t)prot, data, size, in_place);
+    }
+    if (rc != 0) {
+        return (uint64_t)(int64_t)rc;
     }
+    if (!anon) {
+        proc_note_rss(p);
+    }
+    return base;
 }
 
 uint64_t sys_munmap(uint64_t addr, uint64_t len) {
-    const uint64_t PAGE = 4096u;
+    const uint64_t PAGE = VM_PAGE_SIZE;
     if ((addr & (PAGE - 1u)) != 0) return (uint64_t)(-(int64_t)EINVAL);
     if (len == 0) return (uint64_t)(-(int64_t)EINVAL);
 
@@ -242,137 +209,193 @@ uint64_t sys_munmap(uint64_t addr, uint64_t len) {
     uint64_t unmap_end = addr + alen;
     if (unmap_end < unmap_base) return (uint64_t)(-(int64_t)EINVAL);
 
-    int unmapped_any = 0;
-
-    for (uint64_t i = 0; i < MAX_VMAS; i++) {
-        if (!p->vmas[i].used) continue;
+    int mapped_any = 0;
+    for (const vma_t *v = p->vm.vmas; v; v = v->next) {
+        if (v->end > unmap_base && v->start < unmap_end) {
+            mapped_any = 1;
+            break;
+        }
+    }
+    if (!mapped_any) {
+        return (uint64_t)(-(int64_t)EINVAL);
+    }
 
-        uint64_t vb = p->vmas[i].base;
-        uint64_t ve = vb + p->vmas[i].len;
-        if (ve < vb) continue;
+    proc_note_rss(p);
+    if (vm_unmap(&p->vm, unmap_base, alen) != 0) {
+        return (uint64_t)(-(int64_t)ENOMEM);
+    }
+    return 0;
+}
 
-        /* No overlap? */
-        if (unmap_end <= vb || unmap_base >= ve) continue;
+uint64_t sys_mremap(uint64_t old_addr, uint64_t old_len, uint64_t new_len, uint64_t flags, uint64_t new_addr) {
+    const uint64_t PAGE = VM_PAGE_SIZE;
+    const uint64_t MREMAP_MAYMOVE = 1u;
+    const uint64_t MREMAP_FIXED = 2u;
+    (void)new_addr;
 
-        /* Full removal */
-        if (unmap_base <= vb && unmap_end >= ve) {
-            p->vmas[i].used = 0;
-            p->vmas[i].base = 0;
-            p->vmas[i].len = 0;
-            unmapped_any = 1;
-            continue;
-        }
+    if ((old_addr & (PAGE - 1u)) != 0) return (uint64_t)(-(int64_t)EINVAL);
+    if ((flags & ~(MREMAP_MAYMOVE | MREMAP_FIXED)) != 0) return (uint64_t)(-(int64_t)EINVAL);
+    if ((flags & MREMAP_FIXED) != 0) {
+        /* Like MAP_FIXED: would replace existing mappings. */
+        return (uint64_t)(-(int64_t)ENOSYS);
+    }
 
-        /* Trim front */
-        if (unmap_base <= vb && unmap_end < ve) {
-            p->vmas[i].base = unmap_end;
-            p->vmas[i].len = ve - unmap_end;
-            unmapped_any = 1;
-            continue;
-        }
+    uint64_t olen = align_up_u64(old_len, PAGE);
+    uint64_t nlen = align_up_u64(new_len, PAGE);
+    /* old_len 0 duplicates a shared mapping on Linux: there are none. */
+    if (olen == 0 || olen < old_len || nlen == 0 || nlen < new_len) {
+        return (uint64_t)(-(int64_t)EINVAL);
+    }
 
-        /* Trim tail */
-        if (unmap_base > vb && unmap_end >= ve) {
-            p->vmas[i].len = unmap_base - vb;
-            unmapped_any = 1;
-            continue;
-        }
+    proc_t *p = &g_procs[g_cur_proc];
+    uint64_t old_end = old_addr + olen;
+    const vma_t *v = vm_find(&p->vm, old_addr);
+    if (!v || old_end < old_addr || old_end > v->end) {
+        return (uint64_t)(-(int64_t)EFAULT);
+    }
+    if ((v->flags & (VMA_HEAP | VMA_STACK)) != 0) {
+        /* The brk heap and the stack only grow their own way. */
+        return (uint64_t)(-(int64_t)EINVAL);
+    }
+    if ((v->flags & VMA_FILE) != 0 && nlen > olen) {
+        /* The new pages would be anonymous zeros, not more of the file.
+         * Shrinking or moving a file mapping is fine.
+         */
+        return (uint64_t)(-(int64_t)EINVAL);
+    }
 
-        /* Split into two VMAs */
-        if (unmap_base > vb && unmap_end < ve) {
-            int slot = -1;
-            for (uint64_t j = 0; j < MAX_VMAS; j++) {
-                if (!p->vmas[j].used) {
-                    slot = (int)j;
-                    break;
-                }
-            }
-            if (slot < 0) {
+    if (nlen <= olen) {
+        if (nlen < olen) {
+            proc_note_rss(p);
+            if (vm_unmap(&p->vm, old_addr + nlen, olen - nlen) != 0) {
                 return (uint64_t)(-(int64_t)ENOMEM);
             }
-
-            uint64_t left_len = unmap_base - vb;
-            uint64_t right_base = unmap_end;
-            uint64_t right_len = ve - unmap_end;
-
-            p->vmas[i].len = left_len;
-
-            p->vmas[slot].used = 1;
-            p->vmas[slot].base = right_base;
-            p->vmas[slot].len = right_len;
-
-            unmapped_any = 1;
-            continue;
         }
+        return old_addr;
     }
 
-    if (!unmapped_any) {
-        return (uint64_t)(-(int64_t)EINVAL);
+    /* Grow in place if the pages right above are free (vm_map() merges the
+     * extension into the VMA), else move the page table entries.
+     */
+    uint64_t lo = align_up_u64(p->heap_end, PAGE) + HEAP_GUARD;
+    uint64_t hi = USER_STACK_TOP - USER_STACK_SIZE - STACK_GUARD;
+    uint64_t new_end = old_addr + nlen;
+    if (new_end > old_addr && new_end <= hi &&
+        vm_find_free(&p->vm, old_end, new_end, nlen - olen) == old_end) {
+        int rc = vm_map(&p->vm, old_end, nlen - olen, v->prot, v->flags);
+        return (rc == 0) ? old_addr : (uint64_t)(int64_t)rc;
+    }
+    if ((flags & MREMAP_MAYMOVE) == 0) {
+        return (uint64_t)(-(int64_t)ENOMEM);
     }
 
-    p->mmap_next = proc_recompute_mmap_next(p);
-    return 0;
+    uint64_t base = vm_find_free(&p->vm, lo, hi, nlen);
+    if (base == 0) {
+        return (uint64_t)(-(int64_t)ENOMEM);
+    }
+    int rc = vm_move(&p->vm, old_addr, olen, base, nlen);
+    return (rc == 0) ? base : (uint64_t)(int64_t)rc;
 }
 
-uint64_t sys_execve(trap_frame_t *tf, uint64_t pathname_user, uint64_t argv_user, uint64_t envp_user) {
-    enum {
-        MAX_ARGS = 32,
-        MAX_ENVP = 32,
-        MAX_STR = 256,
-    };
-
-    /* Minimal Linux auxv types we care about for static binaries. */
-    enum {
-        AT_NULL = 0,
-        AT_PHDR = 3,
-        AT_PHENT = 4,
-        AT_PHNUM = 5,
-        AT_PAGESZ = 6,
-        AT_ENTRY = 9,
-        AT_UID = 11,
-        AT_EUID = 12,
-        AT_GID = 13,
-        AT_EGID = 14,
-        AT_PLATFORM = 15,
-        AT_EXECFN = 31,
-        AT_RANDOM = 25,
-        AT_SECURE = 23,
-    };
+uint64_t sys_madvise(uint64_t addr, uint64_t len, uint64_t advice) {
+    const uint64_t PAGE = VM_PAGE_SIZE;
+    const uint64_t MADV_NORMAL = 0;
+    const uint64_t MADV_WILLNEED = 3;
+    const uint64_t MADV_DONTNEED = 4;
+    const uint64_t MADV_FREE = 8;
 
-    /* Snapshot argv/envp strings from the *current* user image before loading the new one. */
-    char arg_strs[MAX_ARGS][MAX_STR];
-    char env_strs[MAX_ENVP][MAX_STR];
-    uint64_t argc = 0;
-    uint64_t envc = 0;
+    if ((addr & (PAGE - 1u)) != 0) return (uint64_t)(-(int64_t)EINVAL);
+    uint64_t alen = align_up_u64(len, PAGE);
+    if (alen < len) return (uint64_t)(-(int64_t)EINVAL);
+
+    proc_t *p = &g_procs[g_cur_proc];
+    if (advice == MADV_DONTNEED || advice == MADV_FREE) {
+        /* Give the pages back now; the range reads as zeros afterwards. */
+        proc_note_rss(p);
+        int rc = vm_discard(&p->vm, addr, alen);
+        return (rc == 0) ? 0 : (uint64_t)(int64_t)rc;
+    }
+    /* NORMAL, RANDOM, SEQUENTIAL, WILLNEED: no paging policy to tune. */
+    if (advice >= MADV_NORMAL && advice <= MADV_WILLNEED) {
+        return 0;
+    }
+    return (uint64_t)(-(int64_t)EINVAL);
+}
+
+enum {
+    EXEC_MAX_ARGS = 32,
+    EXEC_MAX_ENVP = 32,
+    EXEC_MAX_STR = 256,
+};
+
+/* Minimal Linux auxv types we care about for static binaries. */
+enum {
+    AT_NULL = 0,
+    AT_PHDR = 3,
+    AT_PHENT = 4,
+    AT_PHNUM = 5,
+    AT_PAGESZ = 6,
+    AT_ENTRY = 9,
+    AT_UID = 11,
+    AT_EUID = 12,
+    AT_GID = 13,
+    AT_EGID = 14,
+    AT_PLATFORM = 15,
+    AT_EXECFN = 31,
+    AT_RANDOM = 25,
+    AT_SECURE = 23,
+};
+
+/* execve/spawn arguments, snapshotted from the caller's address space. */
+typedef struct {
+    char path[MAX_PATH];
+    char arg_strs[EXEC_MAX_ARGS][EXEC_MAX_STR];
+    char env_strs[EXEC_MAX_ENVP][EXEC_MAX_STR];
+    uint64_t argc;
+    uint64_t envc;
+} exec_args_t;
+
+/* Initial user register state of a freshly built image. */
+typedef struct {
+    uint64_t entry;
+    uint64_t sp;
+    uint64_t argv;
+    uint64_t envp;
+    uint64_t heap_base;
+} exec_start_t;
+
+static uint64_t exec_args_read(proc_t *cur, exec_args_t *a, uint64_t pathname_user, uint64_t argv_user, uint64_t envp_user) {
+    a->argc = 0;
+    a->envc = 0;
 
     if (argv_user != 0) {
-        for (; argc < MAX_ARGS; argc++) {
+        for (; a->argc < EXEC_MAX_ARGS; a->argc++) {
             uint64_t p = 0;
-            if (read_u64_from_user(argv_user + argc * 8u, &p) != 0) {
+            if (read_u64_from_user(argv_user + a->argc * 8u, &p) != 0) {
                 return (uint64_t)(-(int64_t)EFAULT);
             }
             if (p == 0) break;
-            if (copy_cstr_from_user(arg_strs[argc], MAX_STR, p) != 0) {
+            if (copy_cstr_from_user(a->arg_strs[a->argc], EXEC_MAX_STR, p) != 0) {
                 return (uint64_t)(-(int64_t)EFAULT);
             }
         }
-        if (argc == MAX_ARGS) {
+        if (a->argc == EXEC_MAX_ARGS) {
             return (uint64_t)(-(int64_t)E2BIG);
         }
     }
 
     if (envp_user != 0) {
-        for (; envc < MAX_ENVP; envc++) {
+        for (; a->envc < EXEC_MAX_ENVP; a->envc++) {
             uint64_t p = 0;
-            if (read_u64_from_user(envp_user + envc * 8u, &p) != 0) {
+            if (read_u64_from_user(envp_user + a->envc * 8u, &p) != 0) {
                 return (uint64_t)(-(int64_t)EFAULT);
             }
             if (p == 0) break;
-            if (copy_cstr_from_user(env_strs[envc], MAX_STR, p) != 0) {
+            if (copy_cstr_from_user(a->env_strs[a->envc], EXEC_MAX_STR, p) != 0) {
                 return (uint64_t)(-(int64_t)EFAULT);
             }
         }
-        if (envc == MAX_ENVP) {
+        if (a->envc == EXEC_MAX_ENVP) {
             return (uint64_t)(-(int64_t)E2BIG);
         }
     }
@@ -382,14 +405,13 @@ uint64_t sys_execve(trap_frame_t *tf, uint64_t pathname_user, uint64_t argv_user
         return (uint64_t)(-(int64_t)EFAULT);
     }
 
-    proc_t *cur = &g_procs[g_cur_proc];
-    char path[MAX_PATH];
-    if (resolve_path(cur, in, path, sizeof(path)) != 0) {
+    if (resolve_path(cur, in, a->path, sizeof(a->path)) != 0) {
         return (uint64_t)(-(int64_t)EINVAL);
     }
 
     /* If argv is missing, provide a sensible argv[0] for compatibility. */
     if (argv_user == 0) {
+        const char *path = a->path;
         const char *p = path;
         for (uint64_t i = 0; path[i] != '\0'; i++) {
             if (path[i] == '/') p = &path[i + 1];
@@ -397,312 +419,262 @@ uint64_t sys_execve(trap_frame_t *tf, uint64_t pathname_user, uint64_t argv_user
         /* If path ends with '/', fall back to the full path. */
         if (*p == '\0') p = path;
 
-        argc = 1;
+        a->argc = 1;
         /* Copy into snapshot buffer.
-         * (Avoid libc; cap at MAX_STR-1.)
+         * (Avoid libc; cap at EXEC_MAX_STR-1.)
          */
         uint64_t j = 0;
-        for (; j + 1 < MAX_STR && p[j] != '\0'; j++) {
-            arg_strs[0][j] = p[j];
+        for (; j + 1 < EXEC_MAX_STR && p[j] != '\0'; j++) {
+            a->arg_strs[0][j] = p[j];
         }
-        arg_strs[0][j] = '\0';
-    }
-
-    const uint8_t *img = 0;
-    uint64_t img_size = 0;
-    uint32_t mode = 0;
-    if (initramfs_lookup(path, &img, &img_size, &mode) != 0) {
-        return (uint64_t)(-(int64_t)ENOENT);
-    }
-    if (S_ISDIR(mode)) {
-        return (uint64_t)(-(int64_t)EISDIR);
-    }
-
-    uint64_t entry = 0;
-    uint64_t minva = 0;
-    uint64_t maxva = 0;
-    uint64_t user_pa_base = cur->user_pa_base;
-    if (user_pa_base == 0) {
-        user_pa_base = USER_REGION_BASE;
-    }
-    if (elf64_load_etexec(img, (size_t)img_size, USER_REGION_BASE, USER_REGION_SIZE, user_pa_base, &entry, &minva, &maxva) != 0) {
-        return (uint64_t)(-(int64_t)ENOEXEC);
-    }
-
-    /*
-     * Touch a few words of the freshly loaded image via both the user VA and
-     * the backing physical alias. This helps avoid occasional stale/garbled
-     * instruction fetches observed under QEMU when execve() replaces the image.
-     */
-    if (maxva > minva) {
-        volatile uint32_t touch = 0;
-        uint64_t va0 = minva;
-        uint64_t pa0 = user_pa_base + (va0 - USER_REGION_BASE);
-        touch ^= *(volatile uint32_t *)(uintptr_t)va0;
-        touch ^= *(volatile uint32_t *)(uintptr_t)pa0;
-
-        uint64_t va1 = minva + 256u;
-        if (va1 + 4u <= maxva) {
-            uint64_t pa1 = user_pa_base + (va1 - USER_REGION_BASE);
-            touch ^= *(volatile uint32_t *)(uintptr_t)va1;
-            touch ^= *(volatile uint32_t *)(uintptr_t)pa1;
-        }
-        (void)touch;
+        a->arg_strs[0][j] = '\0';
     }
+    return 0;
+}
 
-    /* Compute auxiliary vectors derived from the ELF header.
-     * Best-effort: if we can't derive AT_PHDR safely, we omit it.
-     */
-    uint64_t at_phdr = 0;
-    uint64_t at_phent = 0;
-    uint64_t at_phnum = 0;
-    {
-        if (img_size >= sizeof(elf64_ehdr_t)) {
-            elf64_ehdr_t eh;
-            byte_copy(&eh, img, sizeof(eh));
-
-            at_phent = (uint64_t)eh.e_phentsize;
-            at_phnum = (uint64_t)eh.e_phnum;
-
-            uint64_t ph_end = eh.e_phoff + (uint64_t)eh.e_phnum * (uint64_t)eh.e_phentsize;
-            if (ph_end >= eh.e_phoff && ph_end <= img_size && eh.e_phentsize == sizeof(elf64_phdr_t)) {
-                /* Prefer PT_PHDR if present. */
-                for (uint16_t i = 0; i < eh.e_phnum; i++) {
-                    elf64_phdr_t ph;
-                    uint64_t ph_off = eh.e_phoff + (uint64_t)i * sizeof(elf64_phdr_t);
-                    if (ph_off + sizeof(ph) > img_size) break;
-                    byte_copy(&ph, img + ph_off, sizeof(ph));
-
-                    if (ph.p_type == PT_PHDR) {
-                        at_phdr = ph.p_vaddr;
-                        break;
-                    }
-                }
-
-                /* Fallback: program headers are typically within the first PT_LOAD segment. */
-                if (at_phdr == 0) {
-                    for (uint16_t i = 0; i < eh.e_phnum; i++) {
-                        elf64_phdr_t ph;
-                        uint64_t ph_off = eh.e_phoff + (uint64_t)i * sizeof(elf64_phdr_t);
-                        if (ph_off + sizeof(ph) > img_size) break;
-                        byte_copy(&ph, img + ph_off, sizeof(ph));
-
-                        if (ph.p_type != PT_LOAD) continue;
-                        if (ph.p_offset != 0) continue;
-
-                        /* Ensure ELF header + phdr table are within this LOAD in file image. */
-                        uint64_t need_end = eh.e_phoff + (uint64_t)eh.e_phnum * sizeof(elf64_phdr_t);
-                        if (need_end <= ph.p_filesz) {
-                            at_phdr = ph.p_vaddr + eh.e_phoff;
-                            break;
-                        }
-                    }
-                }
-
-                /* Validate computed address is within the loaded user range. */
-                if (at_phdr != 0) {
-                    uint64_t need = at_phnum * at_phent;
-                    if (!user_range_ok(at_phdr, need)) {
-                        at_phdr = 0;
-                    }
-                }
-            }
-        }
-    }
+/* Push len bytes onto the stack being built in vm. */
+static int stack_push(vm_space_t *vm, uint64_t *sp, const void *src, uint64_t len) {
+    *sp -= len;
+    return vm_copy_to(vm, *sp, src, len);
+}
 
-    if (maxva > minva) {
-        cache_sync_icache_for_range(minva, maxva - minva);
-    }
+static int stack_push_u64(vm_space_t *vm, uint64_t *sp, uint64_t v) {
+    return stack_push(vm, sp, &v, sizeof(v));
+}
 
-    /* Build an initial user stack containing argc/argv/envp/auxv (minimal). */
-    uint64_t sp = USER_REGION_BASE + USER_REGION_SIZE;
-    uint64_t argv_addrs[MAX_ARGS];
-    uint64_t envp_addrs[MAX_ENVP];
+static int stack_push_auxv(vm_space_t *vm, uint64_t *sp, uint64_t type, uint64_t val) {
+    uint64_t pair[2] = { type, val };
+    return stack_push(vm, sp, pair, sizeof(pair));
+}
 
-    /* Extra auxv-backed strings/blobs placed on the user stack. */
-    uint64_t execfn_addr = 0;
-    uint64_t platform_addr = 0;
-    uint64_t random_addr = 0;
+/* Initial user stack containing argc/argv/envp/auxv (minimal). */
+static int exec_stack_build(vm_space_t *vm, const elf64_image_t *im, const exec_args_t *a, exec_start_t *st) {
+    uint64_t sp = USER_STACK_TOP;
+    uint64_t argv_addrs[EXEC_MAX_ARGS];
+    uint64_t envp_addrs[EXEC_MAX_ENVP];
+    int rc;
 
     /* Copy strings near the top of the stack so pointers can reference them. */
-    for (uint64_t i = 0; i < argc; i++) {
-        uint64_t len2 = cstr_len(arg_strs[i]) + 1u;
-        sp -= len2;
-        if (!user_range_ok(sp, len2)) {
-            return (uint64_t)(-(int64_t)E2BIG);
-        }
-        if (write_bytes_to_user(sp, arg_strs[i], len2) != 0) {
-            return (uint64_t)(-(int64_t)EFAULT);
-        }
+    for (uint64_t i = 0; i < a->argc; i++) {
+        if ((rc = stack_push(vm, &sp, a->arg_strs[i], cstr_len(a->arg_strs[i]) + 1u)) != 0) return rc;
         argv_addrs[i] = sp;
     }
-
-    for (uint64_t i = 0; i < envc; i++) {
-        uint64_t len2 = cstr_len(env_strs[i]) + 1u;
-        sp -= len2;
-        if (!user_range_ok(sp, len2)) {
-            return (uint64_t)(-(int64_t)E2BIG);
-        }
-        if (write_bytes_to_user(sp, env_strs[i], len2) != 0) {
-            return (uint64_t)(-(int64_t)EFAULT);
-        }
+    for (uint64_t i = 0; i < a->envc; i++) {
+        if ((rc = stack_push(vm, &sp, a->env_strs[i], cstr_len(a->env_strs[i]) + 1u)) != 0) return rc;
         envp_addrs[i] = sp;
     }
 
-    /* execfn (full path) */
-    {
-        uint64_t len2 = cstr_len(path) + 1u;
-        sp -= len2;
-        if (!user_range_ok(sp, len2)) {
-            return (uint64_t)(-(int64_t)E2BIG);
-        }
-        if (write_bytes_to_user(sp, path, len2) != 0) {
-            return (uint64_t)(-(int64_t)EFAULT);
-        }
-        execfn_addr = sp;
-    }
+    /* Extra auxv-backed strings/blobs: execfn (full path), platform and
+     * AT_RANDOM's 16 bytes.
+     */
+    if ((rc = stack_push(vm, &sp, a->path, cstr_len(a->path) + 1u)) != 0) return rc;
+    uint64_t execfn_addr = sp;
 
-    /* platform */
-    {
-        static const char platform[] = "aarch64";
-        uint64_t len2 = sizeof(platform);
-        sp -= len2;
-        if (!user_range_ok(sp, len2)) {
-            return (uint64_t)(-(int64_t)E2BIG);
-        }
-        if (write_bytes_to_user(sp, platform, len2) != 0) {
-            return (uint64_t)(-(int64_t)EFAULT);
-        }
-        platform_addr = sp;
-    }
+    static const char platform[] = "aarch64";
+    if ((rc = stack_push(vm, &sp, platform, sizeof(platform))) != 0) return rc;
+    uint64_t platform_addr = sp;
 
-    /* AT_RANDOM: 16 bytes */
-    {
-        uint8_t rnd[16];
-        /* Deterministic placeholder; replace with real entropy if/when available. */
-        for (uint64_t i = 0; i < sizeof(rnd); i++) rnd[i] = (uint8_t)(0xA5u ^ (uint8_t)i);
-        sp -= sizeof(rnd);
-        if (!user_range_ok(sp, sizeof(rnd))) {
-            return (uint64_t)(-(int64_t)E2BIG);
-        }
-        if (write_bytes_to_user(sp, rnd, sizeof(rnd)) != 0) {
-            return (uint64_t)(-(int64_t)EFAULT);
-        }
-        random_addr = sp;
-    }
+    uint8_t rnd[16];
+    /* Deterministic placeholder; replace with real entropy if/when available. */
+    for (uint64_t i = 0; i < sizeof(rnd); i++) rnd[i] = (uint8_t)(0xA5u ^ (uint8_t)i);
+    if ((rc = stack_push(vm, &sp, rnd, sizeof(rnd))) != 0) return rc;
+    uint64_t random_addr = sp;
 
     /* Align down for pointer writes. */
     sp = align_down_u64(sp, 16);
 
     /* auxv terminator first so it ends up last in memory order. */
-    sp -= 16u;
-    if (write_u64_to_user(sp + 0, AT_NULL) != 0) return (uint64_t)(-(int64_t)EFAULT);
-    if (write_u64_to_user(sp + 8, 0) != 0) return (uint64_t)(-(int64_t)EFAULT);
-
-    /* Minimal auxv surface (best-effort). */
-    sp -= 16u;
-    if (write_u64_to_user(sp + 0, AT_SECURE) != 0) return (uint64_t)(-(int64_t)EFAULT);
-    if (write_u64_to_user(sp + 8, 0) != 0) return (uint64_t)(-(int64_t)EFAULT);
-
-    sp -= 16u;
-    if (write_u64_to_user(sp + 0, AT_RANDOM) != 0) return (uint64_t)(-(int64_t)EFAULT);
-    if (write_u64_to_user(sp + 8, random_addr) != 0) return (uint64_t)(-(int64_t)EFAULT);
+    if ((rc = stack_push_auxv(vm, &sp, AT_NULL, 0)) != 0) return rc;
+    if ((rc = stack_push_auxv(vm, &sp, AT_SECURE, 0)) != 0) return rc;
+    if ((rc = stack_push_auxv(vm, &sp, AT_RANDOM, random_addr)) != 0) return rc;
+    if ((rc = stack_push_auxv(vm, &sp, AT_PLATFORM, platform_addr)) != 0) return rc;
+    if ((rc = stack_push_auxv(vm, &sp, AT_EXECFN, execfn_addr)) != 0) return rc;
+    if ((rc = stack_push_auxv(vm, &sp, AT_PAGESZ, 4096)) != 0) return rc;
+    if ((rc = stack_push_auxv(vm, &sp, AT_ENTRY, im->entry)) != 0) return rc;
+    if (im->phent != 0 && im->phnum != 0) {
+        if ((rc = stack_push_auxv(vm, &sp, AT_PHENT, im->phent)) != 0) return rc;
+        if ((rc = stack_push_auxv(vm, &sp, AT_PHNUM, im->phnum)) != 0) return rc;
+    }
+    if (im->phdr_va != 0) {
+        if ((rc = stack_push_auxv(vm, &sp, AT_PHDR, im->phdr_va)) != 0) return rc;
+    }
+    /* Identity values for ids (single-user environment). */
+    if ((rc = stack_push_auxv(vm, &sp, AT_UID, 0)) != 0) return rc;
+    if ((rc = stack_push_auxv(vm, &sp, AT_EUID, 0)) != 0) return rc;
+    if ((rc = stack_push_auxv(vm, &sp, AT_GID, 0)) != 0) return rc;
+    if ((rc = stack_push_auxv(vm, &sp, AT_EGID, 0)) != 0) return rc;
 
-    sp -= 16u;
-    if (write_u64_to_user(sp + 0, AT_PLATFORM) != 0) return (uint64_t)(-(int64_t)EFAULT);
-    if (write_u64_to_user(sp + 8, platform_addr) != 0) return (uint64_t)(-(int64_t)EFAULT);
+    /* envp, argv (NULL-terminated), argc. */
+    if ((rc = stack_push_u64(vm, &sp, 0)) != 0) return rc;
+    for (uint64_t i = a->envc; i > 0; i--) {
+        if ((rc = stack_push_u64(vm, &sp, envp_addrs[i - 1])) != 0) return rc;
+    }
+    st->envp = sp;
 
-    sp -= 16u;
-    if (write_u64_to_user(sp + 0, AT_EXECFN) != 0) return (uint64_t)(-(int64_t)EFAULT);
-    if (write_u64_to_user(sp + 8, execfn_addr) != 0) return (uint64_t)(-(int64_t)EFAULT);
+    if ((rc = stack_push_u64(vm, &sp, 0)) != 0) return rc;
+    for (uint64_t i = a->argc; i > 0; i--) {
+        if ((rc = stack_push_u64(vm, &sp, argv_addrs[i - 1])) != 0) return rc;
+    }
+    st->argv = sp;
 
-    sp -= 16u;
-    if (write_u64_to_user(sp + 0, AT_PAGESZ) != 0) return (uint64_t)(-(int64_t)EFAULT);
-    if (write_u64_to_user(sp + 8, 4096) != 0) return (uint64_t)(-(int64_t)EFAULT);
+    if ((rc = stack_push_u64(vm, &sp, a->argc)) != 0) return rc;
+    st->sp = sp;
+    return 0;
+}
 
-    sp -= 16u;
-    if (write_u64_to_user(sp + 0, AT_ENTRY) != 0) return (uint64_t)(-(int64_t)EFAULT);
-    if (write_u64_to_user(sp + 8, entry) != 0) return (uint64_t)(-(int64_t)EFAULT);
+/* Build the address space for a new image on the side: program, stack and
+ * its initial contents. Until it is installed nothing else has changed, so
+ * failing leaves the caller intact. Returns 0 or a negative errno (with
+ * *nvm destroyed).
+ */
+static int exec_image_build(const exec_args_t *a, vm_space_t *nvm, exec_start_t *st) {
+    const elf64_image_t *im = 0;
+    int rc = exec_cache_lookup(a->path, &im);
+    if (rc != 0) return rc;
 
-    if (at_phent != 0 && at_phnum != 0) {
-        sp -= 16u;
-        if (write_u64_to_user(sp + 0, AT_PHENT) != 0) return (uint64_t)(-(int64_t)EFAULT);
-        if (write_u64_to_user(sp + 8, at_phent) != 0) return (uint64_t)(-(int64_t)EFAULT);
+    if (vm_space_init(nvm) != 0) return -(int)ENOMEM;
 
-        sp -= 16u;
-        if (write_u64_to_user(sp + 0, AT_PHNUM) != 0) return (uint64_t)(-(int64_t)EFAULT);
-        if (write_u64_to_user(sp + 8, at_phnum) != 0) return (uint64_t)(-(int64_t)EFAULT);
+    rc = elf64_map(im, nvm, initramfs_contains(im->img, im->img_size));
+    if (rc == 0) {
+        rc = vm_map(nvm, USER_STACK_TOP - USER_STACK_SIZE, USER_STACK_SIZE, MMU_PROT_READ | MMU_PROT_WRITE, VMA_STACK);
     }
-
-    if (at_phdr != 0) {
-        sp -= 16u;
-        if (write_u64_to_user(sp + 0, AT_PHDR) != 0) return (uint64_t)(-(int64_t)EFAULT);
-        if (write_u64_to_user(sp + 8, at_phdr) != 0) return (uint64_t)(-(int64_t)EFAULT);
+    if (rc == 0) {
+        rc = exec_stack_build(nvm, im, a, st);
+    }
+    if (rc != 0) {
+        vm_space_destroy(nvm);
+        return rc;
     }
 
-    /* Identity values for ids (single-user environment). */
-    sp -= 16u;
-    if (write_u64_to_user(sp + 0, AT_UID) != 0) return (uint64_t)(-(int64_t)EFAULT);
-    if (write_u64_to_user(sp + 8, 0) != 0) return (uint64_t)(-(int64_t)EFAULT);
-
-    sp -= 16u;
-    if (write_u64_to_user(sp + 0, AT_EUID) != 0) return (uint64_t)(-(int64_t)EFAULT);
-    if (write_u64_to_user(sp + 8, 0) != 0) return (uint64_t)(-(int64_t)EFAULT);
+    st->entry = im->entry;
+    st->heap_base = align_up_u64(im->max_va, VM_PAGE_SIZE);
+    return 0;
+}
 
-    sp -= 16u;
-    if (write_u64_to_user(sp + 0, AT_GID) != 0) return (uint64_t)(-(int64_t)EFAULT);
-    if (write_u64_to_user(sp + 8, 0) != 0) return (uint64_t)(-(int64_t)EFAULT);
+/* A vfork() child is done with its parent's address space (it called execve
+ * or is exiting): hand vm back and let the parent run again. Returns 1 if
+ * the parent took vm, 0 if it is gone and vm stays with the caller.
+ */
+static int vfork_release(proc_t *c, vm_space_t *vm) {
+    if (!c->vfork_borrowed) return 0;
+    c->vfork_borrowed = 0;
+    if (c->parent_idx < 0) return 0;
+
+    proc_t *p = &g_procs[c->parent_idx];
+    waitq_wake_all(&p->child_wq);
+    if (p->state == PROC_ZOMBIE) return 0;
+
+    p->vm = *vm;
+    p->heap_base = c->heap_base;
+    p->heap_end = c->heap_end;
+    return 1;
+}
 
-    sp -= 16u;
-    if (write_u64_to_user(sp + 0, AT_EGID) != 0) return (uint64_t)(-(int64_t)EFAULT);
-    if (write_u64_to_user(sp + 8, 0) != 0) return (uint64_t)(-(int64_t)EFAULT);
+static void vm_space_forget(vm_space_t *vm) {
+    vm->ttbr0_pa = 0;
+    vm->asid = 0;
+    vm->vmas = 0;
+    vm->pages = 0;
+}
 
-    /* envp NULL */
-    sp -= 8u;
-    if (write_u64_to_user(sp, 0) != 0) return (uint64_t)(-(int64_t)EFAULT);
+uint64_t sys_execve(trap_frame_t *tf, uint64_t pathname_user, uint64_t argv_user, uint64_t envp_user) {
+    proc_t *cur = &g_procs[g_cur_proc];
 
-    /* envp pointers */
-    for (uint64_t i = envc; i > 0; i--) {
-        sp -= 8u;
-        if (write_u64_to_user(sp, envp_addrs[i - 1]) != 0) return (uint64_t)(-(int64_t)EFAULT);
+    /* Snapshot argv/envp strings from the *current* user image before loading the new one. */
+    exec_args_t a;
+    uint64_t ret = exec_args_read(cur, &a, pathname_user, argv_user, envp_user);
+    if (ret != 0) {
+        return ret;
     }
-    uint64_t envp_ptr = sp;
 
-    /* argv NULL */
-    sp -= 8u;
-    if (write_u64_to_user(sp, 0) != 0) return (uint64_t)(-(int64_t)EFAULT);
+    vm_space_t nvm;
+    exec_start_t st;
+    int rc = exec_image_build(&a, &nvm, &st);
+    if (rc != 0) {
+        return (uint64_t)(int64_t)rc;
+    }
 
-    /* argv pointers */
-    for (uint64_t i = argc; i > 0; i--) {
-        sp -= 8u;
-        if (write_u64_to_user(sp, argv_addrs[i - 1]) != 0) return (uint64_t)(-(int64_t)EFAULT);
+    /* Point of no return: switch over and free (or, after vfork, give back)
+     * the old image.
+     */
+    proc_note_rss(cur);
+    vm_space_t old = cur->vm;
+    cur->vm = nvm;
+    mmu_ttbr0_switch(cur->vm.ttbr0_pa, &cur->vm.asid);
+    if (!vfork_release(cur, &old)) {
+        mmu_asid_release(&old.asid);
+        vm_space_destroy(&old);
     }
-    uint64_t argv_ptr = sp;
 
-    /* argc */
-    sp -= 8u;
-    if (write_u64_to_user(sp, argc) != 0) return (uint64_t)(-(int64_t)EFAULT);
+    cur->heap_base = st.heap_base;
+    cur->heap_end = cur->heap_base;
+    proc_set_comm(cur, a.path);
 
-    tf->sp_el0 = sp;
-    tf->x[0] = argc;
-    tf->x[1] = argv_ptr;
-    tf->x[2] = envp_ptr;
+    tf->sp_el0 = st.sp;
+    tf->x[0] = a.argc;
+    tf->x[1] = st.argv;
+    tf->x[2] = st.envp;
 
-    write_sp_el0(sp);
-    write_elr_el1(entry);
+    write_sp_el0(st.sp);
+    write_elr_el1(st.entry);
 
     /* Persist entry point for later reschedules (we may time-slice after execve). */
-    g_procs[g_cur_proc].elr = entry;
+    cur->elr = st.entry;
 
-    /*
-     * execve() replaces the current process image without switching processes.
-     * Since we don't use ASIDs, stale VA-tagged cache lines can survive across
-     * the image replacement. Flush here to ensure EL0 always fetches the newly
-     * loaded instructions/data.
+    return 0;
+}
+
+/* New child of parent, returning to EL0 at elr with the registers in tf.
+ * Inherits the fd table, cwd and comm but has no address space yet; the
+ * caller provides one and makes it runnable. Returns the slot or a negative
+ * errno.
+ */
+static int proc_create_child(proc_t *parent, const trap_frame_t *tf, uint64_t elr) {
+    int slot = proc_find_free_slot();
+    if (slot < 0) {
+        return -(int)EMFILE;
+    }
+
+    proc_t *child = &g_procs[slot];
+    proc_clear(child);
+    if (proc_alloc_kstack(child) != 0) {
+        return -(int)ENOMEM;
+    }
+
+    proc_set_pid(child, g_next_pid++);
+    child->ppid = parent->pid;
+    proc_link_child(proc_idx(parent), slot);
+    /* The one copy of the user registers a fork needs: the child returns to
+     * EL0 through this frame the first time it is switched in.
      */
-    cache_clean_invalidate_all();
+    tf_copy(child->tf, tf);
+    child->elr = elr;
+    child->ctx.sp = (uint64_t)(uintptr_t)child->tf;
+    child->ctx.lr = (uint64_t)(uintptr_t)ret_from_fork;
 
-    return 0;
+    /* Inherit FD table (shared file descriptions). */
+    for (uint64_t i = 0; i < MAX_FDS; i++) {
+        int16_t didx = parent->fdt.fd_to_desc[i];
+        child->fdt.fd_to_desc[i] = didx;
+        if (didx >= 0) {
+            desc_incref(didx);
+        }
+    }
+
+    /* Inherit cwd. */
+    child->cwd = vfs_dget(parent->cwd);
+
+    for (uint64_t i = 0; i < PROC_COMM_LEN; i++) {
+        child->comm[i] = parent->comm[i];
+    }
+    child->start_ns = time_now_ns();
+    return slot;
+}
+
+/* Undo proc_create_child() for a child that never ran. */
+static void proc_discard_child(proc_t *child) {
+    proc_close_all_fds(child);
+    proc_reap(child);
 }
 
 uint64_t sys_clone(trap_frame_t *tf, uint64_t flags, uint64_t child_stack, uint64_t ptid, uint64_t ctid, uint64_t tls, uint64_t elr) {
@@ -711,149 +683,307 @@ uint64_t sys_clone(trap_frame_t *tf, uint64_t flags, uint64_t child_stack, uint6
     (void)ctid;
     (void)tls;
 
-    /* Minimal fork-style clone(): allow *only* the low-byte exit signal (e.g. SIGCHLD).
-     * This keeps userland simple and avoids Linux clone() complexity.
+    /* Minimal clone(): fork, or vfork (CLONE_VM | CLONE_VFORK), plus the
+     * low-byte exit signal (e.g. SIGCHLD). This keeps userland simple and
+     * avoids Linux clone() complexity.
      */
-    if ((flags & ~0xffull) != 0) {
+    uint64_t share = flags & ~0xffull;
+    int is_vfork = (share == (LINUX_CLONE_VM | LINUX_CLONE_VFORK));
+    if (share != 0 && !is_vfork) {
         return (uint64_t)(-(int64_t)ENOSYS);
     }
 
-    int slot = proc_find_free_slot();
+    proc_t *parent = &g_procs[g_cur_proc];
+    int slot = proc_create_child(parent, tf, elr);
     if (slot < 0) {
-        return (uint64_t)(-(int64_t)EMFILE);
+        return (uint64_t)(int64_t)slot;
     }
+    proc_t *child = &g_procs[slot];
+    uint64_t pid = child->pid;
 
-    uint64_t child_user_pa = pmm_alloc_2mib_aligned();
-    if (child_user_pa == 0) {
-        return (uint64_t)(-(int64_t)EMFILE);
+    if (is_vfork) {
+        /* The child runs on the parent's address space, tables and ASID
+         * included, until it calls execve or exits; the parent sleeps until
+         * then (vfork_release()), so only one of them ever uses it.
+         */
+        child->vm = parent->vm;
+        vm_space_forget(&parent->vm);
+        child->vfork_borrowed = 1;
+    } else if (vm_space_copy(&child->vm, &parent->vm) != 0) {
+        /* Share the parent's pages copy-on-write; nothing is copied yet. */
+        proc_discard_child(child);
+        return (uint64_t)(-(int64_t)ENOMEM);
     }
+    child->heap_base = parent->heap_base;
+    child->heap_end = parent->heap_end;
+
+    /* In the child, clone returns 0. */
+    child->tf->x[0] = 0;
+    proc_set_state(child, PROC_RUNNABLE);
 
-    uint64_t child_ttbr0 = mmu_ttbr0_create_with_user_pa(child_user_pa);
-    if (child_ttbr0 == 0) {
-        pmm_free_2mib_aligned(child_user_pa);
-        return (uint64_t)(-(int64_t)EMFILE);
+    while (is_vfork && child->pid == pid && child->vfork_borrowed) {
+        wait_block(parent, PROC_WAITING, &parent->child_wq, 0);
+        sched_block();
     }
 
-    /* Copy current user image (VA USER_REGION_BASE) into the child's backing physical region. */
-    const volatile uint8_t *src = (const volatile uint8_t *)(uintptr_t)USER_REGION_BASE;
-    volatile uint8_t *dst = (volatile uint8_t *)(uintptr_t)child_user_pa;
-    for (uint64_t i = 0; i < USER_REGION_SIZE; i++) {
-        dst[i] = src[i];
+    /* Parent sees child's pid as return value. */
+    return pid;
+}
+
+uint64_t sys_mona_spawn(trap_frame_t *tf,
+                        uint64_t pathname_user,
+                        uint64_t argv_user,
+                        uint64_t envp_user,
+                        uint64_t actions_user,
+                        uint64_t nactions,
+                        uint64_t elr) {
+    if (nactions > MONA_SPAWN_MAX_ACTIONS) {
+        return (uint64_t)(-(int64_t)EINVAL);
+    }
+    mona_spawn_action_t acts[MONA_SPAWN_MAX_ACTIONS];
+    for (uint64_t i = 0; i < nactions; i++) {
+        uint64_t base = actions_user + i * sizeof(mona_spawn_action_t);
+        if (read_u64_from_user(base + 0, &acts[i].op) != 0 ||
+            read_u64_from_user(base + 8, &acts[i].fd) != 0 ||
+            read_u64_from_user(base + 16, &acts[i].newfd) != 0) {
+            return (uint64_t)(-(int64_t)EFAULT);
+        }
     }
 
     proc_t *parent = &g_procs[g_cur_proc];
-    uint64_t pid = g_next_pid++;
-    proc_clear(&g_procs[slot]);
-    g_procs[slot].pid = pid;
-    g_procs[slot].ppid = parent->pid;
-    g_procs[slot].state = PROC_RUNNABLE;
-    g_procs[slot].ttbr0_pa = child_ttbr0;
-    g_procs[slot].user_pa_base = child_user_pa;
-    tf_copy(&g_procs[slot].tf, tf);
-    g_procs[slot].elr = elr;
+    exec_args_t a;
+    uint64_t ret = exec_args_read(parent, &a, pathname_user, argv_user, envp_user);
+    if (ret != 0) {
+        return ret;
+    }
 
-    /* Inherit FD table (shared file descriptions). */
-    for (uint64_t i = 0; i < MAX_FDS; i++) {
-        int16_t didx = parent->fdt.fd_to_desc[i];
-        g_procs[slot].fdt.fd_to_desc[i] = didx;
-        if (didx >= 0) {
-            desc_incref(didx);
-        }
+    /* The child starts out with the new image: nothing of the parent's
+     * address space is shared, copied or even looked at.
+     */
+    vm_space_t nvm;
+    exec_start_t st;
+    int rc = exec_image_build(&a, &nvm, &st);
+    if (rc != 0) {
+        return (uint64_t)(int64_t)rc;
     }
 
-    /* Inherit cwd. */
-    for (uint64_t i = 0; i < MAX_PATH; i++) {
-        g_procs[slot].cwd[i] = parent->cwd[i];
-        if (parent->cwd[i] == '\0') {
-            break;
-        }
-        if (i == MAX_PATH - 1) {
-            g_procs[slot].cwd[i] = '\0';
+    int slot = proc_create_child(parent, tf, elr);
+    if (slot < 0) {
+        mmu_asid_release(&nvm.asid);
+        vm_space_destroy(&nvm);
+        return (uint64_t)(int64_t)slot;
+    }
+    proc_t *child = &g_procs[slot];
+    child->vm = nvm;
+
+    /* File actions, in order, on the child's copy of the fd table. */
+    for (uint64_t i = 0; i < nactions; i++) {
+        uint64_t fd = acts[i].fd;
+        uint64_t newfd = acts[i].newfd;
+        if (acts[i].op == MONA_SPAWN_DUP2) {
+            int didx = (fd < MAX_FDS) ? fd_get_desc_idx(&child->fdt, fd) : -1;
+            if (didx < 0 || newfd >= MAX_FDS) {
+                proc_discard_child(child);
+                return (uint64_t)(-(int64_t)EBADF);
+            }
+            if (fd != newfd) {
+                fd_close(&child->fdt, newfd);
+                child->fdt.fd_to_desc[newfd] = (int16_t)didx;
+                desc_incref(didx);
+            }
+        } else if (acts[i].op == MONA_SPAWN_CLOSE) {
+            if (fd < MAX_FDS) {
+                fd_close(&child->fdt, fd);
+            }
+        } else {
+            proc_discard_child(child);
+            return (uint64_t)(-(int64_t)EINVAL);
         }
     }
 
-    /* In the child, clone returns 0. */
-    g_procs[slot].tf.x[0] = 0;
+    child->heap_base = st.heap_base;
+    child->heap_end = st.heap_base;
+    proc_set_comm(child, a.path);
 
-    /* Parent sees child's pid as return value. */
-    return pid;
+    tf_zero(child->tf);
+    child->tf->sp_el0 = st.sp;
+    child->tf->x[0] = a.argc;
+    child->tf->x[1] = st.argv;
+    child->tf->x[2] = st.envp;
+    child->elr = st.entry;
+    proc_set_state(child, PROC_RUNNABLE);
+
+    return child->pid;
 }
 
-uint64_t sys_wait4(trap_frame_t *tf, int64_t pid_req, uint64_t wstatus_user, uint64_t options, uint64_t rusage_user, uint64_t elr) {
-    const uint64_t WNOHANG = 1ull;
-    (void)rusage_user;
+static void rusage_fill(linux_rusage_t *ru,
+                        uint64_t utime_ns,
+                        uint64_t stime_ns,
+                        uint64_t maxrss_kb,
+                        uint64_t minflt,
+                        uint64_t nvcsw,
+                        uint64_t nivcsw) {
+    memset(ru, 0, sizeof(*ru));
+
+    ru->ru_utime.tv_sec = (int64_t)(utime_ns / 1000000000ull);
+    ru->ru_utime.tv_usec = (int64_t)((utime_ns % 1000000000ull) / 1000ull);
+    ru->ru_stime.tv_sec = (int64_t)(stime_ns / 1000000000ull);
+    ru->ru_stime.tv_usec = (int64_t)((stime_ns % 1000000000ull) / 1000ull);
+    ru->ru_maxrss = (int64_t)maxrss_kb;
+    ru->ru_minflt = (int64_t)minflt;
+    ru->ru_nvcsw = (int64_t)nvcsw;
+    ru->ru_nivcsw = (int64_t)nivcsw;
+}
 
-    proc_t *parent = &g_procs[g_cur_proc];
-    uint64_t ppid = parent->pid;
+static inline uint64_t max_u64(uint64_t a, uint64_t b) {
+    return a > b ? a : b;
+}
 
-    /* Find a zombie child matching pid_req. */
+/* Reap a zombie child of p matching pid_req, storing its status at
+ * wstatus_user and its resource usage at rusage_user (in the current address
+ * space; either may be 0). The child's usage, including that of its own
+ * reaped children, is added to p's children totals.
+ * Returns 1 with *ret set if the wait4() is finished (reaped, ECHILD or
+ * EFAULT), 0 if it must wait.
+ */
+static int wait4_try_reap(proc_t *p, int64_t pid_req, uint64_t wstatus_user, uint64_t rusage_user, uint64_t *ret) {
     int found = -1;
-    for (int i = 0; i < (int)MAX_PROCS; i++) {
+    for (int i = p->child_head; i >= 0; i = g_procs[i].sib_next) {
         if (g_procs[i].state != PROC_ZOMBIE) continue;
-        if (g_procs[i].ppid != ppid) continue;
         if (pid_req > 0 && g_procs[i].pid != (uint64_t)pid_req) continue;
         found = i;
         break;
     }
 
-    if (found >= 0) {
-        uint64_t cpid = g_procs[found].pid;
-        if (wstatus_user != 0) {
-            if (!user_range_ok(wstatus_user, 4)) {
-                return (uint64_t)(-(int64_t)EFAULT);
-            }
-            uint32_t st = (uint32_t)((g_procs[found].exit_code & 0xffu) << 8);
-            *(volatile uint32_t *)(uintptr_t)wstatus_user = st;
+    if (found < 0) {
+        /* No children at all? */
+        if (p->child_head < 0) {
+            *ret = (uint64_t)(-(int64_t)ECHILD);
+            return 1;
+        }
+        return 0;
+    }
+
+    uint64_t cpid = g_procs[found].pid;
+    if (wstatus_user != 0) {
+        uint32_t st = (uint32_t)((g_procs[found].exit_code & 0xffu) << 8);
+        if (copy_to_user(wstatus_user, &st, 4) != 0) {
+            *ret = (uint64_t)(-(int64_t)EFAULT);
+            return 1;
         }
+    }
 
-        /* Close child's resources, free backing, then reap. */
-        proc_close_all_fds(&g_procs[found]);
-        if (g_procs[found].user_pa_base != 0 && g_procs[found].user_pa_base != USER_REGION_BASE) {
-            pmm_free_2mib_aligned(g_procs[found].user_pa_base);
+    const proc_t *c = &g_procs[found];
+    uint64_t utime = c->utime_ns + c->cutime_ns;
+    uint64_t stime = c->stime_ns + c->cstime_ns;
+    uint64_t nvcsw = c->nvcsw + c->cnvcsw;
+    uint64_t nivcsw = c->nivcsw + c->cnivcsw;
+    uint64_t maxrss = max_u64(c->maxrss_kb, c->cmaxrss_kb);
+    uint64_t minflt = c->minflt + c->cminflt;
+    if (rusage_user != 0) {
+        linux_rusage_t ru;
+        rusage_fill(&ru, utime, stime, maxrss, minflt, nvcsw, nivcsw);
+        if (write_bytes_to_user(rusage_user, &ru, sizeof(ru)) != 0) {
+            *ret = (uint64_t)(-(int64_t)EFAULT);
+            return 1;
         }
-        proc_clear(&g_procs[found]);
-        return cpid;
     }
+    p->cutime_ns += utime;
+    p->cstime_ns += stime;
+    p->cnvcsw += nvcsw;
+    p->cnivcsw += nivcsw;
+    p->cmaxrss_kb = max_u64(p->cmaxrss_kb, maxrss);
+    p->cminflt += minflt;
+
+    /* Close child's resources, free backing, then reap. */
+    proc_close_all_fds(&g_procs[found]);
+    proc_reap(&g_procs[found]);
+    *ret = cpid;
+    return 1;
+}
 
-    /* No children at all? */
-    int any_child = 0;
-    for (int i = 0; i < (int)MAX_PROCS; i++) {
-        if (g_procs[i].state == PROC_UNUSED) continue;
-        if (g_procs[i].ppid == ppid) {
-            any_child = 1;
-            break;
+uint64_t sys_wait4(int64_t pid_req, uint64_t wstatus_user, uint64_t options, uint64_t rusage_user) {
+    const uint64_t WNOHANG = 1ull;
+
+    proc_t *parent = &g_procs[g_cur_proc];
+
+    uint64_t ret = 0;
+    while (!wait4_try_reap(parent, pid_req, wstatus_user, rusage_user, &ret)) {
+        if ((options & WNOHANG) != 0) {
+            return 0;
         }
+
+        /* Block parent: it will be woken by child exit. */
+        wait_block(parent, PROC_WAITING, &parent->child_wq, 0);
+        sched_block();
     }
-    if (!any_child) {
-        return (uint64_t)(-(int64_t)ECHILD);
+    return ret;
+}
+
+uint64_t sys_getrusage(int64_t who, uint64_t usage_user) {
+    proc_t *cur = &g_procs[g_cur_proc];
+    linux_rusage_t ru;
+
+    if (who == LINUX_RUSAGE_SELF || who == LINUX_RUSAGE_THREAD) {
+        /* Include the time spent in this syscall so far. */
+        proc_acct_sys(cur);
+        proc_note_rss(cur);
+        rusage_fill(&ru, cur->utime_ns, cur->stime_ns, cur->maxrss_kb, cur->minflt, cur->nvcsw, cur->nivcsw);
+    } else if (who == LINUX_RUSAGE_CHILDREN) {
+        rusage_fill(&ru, cur->cutime_ns, cur->cstime_ns, cur->cmaxrss_kb, cur->cminflt, cur->cnvcsw, cur->cnivcsw);
+    } else {
+        return (uint64_t)(-(int64_t)EINVAL);
     }
 
-    if ((options & WNOHANG) != 0) {
-        return 0;
+    if (write_bytes_to_user(usage_user, &ru, sizeof(ru)) != 0) {
+        return (uint64_t)(-(int64_t)EFAULT);
     }
+    return 0;
+}
+
+static inline int64_t ns_to_clock_ticks(uint64_t ns) {
+    return (int64_t)(ns / (1000000000ull / LINUX_USER_HZ));
+}
 
-    /* Block parent: it will be woken by child exit. */
-    parent->state = PROC_WAITING;
-    parent->wait_target_pid = pid_req;
-    parent->wait_status_user = wstatus_user;
-    tf_copy(&parent->tf, tf);
-    parent->elr = elr;
+uint64_t sys_times(uint64_t tms_user) {
+    proc_t *cur = &g_procs[g_cur_proc];
+    proc_acct_sys(cur);
+
+    if (tms_user != 0) {
+        linux_tms_t t;
+        t.tms_utime = ns_to_clock_ticks(cur->utime_ns);
+        t.tms_stime = ns_to_clock_ticks(cur->stime_ns);
+        t.tms_cutime = ns_to_clock_ticks(cur->cutime_ns);
+        t.tms_cstime = ns_to_clock_ticks(cur->cstime_ns);
+        if (write_bytes_to_user(tms_user, &t, sizeof(t)) != 0) {
+            return (uint64_t)(-(int64_t)EFAULT);
+        }
+    }
+
+    /* Elapsed ticks since boot. */
+    return (uint64_t)ns_to_clock_ticks(time_now_ns());
+}
 
-    /* Switch to another runnable task. */
-    int next = sched_pick_next_runnable();
-    if (next >= 0 && next != g_cur_proc) {
-        proc_switch_to(next, tf);
-        return SYSCALL_SWITCHED;
+/* A child just became a zombie: wake its parent if it sleeps in wait4(),
+ * which then reaps it. Orphans are reaped right away since nobody can wait
+ * for them.
+ */
+static void proc_notify_parent_of_exit(int cidx) {
+    proc_t *c = &g_procs[cidx];
+    if (c->parent_idx < 0) {
+        /* An exiting task still runs on its kernel stack: sched_exit() frees
+         * it once this core has switched away.
+         */
+        if (cidx != g_cur_proc) {
+            proc_reap(c);
+        }
+        return;
     }
 
-    /* No runnable tasks; keep running (busy) for now. */
-    parent->state = PROC_RUNNABLE;
-    parent->wait_target_pid = 0;
-    parent->wait_status_user = 0;
-    return (uint64_t)(-(int64_t)EAGAIN);
+    waitq_wake_all(&g_procs[c->parent_idx].child_wq);
 }
 
-int handle_exit_and_maybe_switch(trap_frame_t *tf, uint64_t code) {
+void proc_exit(uint64_t code) {
     /* Mark current as zombie and wake its parent if waiting; otherwise keep zombie until reaped. */
     if (g_cur_proc == 0) {
         uart_write("\n[el0] exit_group status=");
@@ -867,76 +997,32 @@ int handle_exit_and_maybe_switch(trap_frame_t *tf, uint64_t code) {
     proc_close_all_fds(&g_procs[cidx]);
 
     /* Best-effort thread-lib compatibility: clear *clear_child_tid on exit. */
-    if (g_procs[cidx].clear_child_tid_user != 0 && user_range_ok(g_procs[cidx].clear_child_tid_user, 4)) {
-        *(volatile uint32_t *)(uintptr_t)g_procs[cidx].clear_child_tid_user = 0;
-    }
-
-    g_procs[cidx].state = PROC_ZOMBIE;
-    g_procs[cidx].exit_code = code;
-    uint64_t cpid = g_procs[cidx].pid;
-
-    /* Try to wake parent if it is waiting. */
-    for (int i = 0; i < (int)MAX_PROCS; i++) {
-        if (g_procs[i].state != PROC_WAITING) continue;
-        if (g_procs[i].pid != g_procs[cidx].ppid) continue;
-
-        int64_t want = g_procs[i].wait_target_pid;
-        if (want > 0 && (uint64_t)want != cpid) {
-            break;
-        }
-
-        /* Switch to parent's address space before writing status/return value. */
-        mmu_ttbr0_write(g_procs[i].ttbr0_pa);
-
-        uint64_t wstatus_user = g_procs[i].wait_status_user;
-        if (wstatus_user != 0 && user_range_ok(wstatus_user, 4)) {
-            uint32_t st = (uint32_t)((code & 0xffu) << 8);
-            *(volatile uint32_t *)(uintptr_t)wstatus_user = st;
-        }
-
-        g_procs[i].state = PROC_RUNNABLE;
-        g_procs[i].wait_target_pid = 0;
-        g_procs[i].wait_status_user = 0;
-        g_procs[i].tf.x[0] = cpid;
-
-        /* Parent was already blocked in wait4; reap the child now. */
-        if (g_procs[cidx].user_pa_base != 0 && g_procs[cidx].user_pa_base != USER_REGION_BASE) {
-            pmm_free_2mib_aligned(g_procs[cidx].user_pa_base);
-        }
-        proc_clear(&g_procs[cidx]);
-        break;
+    uint64_t tid_user = g_procs[cidx].clear_child_tid_user;
+    if (tid_user != 0 && user_range_ok(tid_user, 4)) {
+        /* Through the kernel alias: a fault here must not re-enter the exit. */
+        uint32_t zero = 0;
+        (void)vm_copy_to(&g_procs[cidx].vm, tid_user, &zero, sizeof(zero));
     }
 
-    /* Switch to another runnable task. */
-    int next = sched_pick_next_runnable();
-    if (next >= 0 && next != g_cur_proc) {
-        proc_switch_to(next, tf);
-        return 1;
-    }
-
-    /* If nothing else runs, fall back to pid1 if runnable. */
-    if (g_procs[0].state == PROC_RUNNABLE) {
-        proc_switch_to(0, tf);
-        return 1;
+    proc_note_rss(&g_procs[cidx]);
+    /* After vfork: the parent gets its address space back. This core keeps
+     * the tables loaded until sched_exit() switches away, which is fine:
+     * the parent cannot free them before then.
+     */
+    if (vfork_release(&g_procs[cidx], &g_procs[cidx].vm)) {
+        vm_space_forget(&g_procs[cidx].vm);
     }
+    g_procs[cidx].exit_code = code;
+    g_procs[cidx].pending_kill = 0;
+    proc_set_state(&g_procs[cidx], PROC_ZOMBIE);
 
-    uart_write("\n[el0] exit_group status=");
-    uart_write_hex_u64(code);
-    uart_write("\n");
-    return 0;
-}
+    proc_notify_parent_of_exit(cidx);
 
-static int proc_find_idx_by_pid(uint64_t pid) {
-    for (int i = 0; i < (int)MAX_PROCS; i++) {
-        if (g_procs[i].state == PROC_UNUSED) continue;
-        if (g_procs[i].pid == pid) return i;
-    }
-    return -1;
+    /* Switch to another runnable task (or idle); never comes back. */
+    sched_exit();
 }
 
-uint64_t sys_kill(trap_frame_t *tf, int64_t pid, uint64_t sig, uint64_t elr) {
-    (void)elr;
-
+uint64_t sys_kill(int64_t pid, uint64_t sig) {
     if (pid <= 0) {
         return (uint64_t)(-(int64_t)EINVAL);
     }
@@ -964,57 +1050,39 @@ uint64_t sys_kill(trap_frame_t *tf, int64_t pid, uint64_t sig, uint64_t elr) {
 
     /* Self-kill: reuse the normal exit path so we switch properly. */
     if (idx == g_cur_proc) {
-        int switched = handle_exit_and_maybe_switch(tf, code);
-        return switched ? SYSCALL_SWITCHED : 0;
+        proc_exit(code);
     }
 
-    /* Kill another process: mark zombie and wake a waiting parent if present. */
-    proc_close_all_fds(&g_procs[idx]);
-
-    /* Best-effort thread-lib compatibility: clear *clear_child_tid on exit. */
-    if (g_procs[idx].clear_child_tid_user != 0) {
-        mmu_ttbr0_write(g_procs[idx].ttbr0_pa);
-        if (user_range_ok(g_procs[idx].clear_child_tid_user, 4)) {
-            *(volatile uint32_t *)(uintptr_t)g_procs[idx].clear_child_tid_user = 0;
-        }
+    /* Running on another core: it must not be torn down underneath that
+     * core. It exits on its next kernel entry instead.
+     */
+    if (g_procs[idx].on_cpu >= 0) {
+        g_procs[idx].pending_kill = 1;
+        g_procs[idx].pending_kill_code = code;
+        return 0;
     }
 
-    g_procs[idx].state = PROC_ZOMBIE;
-    g_procs[idx].exit_code = code;
-    uint64_t cpid = g_procs[idx].pid;
-
-    for (int i = 0; i < (int)MAX_PROCS; i++) {
-        if (g_procs[i].state != PROC_WAITING) continue;
-        if (g_procs[i].pid != g_procs[idx].ppid) continue;
-
-        int64_t want = g_procs[i].wait_target_pid;
-        if (want > 0 && (uint64_t)want != cpid) {
-            break;
-        }
-
-        /* Switch to parent's address space before writing status/return value. */
-        mmu_ttbr0_write(g_procs[i].ttbr0_pa);
-
-        uint64_t wstatus_user = g_procs[i].wait_status_user;
-        if (wstatus_user != 0 && user_range_ok(wstatus_user, 4)) {
-            uint32_t st = (uint32_t)((code & 0xffu) << 8);
-            *(volatile uint32_t *)(uintptr_t)wstatus_user = st;
-        }
-
-        g_procs[i].state = PROC_RUNNABLE;
-        g_procs[i].wait_target_pid = 0;
-        g_procs[i].wait_status_user = 0;
-        g_procs[i].tf.x[0] = cpid;
+    /* Kill another process: mark zombie and wake a waiting parent if present.
+     * If it sleeps in a blocking syscall, its suspended kernel context is
+     * simply never resumed; the kernel stack goes away when it is reaped.
+     */
+    proc_close_all_fds(&g_procs[idx]);
 
-        /* Parent was blocked in wait4; reap the child now. */
-        if (g_procs[idx].user_pa_base != 0 && g_procs[idx].user_pa_base != USER_REGION_BASE) {
-            pmm_free_2mib_aligned(g_procs[idx].user_pa_base);
-        }
-        proc_clear(&g_procs[idx]);
-        break;
+    /* Best-effort thread-lib compatibility: clear *clear_child_tid on exit.
+     * Written through the kernel alias: its tables are not loaded here.
+     */
+    uint64_t tid_user = g_procs[idx].clear_child_tid_user;
+    if (tid_user != 0 && vm_range_ok(&g_procs[idx].vm, tid_user, 4)) {
+        const uint32_t zero = 0;
+        (void)vm_copy_to(&g_procs[idx].vm, tid_user, &zero, sizeof(zero));
     }
 
-    /* Restore current process address space before returning to user. */
-    mmu_ttbr0_write(g_procs[g_cur_proc].ttbr0_pa);
+    proc_note_rss(&g_procs[idx]);
+    if (vfork_release(&g_procs[idx], &g_procs[idx].vm)) {
+        vm_space_forget(&g_procs[idx].vm);
+    }
+    g_procs[idx].exit_code = code;
+    proc_set_state(&g_procs[idx], PROC_ZOMBIE);
+    proc_notify_parent_of_exit(idx);
     return 0;
 }
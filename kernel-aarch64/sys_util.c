@@ -1,15 +1,17 @@
 #include "sys_util.h"
 
 #include "errno.h"
-#include "mmu.h"
+#include "fd.h"
+#include "string.h"
+#include "uaccess.h"
+#include "vfs.h"
+#include "vm.h"
 
 int user_range_ok(uint64_t user_ptr, uint64_t len) {
-    if (len == 0) return 1;
-    if (user_ptr < USER_REGION_BASE) return 0;
-    if (user_ptr >= USER_REGION_BASE + USER_REGION_SIZE) return 0;
-    if (user_ptr + len < user_ptr) return 0; /* overflow */
-    if (user_ptr + len > USER_REGION_BASE + USER_REGION_SIZE) return 0;
-    return 1;
+    /* Pages need not be committed yet: kernel accesses fault them in like
+     * user ones (see exceptions.c).
+     */
+    return vm_range_ok(&proc_current()->vm, user_ptr, len);
 }
 
 uint64_t cstr_len_u64(const char *s) {
@@ -91,37 +93,63 @@ int normalize_abs_path(const char *in, char *out, uint64_t outsz) {
     return 0;
 }
 
-int resolve_path(proc_t *p, const char *in, char *out, uint64_t outsz) {
-    if (!p || !in || !out) return -1;
+/* Absolute path of the directory relative paths start from, for dirfd. */
+static int dirfd_base_path(proc_t *p, int64_t dirfd, char *out, uint64_t outsz) {
+    if (dirfd == AT_FDCWD) {
+        if (!p->cwd) return -(int)ENOENT;
+        return vfs_dentry_path(p->cwd, out, outsz);
+    }
+    if (dirfd < 0) return -(int)EBADF;
+
+    int didx = fd_get_desc_idx(&p->fdt, (uint64_t)dirfd);
+    file_desc_t *d = desc_get(didx);
+    if (didx < 0 || !d) return -(int)EBADF;
+
+    if (d->kind == FDESC_INITRAMFS && d->u.initramfs.is_dir && d->u.initramfs.dir) {
+        return vfs_dentry_path(d->u.initramfs.dir, out, outsz);
+    }
+    if (d->kind == FDESC_PROC && d->u.proc.node == 1u) {
+        /* procfs is not in the dentry tree (see sys_openat()). */
+        if (outsz < sizeof("/proc")) return -(int)ENAMETOOLONG;
+        memcpy(out, "/proc", sizeof("/proc"));
+        return 0;
+    }
+    return -(int)ENOTDIR;
+}
+
+int resolve_path_at(proc_t *p, int64_t dirfd, const char *in, char *out, uint64_t outsz) {
+    if (!p || !in || !out) return -(int)EINVAL;
 
     char tmp[MAX_PATH];
     tmp[0] = '\0';
 
     if (cstr_starts_with(in, '/')) {
-        /* Already absolute. */
+        /* Already absolute: dirfd is ignored. */
         uint64_t n = cstr_len_u64(in);
-        if (n + 1 > sizeof(tmp)) return -1;
+        if (n + 1 > sizeof(tmp)) return -(int)ENAMETOOLONG;
         for (uint64_t i = 0; i <= n; i++) tmp[i] = in[i];
     } else {
-        uint64_t cwd_len = cstr_len_u64(p->cwd);
-        uint64_t in_len = cstr_len_u64(in);
+        int rc = dirfd_base_path(p, dirfd, tmp, sizeof(tmp));
+        if (rc != 0) return rc;
 
-        /* tmp = cwd + "/" + in, allowing cwd=="/". */
-        if (cwd_len == 0) {
-            return -1;
-        }
+        uint64_t base_len = cstr_len_u64(tmp);
+        uint64_t in_len = cstr_len_u64(in);
 
-        uint64_t need = cwd_len + 1 + in_len + 1;
-        if (need > sizeof(tmp)) return -1;
+        /* tmp = base + "/" + in, allowing base=="/". */
+        uint64_t need = base_len + 1 + in_len + 1;
+        if (need > sizeof(tmp)) return -(int)ENAMETOOLONG;
 
-        uint64_t o = 0;
-        for (uint64_t i = 0; i < cwd_len; i++) tmp[o++] = p->cwd[i];
+        uint64_t o = base_len;
         tmp[o++] = '/';
         for (uint64_t i = 0; i < in_len; i++) tmp[o++] = in[i];
         tmp[o] = '\0';
     }
 
-    return normalize_abs_path(tmp, out, outsz);
+    return (normalize_abs_path(tmp, out, outsz) == 0) ? 0 : -(int)ENAMETOOLONG;
+}
+
+int resolve_path(proc_t *p, const char *in, char *out, uint64_t outsz) {
+    return resolve_path_at(p, AT_FDCWD, in, out, outsz);
 }
 
 int abs_path_to_no_slash_trim(const char *abs_path, char *out_no_slash, uint64_t outsz) {
@@ -177,40 +205,35 @@ int abs_path_parent_dir(const char *abs_path, char *out_parent_abs, uint64_t out
 
 int copy_cstr_from_user(char *dst, uint64_t dstsz, uint64_t user_ptr) {
     if (dstsz == 0) return -1;
-    for (uint64_t i = 0; i < dstsz; i++) {
-        if (!user_range_ok(user_ptr + i, 1)) return -1;
-        char c = *(const volatile char *)(uintptr_t)(user_ptr + i);
-        dst[i] = c;
-        if (c == '\0') return 0;
+    /* A page at a time: if its first byte is mapped, all of it is. */
+    uint64_t i = 0;
+    while (i < dstsz) {
+        uint64_t n = VM_PAGE_SIZE - ((user_ptr + i) & (VM_PAGE_SIZE - 1u));
+        if (n > dstsz - i) n = dstsz - i;
+        if (copy_from_user(dst + i, user_ptr + i, n) != 0) return -1;
+        for (uint64_t j = 0; j < n; j++) {
+            if (dst[i + j] == '\0') return 0;
+        }
+        i += n;
     }
     dst[dstsz - 1] = '\0';
     return -1;
 }
 
 int read_u64_from_user(uint64_t user_ptr, uint64_t *out) {
-    if (!user_range_ok(user_ptr, 8)) return -1;
-    *out = *(const volatile uint64_t *)(uintptr_t)user_ptr;
-    return 0;
+    return copy_from_user(out, user_ptr, 8) == 0 ? 0 : -1;
 }
 
 int write_bytes_to_user(uint64_t user_dst, const void *src, uint64_t len) {
-    if (!user_range_ok(user_dst, len)) return -1;
-    volatile uint8_t *d = (volatile uint8_t *)(uintptr_t)user_dst;
-    const uint8_t *s = (const uint8_t *)src;
-    for (uint64_t i = 0; i < len; i++) d[i] = s[i];
-    return 0;
+    return copy_to_user(user_dst, src, len) == 0 ? 0 : -1;
 }
 
 int write_u64_to_user(uint64_t user_dst, uint64_t v) {
-    if (!user_range_ok(user_dst, 8)) return -1;
-    *(volatile uint64_t *)(uintptr_t)user_dst = v;
-    return 0;
+    return copy_to_user(user_dst, &v, 8) == 0 ? 0 : -1;
 }
 
 int write_u16_to_user(uint64_t user_dst, uint16_t v) {
-    if (!user_range_ok(user_dst, 2)) return -1;
-    *(volatile uint16_t *)(uintptr_t)user_dst = v;
-    return 0;
+    return copy_to_user(user_dst, &v, 2) == 0 ? 0 : -1;
 }
 
 uint64_t align_down_u64(uint64_t x, uint64_t a) {
@@ -1,17 +1,23 @@
 #include "time.h"
 
+#include "smp.h"
+
 static uint64_t g_cntfrq_hz = 0;
 static uint64_t g_boot_cntpct = 0;
 static uint8_t g_time_inited = 0;
 static uint64_t g_tick_interval_cnt = 0;
 
-typedef enum {
-    TICK_MODE_DISABLED = 0,
-    TICK_MODE_PERIODIC = 1,
-    TICK_MODE_ONESHOT = 2,
-} tick_mode_t;
+/* CNTP is banked per core, so each core tracks its own tick state.
+ * The compare value is the earlier of the next periodic tick (if enabled) and
+ * the earliest kernel timer deadline (see timer.c).
+ */
+typedef struct {
+    uint8_t periodic;
+    uint64_t next_tick_cnt; /* absolute CNTPCT of the next periodic tick */
+    uint64_t deadline_ns;   /* earliest kernel timer deadline, 0 = none */
+} tick_state_t;
 
-static tick_mode_t g_tick_mode = TICK_MODE_DISABLED;
+static tick_state_t g_tick[MAX_CPUS];
 
 static inline uint64_t read_cntfrq_el0(void) {
     uint64_t v;
@@ -25,8 +31,8 @@ static inline uint64_t read_cntpct_el0(void) {
     return v;
 }
 
-static inline void write_cntp_tval_el0(uint64_t v) {
-    __asm__ volatile("msr cntp_tval_el0, %0" :: "r"(v));
+static inline void write_cntp_cval_el0(uint64_t v) {
+    __asm__ volatile("msr cntp_cval_el0, %0" :: "r"(v));
 }
 
 static inline void write_cntp_ctl_el0(uint64_t v) {
@@ -34,13 +40,6 @@ static inline void write_cntp_ctl_el0(uint64_t v) {
     __asm__ volatile("isb");
 }
 
-static inline uint64_t clamp_cntp_tval(uint64_t cnt) {
-    /* CNTP_TVAL_EL0 is a signed 32-bit value (ticks until next interrupt). */
-    if (cnt == 0) cnt = 1;
-    if (cnt > 0x7fffffffull) cnt = 0x7fffffffull;
-    return cnt;
-}
-
 static uint64_t ns_to_cnt_ticks(uint64_t ns) {
     if (!g_time_inited || g_cntfrq_hz == 0) return 0;
 
@@ -108,10 +107,43 @@ uint64_t time_now_ns(void) {
     return ns + frac;
 }
 
+/* Absolute counter value at monotonic time ns (rounded up, so the IRQ never
+ * fires before the deadline has passed).
+ */
+static uint64_t ns_to_abs_cnt(uint64_t ns) {
+    uint64_t u64_max = (uint64_t)~0ull;
+    uint64_t ticks = ns_to_cnt_ticks(ns);
+    if (ticks >= u64_max - g_boot_cntpct - 1ull) return u64_max;
+    return g_boot_cntpct + ticks + 1ull;
+}
+
+static void tick_program(tick_state_t *t) {
+    uint64_t when = 0;
+    if (t->periodic) {
+        when = t->next_tick_cnt;
+    }
+    if (t->deadline_ns != 0) {
+        uint64_t d = ns_to_abs_cnt(t->deadline_ns);
+        if (when == 0 || d < when) when = d;
+    }
+
+    if (when == 0) {
+        write_cntp_ctl_el0(0ull);
+        return;
+    }
+
+    /* Enable CNTP and unmask its interrupt (IMASK=0). A compare value in the
+     * past fires immediately.
+     */
+    write_cntp_cval_el0(when);
+    write_cntp_ctl_el0(1ull);
+}
+
 void time_tick_init(uint32_t hz) {
+    tick_state_t *t = &g_tick[cpu_id()];
     if (!g_time_inited || g_cntfrq_hz == 0) {
         g_tick_interval_cnt = 0;
-        g_tick_mode = TICK_MODE_DISABLED;
+        t->periodic = 0;
         return;
     }
     if (hz == 0) hz = 1;
@@ -122,51 +154,57 @@ void time_tick_init(uint32_t hz) {
 
     g_tick_interval_cnt = interval;
 
-    g_tick_mode = TICK_MODE_PERIODIC;
-
-    /* Enable CNTP and unmask its interrupt (IMASK=0). */
-    write_cntp_tval_el0(clamp_cntp_tval(g_tick_interval_cnt));
-    write_cntp_ctl_el0(1ull);
+    t->periodic = 1;
+    t->next_tick_cnt = read_cntpct_el0() + g_tick_interval_cnt;
+    tick_program(t);
 }
 
 void time_tick_enable_periodic(void) {
     if (!g_time_inited || g_cntfrq_hz == 0) return;
     if (g_tick_interval_cnt == 0) return;
-    if (g_tick_mode == TICK_MODE_PERIODIC) return;
+    tick_state_t *t = &g_tick[cpu_id()];
+    if (t->periodic) return;
 
-    g_tick_mode = TICK_MODE_PERIODIC;
-    write_cntp_tval_el0(clamp_cntp_tval(g_tick_interval_cnt));
-    write_cntp_ctl_el0(1ull);
+    t->periodic = 1;
+    t->next_tick_cnt = read_cntpct_el0() + g_tick_interval_cnt;
+    tick_program(t);
 }
 
-void time_tick_schedule_oneshot_ns(uint64_t delta_ns) {
+void time_tick_set_deadline_ns(uint64_t deadline_ns) {
     if (!g_time_inited || g_cntfrq_hz == 0) return;
+    tick_state_t *t = &g_tick[cpu_id()];
+    if (t->deadline_ns == deadline_ns) return;
+    t->deadline_ns = deadline_ns;
+    tick_program(t);
+}
 
-    uint64_t ticks = ns_to_cnt_ticks(delta_ns);
-    if (ticks == 0) ticks = 1;
-
-    g_tick_mode = TICK_MODE_ONESHOT;
-    write_cntp_tval_el0(clamp_cntp_tval(ticks));
-    write_cntp_ctl_el0(1ull);
+uint64_t time_tick_deadline_ns(void) {
+    return g_tick[cpu_id()].deadline_ns;
 }
 
 void time_tick_handle_irq(void) {
-    if (g_tick_mode == TICK_MODE_PERIODIC) {
-        if (g_tick_interval_cnt == 0) return;
-        /* Writing TVAL schedules the next event and clears ISTATUS. */
-        write_cntp_tval_el0(clamp_cntp_tval(g_tick_interval_cnt));
-        return;
+    tick_state_t *t = &g_tick[cpu_id()];
+    uint64_t now = read_cntpct_el0();
+
+    if (t->periodic && now >= t->next_tick_cnt) {
+        t->next_tick_cnt += g_tick_interval_cnt;
+        if (t->next_tick_cnt <= now) {
+            /* Missed ticks (e.g. long IRQs-off stretch): don't replay them. */
+            t->next_tick_cnt = now + g_tick_interval_cnt;
+        }
     }
 
-    if (g_tick_mode == TICK_MODE_ONESHOT) {
-        /* One-shot fired: disable until the scheduler programs the next event. */
-        write_cntp_ctl_el0(0ull);
-        g_tick_mode = TICK_MODE_DISABLED;
-        return;
+    if (t->deadline_ns != 0 && now >= ns_to_abs_cnt(t->deadline_ns)) {
+        /* Reached: timer_run() programs the next one. */
+        t->deadline_ns = 0;
     }
+
+    /* Rewriting the compare value (or disabling) clears ISTATUS. */
+    tick_program(t);
 }
 
 void time_tick_disable(void) {
-    write_cntp_ctl_el0(0ull);
-    g_tick_mode = TICK_MODE_DISABLED;
+    tick_state_t *t = &g_tick[cpu_id()];
+    t->periodic = 0;
+    tick_program(t);
 }
@@ -0,0 +1,229 @@
+#include "timer.h"
+
+#include "time.h"
+
+/*
+ * Cascading timing wheel (classic BSD/Linux layout).
+ *
+ * Time is quantized to "jiffies" of 2^20 ns (~1.05ms). Level L has 64 slots
+ * of 64^L jiffies each, so 5 levels cover ~13 days; later deadlines are parked
+ * in the last level and re-sorted when they cascade. A timer lives in level 0
+ * once it is less than 64 jiffies away; every 64^L jiffies the current
+ * level-L slot is redistributed into the finer levels.
+ *
+ * Expiry itself is exact: only timers whose expires_ns has passed fire, the
+ * wheel just decides which ones need looking at.
+ */
+
+#define TIMER_JIFFY_SHIFT 20u
+#define TIMER_LVL_BITS 6u
+#define TIMER_LVL_SIZE (1u << TIMER_LVL_BITS)
+#define TIMER_LVL_MASK (TIMER_LVL_SIZE - 1u)
+#define TIMER_LEVELS 5u
+#define TIMER_MAX_DELTA ((1ull << (TIMER_LVL_BITS * TIMER_LEVELS)) - 1ull)
+
+static ktimer_t *g_wheel[TIMER_LEVELS][TIMER_LVL_SIZE];
+static uint64_t g_wheel_map[TIMER_LEVELS];
+/* Next jiffy whose level-0 slot has not been fully processed yet. */
+static uint64_t g_base_j;
+static uint8_t g_wheel_inited;
+static uint32_t g_pending;
+
+static inline uint64_t ns_to_jiffy(uint64_t ns) {
+    return ns >> TIMER_JIFFY_SHIFT;
+}
+
+static inline uint64_t jiffy_to_ns(uint64_t j) {
+    return j << TIMER_JIFFY_SHIFT;
+}
+
+static inline uint32_t ctz64(uint64_t v) {
+    return (uint32_t)__builtin_ctzll(v);
+}
+
+static void wheel_init_if_needed(void) {
+    if (g_wheel_inited) return;
+    g_base_j = ns_to_jiffy(time_now_ns());
+    g_wheel_inited = 1;
+}
+
+static void bucket_link(ktimer_t *t, uint32_t lvl, uint32_t slot) {
+    ktimer_t **head = &g_wheel[lvl][slot];
+    t->next = *head;
+    if (t->next) t->next->pprev = &t->next;
+    t->pprev = head;
+    *head = t;
+    t->bucket = (uint16_t)(lvl * TIMER_LVL_SIZE + slot);
+    g_wheel_map[lvl] |= 1ull << slot;
+}
+
+static void bucket_unlink(ktimer_t *t) {
+    *t->pprev = t->next;
+    if (t->next) t->next->pprev = t->pprev;
+    t->next = 0;
+    t->pprev = 0;
+
+    uint32_t lvl = t->bucket / TIMER_LVL_SIZE;
+    uint32_t slot = t->bucket % TIMER_LVL_SIZE;
+    if (!g_wheel[lvl][slot]) {
+        g_wheel_map[lvl] &= ~(1ull << slot);
+    }
+}
+
+static void wheel_insert(ktimer_t *t) {
+    uint64_t j = ns_to_jiffy(t->expires_ns);
+    if (j < g_base_j) j = g_base_j;
+    uint64_t delta = j - g_base_j;
+    if (delta > TIMER_MAX_DELTA) {
+        delta = TIMER_MAX_DELTA;
+        j = g_base_j + delta;
+    }
+
+    uint32_t lvl = 0;
+    while (lvl + 1u < TIMER_LEVELS && delta >= (1ull << (TIMER_LVL_BITS * (lvl + 1u)))) {
+        lvl++;
+    }
+    uint32_t slot = (uint32_t)((j >> (TIMER_LVL_BITS * lvl)) & TIMER_LVL_MASK);
+    bucket_link(t, lvl, slot);
+}
+
+void timer_init(ktimer_t *t, ktimer_fn_t fn, void *arg) {
+    t->next = 0;
+    t->pprev = 0;
+    t->expires_ns = 0;
+    t->fn = fn;
+    t->arg = arg;
+    t->bucket = 0;
+}
+
+void timer_arm(ktimer_t *t, uint64_t expires_ns) {
+    wheel_init_if_needed();
+    if (timer_pending(t)) {
+        bucket_unlink(t);
+    } else {
+        g_pending++;
+    }
+    t->expires_ns = expires_ns;
+    wheel_insert(t);
+
+    /* A new head: pull this core's hardware deadline in. */
+    uint64_t cur = time_tick_deadline_ns();
+    if (cur == 0 || expires_ns < cur) {
+        time_tick_set_deadline_ns(expires_ns);
+    }
+}
+
+void timer_cancel(ktimer_t *t) {
+    if (!timer_pending(t)) return;
+    bucket_unlink(t);
+    g_pending--;
+    /* Leave the hardware deadline alone: an early wakeup is harmless. */
+}
+
+/* Move every timer of a coarse slot down into the finer levels. */
+static void wheel_cascade(uint32_t lvl, uint32_t slot) {
+    ktimer_t *t = g_wheel[lvl][slot];
+    g_wheel[lvl][slot] = 0;
+    g_wheel_map[lvl] &= ~(1ull << slot);
+    while (t) {
+        ktimer_t *next = t->next;
+        t->next = 0;
+        t->pprev = 0;
+        wheel_insert(t);
+        t = next;
+    }
+}
+
+static void timer_fire(ktimer_t *t) {
+    bucket_unlink(t);
+    g_pending--;
+    if (t->fn) t->fn(t, t->arg);
+}
+
+void timer_run(void) {
+    uint64_t now = time_now_ns();
+    if (now == 0) return;
+    wheel_init_if_needed();
+
+    uint64_t now_j = ns_to_jiffy(now);
+    while (g_base_j <= now_j) {
+        uint32_t idx = (uint32_t)(g_base_j & TIMER_LVL_MASK);
+        if (idx == 0) {
+            /* Crossing a level-0 wrap: cascade the coarser levels whose
+             * current slot starts here (finer first, as each feeds the next).
+             */
+            for (uint32_t lvl = 1; lvl < TIMER_LEVELS; lvl++) {
+                uint32_t s = (uint32_t)((g_base_j >> (TIMER_LVL_BITS * lvl)) & TIMER_LVL_MASK);
+                wheel_cascade(lvl, s);
+                if (s != 0) break;
+            }
+        }
+
+        if (g_base_j < now_j) {
+            if (g_wheel_map[0] == 0) {
+                /* Nothing due in level 0: skip ahead to the next wrap. */
+                uint64_t next_wrap = (g_base_j | TIMER_LVL_MASK) + 1ull;
+                g_base_j = (next_wrap < now_j) ? next_wrap : now_j;
+                continue;
+            }
+            /* The whole jiffy is in the past: everything in the slot fires. */
+            while (g_wheel[0][idx]) {
+                timer_fire(g_wheel[0][idx]);
+            }
+            g_base_j++;
+            continue;
+        }
+
+        /* Current jiffy: only fire what has actually expired. */
+        for (;;) {
+            ktimer_t *due = 0;
+            for (ktimer_t *t = g_wheel[0][idx]; t; t = t->next) {
+                if (t->expires_ns <= now) {
+                    due = t;
+                    break;
+                }
+            }
+            if (!due) break;
+            timer_fire(due);
+        }
+        break;
+    }
+
+    time_tick_set_deadline_ns(timer_next_deadline_ns());
+}
+
+uint64_t timer_next_deadline_ns(void) {
+    if (g_pending == 0 || !g_wheel_inited) return 0;
+
+    uint64_t best = 0;
+
+    /* Level 0: first occupied slot at or after the base, exact deadline. */
+    uint64_t map = g_wheel_map[0];
+    if (map) {
+        uint32_t base_idx = (uint32_t)(g_base_j & TIMER_LVL_MASK);
+        uint64_t rot = (map >> base_idx) | (base_idx ? (map << (TIMER_LVL_SIZE - base_idx)) : 0);
+        uint32_t slot = (ctz64(rot) + base_idx) & TIMER_LVL_MASK;
+        for (ktimer_t *t = g_wheel[0][slot]; t; t = t->next) {
+            if (best == 0 || t->expires_ns < best) best = t->expires_ns;
+        }
+    }
+
+    /* Coarser levels: the next cascade of the first occupied slot. */
+    for (uint32_t lvl = 1; lvl < TIMER_LEVELS; lvl++) {
+        map = g_wheel_map[lvl];
+        if (!map) continue;
+
+        uint32_t shift = TIMER_LVL_BITS * lvl;
+        uint64_t cur = g_base_j >> shift;
+        /* Slots strictly after the current one cascade first; the current
+         * slot itself was already cascaded and now holds the next lap.
+         */
+        uint32_t start = (uint32_t)((cur + 1ull) & TIMER_LVL_MASK);
+        uint64_t rot = (map >> start) | (start ? (map << (TIMER_LVL_SIZE - start)) : 0);
+        uint64_t ahead = (uint64_t)ctz64(rot) + 1ull;
+        uint64_t when = jiffy_to_ns((cur + ahead) << shift);
+        if (best == 0 || when < best) best = when;
+    }
+
+    return best;
+}
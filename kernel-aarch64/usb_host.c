@@ -1,8 +1,8 @@
 #include "usb_host.h"
 
-#include "cache.h"
-
+#include "dma.h"
 #include "mmu.h"
+#include "string.h"
 #include "time.h"
 #include "uart_pl011.h"
 
@@ -95,6 +95,17 @@ static inline volatile uint32_t *dwc2_fifo(uint32_t n) {
 /* QEMU's DWC2 model appears to behave best in host DMA mode. */
 #define USB_USE_DMA 1
 
+/* In DMA mode every transfer goes through a per-channel bounce buffer in
+ * uncached DMA memory (dma.h): callers may pass any buffer (stack, unaligned)
+ * and no cache maintenance is needed. Channels: 0 control, 1 IN, 2 OUT.
+ */
+#define USB_DMA_CHANNELS 3u
+#define USB_DMA_BOUNCE 8192u
+
+#if USB_USE_DMA
+static uint8_t *g_bounce[USB_DMA_CHANNELS];
+#endif
+
 static uint64_t usb_virt_to_phys(const void *p) {
     uint64_t va = (uint64_t)(uintptr_t)p;
     if (va >= KERNEL_VA_BASE) return va - KERNEL_VA_BASE;
@@ -287,11 +298,9 @@ static int dwc2_out_xfer(uint32_t ch, uint8_t dev_addr, uint8_t ep, uint8_t ep_t
     *dwc2_reg(HCTSIZ(ch)) = hctsiz;
 
 #if USB_USE_DMA
-    if (len && data) {
-        /* Ensure device sees latest bytes. */
-        cache_clean_dcache_for_range((uint64_t)(uintptr_t)data, (uint64_t)len);
-    }
-    *dwc2_reg(HCDMA(ch)) = (uint32_t)usb_virt_to_phys(data);
+    if (ch >= USB_DMA_CHANNELS || !g_bounce[ch] || len > USB_DMA_BOUNCE) return -1;
+    if (len) memcpy(g_bounce[ch], data, len);
+    *dwc2_reg(HCDMA(ch)) = (uint32_t)usb_virt_to_phys(g_bounce[ch]);
 #else
     (void)dwc2_fifo;
 #endif
@@ -344,11 +353,8 @@ static int dwc2_in_xfer(uint32_t ch, uint8_t dev_addr, uint8_t ep, uint8_t ep_ty
     *dwc2_reg(HCTSIZ(ch)) = hctsiz;
 
 #if USB_USE_DMA
-    if (len && out) {
-        /* Drop any stale cache lines before device DMA writes into this buffer. */
-        cache_invalidate_dcache_for_range((uint64_t)(uintptr_t)out, (uint64_t)len);
-    }
-    *dwc2_reg(HCDMA(ch)) = (uint32_t)usb_virt_to_phys(out);
+    if (ch >= USB_DMA_CHANNELS || !g_bounce[ch] || len > USB_DMA_BOUNCE) return -1;
+    *dwc2_reg(HCDMA(ch)) = (uint32_t)usb_virt_to_phys(g_bounce[ch]);
 #endif
 
     hcchar = *dwc2_reg(HCCHAR(ch));
@@ -379,6 +385,9 @@ static int dwc2_in_xfer(uint32_t ch, uint8_t dev_addr, uint8_t ep, uint8_t ep_ty
 
     uint32_t rem = (*dwc2_reg(HCTSIZ(ch))) & HCTSIZ_XFERSIZE_MASK;
     uint32_t got = (len >= rem) ? (len - rem) : 0;
+#if USB_USE_DMA
+    if (got) memcpy(out, g_bounce[ch], got);
+#endif
     if (out_got) *out_got = got;
     return 0;
 }
@@ -661,6 +670,16 @@ int usb_host_init(void) {
     dwc2_host_configure_fsls_clock();
     dwc2_flush_fifos();
 
+#if USB_USE_DMA
+    for (uint32_t ch = 0; ch < USB_DMA_CHANNELS; ch++) {
+        if (!g_bounce[ch]) g_bounce[ch] = (uint8_t *)dma_alloc(USB_DMA_BOUNCE);
+        if (!g_bounce[ch]) {
+            uart_write("usb: no DMA memory\n");
+            return -1;
+        }
+    }
+#endif
+
     uint32_t ahb = *dwc2_reg(GAHBCFG);
 #if USB_USE_DMA
     ahb |= GAHBCFG_DMAEN;
@@ -307,18 +307,8 @@ static int rndis_send_cmd(uint8_t dev_addr, int low_speed, uint8_t ctrl_if, cons
         .wLength = len,
     };
 
-    /* DWC2 + cache maintenance is sensitive to buffer alignment.
-     * Use an aligned scratch buffer for small control-plane messages.
-     */
-    uint8_t tmp[512] __attribute__((aligned(64)));
-    const uint8_t *src = (const uint8_t *)buf;
-    uint8_t *xfer_buf = (uint8_t *)buf;
-    if (src && len <= sizeof(tmp)) {
-        for (uint16_t i = 0; i < len; i++) tmp[i] = src[i];
-        xfer_buf = tmp;
-    }
-
-    return usb_host_control_xfer(dev_addr, low_speed, req, xfer_buf, len, 0);
+    /* usb_host bounces DMA through its own buffers: any buffer will do. */
+    return usb_host_control_xfer(dev_addr, low_speed, req, (uint8_t *)buf, len, 0);
 }
 
 static int rndis_get_resp(uint8_t dev_addr, int low_speed, uint8_t ctrl_if, void *buf, uint16_t buf_len, uint32_t *out_got) {
@@ -330,26 +320,9 @@ static int rndis_get_resp(uint8_t dev_addr, int low_speed, uint8_t ctrl_if, void
         .wLength = buf_len,
     };
 
-    uint8_t tmp[512] __attribute__((aligned(64)));
-    uint8_t *xfer_buf = (uint8_t *)buf;
-    uint16_t xfer_len = buf_len;
-    if (buf_len <= sizeof(tmp)) {
-        xfer_buf = tmp;
-        xfer_len = (uint16_t)sizeof(tmp);
-        /* Preserve requested length in setup packet. */
-        req.wLength = buf_len;
-    }
-
     uint32_t got = 0;
-    int rc = usb_host_control_xfer(dev_addr, low_speed, req, xfer_buf, req.wLength, &got);
-    if (rc == 0 && buf && xfer_buf == tmp) {
-        uint32_t n = got;
-        if (n > buf_len) n = buf_len;
-        for (uint32_t i = 0; i < n; i++) ((uint8_t *)buf)[i] = tmp[i];
-        got = n;
-    }
-
-    (void)xfer_len;
+    int rc = usb_host_control_xfer(dev_addr, low_speed, req, (uint8_t *)buf, buf_len, &got);
+    if (rc == 0 && got > buf_len) got = buf_len;
     if (out_got) *out_got = got;
     return rc;
 }
@@ -1,342 +1,813 @@
 #include "vfs.h"
 
 #include "errno.h"
+#include "idtab.h"
+#include "pmm.h"
+#include "slab.h"
 #include "stat_bits.h"
 #include "stdint.h"
+#include "string.h"
 
 enum {
     MAX_PATH = 256,
-    MAX_RAMDIRS = 64,
-    MAX_RAMFILES = 64,
-    MAX_RAMINODES = 64,
-    RAMFILE_CAP = 4096,
+    NAME_MAX = 255,
+    MAX_RAMFILES = 4096,
+    MAX_RAMINODES = 4096,
+    RAMFILE_PAGE = 4096,
+    /* Radix tree nodes: one page of page addresses. */
+    RAMFILE_FANOUT = RAMFILE_PAGE / 8,
+    RAMFILE_FANOUT_SHIFT = 9,
+    RAMFILE_MAX_HEIGHT = 3,
+    DCACHE_HASH_SIZE = 256,
+    /* Unused negative dentries kept before the oldest are dropped. */
+    DCACHE_MAX_NEGATIVE = 128,
+    /* Names up to this long live in the dentry itself. */
+    DNAME_INLINE = 24,
 };
 
-typedef struct {
-    uint8_t used;
-    uint32_t mode;       /* includes S_IFDIR */
-    char path[MAX_PATH]; /* normalized, no leading slashes, no trailing slash (except "" for root, unused) */
-} ramdir_t;
+/*
+ * Dentry cache.
+ *
+ * One node per path component, hashed by (parent, name): paths resolve one
+ * component at a time from the root or from a cached directory (the cwd, a
+ * directory fd), whatever their length and however many entries exist.
+ *
+ * The overlay lives in the tree itself: a ramdir or ramfile is a dentry of
+ * that kind, linked into its parent's overlay child list. Initramfs entries
+ * get a dentry when first looked up, and so do names that do not exist
+ * (negative dentries), so repeated misses (PATH searches) are cheap too.
+ * An overlay entry shadows the initramfs entry of the same name.
+ *
+ * Positive dentries stay for good (initramfs ones are bounded by the
+ * archive). Negative ones are dropped oldest first beyond
+ * DCACHE_MAX_NEGATIVE, unless pinned (vfs_dget(), or cached children).
+ *
+ * Directory cursors (vfs_dir_t) walk the archive's child list and then the
+ * overlay child list, where they keep their place with a marker dentry, so
+ * reading a directory in pieces costs O(1) per entry however it changes.
+ */
+typedef enum {
+    DENTRY_NEGATIVE = 0,
+    DENTRY_INITRAMFS = 1,
+    DENTRY_RAMDIR = 2,
+    DENTRY_RAMFILE = 3,
+    DENTRY_CURSOR = 4, /* vfs_dir_t position marker, never hashed */
+} dentry_kind_t;
+
+struct vfs_dentry {
+    struct vfs_dentry *hash_next;
+    struct vfs_dentry *parent;   /* the root is its own parent */
+    /* Overlay children (ramdirs and ramfiles, cursor markers), newest first. */
+    struct vfs_dentry *child;
+    struct vfs_dentry *sibling;
+    struct vfs_dentry *sibling_prev;
+    /* Negative dentries, oldest first. */
+    struct vfs_dentry *neg_prev;
+    struct vfs_dentry *neg_next;
+    /* Initramfs entry under this name, if the archive is indexed. */
+    const initramfs_node_t *irn;
+    uint32_t hash;
+    uint32_t refs;               /* cached children + vfs_dget() pins */
+    uint32_t kind;               /* dentry_kind_t */
+    uint32_t mode;               /* DENTRY_INITRAMFS, DENTRY_RAMDIR */
+    uint32_t ramfile_id;         /* DENTRY_RAMFILE */
+    uint32_t name_len;
+    const uint8_t *data;         /* DENTRY_INITRAMFS */
+    uint64_t size;
+    char *name;                  /* iname or kmalloc'ed, NUL-terminated */
+    char iname[DNAME_INLINE];
+};
 
-static ramdir_t g_ramdirs[MAX_RAMDIRS];
+static vfs_dentry_t g_root;
+static vfs_dentry_t *g_dhash[DCACHE_HASH_SIZE];
+static vfs_dentry_t *g_neg_head;
+static vfs_dentry_t *g_neg_tail;
+static uint32_t g_neg_count;
+static kmem_cache_t *g_dentry_cache;
 
+/* Ramfile inodes and directory entries are slab objects (ids via idtab);
+ * the data block is kmalloc'ed when the file is created.
+ */
 typedef struct {
-    uint8_t used;
     uint32_t mode; /* includes S_IFREG */
-    uint64_t size;
     uint32_t nlink;
-    uint8_t data[RAMFILE_CAP];
+    uint64_t size;
+    /* Contents: a radix tree of PMM pages, much like a page table. At
+     * height 0 root is the only data page (or 0); at height h it is a node
+     * of RAMFILE_FANOUT subtrees of height h-1. Missing pages are holes and
+     * read as zeros, and bytes past size in the last page are kept zero.
+     */
+    uint64_t root;
+    uint32_t height;
+    uint32_t _pad;
+    uint64_t pages; /* data pages allocated */
 } raminode_t;
 
-static raminode_t g_raminodes[MAX_RAMINODES];
+static idtab_t g_raminodes = IDTAB_INIT(MAX_RAMINODES);
+static kmem_cache_t *g_raminode_cache;
 
+/* A name for an inode: open file descriptions refer to these by id. */
 typedef struct {
-    uint8_t used;
     uint32_t inode_id;
-    char path[MAX_PATH];
+    vfs_dentry_t *dentry;
 } ramfile_t;
 
-static ramfile_t g_ramfiles[MAX_RAMFILES];
+static idtab_t g_ramfiles = IDTAB_INIT(MAX_RAMFILES);
+static kmem_cache_t *g_ramfile_cache;
 
-static int raminode_alloc_slot(void) {
-    for (int i = 0; i < (int)MAX_RAMINODES; i++) {
-        if (!g_raminodes[i].used) return i;
-    }
-    return -1;
+static inline raminode_t *raminode_get(uint32_t id) {
+    return (raminode_t *)idtab_get(&g_raminodes, id);
 }
 
-static void raminode_incref(uint32_t id) {
-    if (id >= (uint32_t)MAX_RAMINODES) return;
-    if (!g_raminodes[id].used) return;
-    g_raminodes[id].nlink++;
+static inline ramfile_t *ramfile_get(uint32_t id) {
+    return (ramfile_t *)idtab_get(&g_ramfiles, id);
 }
 
-static void raminode_decref(uint32_t id) {
-    if (id >= (uint32_t)MAX_RAMINODES) return;
-    if (!g_raminodes[id].used) return;
-    if (g_raminodes[id].nlink > 0) g_raminodes[id].nlink--;
-    if (g_raminodes[id].nlink == 0) {
-        g_raminodes[id].used = 0;
-        g_raminodes[id].mode = 0;
-        g_raminodes[id].size = 0;
-        g_raminodes[id].nlink = 0;
-        for (uint64_t i = 0; i < (uint64_t)RAMFILE_CAP; i++) g_raminodes[id].data[i] = 0;
-    }
+/* Pages [0, RAMFILE_MAX_PAGES) can be stored: 512GiB. */
+#define RAMFILE_MAX_PAGES (1ull << (RAMFILE_FANOUT_SHIFT * RAMFILE_MAX_HEIGHT))
+
+/* What holes read as. */
+static const uint8_t g_zero_page[RAMFILE_PAGE];
+
+static inline uint64_t *rt_node(uint64_t pa) {
+    /* Identity-mapped: the kernel reaches every page at VA==PA. */
+    return (uint64_t *)(uintptr_t)pa;
 }
 
-static uint64_t cstr_len_u64(const char *s) {
-    uint64_t n = 0;
-    while (s && s[n] != '\0') n++;
-    return n;
+/* Data pages covered by a subtree of height h. */
+static inline uint64_t rt_span(uint32_t h) {
+    return 1ull << (RAMFILE_FANOUT_SHIFT * h);
 }
 
-static uint32_t cstr_len_u32(const char *s) {
-    uint32_t n = 0;
-    while (s && s[n] != '\0') n++;
-    return n;
+static uint64_t rt_alloc_zeroed(void) {
+    uint64_t pa = pmm_alloc_page();
+    if (pa != 0) memset(rt_node(pa), 0, RAMFILE_PAGE);
+    return pa;
 }
 
-static int cstr_eq_u64(const char *a, const char *b) {
-    if (!a || !b) return 0;
-    while (*a && *b) {
-        if (*a != *b) return 0;
-        a++;
-        b++;
+/* Physical address of data page idx, 0 for a hole. With alloc, the tree
+ * grows and the hole is filled; then 0 means out of memory or idx too big.
+ */
+static uint64_t ram_page(raminode_t *ino, uint64_t idx, int alloc) {
+    if (idx >= RAMFILE_MAX_PAGES) return 0;
+    if (idx >= rt_span(ino->height)) {
+        if (!alloc) return 0;
+        if (ino->root == 0) {
+            while (idx >= rt_span(ino->height)) ino->height++;
+        }
+        while (idx >= rt_span(ino->height)) {
+            /* One level up: the old tree becomes the first subtree. */
+            uint64_t n = rt_alloc_zeroed();
+            if (n == 0) return 0;
+            rt_node(n)[0] = ino->root;
+            ino->root = n;
+            ino->height++;
+        }
+    }
+
+    uint64_t *slot = &ino->root;
+    for (uint32_t h = ino->height;; h--) {
+        if (*slot == 0) {
+            if (!alloc) return 0;
+            uint64_t pa = rt_alloc_zeroed();
+            if (pa == 0) return 0;
+            *slot = pa;
+            if (h == 0) ino->pages++;
+        }
+        if (h == 0) return *slot;
+        uint64_t shift = (uint64_t)RAMFILE_FANOUT_SHIFT * (h - 1u);
+        slot = &rt_node(*slot)[(idx >> shift) & (RAMFILE_FANOUT - 1u)];
+    }
+}
+
+/* Free the data pages in [first, end) of the subtree at *slot (height h,
+ * starting at page base) and the nodes that leaves empty.
+ */
+static void rt_free(raminode_t *ino, uint64_t *slot, uint32_t h, uint64_t base, uint64_t first, uint64_t end) {
+    if (*slot == 0) return;
+    uint64_t span = rt_span(h);
+    if (end <= base || first >= base + span) return;
+
+    if (h == 0) {
+        /* Data pages may also be mapped by processes (mmap()). */
+        pmm_page_put(*slot);
+        *slot = 0;
+        ino->pages--;
+        return;
+    }
+
+    uint64_t *node = rt_node(*slot);
+    uint64_t child = span >> RAMFILE_FANOUT_SHIFT;
+    uint64_t lo = (first > base) ? (first - base) / child : 0;
+    uint64_t hi = (end - base - 1u) / child;
+    if (hi >= (uint64_t)RAMFILE_FANOUT) hi = RAMFILE_FANOUT - 1u;
+    for (uint64_t i = lo; i <= hi; i++) {
+        rt_free(ino, &node[i], h - 1u, base + i * child, first, end);
+    }
+
+    for (uint64_t i = 0; i < (uint64_t)RAMFILE_FANOUT; i++) {
+        if (node[i] != 0) return;
+    }
+    pmm_free_page(*slot);
+    *slot = 0;
+}
+
+/* Drop tree levels that only hold their first subtree. */
+static void rt_shrink(raminode_t *ino) {
+    while (ino->height > 0 && ino->root != 0) {
+        uint64_t *node = rt_node(ino->root);
+        for (uint64_t i = 1; i < (uint64_t)RAMFILE_FANOUT; i++) {
+            if (node[i] != 0) return;
+        }
+        uint64_t sub = node[0];
+        pmm_free_page(ino->root);
+        ino->root = sub;
+        ino->height--;
     }
-    return *a == *b;
+    if (ino->root == 0) ino->height = 0;
 }
 
-static const char *strip_leading_slashes_const(const char *p) {
-    while (p && *p == '/') p++;
-    return p;
+/* Zero bytes [off, off+len) of one page, if it is there. */
+static void ram_zero(raminode_t *ino, uint64_t off, uint64_t len) {
+    uint64_t pa = ram_page(ino, off / RAMFILE_PAGE, 0);
+    if (pa != 0) memset((uint8_t *)rt_node(pa) + off % RAMFILE_PAGE, 0, len);
 }
 
-static int ramdir_find(const char *path_no_slash) {
-    for (int i = 0; i < (int)MAX_RAMDIRS; i++) {
-        if (!g_ramdirs[i].used) continue;
-        if (cstr_eq_u64(g_ramdirs[i].path, path_no_slash)) return i;
+/* Free the whole pages of [off, off+len) and zero the partial ones. */
+static void ram_punch(raminode_t *ino, uint64_t off, uint64_t len) {
+    uint64_t end = off + len;
+    if (end < off) end = ~0ull;
+    uint64_t first = (off + RAMFILE_PAGE - 1u) / RAMFILE_PAGE;
+    uint64_t last = end / RAMFILE_PAGE;
+
+    if (off % RAMFILE_PAGE != 0) {
+        uint64_t n = RAMFILE_PAGE - off % RAMFILE_PAGE;
+        ram_zero(ino, off, (len < n) ? len : n);
+    }
+    if (end % RAMFILE_PAGE != 0 && end / RAMFILE_PAGE >= first) {
+        ram_zero(ino, end - end % RAMFILE_PAGE, end % RAMFILE_PAGE);
+    }
+    if (first < last) {
+        rt_free(ino, &ino->root, ino->height, 0, first, last);
+        rt_shrink(ino);
     }
-    return -1;
 }
 
-static int ramdir_alloc_slot(void) {
-    for (int i = 0; i < (int)MAX_RAMDIRS; i++) {
-        if (!g_ramdirs[i].used) return i;
+static int raminode_create(uint32_t mode) {
+    raminode_t *ino = (raminode_t *)kmem_cache_alloc(g_raminode_cache);
+    if (!ino) return -1;
+    ino->mode = mode;
+    ino->size = 0;
+    ino->nlink = 1;
+    ino->root = 0;
+    ino->height = 0;
+    ino->pages = 0;
+
+    int id = idtab_alloc(&g_raminodes, ino);
+    if (id < 0) {
+        kmem_cache_free(g_raminode_cache, ino);
+        return -1;
     }
-    return -1;
+    return id;
+}
+
+static void raminode_incref(uint32_t id) {
+    raminode_t *ino = raminode_get(id);
+    if (!ino) return;
+    ino->nlink++;
 }
 
-static int ramfile_find(const char *path_no_slash) {
-    for (int i = 0; i < (int)MAX_RAMFILES; i++) {
-        if (!g_ramfiles[i].used) continue;
-        if (cstr_eq_u64(g_ramfiles[i].path, path_no_slash)) return i;
+static void raminode_decref(uint32_t id) {
+    raminode_t *ino = raminode_get(id);
+    if (!ino) return;
+    if (ino->nlink > 0) ino->nlink--;
+    if (ino->nlink == 0) {
+        idtab_remove(&g_raminodes, id);
+        rt_free(ino, &ino->root, ino->height, 0, 0, RAMFILE_MAX_PAGES);
+        kmem_cache_free(g_raminode_cache, ino);
     }
-    return -1;
 }
 
-static int ramfile_alloc_slot(void) {
-    for (int i = 0; i < (int)MAX_RAMFILES; i++) {
-        if (!g_ramfiles[i].used) return i;
+static raminode_t *ramfile_inode(uint32_t id) {
+    ramfile_t *f = ramfile_get(id);
+    return f ? raminode_get(f->inode_id) : 0;
+}
+
+/* New directory entry for inode_id at d; returns its id or a negative errno. */
+static int ramfile_add(vfs_dentry_t *d, uint32_t inode_id) {
+    ramfile_t *f = (ramfile_t *)kmem_cache_alloc(g_ramfile_cache);
+    if (!f) return -(int)ENOMEM;
+    f->inode_id = inode_id;
+    f->dentry = d;
+
+    int id = idtab_alloc(&g_ramfiles, f);
+    if (id < 0) {
+        kmem_cache_free(g_ramfile_cache, f);
+        return -(int)ENOMEM;
     }
-    return -1;
+    return id;
 }
 
-void vfs_init(void) {
-    for (uint64_t i = 0; i < (uint64_t)MAX_RAMDIRS; i++) {
-        g_ramdirs[i].used = 0;
-        g_ramdirs[i].mode = 0;
-        g_ramdirs[i].path[0] = '\0';
+static uint32_t d_hash(const vfs_dentry_t *parent, const char *name, uint32_t len) {
+    /* FNV-1a over the name, seeded with the parent. */
+    uint32_t h = 2166136261u ^ (uint32_t)((uintptr_t)parent >> 4);
+    for (uint32_t i = 0; i < len; i++) {
+        h ^= (uint8_t)name[i];
+        h *= 16777619u;
     }
+    return h;
+}
 
-    for (uint64_t i = 0; i < (uint64_t)MAX_RAMFILES; i++) {
-        g_ramfiles[i].used = 0;
-        g_ramfiles[i].inode_id = 0;
-        g_ramfiles[i].path[0] = '\0';
+static vfs_dentry_t *d_find(const vfs_dentry_t *parent, const char *name, uint32_t len, uint32_t h) {
+    for (vfs_dentry_t *d = g_dhash[h % DCACHE_HASH_SIZE]; d; d = d->hash_next) {
+        if (d->hash != h || d->parent != parent || d->name_len != len) continue;
+        uint32_t i = 0;
+        while (i < len && d->name[i] == name[i]) i++;
+        if (i == len) return d;
     }
+    return 0;
+}
 
-    for (uint64_t i = 0; i < (uint64_t)MAX_RAMINODES; i++) {
-        g_raminodes[i].used = 0;
-        g_raminodes[i].mode = 0;
-        g_raminodes[i].size = 0;
-        g_raminodes[i].nlink = 0;
-        for (uint64_t j = 0; j < (uint64_t)RAMFILE_CAP; j++) {
-            g_raminodes[i].data[j] = 0;
-        }
+static uint32_t d_mode(const vfs_dentry_t *d) {
+    if (d->kind == DENTRY_RAMFILE) {
+        raminode_t *ino = ramfile_inode(d->ramfile_id);
+        return ino ? ino->mode : 0;
     }
+    return (d->kind == DENTRY_NEGATIVE) ? 0 : d->mode;
 }
 
-int vfs_lookup_abs(const char *abs_path, const uint8_t **out_data, uint64_t *out_size, uint32_t *out_mode) {
-    if (!abs_path) return -1;
+static int d_is_dir(const vfs_dentry_t *d) {
+    return d->kind != DENTRY_NEGATIVE && S_ISDIR(d_mode(d));
+}
 
-    /* Root directory always exists. */
-    if (cstr_eq_u64(abs_path, "/")) {
-        if (out_data) *out_data = 0;
-        if (out_size) *out_size = 0;
-        if (out_mode) *out_mode = S_IFDIR | 0755u;
-        return 0;
+static void neg_del(vfs_dentry_t *d) {
+    if (d->neg_prev) d->neg_prev->neg_next = d->neg_next;
+    else if (g_neg_head == d) g_neg_head = d->neg_next;
+    else return; /* not on the list */
+    if (d->neg_next) d->neg_next->neg_prev = d->neg_prev;
+    else g_neg_tail = d->neg_prev;
+    d->neg_prev = 0;
+    d->neg_next = 0;
+    g_neg_count--;
+}
+
+static void d_free(vfs_dentry_t *d) {
+    neg_del(d);
+    vfs_dentry_t **link = &g_dhash[d->hash % DCACHE_HASH_SIZE];
+    while (*link && *link != d) link = &(*link)->hash_next;
+    if (*link) *link = d->hash_next;
+    d->parent->refs--;
+    if (d->name != d->iname) kfree(d->name);
+    kmem_cache_free(g_dentry_cache, d);
+}
+
+/* Cache d as a miss, making room first so d itself is never dropped here. */
+static void neg_add(vfs_dentry_t *d) {
+    vfs_dentry_t *v = g_neg_head;
+    while (v && g_neg_count >= (uint32_t)DCACHE_MAX_NEGATIVE) {
+        vfs_dentry_t *next = v->neg_next;
+        if (v->refs == 0) d_free(v);
+        v = next;
     }
+    d->neg_next = 0;
+    d->neg_prev = g_neg_tail;
+    if (g_neg_tail) g_neg_tail->neg_next = d;
+    else g_neg_head = d;
+    g_neg_tail = d;
+    g_neg_count++;
+}
 
-    const char *p = strip_leading_slashes_const(abs_path);
-    if (!p || *p == '\0') {
-        if (out_data) *out_data = 0;
-        if (out_size) *out_size = 0;
-        if (out_mode) *out_mode = S_IFDIR | 0755u;
+/* Absolute path of d ("/" for the root). Returns 0 or -ENAMETOOLONG. */
+int vfs_dentry_path(const vfs_dentry_t *d, char *out, uint64_t cap) {
+    if (cap < 2) return -(int)ENAMETOOLONG;
+    uint64_t len = 0;
+    for (const vfs_dentry_t *v = d; v != &g_root; v = v->parent) {
+        len += 1u + v->name_len;
+    }
+    if (len == 0) {
+        out[0] = '/';
+        out[1] = '\0';
         return 0;
     }
+    if (len + 1 > cap) return -(int)ENAMETOOLONG;
 
-    int ridx = ramdir_find(p);
-    if (ridx >= 0) {
-        if (out_data) *out_data = 0;
-        if (out_size) *out_size = 0;
-        if (out_mode) *out_mode = g_ramdirs[ridx].mode;
-        return 0;
+    out[len] = '\0';
+    for (const vfs_dentry_t *v = d; v != &g_root; v = v->parent) {
+        len -= v->name_len;
+        memcpy(&out[len], v->name, v->name_len);
+        out[--len] = '/';
+    }
+    return 0;
+}
+
+/* What the initramfs has under d's name (after an overlay entry is gone). */
+static void d_resolve_initramfs(vfs_dentry_t *d) {
+    d->kind = DENTRY_NEGATIVE;
+    d->data = 0;
+    d->size = 0;
+    d->mode = 0;
+    if (initramfs_root()) {
+        if (d->irn) {
+            initramfs_node_stat(d->irn, &d->data, &d->size, &d->mode);
+            d->kind = DENTRY_INITRAMFS;
+        }
+    } else {
+        /* Not indexed: look the path up in the archive. */
+        char path[MAX_PATH];
+        if (vfs_dentry_path(d, path, sizeof(path)) == 0 &&
+            initramfs_lookup(path, &d->data, &d->size, &d->mode) == 0) {
+            d->kind = DENTRY_INITRAMFS;
+        }
+    }
+    if (d->kind == DENTRY_NEGATIVE && d != &g_root) {
+        neg_add(d);
     }
+}
 
-    int fidx = ramfile_find(p);
-    if (fidx >= 0) {
-        uint32_t inode_id = g_ramfiles[fidx].inode_id;
-        if (inode_id < (uint32_t)MAX_RAMINODES && g_raminodes[inode_id].used) {
-            if (out_data) *out_data = (const uint8_t *)g_raminodes[inode_id].data;
-            if (out_size) *out_size = g_raminodes[inode_id].size;
-            if (out_mode) *out_mode = g_raminodes[inode_id].mode;
+/* Cached or new dentry for name[0, len) in parent; 0 on OOM. */
+static vfs_dentry_t *d_lookup(vfs_dentry_t *parent, const char *name, uint32_t len) {
+    uint32_t h = d_hash(parent, name, len);
+    vfs_dentry_t *d = d_find(parent, name, len, h);
+    if (d) return d;
+
+    d = (vfs_dentry_t *)kmem_cache_alloc(g_dentry_cache);
+    if (!d) return 0;
+    d->name = d->iname;
+    if (len >= (uint32_t)DNAME_INLINE) {
+        d->name = (char *)kmalloc((uint64_t)len + 1u);
+        if (!d->name) {
+            kmem_cache_free(g_dentry_cache, d);
             return 0;
         }
-        /* Corrupt entry; treat as missing. */
-        return -1;
     }
+    memcpy(d->name, name, len);
+    d->name[len] = '\0';
+    d->name_len = len;
+    d->parent = parent;
+    parent->refs++;
+    d->child = 0;
+    d->sibling = 0;
+    d->sibling_prev = 0;
+    d->neg_prev = 0;
+    d->neg_next = 0;
+    d->irn = parent->irn ? initramfs_child(parent->irn, name, len) : 0;
+    d->refs = 0;
+    d->ramfile_id = 0;
+    d->hash = h;
+    d->hash_next = g_dhash[h % DCACHE_HASH_SIZE];
+    g_dhash[h % DCACHE_HASH_SIZE] = d;
+    d_resolve_initramfs(d);
+    return d;
+}
 
-    if (initramfs_lookup(abs_path, out_data, out_size, out_mode) == 0) {
-        return 0;
+/* Dentry for the last component of path, walked from base (from the root
+ * for absolute paths); it may be negative. Earlier components must be
+ * directories. The result is valid until the next VFS call unless pinned.
+ * Returns 0 and sets *err (-ENOENT, -ENOTDIR, -ENAMETOOLONG, -ENOMEM) if
+ * the walk stops early.
+ */
+static vfs_dentry_t *d_walk(vfs_dentry_t *base, const char *path, int *err) {
+    vfs_dentry_t *d = (!base || path[0] == '/') ? &g_root : base;
+    const char *p = path;
+    for (;;) {
+        while (*p == '/') p++;
+        if (*p == '\0') return d;
+
+        const char *name = p;
+        uint32_t len = 0;
+        while (p[len] != '\0' && p[len] != '/') len++;
+        p += len;
+
+        if (!d_is_dir(d)) {
+            *err = (d->kind == DENTRY_NEGATIVE) ? -(int)ENOENT : -(int)ENOTDIR;
+            return 0;
+        }
+        if (len == 1 && name[0] == '.') continue;
+        if (len == 2 && name[0] == '.' && name[1] == '.') {
+            d = d->parent;
+            continue;
+        }
+        if (len > (uint32_t)NAME_MAX) {
+            *err = -(int)ENAMETOOLONG;
+            return 0;
+        }
+        d = d_lookup(d, name, len);
+        if (!d) {
+            *err = -(int)ENOMEM;
+            return 0;
+        }
     }
-    return -1;
 }
 
-typedef struct {
-    initramfs_dir_cb_t cb;
-    void *cb_ctx;
-    char seen[128][128];
-    uint32_t seen_len[128];
-    uint32_t seen_count;
-} vfs_list_ctx_t;
+/* Like d_walk() for callers that only care whether the entry exists. */
+static vfs_dentry_t *d_walk_positive(const char *path) {
+    int err = 0;
+    vfs_dentry_t *d = d_walk(&g_root, path, &err);
+    return (d && d->kind != DENTRY_NEGATIVE) ? d : 0;
+}
 
-static int slice_eq_u32(const char *a, uint32_t alen, const char *b, uint32_t blen) {
-    if (alen != blen) return 0;
-    for (uint32_t i = 0; i < alen; i++) {
-        if (a[i] != b[i]) return 0;
-    }
-    return 1;
+/* Insert d into parent's overlay child list after prev (0: at the head). */
+static void child_link(vfs_dentry_t *parent, vfs_dentry_t *prev, vfs_dentry_t *d) {
+    vfs_dentry_t *next = prev ? prev->sibling : parent->child;
+    d->sibling_prev = prev;
+    d->sibling = next;
+    if (next) next->sibling_prev = d;
+    if (prev) prev->sibling = d;
+    else parent->child = d;
 }
 
-static int vfs_seen_has(vfs_list_ctx_t *vc, const char *name, uint32_t len) {
-    for (uint32_t i = 0; i < vc->seen_count; i++) {
-        if (slice_eq_u32(vc->seen[i], vc->seen_len[i], name, len)) return 1;
+static void child_unlink(vfs_dentry_t *parent, vfs_dentry_t *d) {
+    if (d->sibling_prev) d->sibling_prev->sibling = d->sibling;
+    else if (parent->child == d) parent->child = d->sibling;
+    else return; /* not linked */
+    if (d->sibling) d->sibling->sibling_prev = d->sibling_prev;
+    d->sibling = 0;
+    d->sibling_prev = 0;
+}
+
+/* Does dir have overlay children (cursor markers aside)? */
+static int d_has_children(const vfs_dentry_t *dir) {
+    for (const vfs_dentry_t *c = dir->child; c; c = c->sibling) {
+        if (c->kind != DENTRY_CURSOR) return 1;
     }
     return 0;
 }
 
-static void vfs_seen_add(vfs_list_ctx_t *vc, const char *name, uint32_t len) {
-    if (vc->seen_count >= (uint32_t)(sizeof(vc->seen) / sizeof(vc->seen[0]))) return;
-    uint32_t n = len;
-    if (n >= (uint32_t)sizeof(vc->seen[0])) n = (uint32_t)sizeof(vc->seen[0]) - 1;
-    for (uint32_t i = 0; i < n; i++) vc->seen[vc->seen_count][i] = name[i];
-    vc->seen[vc->seen_count][n] = '\0';
-    vc->seen_len[vc->seen_count] = n;
-    vc->seen_count++;
+/* Turn d into an overlay entry of kind. */
+static void d_make_ram(vfs_dentry_t *d, uint32_t kind) {
+    neg_del(d);
+    d->kind = kind;
+    child_link(d->parent, 0, d);
 }
 
-static int vfs_list_emit_unique(const char *name, uint32_t mode, void *ctx) {
-    vfs_list_ctx_t *vc = (vfs_list_ctx_t *)ctx;
-    uint32_t n = cstr_len_u32(name);
-    if (n == 0) return 0;
-    if (vfs_seen_has(vc, name, n)) return 0;
-    vfs_seen_add(vc, name, n);
-    return vc->cb(name, mode, vc->cb_ctx);
+/* Drop d's overlay entry; the initramfs one (if any) shows again. */
+static void d_unmake_ram(vfs_dentry_t *d) {
+    child_unlink(d->parent, d);
+    d_resolve_initramfs(d);
 }
 
-int vfs_list_dir(const char *dir_path_no_slash, initramfs_dir_cb_t cb, void *ctx) {
-    if (!cb) return -1;
+void vfs_init(void) {
+    if (!g_ramfile_cache) {
+        g_ramfile_cache = kmem_cache_create("ramfile", sizeof(ramfile_t), 0, 0);
+        g_raminode_cache = kmem_cache_create("raminode", sizeof(raminode_t), 0, 0);
+        g_dentry_cache = kmem_cache_create("dentry", sizeof(vfs_dentry_t), 0, 0);
+    }
 
-    /* Ensure dir exists (either initramfs or ramdir). */
-    char abs[MAX_PATH];
-    if (!dir_path_no_slash || dir_path_no_slash[0] == '\0') {
-        abs[0] = '/';
-        abs[1] = '\0';
-    } else {
-        uint64_t n = cstr_len_u64(dir_path_no_slash);
-        if (n + 2 > sizeof(abs)) return -1;
-        abs[0] = '/';
-        for (uint64_t i = 0; i <= n; i++) abs[1 + i] = dir_path_no_slash[i];
+    g_root.parent = &g_root;
+    g_root.name = g_root.iname;
+    g_root.iname[0] = '\0';
+    g_root.irn = initramfs_root();
+    d_resolve_initramfs(&g_root);
+    /* The root directory always exists. */
+    g_root.kind = DENTRY_INITRAMFS;
+    if (!S_ISDIR(g_root.mode)) {
+        g_root.mode = S_IFDIR | 0755u;
     }
+}
+
+vfs_dentry_t *vfs_root(void) {
+    return &g_root;
+}
+
+vfs_dentry_t *vfs_dget(vfs_dentry_t *d) {
+    if (d) d->refs++;
+    return d;
+}
 
-    uint32_t mode = 0;
-    if (vfs_lookup_abs(abs, 0, 0, &mode) != 0) return -1;
-    if (!S_ISDIR(mode)) return -1;
+void vfs_dput(vfs_dentry_t *d) {
+    /* Unpinned negative dentries go when the cache next needs room. */
+    if (d && d->refs > 0) d->refs--;
+}
+
+int vfs_walk(vfs_dentry_t *base, const char *path, vfs_dentry_t **out) {
+    if (!path) return -(int)EINVAL;
+    int err = 0;
+    vfs_dentry_t *d = d_walk(base, path, &err);
+    if (!d) return err;
+    if (d->kind == DENTRY_NEGATIVE) return -(int)ENOENT;
+    *out = d;
+    return 0;
+}
+
+int vfs_dentry_stat(const vfs_dentry_t *d, const uint8_t **out_data, uint64_t *out_size, uint32_t *out_mode) {
+    if (d->kind == DENTRY_NEGATIVE) return -(int)ENOENT;
+    if (d->kind == DENTRY_RAMFILE) {
+        raminode_t *ino = ramfile_inode(d->ramfile_id);
+        if (!ino) return -(int)ENOENT;
+        if (out_data) {
+            /* Only the first page is contiguous: enough for symlinks. */
+            uint64_t pa = ram_page(ino, 0, 0);
+            *out_data = pa ? (const uint8_t *)rt_node(pa) : g_zero_page;
+        }
+        if (out_size) *out_size = ino->size;
+        if (out_mode) *out_mode = ino->mode;
+        return 0;
+    }
+    if (out_data) *out_data = d->data;
+    if (out_size) *out_size = d->size;
+    if (out_mode) *out_mode = d->mode;
+    return 0;
+}
+
+int vfs_lookup_abs(const char *abs_path, const uint8_t **out_data, uint64_t *out_size, uint32_t *out_mode) {
+    if (!abs_path) return -1;
+    vfs_dentry_t *d = d_walk_positive(abs_path);
+    if (!d) return -1;
+    return (vfs_dentry_stat(d, out_data, out_size, out_mode) == 0) ? 0 : -1;
+}
+
+typedef struct {
+    vfs_dentry_t *dir;
+    initramfs_dir_cb_t cb;
+    void *cb_ctx;
+} vfs_list_ctx_t;
+
+/* Initramfs children, minus the names an overlay entry shadows. */
+static int vfs_list_initramfs_cb(const char *name, uint32_t mode, void *ctx) {
+    vfs_list_ctx_t *vc = (vfs_list_ctx_t *)ctx;
+    uint32_t len = 0;
+    while (name[len] != '\0') len++;
+    const vfs_dentry_t *d = d_find(vc->dir, name, len, d_hash(vc->dir, name, len));
+    if (d && (d->kind == DENTRY_RAMDIR || d->kind == DENTRY_RAMFILE)) return 0;
+    return vc->cb(name, mode, vc->cb_ctx);
+}
+
+int vfs_dentry_list(vfs_dentry_t *dir, initramfs_dir_cb_t cb, void *ctx) {
+    if (!cb || !d_is_dir(dir)) return -1;
 
     vfs_list_ctx_t vc;
+    vc.dir = dir;
     vc.cb = cb;
     vc.cb_ctx = ctx;
-    vc.seen_count = 0;
 
     /* First: initramfs entries. */
-    (void)initramfs_list_dir(dir_path_no_slash ? dir_path_no_slash : "", vfs_list_emit_unique, &vc);
-
-    /* Second: ramdir + ramfile overlay entries. */
-    const char *prefix = dir_path_no_slash ? dir_path_no_slash : "";
-    uint32_t plen = cstr_len_u32(prefix);
-
-    for (int i = 0; i < (int)(MAX_RAMDIRS + MAX_RAMFILES); i++) {
-        const char *rp = 0;
-        if (i < (int)MAX_RAMDIRS) {
-            if (!g_ramdirs[i].used) continue;
-            rp = g_ramdirs[i].path;
+    if (dir->kind == DENTRY_INITRAMFS) {
+        if (dir->irn) {
+            for (const initramfs_node_t *c = initramfs_first_child(dir->irn); c; c = initramfs_next_sibling(c)) {
+                const char *cn = 0;
+                uint32_t len = initramfs_node_name(c, &cn);
+                char tmp[NAME_MAX + 1];
+                if (len > (uint32_t)NAME_MAX) continue;
+                memcpy(tmp, cn, len);
+                tmp[len] = '\0';
+                uint32_t mode = 0;
+                initramfs_node_stat(c, 0, 0, &mode);
+                int rc = vfs_list_initramfs_cb(tmp, mode, &vc);
+                if (rc != 0) return rc;
+            }
         } else {
-            int fi = i - (int)MAX_RAMDIRS;
-            if (!g_ramfiles[fi].used) continue;
-            rp = g_ramfiles[fi].path;
-        }
-        if (!rp || rp[0] == '\0') continue;
-
-        const char *child = rp;
-        if (plen != 0) {
-            /* Must start with "<prefix>/" */
-            for (uint32_t j = 0; j < plen; j++) {
-                if (rp[j] != prefix[j]) {
-                    child = 0;
-                    break;
-                }
+            char path[MAX_PATH];
+            if (vfs_dentry_path(dir, path, sizeof(path)) == 0) {
+                (void)initramfs_list_dir(path, vfs_list_initramfs_cb, &vc);
             }
-            if (!child) continue;
-            if (rp[plen] != '/') continue;
-            child = rp + plen + 1;
-            if (child[0] == '\0') continue; /* the directory itself */
         }
+    }
 
-        uint32_t clen = 0;
-        while (child[clen] != '\0' && child[clen] != '/') clen++;
-        if (clen == 0) continue;
-
-        /* Determine mode for this immediate child: look up exact child path if present. */
-        uint32_t child_mode = S_IFDIR | 0755u;
-        {
-            char child_full[MAX_PATH];
-            uint64_t o = 0;
-            if (plen != 0) {
-                if ((uint64_t)plen + 1 >= sizeof(child_full)) {
-                    continue;
-                }
-                for (uint32_t j = 0; j < plen; j++) child_full[o++] = prefix[j];
-                child_full[o++] = '/';
-            }
-            if (o + (uint64_t)clen + 1 >= sizeof(child_full)) {
-                continue;
+    /* Second: overlay entries. */
+    for (vfs_dentry_t *c = dir->child; c; c = c->sibling) {
+        if (c->kind == DENTRY_CURSOR) continue;
+        int rc = cb(c->name, d_mode(c), ctx);
+        if (rc != 0) return rc;
+    }
+    return 0;
+}
+
+int vfs_list_dir(const char *dir_path_no_slash, initramfs_dir_cb_t cb, void *ctx) {
+    vfs_dentry_t *d = d_walk_positive(dir_path_no_slash ? dir_path_no_slash : "");
+    if (!d) return -1;
+    return vfs_dentry_list(d, cb, ctx);
+}
+
+typedef enum {
+    DIR_INITRAMFS = 0,
+    DIR_OVERLAY = 1,
+    DIR_END = 2,
+} vfs_dir_phase_t;
+
+struct vfs_dir {
+    vfs_dentry_t *dir;               /* pinned */
+    uint32_t phase;                  /* vfs_dir_phase_t */
+    /* DIR_INITRAMFS: next archive entry, or (no index) entries done. */
+    const initramfs_node_t *irn;
+    uint64_t done;
+    /* DIR_OVERLAY: linked into dir->child after the last entry returned. */
+    vfs_dentry_t mark;
+};
+
+static void dir_reset(vfs_dir_t *c) {
+    child_unlink(c->dir, &c->mark);
+    c->phase = DIR_INITRAMFS;
+    c->irn = c->dir->irn ? initramfs_first_child(c->dir->irn) : 0;
+    c->done = 0;
+}
+
+vfs_dir_t *vfs_dir_open(vfs_dentry_t *d) {
+    vfs_dir_t *c = (vfs_dir_t *)kzalloc(sizeof(*c));
+    if (!c) return 0;
+    c->dir = vfs_dget(d);
+    c->mark.kind = DENTRY_CURSOR;
+    c->mark.parent = d;
+    c->mark.name = c->mark.iname;
+    dir_reset(c);
+    return c;
+}
+
+void vfs_dir_close(vfs_dir_t *c) {
+    if (!c) return;
+    child_unlink(c->dir, &c->mark);
+    vfs_dput(c->dir);
+    kfree(c);
+}
+
+vfs_dentry_t *vfs_dir_dentry(vfs_dir_t *c) {
+    return c->dir;
+}
+
+void vfs_dir_rewind(vfs_dir_t *c) {
+    dir_reset(c);
+}
+
+typedef struct {
+    vfs_list_ctx_t vc;
+    uint64_t skip;
+    uint64_t *done;
+    int stop; /* the callback's non-zero return */
+} vfs_dir_scan_ctx_t;
+
+/* Unindexed archive: skip what earlier calls returned, count what is
+ * accepted now. O(entries) per call, but only without the index.
+ */
+static int vfs_dir_scan_cb(const char *name, uint32_t mode, void *ctx) {
+    vfs_dir_scan_ctx_t *sc = (vfs_dir_scan_ctx_t *)ctx;
+    if (sc->skip > 0) {
+        sc->skip--;
+        return 0;
+    }
+    int rc = vfs_list_initramfs_cb(name, mode, &sc->vc);
+    if (rc == 0) (*sc->done)++;
+    sc->stop = rc;
+    return rc;
+}
+
+int vfs_dir_read(vfs_dir_t *c, initramfs_dir_cb_t cb, void *ctx) {
+    vfs_dentry_t *dir = c->dir;
+    if (!cb) return -1;
+    if (!d_is_dir(dir)) {
+        /* Removed while open: nothing left to list. */
+        return 0;
+    }
+
+    if (c->phase == DIR_INITRAMFS) {
+        vfs_list_ctx_t vc;
+        vc.dir = dir;
+        vc.cb = cb;
+        vc.cb_ctx = ctx;
+
+        if (dir->kind != DENTRY_INITRAMFS) {
+            /* A ramdir has no archive entries. */
+        } else if (dir->irn) {
+            for (; c->irn; c->irn = initramfs_next_sibling(c->irn)) {
+                const char *cn = 0;
+                uint32_t len = initramfs_node_name(c->irn, &cn);
+                char tmp[NAME_MAX + 1];
+                if (len > (uint32_t)NAME_MAX) continue;
+                memcpy(tmp, cn, len);
+                tmp[len] = '\0';
+                uint32_t mode = 0;
+                initramfs_node_stat(c->irn, 0, 0, &mode);
+                int rc = vfs_list_initramfs_cb(tmp, mode, &vc);
+                if (rc != 0) return rc;
             }
-            for (uint32_t j = 0; j < clen; j++) child_full[o++] = child[j];
-            child_full[o] = '\0';
-
-            int ei = ramdir_find(child_full);
-            if (ei >= 0) {
-                child_mode = g_ramdirs[ei].mode;
-            } else {
-                int ef = ramfile_find(child_full);
-                if (ef >= 0) {
-                    uint32_t inode_id = g_ramfiles[ef].inode_id;
-                    if (inode_id < (uint32_t)MAX_RAMINODES && g_raminodes[inode_id].used) {
-                        child_mode = g_raminodes[inode_id].mode;
-                    }
-                }
+        } else {
+            char path[MAX_PATH];
+            if (vfs_dentry_path(dir, path, sizeof(path)) == 0) {
+                vfs_dir_scan_ctx_t sc;
+                sc.vc = vc;
+                sc.skip = c->done;
+                sc.done = &c->done;
+                sc.stop = 0;
+                (void)initramfs_list_dir(path, vfs_dir_scan_cb, &sc);
+                if (sc.stop != 0) return sc.stop;
             }
         }
-
-        /* Copy into temporary NUL-terminated buffer for callback. */
-        char tmp[128];
-        if (clen >= sizeof(tmp)) clen = (uint32_t)sizeof(tmp) - 1;
-        for (uint32_t j = 0; j < clen; j++) tmp[j] = child[j];
-        tmp[clen] = '\0';
-
-        int rc = vfs_list_emit_unique(tmp, child_mode, &vc);
-        if (rc != 0) return rc;
+        c->phase = DIR_OVERLAY;
+        child_link(dir, 0, &c->mark);
     }
 
+    if (c->phase == DIR_OVERLAY) {
+        vfs_dentry_t *e;
+        while ((e = c->mark.sibling) != 0) {
+            if (e->kind != DENTRY_CURSOR) {
+                int rc = cb(e->name, d_mode(e), ctx);
+                if (rc != 0) return rc;
+            }
+            /* Step over e. */
+            child_unlink(dir, &c->mark);
+            child_link(dir, e, &c->mark);
+        }
+        child_unlink(dir, &c->mark);
+        c->phase = DIR_END;
+    }
     return 0;
 }
 
@@ -344,64 +815,33 @@ int vfs_ramdir_create(const char *path_no_slash, uint32_t mode) {
     if (!path_no_slash || path_no_slash[0] == '\0') {
         return -(int)ENOENT;
     }
-    if (ramdir_find(path_no_slash) >= 0) {
+    int err = 0;
+    vfs_dentry_t *d = d_walk(&g_root, path_no_slash, &err);
+    if (!d) return err;
+    if (d == &g_root || d->kind != DENTRY_NEGATIVE) {
         return -(int)EEXIST;
     }
 
-    int slot = ramdir_alloc_slot();
-    if (slot < 0) {
-        return -(int)ENOMEM;
-    }
-
-    uint64_t n = cstr_len_u64(path_no_slash);
-    if (n + 1 > sizeof(g_ramdirs[slot].path)) {
-        return -(int)ENAMETOOLONG;
-    }
-
-    g_ramdirs[slot].used = 1;
-    g_ramdirs[slot].mode = mode;
-    for (uint64_t i = 0; i <= n; i++) g_ramdirs[slot].path[i] = path_no_slash[i];
-
+    d->mode = mode;
+    d_make_ram(d, DENTRY_RAMDIR);
     return 0;
 }
 
-static int path_has_prefix_dir(const char *path, const char *dir) {
-    if (!path || !dir) return 0;
-    uint64_t dlen = cstr_len_u64(dir);
-    for (uint64_t i = 0; i < dlen; i++) {
-        if (path[i] != dir[i]) return 0;
-    }
-    if (path[dlen] != '/') return 0;
-    return 1;
-}
-
 int vfs_ramdir_remove(const char *path_no_slash) {
     if (!path_no_slash || path_no_slash[0] == '\0') {
         return -(int)EINVAL;
     }
 
-    int idx = ramdir_find(path_no_slash);
-    if (idx < 0) {
+    vfs_dentry_t *d = d_walk_positive(path_no_slash);
+    if (!d || d->kind != DENTRY_RAMDIR) {
         return -(int)ENOENT;
     }
-
     /* Must be empty with respect to overlay children. */
-    for (int i = 0; i < (int)MAX_RAMDIRS; i++) {
-        if (!g_ramdirs[i].used) continue;
-        if (path_has_prefix_dir(g_ramdirs[i].path, path_no_slash)) {
-            return -(int)ENOTEMPTY;
-        }
-    }
-    for (int i = 0; i < (int)MAX_RAMFILES; i++) {
-        if (!g_ramfiles[i].used) continue;
-        if (path_has_prefix_dir(g_ramfiles[i].path, path_no_slash)) {
-            return -(int)ENOTEMPTY;
-        }
+    if (d_has_children(d)) {
+        return -(int)ENOTEMPTY;
     }
 
-    g_ramdirs[idx].used = 0;
-    g_ramdirs[idx].mode = 0;
-    g_ramdirs[idx].path[0] = '\0';
+    d_unmake_ram(d);
     return 0;
 }
 
@@ -409,39 +849,26 @@ int vfs_ramfile_create(const char *path_no_slash, uint32_t mode) {
     if (!path_no_slash || path_no_slash[0] == '\0') {
         return -(int)ENOENT;
     }
-    if (ramfile_find(path_no_slash) >= 0) {
-        return -(int)EEXIST;
-    }
-    /* Do not allow creating a file where a directory exists in overlay. */
-    if (ramdir_find(path_no_slash) >= 0) {
+    int err = 0;
+    vfs_dentry_t *d = d_walk(&g_root, path_no_slash, &err);
+    if (!d) return err;
+    /* A ramfile may shadow an initramfs file, but nothing else. */
+    if (d == &g_root || d->kind == DENTRY_RAMFILE || d->kind == DENTRY_RAMDIR || d_is_dir(d)) {
         return -(int)EEXIST;
     }
 
-    int slot = ramfile_alloc_slot();
-    if (slot < 0) {
+    int inode_id = raminode_create(mode);
+    if (inode_id < 0) {
         return -(int)ENOMEM;
     }
 
-    int inode_slot = raminode_alloc_slot();
-    if (inode_slot < 0) {
-        return -(int)ENOMEM;
+    int id = ramfile_add(d, (uint32_t)inode_id);
+    if (id < 0) {
+        raminode_decref((uint32_t)inode_id);
+        return id;
     }
-
-    uint64_t n = cstr_len_u64(path_no_slash);
-    if (n + 1 > sizeof(g_ramfiles[slot].path)) {
-        return -(int)ENAMETOOLONG;
-    }
-
-    g_ramfiles[slot].used = 1;
-    g_ramfiles[slot].inode_id = (uint32_t)inode_slot;
-    for (uint64_t i = 0; i <= n; i++) g_ramfiles[slot].path[i] = path_no_slash[i];
-
-    g_raminodes[inode_slot].used = 1;
-    g_raminodes[inode_slot].mode = mode;
-    g_raminodes[inode_slot].size = 0;
-    g_raminodes[inode_slot].nlink = 1;
-    for (uint64_t i = 0; i < (uint64_t)RAMFILE_CAP; i++) g_raminodes[inode_slot].data[i] = 0;
-
+    d->ramfile_id = (uint32_t)id;
+    d_make_ram(d, DENTRY_RAMFILE);
     return 0;
 }
 
@@ -449,15 +876,17 @@ int vfs_ramfile_unlink(const char *path_no_slash) {
     if (!path_no_slash || path_no_slash[0] == '\0') {
         return -(int)ENOENT;
     }
-    int idx = ramfile_find(path_no_slash);
-    if (idx < 0) {
+    vfs_dentry_t *d = d_walk_positive(path_no_slash);
+    if (!d || d->kind != DENTRY_RAMFILE) {
         return -(int)ENOENT;
     }
-    uint32_t inode_id = g_ramfiles[idx].inode_id;
-    g_ramfiles[idx].used = 0;
-    g_ramfiles[idx].inode_id = 0;
-    g_ramfiles[idx].path[0] = '\0';
-    raminode_decref(inode_id);
+    ramfile_t *f = (ramfile_t *)idtab_remove(&g_ramfiles, d->ramfile_id);
+    d_unmake_ram(d);
+    if (f) {
+        uint32_t inode_id = f->inode_id;
+        kmem_cache_free(g_ramfile_cache, f);
+        raminode_decref(inode_id);
+    }
     return 0;
 }
 
@@ -465,100 +894,140 @@ int vfs_ramfile_link(const char *old_path_no_slash, const char *new_path_no_slas
     if (!old_path_no_slash || old_path_no_slash[0] == '\0') return -(int)ENOENT;
     if (!new_path_no_slash || new_path_no_slash[0] == '\0') return -(int)ENOENT;
 
-    int old_idx = ramfile_find(old_path_no_slash);
-    if (old_idx < 0) {
+    vfs_dentry_t *od = d_walk_positive(old_path_no_slash);
+    if (!od || od->kind != DENTRY_RAMFILE) {
         return -(int)ENOENT;
     }
-
-    if (ramfile_find(new_path_no_slash) >= 0) {
-        return -(int)EEXIST;
-    }
-    if (ramdir_find(new_path_no_slash) >= 0) {
-        return -(int)EEXIST;
-    }
-
-    int slot = ramfile_alloc_slot();
-    if (slot < 0) {
-        return -(int)ENOMEM;
+    ramfile_t *of = ramfile_get(od->ramfile_id);
+    if (!of || !raminode_get(of->inode_id)) {
+        return -(int)ENOENT;
     }
+    uint32_t inode_id = of->inode_id;
 
-    uint64_t n = cstr_len_u64(new_path_no_slash);
-    if (n + 1 > sizeof(g_ramfiles[slot].path)) {
-        return -(int)ENAMETOOLONG;
+    int err = 0;
+    vfs_dentry_t *nd = d_walk(&g_root, new_path_no_slash, &err);
+    if (!nd) return err;
+    if (nd == &g_root || nd->kind == DENTRY_RAMFILE || nd->kind == DENTRY_RAMDIR || d_is_dir(nd)) {
+        return -(int)EEXIST;
     }
 
-    uint32_t inode_id = g_ramfiles[old_idx].inode_id;
-    if (inode_id >= (uint32_t)MAX_RAMINODES || !g_raminodes[inode_id].used) {
-        return -(int)ENOENT;
+    int id = ramfile_add(nd, inode_id);
+    if (id < 0) {
+        return id;
     }
-
-    g_ramfiles[slot].used = 1;
-    g_ramfiles[slot].inode_id = inode_id;
-    for (uint64_t i = 0; i <= n; i++) g_ramfiles[slot].path[i] = new_path_no_slash[i];
+    nd->ramfile_id = (uint32_t)id;
+    d_make_ram(nd, DENTRY_RAMFILE);
     raminode_incref(inode_id);
     return 0;
 }
 
 int vfs_ramfile_find_abs(const char *abs_path, uint32_t *out_id) {
     if (!abs_path) return -(int)EINVAL;
-    const char *p = strip_leading_slashes_const(abs_path);
-    if (!p || *p == '\0') return -(int)ENOENT;
-    int idx = ramfile_find(p);
-    if (idx < 0) return -(int)ENOENT;
-    if (out_id) *out_id = (uint32_t)idx;
+    vfs_dentry_t *d = d_walk_positive(abs_path);
+    if (!d || d->kind != DENTRY_RAMFILE) return -(int)ENOENT;
+    if (out_id) *out_id = d->ramfile_id;
     return 0;
 }
 
 int vfs_ramfile_set_mode_abs(const char *abs_path, uint32_t new_mode) {
     if (!abs_path) return -(int)EINVAL;
-    const char *p = strip_leading_slashes_const(abs_path);
-    if (!p || *p == '\0') return -(int)ENOENT;
-    int idx = ramfile_find(p);
-    if (idx < 0) return -(int)ENOENT;
-
-    uint32_t inode_id = g_ramfiles[idx].inode_id;
-    if (inode_id >= (uint32_t)MAX_RAMINODES) return -(int)ENOENT;
-    if (!g_raminodes[inode_id].used) return -(int)ENOENT;
-    g_raminodes[inode_id].mode = new_mode;
+    vfs_dentry_t *d = d_walk_positive(abs_path);
+    if (!d || d->kind != DENTRY_RAMFILE) return -(int)ENOENT;
+
+    raminode_t *ino = ramfile_inode(d->ramfile_id);
+    if (!ino) return -(int)ENOENT;
+    ino->mode = new_mode;
     return 0;
 }
 
 int vfs_ramdir_set_mode_abs(const char *abs_path, uint32_t new_mode) {
     if (!abs_path) return -(int)EINVAL;
-
-    /* Root is not represented as an overlay ramdir; treat as non-overlay. */
-    if (cstr_eq_u64(abs_path, "/")) return -(int)ENOENT;
-
-    const char *p = strip_leading_slashes_const(abs_path);
-    if (!p || *p == '\0') return -(int)ENOENT;
-    int idx = ramdir_find(p);
-    if (idx < 0) return -(int)ENOENT;
-    g_ramdirs[idx].mode = new_mode;
+    /* The root is not an overlay ramdir. */
+    vfs_dentry_t *d = d_walk_positive(abs_path);
+    if (!d || d->kind != DENTRY_RAMDIR) return -(int)ENOENT;
+    d->mode = new_mode;
     return 0;
 }
 
-int vfs_ramfile_get(uint32_t id, uint8_t **out_data, uint64_t *out_size, uint64_t *out_cap, uint32_t *out_mode) {
+int vfs_ramfile_get(uint32_t id, uint64_t *out_size, uint64_t *out_pages, uint32_t *out_mode) {
     if (id >= (uint32_t)MAX_RAMFILES) return -(int)EINVAL;
-    if (!g_ramfiles[id].used) return -(int)ENOENT;
-
-    uint32_t inode_id = g_ramfiles[id].inode_id;
-    if (inode_id >= (uint32_t)MAX_RAMINODES) return -(int)ENOENT;
-    if (!g_raminodes[inode_id].used) return -(int)ENOENT;
-    if (out_data) *out_data = g_raminodes[inode_id].data;
-    if (out_size) *out_size = g_raminodes[inode_id].size;
-    if (out_cap) *out_cap = (uint64_t)RAMFILE_CAP;
-    if (out_mode) *out_mode = g_raminodes[inode_id].mode;
+    raminode_t *ino = ramfile_inode(id);
+    if (!ino) return -(int)ENOENT;
+    if (out_size) *out_size = ino->size;
+    if (out_pages) *out_pages = ino->pages;
+    if (out_mode) *out_mode = ino->mode;
     return 0;
 }
 
 int vfs_ramfile_set_size(uint32_t id, uint64_t new_size) {
     if (id >= (uint32_t)MAX_RAMFILES) return -(int)EINVAL;
-    if (!g_ramfiles[id].used) return -(int)ENOENT;
-    if (new_size > (uint64_t)RAMFILE_CAP) return -(int)EINVAL;
+    if (new_size > RAMFILE_MAX_PAGES * RAMFILE_PAGE) return -(int)EFBIG;
+    raminode_t *ino = ramfile_inode(id);
+    if (!ino) return -(int)ENOENT;
+    if (new_size < ino->size) {
+        /* Free what lies past the new end; the rest of its page reads as
+         * zeros if the file grows again.
+         */
+        if (new_size % RAMFILE_PAGE != 0) {
+            ram_zero(ino, new_size, RAMFILE_PAGE - new_size % RAMFILE_PAGE);
+        }
+        rt_free(ino, &ino->root, ino->height, 0, (new_size + RAMFILE_PAGE - 1u) / RAMFILE_PAGE, RAMFILE_MAX_PAGES);
+        rt_shrink(ino);
+    }
+    /* Growing leaves a hole. */
+    ino->size = new_size;
+    return 0;
+}
+
+int64_t vfs_ramfile_read_span(uint32_t id, uint64_t off, const uint8_t **out) {
+    raminode_t *ino = ramfile_inode(id);
+    if (!ino) return -(int)ENOENT;
+    if (off >= ino->size) return 0;
+
+    uint64_t in_page = off % RAMFILE_PAGE;
+    uint64_t n = RAMFILE_PAGE - in_page;
+    if (n > ino->size - off) n = ino->size - off;
+    uint64_t pa = ram_page(ino, off / RAMFILE_PAGE, 0);
+    *out = (pa ? (const uint8_t *)rt_node(pa) : g_zero_page) + in_page;
+    return (int64_t)n;
+}
+
+int64_t vfs_ramfile_write_span(uint32_t id, uint64_t off, uint8_t **out) {
+    raminode_t *ino = ramfile_inode(id);
+    if (!ino) return -(int)ENOENT;
+    if (off / RAMFILE_PAGE >= RAMFILE_MAX_PAGES) return -(int)EFBIG;
+
+    uint64_t pa = ram_page(ino, off / RAMFILE_PAGE, 1);
+    if (pa == 0) return -(int)ENOMEM;
+    *out = (uint8_t *)rt_node(pa) + off % RAMFILE_PAGE;
+    return (int64_t)(RAMFILE_PAGE - off % RAMFILE_PAGE);
+}
+
+uint64_t vfs_ramfile_page(uint32_t id, uint64_t idx) {
+    raminode_t *ino = ramfile_inode(id);
+    if (!ino || idx * RAMFILE_PAGE >= ino->size) return 0;
+    return ram_page(ino, idx, 0);
+}
+
+int vfs_ramfile_allocate(uint32_t id, uint64_t off, uint64_t len, int keep_size) {
+    raminode_t *ino = ramfile_inode(id);
+    if (!ino) return -(int)ENOENT;
+    uint64_t end = off + len;
+    if (end < off || end > RAMFILE_MAX_PAGES * RAMFILE_PAGE) return -(int)EFBIG;
+
+    for (uint64_t idx = off / RAMFILE_PAGE; idx * RAMFILE_PAGE < end; idx++) {
+        if (ram_page(ino, idx, 1) == 0) return -(int)ENOSPC;
+    }
+    if (!keep_size && end > ino->size) ino->size = end;
+    return 0;
+}
 
-    uint32_t inode_id = g_ramfiles[id].inode_id;
-    if (inode_id >= (uint32_t)MAX_RAMINODES) return -(int)ENOENT;
-    if (!g_raminodes[inode_id].used) return -(int)ENOENT;
-    g_raminodes[inode_id].size = new_size;
+int vfs_ramfile_punch(uint32_t id, uint64_t off, uint64_t len) {
+    raminode_t *ino = ramfile_inode(id);
+    if (!ino) return -(int)ENOENT;
+    if (off >= ino->size) return 0;
+    /* Past the size everything is a hole already. */
+    if (len > ino->size - off) len = ino->size - off;
+    ram_punch(ino, off, len);
     return 0;
 }
@@ -0,0 +1,594 @@
+#include "vm.h"
+
+#include "cache.h"
+#include "errno.h"
+#include "pmm.h"
+#include "slab.h"
+#include "string.h"
+
+/* Span of one L3 table: if it is missing, nothing in the span is mapped. */
+#define VM_L3_SPAN 0x200000ull
+
+/* Pages zeroed ahead of time by idle cores (vm_zero_pool_refill()). */
+#define VM_ZERO_POOL 32u
+
+static kmem_cache_t *g_vma_cache;
+static uint64_t g_zero_pool[VM_ZERO_POOL];
+static uint32_t g_zero_count;
+
+static inline uint64_t page_down(uint64_t v) {
+    return v & ~(VM_PAGE_SIZE - 1ull);
+}
+
+static inline uint64_t l3_span_next(uint64_t va) {
+    return (va & ~(VM_L3_SPAN - 1ull)) + VM_L3_SPAN;
+}
+
+/* May others see writes to the page behind pte? Then it must be copied. */
+static int pte_shared(uint64_t pte) {
+    return (pte & MMU_PTE_NOREF) != 0 || pmm_page_refs(mmu_pte_pa(pte)) > 1;
+}
+
+static void page_zero(uint64_t pa) {
+    /* Identity-mapped: the kernel reaches every page at VA==PA. */
+    memset((void *)(uintptr_t)pa, 0, VM_PAGE_SIZE);
+}
+
+static void page_copy(uint64_t dst_pa, uint64_t src_pa) {
+    memcpy((void *)(uintptr_t)dst_pa, (const void *)(uintptr_t)src_pa, VM_PAGE_SIZE);
+}
+
+/* A zero-filled page for a demand-zero fault: from the pool if possible, so
+ * the fault itself only has to map it.
+ */
+static uint64_t zero_page_alloc(void) {
+    if (g_zero_count > 0) {
+        return g_zero_pool[--g_zero_count];
+    }
+    uint64_t pa = pmm_alloc_page();
+    if (pa != 0) {
+        page_zero(pa);
+    }
+    return pa;
+}
+
+int vm_zero_pool_refill(void) {
+    if (g_zero_count >= VM_ZERO_POOL) return 0;
+    uint64_t pa = pmm_alloc_page();
+    if (pa == 0) return 0;
+    page_zero(pa);
+    g_zero_pool[g_zero_count++] = pa;
+    return 1;
+}
+
+void vm_init(void) {
+    if (!g_vma_cache) {
+        g_vma_cache = kmem_cache_create("vma", sizeof(vma_t), 0, 0);
+    }
+}
+
+static vma_t *vma_alloc(uint64_t start, uint64_t end, uint32_t prot, uint32_t flags) {
+    vma_t *v = (vma_t *)kmem_cache_alloc(g_vma_cache);
+    if (!v) return 0;
+    v->next = 0;
+    v->start = start;
+    v->end = end;
+    v->prot = prot;
+    v->flags = flags;
+    return v;
+}
+
+int vm_space_init(vm_space_t *vm) {
+    vm->asid = 0;
+    vm->vmas = 0;
+    vm->pages = 0;
+    vm->ttbr0_pa = mmu_ttbr0_create();
+    return (vm->ttbr0_pa != 0) ? 0 : -(int)ENOMEM;
+}
+
+/* Free the committed pages of [start, end). */
+static void vm_zap(vm_space_t *vm, uint64_t start, uint64_t end) {
+    uint64_t va = start;
+    while (va < end) {
+        uint64_t *pte = mmu_user_pte(vm->ttbr0_pa, va, 0);
+        if (!pte) {
+            va = l3_span_next(va);
+            continue;
+        }
+        if (mmu_pte_valid(*pte)) {
+            uint64_t old = *pte;
+            mmu_user_pte_clear(pte, va, vm->asid);
+            if ((old & MMU_PTE_NOREF) == 0) {
+                pmm_page_put(mmu_pte_pa(old));
+            }
+            vm->pages--;
+        }
+        va += VM_PAGE_SIZE;
+    }
+}
+
+void vm_space_destroy(vm_space_t *vm) {
+    vma_t *v = vm->vmas;
+    while (v) {
+        vma_t *next = v->next;
+        if (vm->ttbr0_pa != 0) {
+            vm_zap(vm, v->start, v->end);
+        }
+        kmem_cache_free(g_vma_cache, v);
+        v = next;
+    }
+    mmu_ttbr0_destroy(vm->ttbr0_pa);
+    vm->ttbr0_pa = 0;
+    vm->vmas = 0;
+    vm->pages = 0;
+}
+
+/* Make sure the page at va (inside v) is backed and return its address. */
+static int vm_commit(vm_space_t *vm, const vma_t *v, uint64_t va, uint64_t *pa_out) {
+    uint64_t *pte = mmu_user_pte(vm->ttbr0_pa, va, 1);
+    if (!pte) return -(int)ENOMEM;
+    if (mmu_pte_valid(*pte)) {
+        *pa_out = mmu_pte_pa(*pte);
+        return 0;
+    }
+
+    uint64_t pa = zero_page_alloc();
+    if (pa == 0) return -(int)ENOMEM;
+    if ((v->prot & MMU_PROT_EXEC) != 0) {
+        /* The I-cache may still hold the page's previous contents. */
+        cache_sync_icache_for_range(pa, VM_PAGE_SIZE);
+    }
+    mmu_user_pte_set(pte, mmu_user_page_desc(pa, v->prot));
+    vm->pages++;
+    *pa_out = pa;
+    return 0;
+}
+
+/* Write to a page that is mapped read-only because it may be shared since
+ * fork: take a private copy, or just write access if no one else maps it
+ * any more.
+ */
+static int vm_cow(vm_space_t *vm, const vma_t *v, uint64_t va, uint64_t *pte, uint64_t *pa_out) {
+    uint64_t desc = *pte;
+    uint64_t old = mmu_pte_pa(desc);
+    if (!pte_shared(desc)) {
+        mmu_user_pte_update(pte, mmu_user_page_desc(old, v->prot), va, vm->asid);
+        *pa_out = old;
+        return 0;
+    }
+
+    uint64_t pa = pmm_alloc_page();
+    if (pa == 0) return -(int)ENOMEM;
+    page_copy(pa, old);
+    if ((v->prot & MMU_PROT_EXEC) != 0) {
+        cache_sync_icache_for_range(pa, VM_PAGE_SIZE);
+    }
+    /* Another page behind the same va: break before make. */
+    mmu_user_pte_clear(pte, va, vm->asid);
+    mmu_user_pte_set(pte, mmu_user_page_desc(pa, v->prot));
+    if ((desc & MMU_PTE_NOREF) == 0) {
+        pmm_page_put(old);
+    }
+    *pa_out = pa;
+    return 0;
+}
+
+int vm_space_copy(vm_space_t *dst, vm_space_t *src) {
+    int rc = vm_space_init(dst);
+    if (rc != 0) return rc;
+
+    vma_t **tail = &dst->vmas;
+    for (const vma_t *v = src->vmas; v; v = v->next) {
+        vma_t *nv = vma_alloc(v->start, v->end, v->prot, v->flags);
+        if (!nv) {
+            rc = -(int)ENOMEM;
+            break;
+        }
+        *tail = nv;
+        tail = &nv->next;
+
+        /* Share what the parent committed, read-only on both sides until
+         * one of them writes (vm_cow()).
+         */
+        uint32_t share_prot = v->prot & ~(uint32_t)MMU_PROT_WRITE;
+        uint64_t va = v->start;
+        while (va < v->end) {
+            uint64_t *spte = mmu_user_pte(src->ttbr0_pa, va, 0);
+            if (!spte) {
+                va = l3_span_next(va);
+                continue;
+            }
+            if (mmu_pte_valid(*spte)) {
+                uint64_t *dpte = mmu_user_pte(dst->ttbr0_pa, va, 1);
+                if (!dpte) {
+                    rc = -(int)ENOMEM;
+                    break;
+                }
+                uint64_t pa = mmu_pte_pa(*spte);
+                uint64_t noref = *spte & MMU_PTE_NOREF;
+                uint64_t desc = mmu_user_page_desc(pa, share_prot) | noref;
+                if (share_prot != v->prot) {
+                    mmu_user_pte_update(spte, desc, va, 0);
+                }
+                if (!noref) {
+                    pmm_page_get(pa);
+                }
+                mmu_user_pte_set(dpte, desc);
+                dst->pages++;
+            }
+            va += VM_PAGE_SIZE;
+        }
+        if (rc != 0) break;
+    }
+
+    /* The parent may still have writable entries for its pages cached. */
+    mmu_asid_flush(src->asid);
+
+    if (rc != 0) {
+        vm_space_destroy(dst);
+    }
+    return rc;
+}
+
+uint64_t vm_space_size(const vm_space_t *vm) {
+    uint64_t bytes = 0;
+    for (const vma_t *v = vm->vmas; v; v = v->next) {
+        bytes += v->end - v->start;
+    }
+    return bytes;
+}
+
+vma_t *vm_find(const vm_space_t *vm, uint64_t va) {
+    for (vma_t *v = vm->vmas; v; v = v->next) {
+        if (va < v->start) break;
+        if (va < v->end) return v;
+    }
+    return 0;
+}
+
+int vm_range_ok(const vm_space_t *vm, uint64_t va, uint64_t len) {
+    return vm_range_prot_ok(vm, va, len, MMU_PROT_READ);
+}
+
+int vm_range_prot_ok(const vm_space_t *vm, uint64_t va, uint64_t len, uint32_t prot) {
+    if (len == 0) return 1;
+    uint64_t end = va + len;
+    if (end < va) return 0; /* overflow */
+
+    for (const vma_t *v = vm->vmas; v; v = v->next) {
+        if (v->end <= va) continue;
+        if (v->start > va || (v->prot & prot) != prot) return 0;
+        if (v->end >= end) return 1;
+        /* Continues only if the next VMA starts right here. */
+        va = v->end;
+    }
+    return 0;
+}
+
+int vm_map(vm_space_t *vm, uint64_t start, uint64_t len, uint32_t prot, uint32_t flags) {
+    uint64_t end = start + len;
+    if (len == 0 || ((start | len) & (VM_PAGE_SIZE - 1ull)) != 0 || end < start) {
+        return -(int)EINVAL;
+    }
+    if (start < USER_REGION_BASE || end > USER_REGION_BASE + USER_REGION_SIZE) {
+        return -(int)EINVAL;
+    }
+
+    vma_t *prev = 0;
+    vma_t *next = vm->vmas;
+    while (next && next->start < start) {
+        prev = next;
+        next = next->next;
+    }
+    if ((prev && prev->end > start) || (next && next->start < end)) {
+        return -(int)EINVAL;
+    }
+
+    int join_prev = prev && prev->end == start && prev->prot == prot && prev->flags == flags;
+    int join_next = next && next->start == end && next->prot == prot && next->flags == flags;
+    if (join_prev && join_next) {
+        prev->end = next->end;
+        prev->next = next->next;
+        kmem_cache_free(g_vma_cache, next);
+    } else if (join_prev) {
+        prev->end = end;
+    } else if (join_next) {
+        next->start = start;
+    } else {
+        vma_t *v = vma_alloc(start, end, prot, flags);
+        if (!v) return -(int)ENOMEM;
+        v->next = next;
+        if (prev) prev->next = v;
+        else vm->vmas = v;
+    }
+    return 0;
+}
+
+int vm_unmap(vm_space_t *vm, uint64_t start, uint64_t len) {
+    uint64_t end = start + len;
+    if (end < start) return -(int)EINVAL;
+
+    /* Punching a hole splits a VMA: get the second half up front so
+     * failure leaves everything as it was.
+     */
+    vma_t *spare = 0;
+    for (vma_t *v = vm->vmas; v; v = v->next) {
+        if (v->start < start && v->end > end) {
+            spare = vma_alloc(end, v->end, v->prot, v->flags);
+            if (!spare) return -(int)ENOMEM;
+            break;
+        }
+    }
+
+    vma_t **link = &vm->vmas;
+    while (*link) {
+        vma_t *v = *link;
+        if (v->end <= start) {
+            link = &v->next;
+            continue;
+        }
+        if (v->start >= end) break;
+
+        uint64_t zs = (v->start > start) ? v->start : start;
+        uint64_t ze = (v->end < end) ? v->end : end;
+        vm_zap(vm, zs, ze);
+
+        if (v->start >= start && v->end <= end) {
+            *link = v->next;
+            kmem_cache_free(g_vma_cache, v);
+            continue;
+        }
+        if (v->start < start && v->end > end) {
+            spare->next = v->next;
+            v->end = start;
+            v->next = spare;
+            break;
+        }
+        if (v->start < start) {
+            v->end = start;
+            link = &v->next;
+            continue;
+        }
+        v->start = end;
+        break;
+    }
+    return 0;
+}
+
+int vm_discard(vm_space_t *vm, uint64_t start, uint64_t len) {
+    uint64_t end = start + len;
+    if (end < start) return -(int)EINVAL;
+
+    /* The whole range must be mapped, as for Linux madvise(). File
+     * mappings are refused: there is nothing to refill them from but zeros.
+     */
+    uint64_t va = start;
+    int file = 0;
+    for (const vma_t *v = vm->vmas; v && va < end; v = v->next) {
+        if (v->end <= va) continue;
+        if (v->start > va) break;
+        if ((v->flags & VMA_FILE) != 0) file = 1;
+        va = v->end;
+    }
+    if (va < end) return -(int)ENOMEM;
+    if (file) return -(int)EINVAL;
+
+    vm_zap(vm, start, end);
+    return 0;
+}
+
+/* Make va a VMA boundary, splitting the VMA around it if needed. The result
+ * maps the same pages either way. Returns 0 or -ENOMEM.
+ */
+static int vma_split_at(vm_space_t *vm, uint64_t va) {
+    vma_t *v = vm_find(vm, va);
+    if (!v || v->start == va) return 0;
+
+    vma_t *nv = vma_alloc(va, v->end, v->prot, v->flags);
+    if (!nv) return -(int)ENOMEM;
+    nv->next = v->next;
+    v->end = va;
+    v->next = nv;
+    return 0;
+}
+
+int vm_move(vm_space_t *vm, uint64_t old, uint64_t old_len, uint64_t new_start, uint64_t new_len) {
+    uint64_t old_end = old + old_len;
+    if (old_len == 0 || new_len < old_len || ((old | old_len | new_start | new_len) & (VM_PAGE_SIZE - 1ull)) != 0) {
+        return -(int)EINVAL;
+    }
+    const vma_t *v = vm_find(vm, old);
+    if (!v || old_end > v->end) return -(int)EINVAL;
+    uint32_t prot = v->prot;
+    uint32_t flags = v->flags;
+
+    /* Everything that can fail comes first: the old range becomes VMAs of
+     * its own (so dropping it later needs no allocation), then the tables
+     * behind the destination of each committed page.
+     */
+    int rc = vma_split_at(vm, old);
+    if (rc == 0) rc = vma_split_at(vm, old_end);
+    if (rc != 0) return rc;
+
+    uint64_t va = old;
+    while (va < old_end) {
+        uint64_t *pte = mmu_user_pte(vm->ttbr0_pa, va, 0);
+        if (!pte) {
+            va = l3_span_next(va);
+            continue;
+        }
+        if (mmu_pte_valid(*pte)) {
+            if (!mmu_user_pte(vm->ttbr0_pa, new_start + (va - old), 1)) return -(int)ENOMEM;
+        }
+        va += VM_PAGE_SIZE;
+    }
+    rc = vm_map(vm, new_start, new_len, prot, flags);
+    if (rc != 0) return rc;
+
+    /* Move the entries; the pages, their references and vm->pages stay as
+     * they are. The new entries were invalid, so only the old va's need
+     * their TLB entries dropped, once at the end.
+     */
+    va = old;
+    while (va < old_end) {
+        uint64_t *pte = mmu_user_pte(vm->ttbr0_pa, va, 0);
+        if (!pte) {
+            va = l3_span_next(va);
+            continue;
+        }
+        if (mmu_pte_valid(*pte)) {
+            uint64_t desc = *pte;
+            mmu_user_pte_clear(pte, va, 0);
+            mmu_user_pte_set(mmu_user_pte(vm->ttbr0_pa, new_start + (va - old), 0), desc);
+        }
+        va += VM_PAGE_SIZE;
+    }
+    mmu_asid_flush(vm->asid);
+
+    /* Nothing left to free, and no split needed any more. */
+    return vm_unmap(vm, old, old_len);
+}
+
+uint64_t vm_find_free(const vm_space_t *vm, uint64_t lo, uint64_t hi, uint64_t len) {
+    lo = page_down(lo + VM_PAGE_SIZE - 1ull);
+    hi = page_down(hi);
+    if (len == 0 || hi < lo || hi - lo < len) return 0;
+
+    uint64_t best = 0;
+    uint64_t gap_start = lo;
+    for (const vma_t *v = vm->vmas; v; v = v->next) {
+        uint64_t gap_end = (v->start < hi) ? v->start : hi;
+        if (gap_end > gap_start && gap_end - gap_start >= len) {
+            best = gap_end - len;
+        }
+        if (v->end > gap_start) gap_start = v->end;
+        if (gap_start >= hi) return best;
+    }
+    if (hi - gap_start >= len) {
+        best = hi - len;
+    }
+    return best;
+}
+
+int vm_fault(vm_space_t *vm, uint64_t va, uint32_t access) {
+    vma_t *v = vm_find(vm, va);
+    if (!v) return -(int)EFAULT;
+
+    uint32_t allowed = v->prot;
+    if ((allowed & MMU_PROT_WRITE) != 0) {
+        /* No write-only pages on AArch64. */
+        allowed |= MMU_PROT_READ;
+    }
+    if ((access & ~allowed) != 0) return -(int)EFAULT;
+
+    uint64_t page = page_down(va);
+    uint64_t pa = 0;
+    uint64_t *pte = mmu_user_pte(vm->ttbr0_pa, page, 0);
+    if (pte && mmu_pte_valid(*pte)) {
+        /* Present but the access was refused: an allowed write means the
+         * page is shared copy-on-write, anything else a permission fault.
+         */
+        if ((access & MMU_PROT_WRITE) == 0) return -(int)EFAULT;
+        return vm_cow(vm, v, page, pte, &pa);
+    }
+
+    return vm_commit(vm, v, page, &pa);
+}
+
+int vm_copy_to(vm_space_t *vm, uint64_t va, const void *src, uint64_t len) {
+    const uint8_t *s = (const uint8_t *)src;
+    while (len != 0) {
+        vma_t *v = vm_find(vm, va);
+        if (!v) return -(int)EFAULT;
+
+        uint64_t page = page_down(va);
+        uint64_t off = va - page;
+        uint64_t n = VM_PAGE_SIZE - off;
+        if (n > len) n = len;
+
+        uint64_t pa = 0;
+        int rc = vm_commit(vm, v, page, &pa);
+        if (rc == 0) {
+            /* Never write through to a page someone else still maps. */
+            uint64_t *pte = mmu_user_pte(vm->ttbr0_pa, page, 0);
+            if (pte_shared(*pte)) {
+                rc = vm_cow(vm, v, page, pte, &pa);
+            }
+        }
+        if (rc != 0) return rc;
+
+        memcpy((void *)(uintptr_t)(pa + off), s, n);
+        if ((v->prot & MMU_PROT_EXEC) != 0) {
+            cache_sync_icache_for_range(pa + off, n);
+        }
+
+        va += n;
+        s += n;
+        len -= n;
+    }
+    return 0;
+}
+
+int vm_map_data(vm_space_t *vm,
+                uint64_t start,
+                uint64_t len,
+                uint32_t prot,
+                const uint8_t *data,
+                uint64_t size,
+                int in_place) {
+    int rc = vm_map(vm, start, len, prot, VMA_FILE);
+    if (rc != 0) return rc;
+    if (size > len) size = len;
+
+    uint64_t va = start;
+    if (in_place && ((uintptr_t)data & (VM_PAGE_SIZE - 1ull)) == 0) {
+        /* Whole pages: map the data itself, read-only even in a writable
+         * mapping so the first write takes a private copy (vm_cow()).
+         */
+        uint32_t ro = prot & ~(uint32_t)MMU_PROT_WRITE;
+        while (size >= VM_PAGE_SIZE) {
+            uint64_t *pte = mmu_user_pte(vm->ttbr0_pa, va, 1);
+            if (!pte) {
+                rc = -(int)ENOMEM;
+                goto fail;
+            }
+            uint64_t pa = (uint64_t)(uintptr_t)data;
+            if ((prot & MMU_PROT_EXEC) != 0) {
+                cache_sync_icache_for_range(pa, VM_PAGE_SIZE);
+            }
+            mmu_user_pte_set(pte, mmu_user_page_desc(pa, ro) | MMU_PTE_NOREF);
+            vm->pages++;
+            va += VM_PAGE_SIZE;
+            data += VM_PAGE_SIZE;
+            size -= VM_PAGE_SIZE;
+        }
+    }
+
+    /* The rest (a partial last page must read as zeros beyond the data). */
+    if (size != 0) {
+        rc = vm_copy_to(vm, va, data, size);
+        if (rc != 0) goto fail;
+    }
+    return 0;
+
+fail:
+    (void)vm_unmap(vm, start, len);
+    return rc;
+}
+
+int vm_map_page(vm_space_t *vm, uint64_t va, uint64_t pa) {
+    const vma_t *v = vm_find(vm, va);
+    if (!v || (va & (VM_PAGE_SIZE - 1ull)) != 0) return -(int)EINVAL;
+    uint64_t *pte = mmu_user_pte(vm->ttbr0_pa, va, 1);
+    if (!pte) return -(int)ENOMEM;
+    if (mmu_pte_valid(*pte)) return -(int)EINVAL;
+
+    /* Read-only until the first write takes a private copy (vm_cow()). */
+    pmm_page_get(pa);
+    if ((v->prot & MMU_PROT_EXEC) != 0) {
+        cache_sync_icache_for_range(pa, VM_PAGE_SIZE);
+    }
+    mmu_user_pte_set(pte, mmu_user_page_desc(pa, v->prot & ~(uint32_t)MMU_PROT_WRITE));
+    vm->pages++;
+    return 0;
+}
@@ -0,0 +1,71 @@
+#include "wait.h"
+
+#include "proc.h"
+#include "time.h"
+
+void waitq_init(waitq_t *q) {
+    q->head = -1;
+    q->tail = -1;
+}
+
+static void waitq_append(waitq_t *q, proc_t *p) {
+    int16_t idx = (int16_t)proc_idx(p);
+    p->wait.q = q;
+    p->wait.prev = q->tail;
+    p->wait.next = -1;
+    if (q->tail >= 0) g_procs[q->tail].wait.next = idx;
+    else q->head = idx;
+    q->tail = idx;
+}
+
+void wait_dequeue(proc_t *p) {
+    waitq_t *q = p->wait.q;
+    if (!q) return;
+
+    if (p->wait.prev >= 0) g_procs[p->wait.prev].wait.next = p->wait.next;
+    else q->head = p->wait.next;
+    if (p->wait.next >= 0) g_procs[p->wait.next].wait.prev = p->wait.prev;
+    else q->tail = p->wait.prev;
+
+    p->wait.q = 0;
+    p->wait.prev = -1;
+    p->wait.next = -1;
+}
+
+static void wait_wake(proc_t *p) {
+    if (proc_state_is_blocked(p->state)) {
+        /* Leaving the blocked state unlinks the task (see proc_set_state). */
+        proc_set_state(p, PROC_RUNNABLE);
+    } else {
+        wait_dequeue(p);
+    }
+}
+
+uint32_t waitq_wake_one(waitq_t *q) {
+    if (!q || q->head < 0) return 0;
+    wait_wake(&g_procs[q->head]);
+    return 1;
+}
+
+uint32_t waitq_wake_all(waitq_t *q) {
+    uint32_t n = 0;
+    while (q && q->head >= 0) {
+        wait_wake(&g_procs[q->head]);
+        n++;
+    }
+    return n;
+}
+
+void wait_block(proc_t *p, int state, waitq_t *q, uint64_t deadline_ns) {
+    wait_dequeue(p);
+    p->wait.deadline_ns = deadline_ns;
+    if (q) waitq_append(q, p);
+    /* Entering the state arms the deadline timer. */
+    proc_set_state(p, (proc_state_t)state);
+}
+
+int wait_timed_out(const proc_t *p) {
+    if (p->wait.deadline_ns == 0) return 0;
+    uint64_t now = time_now_ns();
+    return now != 0 && now >= p->wait.deadline_ns;
+}
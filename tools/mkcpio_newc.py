@@ -10,14 +10,24 @@ def to_hex8(x: int) -> bytes:
     return f"{x:08x}".encode("ascii")
 
 
+PAGE_SIZE = 4096
+
+
 def pad4(n: int) -> int:
     return (4 - (n & 3)) & 3
 
 
-def write_newc_entry(out, name: str, data: bytes, mode: int):
-    namesz = len(name) + 1
+def write_newc_entry(out, name: str, data: bytes, mode: int, page_align: bool = False):
+    namesz = len(name.encode("utf-8")) + 1
     filesize = len(data)
 
+    if page_align and filesize != 0:
+        # Start the file data on a page boundary (the kernel maps it into
+        # processes in place) by padding the name with NULs; readers stop at
+        # the first NUL and skip namesize bytes.
+        data_off = out.tell() + 110 + namesz
+        namesz += (PAGE_SIZE - (data_off % PAGE_SIZE)) % PAGE_SIZE
+
     header = b"".join(
         [
             b"070701",  # c_magic
@@ -39,7 +49,8 @@ def write_newc_entry(out, name: str, data: bytes, mode: int):
 
     assert len(header) == 110
     out.write(header)
-    out.write(name.encode("utf-8") + b"\x00")
+    name_bytes = name.encode("utf-8")
+    out.write(name_bytes + b"\x00" * (namesz - len(name_bytes)))
     out.write(b"\x00" * pad4(110 + namesz))
 
     out.write(data)
@@ -71,7 +82,7 @@ def build_from_dir(root: Path, out_path: Path):
 
     with out_path.open("wb") as out:
         for name, data, mode in files:
-            write_newc_entry(out, name, data, mode)
+            write_newc_entry(out, name, data, mode, page_align=stat.S_ISREG(mode))
         write_newc_entry(out, "TRAILER!!!", b"", stat.S_IFREG | 0)
 
 
@@ -0,0 +1,72 @@
+#pragma once
+
+#include "syscall.h"
+
+/*
+ * Tiny allocator for programs that grow a few large buffers (file contents,
+ * line tables). Every block is an anonymous mapping of its own with a small
+ * header in front; mem_realloc() grows it with mremap(MREMAP_MAYMOVE), which
+ * extends the mapping in place or moves its pages without copying them, so
+ * growing a buffer to N bytes costs O(N) however often it is resized.
+ *
+ * Page-granular: not meant for many small objects.
+ */
+
+enum {
+    MEM_PAGE = 4096,
+    MEM_MREMAP_MAYMOVE = 1,
+};
+
+typedef struct {
+    uint64_t map_len; /* bytes mapped, header included */
+    uint64_t pad;     /* keep the payload 16-byte aligned */
+} mem_hdr_t;
+
+static inline uint64_t mem_map_len(uint64_t size) {
+    uint64_t need = size + (uint64_t)sizeof(mem_hdr_t);
+    if (need < size) return 0;
+    return (need + MEM_PAGE - 1u) & ~(uint64_t)(MEM_PAGE - 1u);
+}
+
+static inline void *mem_alloc(uint64_t size) {
+    uint64_t len = mem_map_len(size);
+    if (len == 0) return 0;
+    uint64_t p = sys_mmap(0, len, 0x1 /* PROT_READ */ | 0x2 /* PROT_WRITE */,
+                          0x02 /* MAP_PRIVATE */ | 0x20 /* MAP_ANONYMOUS */, -1, 0);
+    if ((int64_t)p < 0) return 0;
+    mem_hdr_t *h = (mem_hdr_t *)(uintptr_t)p;
+    h->map_len = len;
+    return h + 1;
+}
+
+/* Usable bytes of a block: at least what was asked for. */
+static inline uint64_t mem_size(const void *ptr) {
+    return ((const mem_hdr_t *)ptr - 1)->map_len - (uint64_t)sizeof(mem_hdr_t);
+}
+
+static inline void mem_free(void *ptr) {
+    if (!ptr) return;
+    mem_hdr_t *h = (mem_hdr_t *)ptr - 1;
+    (void)sys_munmap(h, h->map_len);
+}
+
+/* Resize to at least size bytes, keeping the contents. Grows by half again
+ * at a time so that appending a byte at a time does not mean a syscall per
+ * page. Returns the (possibly moved) block, or 0 with ptr left untouched.
+ */
+static inline void *mem_realloc(void *ptr, uint64_t size) {
+    if (!ptr) return mem_alloc(size);
+
+    mem_hdr_t *h = (mem_hdr_t *)ptr - 1;
+    uint64_t len = mem_map_len(size);
+    if (len == 0) return 0;
+    if (len <= h->map_len) return ptr;
+
+    uint64_t grown = mem_map_len(h->map_len + h->map_len / 2u);
+    if (grown > len) len = grown;
+    uint64_t p = sys_mremap(h, h->map_len, len, MEM_MREMAP_MAYMOVE);
+    if ((int64_t)p < 0) return 0;
+    h = (mem_hdr_t *)(uintptr_t)p;
+    h->map_len = len;
+    return h + 1;
+}
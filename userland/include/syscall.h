@@ -47,6 +47,42 @@ typedef struct {
     int64_t __glibc_reserved[3];
 } linux_stat_t;
 
+typedef struct {
+    int64_t tv_sec;
+    int64_t tv_usec;
+} linux_timeval_t;
+
+typedef struct {
+    linux_timeval_t ru_utime;
+    linux_timeval_t ru_stime;
+    int64_t ru_maxrss; /* KiB */
+    int64_t ru_ixrss;
+    int64_t ru_idrss;
+    int64_t ru_isrss;
+    int64_t ru_minflt;
+    int64_t ru_majflt;
+    int64_t ru_nswap;
+    int64_t ru_inblock;
+    int64_t ru_oublock;
+    int64_t ru_msgsnd;
+    int64_t ru_msgrcv;
+    int64_t ru_nsignals;
+    int64_t ru_nvcsw;
+    int64_t ru_nivcsw;
+} linux_rusage_t;
+
+enum {
+    RUSAGE_SELF = 0,
+    RUSAGE_CHILDREN = -1,
+};
+
+typedef struct {
+    int64_t tms_utime;
+    int64_t tms_stime;
+    int64_t tms_cutime;
+    int64_t tms_cstime;
+} linux_tms_t;
+
 enum { LINUX_UTSNAME_LEN = 65 };
 
 typedef struct {
@@ -94,6 +130,15 @@ static inline uint64_t sys_clock_gettime(uint64_t clockid, linux_timespec_t *tp)
     return __syscall2(__NR_clock_gettime, clockid, (uint64_t)(uintptr_t)tp);
 }
 
+static inline uint64_t sys_getrusage(int64_t who, linux_rusage_t *usage) {
+    return __syscall2(__NR_getrusage, (uint64_t)who, (uint64_t)(uintptr_t)usage);
+}
+
+/* Returns clock ticks (100 Hz) since boot. */
+static inline uint64_t sys_times(linux_tms_t *buf) {
+    return __syscall1(__NR_times, (uint64_t)(uintptr_t)buf);
+}
+
 static inline uint64_t sys_brk(void *addr) {
     return __syscall1(__NR_brk, (uint64_t)(uintptr_t)addr);
 }
@@ -162,6 +207,14 @@ static inline uint64_t sys_munmap(void *addr, uint64_t len) {
     return __syscall2(__NR_munmap, (uint64_t)(uintptr_t)addr, len);
 }
 
+static inline uint64_t sys_mremap(void *old_addr, uint64_t old_len, uint64_t new_len, uint64_t flags) {
+    return __syscall5(__NR_mremap, (uint64_t)(uintptr_t)old_addr, old_len, new_len, flags, 0);
+}
+
+static inline uint64_t sys_madvise(void *addr, uint64_t len, uint64_t advice) {
+    return __syscall3(__NR_madvise, (uint64_t)(uintptr_t)addr, len, advice);
+}
+
 static inline uint64_t sys_openat(uint64_t dirfd, const char *pathname, uint64_t flags, uint64_t mode) {
     return __syscall4_upuu(__NR_openat, dirfd, pathname, flags, mode);
 }
@@ -204,6 +257,15 @@ static inline uint64_t sys_dup2(uint64_t oldfd, uint64_t newfd) {
     return sys_dup3(oldfd, newfd, 0);
 }
 
+enum {
+    F_SETPIPE_SZ = 1031,
+    F_GETPIPE_SZ = 1032,
+};
+
+static inline uint64_t sys_fcntl(uint64_t fd, uint64_t cmd, uint64_t arg) {
+    return __syscall3(__NR_fcntl, fd, cmd, arg);
+}
+
 static inline uint64_t sys_pipe2(int pipefd[2], uint64_t flags) {
     return __syscall2(__NR_pipe2, (uint64_t)(uintptr_t)pipefd, flags);
 }
@@ -220,6 +282,26 @@ static inline uint64_t sys_lseek(uint64_t fd, int64_t offset, uint64_t whence) {
     return __syscall3(__NR_lseek, fd, (uint64_t)offset, whence);
 }
 
+static inline uint64_t sys_truncate(const char *path, int64_t length) {
+    return __syscall2(__NR_truncate, (uint64_t)(uintptr_t)path, (uint64_t)length);
+}
+
+static inline uint64_t sys_ftruncate(uint64_t fd, int64_t length) {
+    return __syscall2(__NR_ftruncate, fd, (uint64_t)length);
+}
+
+static inline uint64_t sys_fallocate(uint64_t fd, uint64_t mode, int64_t off, int64_t len) {
+    return __syscall4(__NR_fallocate, fd, mode, (uint64_t)off, (uint64_t)len);
+}
+
+static inline uint64_t sys_fsync(uint64_t fd) {
+    return __syscall1(__NR_fsync, fd);
+}
+
+static inline uint64_t sys_sync(void) {
+    return __syscall0(__NR_sync);
+}
+
 static inline uint64_t sys_newfstatat(uint64_t dirfd, const char *pathname, void *statbuf, uint64_t flags) {
     return __syscall4_uppu(__NR_newfstatat, dirfd, pathname, statbuf, flags);
 }
@@ -255,6 +337,14 @@ static inline uint64_t sys_fork(void) {
     return sys_clone(17, 0, 0, 0, 0);
 }
 
+/* clone(CLONE_VM | CLONE_VFORK | SIGCHLD): the child runs on our address
+ * space (and stack) while we are suspended, so it may only call execve or
+ * exit. Prefer sys_mona_spawn().
+ */
+static inline uint64_t sys_vfork(void) {
+    return sys_clone(0x4000ull | 0x100ull | 17, 0, 0, 0, 0);
+}
+
 static inline uint64_t sys_write(uint64_t fd, const void *buf, uint64_t len) {
     return __syscall3_p(__NR_write, fd, (void *)buf, len);
 }
@@ -352,6 +442,35 @@ static inline uint64_t sys_mona_tcp6_recv(uint64_t fd, void *buf, uint64_t len,
                       timeout_ms);
 }
 
+/* mona-specific: posix_spawn-like fork+exec. The child starts as a fresh
+ * image of pathname with our fds, edited by the actions in order; errors
+ * such as ENOENT come back from this call. Returns the child's pid.
+ */
+enum {
+    MONA_SPAWN_DUP2 = 1,  /* dup2(fd, newfd) */
+    MONA_SPAWN_CLOSE = 2, /* close(fd) */
+    MONA_SPAWN_MAX_ACTIONS = 16,
+};
+
+typedef struct {
+    uint64_t op;
+    uint64_t fd;
+    uint64_t newfd;
+} mona_spawn_action_t;
+
+static inline uint64_t sys_mona_spawn(const char *pathname,
+                                      const char *const *argv,
+                                      const char *const *envp,
+                                      const mona_spawn_action_t *actions,
+                                      uint64_t nactions) {
+    return __syscall5(__NR_mona_spawn,
+                      (uint64_t)(uintptr_t)pathname,
+                      (uint64_t)(uintptr_t)argv,
+                      (uint64_t)(uintptr_t)envp,
+                      (uint64_t)(uintptr_t)actions,
+                      nactions);
+}
+
 __attribute__((noreturn)) static inline void sys_exit_group(uint64_t status) {
     (void)__syscall1(__NR_exit_group, status);
     for (;;) { }
@@ -353,7 +353,6 @@ static int awk_fd(uint64_t fd, const awk_prog_t *p) {
         long nread = (long)sys_read(fd, rbuf, sizeof(rbuf));
         if (nread == 0) break;
         if (nread < 0) {
-            if (nread == -11) continue; /* EAGAIN */
             return -1;
         }
 
@@ -12,10 +12,6 @@ int main(int argc, char **argv, char **envp) {
             long n = (long)sys_read(0, buf, sizeof(buf));
             if (n == 0) break;
             if (n < 0) {
-                /* EAGAIN (11) => retry (used for pipes). */
-                if (n == -11) {
-                    continue;
-                }
                 sys_puts("cat: read failed\n");
                 return 1;
             }
@@ -56,8 +56,6 @@ static int write_all(uint64_t fd, const char *buf, uint64_t len) {
     while (off < len) {
         long rc = (long)sys_write(fd, buf + off, len - off);
         if (rc < 0) {
-            /* EAGAIN (11) => retry (pipes). */
-            if (rc == -11) continue;
             return -1;
         }
         if (rc == 0) return -1;
@@ -181,7 +179,6 @@ static int cp_one(const char *src, const char *dst) {
         long n = (long)sys_read(in_fd, buf, sizeof(buf));
         if (n == 0) break;
         if (n < 0) {
-            if (n == -11) continue;
             sys_puts("cp: read failed rc=");
             write_i64_dec_local((int64_t)n);
             sys_puts("\n");
@@ -196,7 +196,6 @@ static int cut_fd(uint64_t fd,
         long nread = (long)sys_read(fd, rbuf, sizeof(rbuf));
         if (nread == 0) break;
         if (nread < 0) {
-            if (nread == -11) continue; /* EAGAIN */
             return -1;
         }
 
@@ -1,3 +1,4 @@
+#include "alloc.h"
 #include "syscall.h"
 
 #define AT_FDCWD ((long)-100)
@@ -108,23 +109,11 @@ static int buf_reserve(buf_t *b, uint64_t need_cap) {
     if (!b) return -1;
     if (need_cap <= b->cap) return 0;
 
-    uint64_t new_cap = (b->cap == 0) ? 4096u : b->cap;
-    while (new_cap < need_cap) {
-        if (new_cap > (1ull << 31)) return -1;
-        new_cap *= 2u;
-    }
-
-    uint64_t newp_u = sys_mmap(0, new_cap, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
-    if ((int64_t)newp_u < 0) return -1;
-    char *newp = (char *)(uintptr_t)newp_u;
-
-    for (uint64_t i = 0; i < b->len; i++) newp[i] = b->p[i];
-
-    if (b->p && b->cap) {
-        (void)sys_munmap(b->p, b->cap);
-    }
+    /* mem_realloc() grows without copying what was read so far. */
+    char *newp = (char *)mem_realloc(b->p, need_cap);
+    if (!newp) return -1;
     b->p = newp;
-    b->cap = new_cap;
+    b->cap = mem_size(newp);
     return 0;
 }
 
@@ -134,22 +123,17 @@ static int read_all(uint64_t fd, buf_t *out) {
     out->len = 0;
     out->cap = 0;
 
-    char tmp[512];
     for (;;) {
-        long n = (long)sys_read(fd, tmp, sizeof(tmp));
+        /* Read straight into the buffer, keeping room for the NUL. */
+        if (buf_reserve(out, out->len + 4096u + 1u) != 0) return -1;
+        long n = (long)sys_read(fd, out->p + out->len, out->cap - out->len - 1u);
         if (n < 0) {
-            if (n == -11) continue; /* EAGAIN */
             return -1;
         }
         if (n == 0) break;
-
-        if (buf_reserve(out, out->len + (uint64_t)n + 1) != 0) return -1;
-        for (long i = 0; i < n; i++) {
-            out->p[out->len++] = tmp[i];
-        }
+        out->len += (uint64_t)n;
     }
 
-    if (buf_reserve(out, out->len + 1) != 0) return -1;
     out->p[out->len] = '\0';
     return 0;
 }
@@ -394,7 +378,6 @@ static int diff_files(const char *a, const char *b, int opt_q, int opt_s) {
         if (ia == na) {
             long r = (long)sys_read((uint64_t)fda, bufa, sizeof(bufa));
             if (r < 0) {
-                if (r == -11) continue; /* EAGAIN */
                 (void)sys_close((uint64_t)fda);
                 (void)sys_close((uint64_t)fdb);
                 if (!opt_q) sys_puts("diff: read failed\n");
@@ -407,7 +390,6 @@ static int diff_files(const char *a, const char *b, int opt_q, int opt_s) {
         if (ib == nb) {
             long r = (long)sys_read((uint64_t)fdb, bufb, sizeof(bufb));
             if (r < 0) {
-                if (r == -11) continue; /* EAGAIN */
                 (void)sys_close((uint64_t)fda);
                 (void)sys_close((uint64_t)fdb);
                 if (!opt_q) sys_puts("diff: read failed\n");
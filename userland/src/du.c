@@ -16,7 +16,7 @@ typedef struct {
 
 enum {
     MAX_PATH = 256,
-    DENTS_BUF = 512,
+    DENTS_BUF = 4096,
     MAX_DEPTH = 64,
 };
 
@@ -21,7 +21,7 @@ typedef struct {
 
 enum {
     MAX_PATH = 256,
-    DENTS_BUF = 512,
+    DENTS_BUF = 4096,
 };
 
 static int streq(const char *a, const char *b) {
@@ -98,7 +98,28 @@ static void print_prefix(const grep_opts_t *o, const char *name, uint64_t line_n
     }
 }
 
-static int grep_fd(uint64_t fd, const char *name, const grep_opts_t *o, uint64_t *out_count, int *out_any_match) {
+/* Regular files are mapped and scanned in place instead of being copied
+ * through read(). Returns 0 if fd cannot be mapped (pipes, the console).
+ */
+static const char *map_fd(uint64_t fd, uint64_t *out_size) {
+    long size = (long)sys_lseek(fd, 0, 2 /* SEEK_END */);
+    (void)sys_lseek(fd, 0, 0 /* SEEK_SET */);
+    if (size <= 0) return 0;
+
+    long p = (long)sys_mmap(0, (uint64_t)size, 1 /* PROT_READ */, 2 /* MAP_PRIVATE */, (int64_t)fd, 0);
+    if (p < 0 && p > -4096) return 0;
+    *out_size = (uint64_t)size;
+    return (const char *)(uintptr_t)p;
+}
+
+/* Input is map[0, map_size) if map is set, else read from fd. */
+static int grep_stream(uint64_t fd,
+                       const char *map,
+                       uint64_t map_size,
+                       const char *name,
+                       const grep_opts_t *o,
+                       uint64_t *out_count,
+                       int *out_any_match) {
     uint64_t line_no = 1;
     uint64_t match_count = 0;
     int any_match = 0;
@@ -113,16 +134,22 @@ static int grep_fd(uint64_t fd, const char *name, const grep_opts_t *o, uint64_t
     int line_has_match = (o->pat_len == 0) ? 1 : 0;
 
     for (;;) {
-        long nread = (long)sys_read(fd, rbuf, sizeof(rbuf));
+        const char *chunk = rbuf;
+        long nread;
+        if (map) {
+            chunk = map;
+            nread = (long)map_size;
+            map_size = 0;
+        } else {
+            nread = (long)sys_read(fd, rbuf, sizeof(rbuf));
+        }
         if (nread == 0) break;
         if (nread < 0) {
-            /* EAGAIN (11) => retry (pipes). */
-            if (nread == -11) continue;
             return -1;
         }
 
         for (long i = 0; i < nread; i++) {
-            char ch = rbuf[i];
+            char ch = chunk[i];
 
             if (ch == '\n') {
                 int selected = o->opt_v ? !line_has_match : line_has_match;
@@ -199,6 +226,16 @@ static int grep_fd(uint64_t fd, const char *name, const grep_opts_t *o, uint64_t
     return 0;
 }
 
+static int grep_fd(uint64_t fd, const char *name, const grep_opts_t *o, uint64_t *out_count, int *out_any_match) {
+    uint64_t map_size = 0;
+    const char *map = map_fd(fd, &map_size);
+    int rc = grep_stream(fd, map, map_size, name, o, out_count, out_any_match);
+    if (map) {
+        (void)sys_munmap((void *)map, map_size);
+    }
+    return rc;
+}
+
 int main(int argc, char **argv, char **envp) {
     (void)envp;
 
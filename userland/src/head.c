@@ -44,8 +44,6 @@ static int head_bytes_fd(uint64_t fd, uint64_t max_bytes) {
         long n = (long)sys_read(fd, buf, want);
         if (n == 0) return 0;
         if (n < 0) {
-            /* EAGAIN (11) => retry (pipes). */
-            if (n == -11) continue;
             return -1;
         }
         (void)sys_write(1, buf, (uint64_t)n);
@@ -64,7 +62,6 @@ static int head_lines_fd(uint64_t fd, uint64_t max_lines) {
         long n = (long)sys_read(fd, buf, sizeof(buf));
         if (n == 0) return 0;
         if (n < 0) {
-            if (n == -11) continue;
             return -1;
         }
 
@@ -117,10 +117,6 @@ static int run_capture(const char *path, const char *const argv[], char *out, ui
     while (pos + 1 < out_cap) {
         long n = (long)sys_read((uint64_t)pfds[0], out + pos, out_cap - pos - 1);
         if (n < 0) {
-            /* EAGAIN (11) => retry (used for pipes). */
-            if (n == -11) {
-                continue;
-            }
             sys_puts("[kinit] capture read failed\n");
             read_failed = 1;
             break;
@@ -1056,6 +1052,917 @@ int main(int argc, char **argv, char **envp) {
         }
     }
 
+    /* Kernel interface test: vfork + execve/exit, and mona_spawn with file actions. */
+    {
+        sys_puts("[kinit] selftest: vfork + mona_spawn\n");
+
+        /* The vfork child borrows our address space: its store is visible
+         * here, and we only resume once it has exited.
+         */
+        static volatile int vfork_mark;
+        vfork_mark = 0;
+        long pid = (long)sys_vfork();
+        if (pid == 0) {
+            vfork_mark = 1;
+            sys_exit_group(7);
+        }
+        if (pid < 0) {
+            sys_puts("[kinit] vfork failed\n");
+            failed |= 1;
+        } else {
+            int st = 0;
+            if ((int64_t)sys_wait4((uint64_t)pid, &st, 0, 0) < 0 || ((st >> 8) & 0xff) != 7) {
+                sys_puts("[kinit] vfork child exit status unexpected\n");
+                failed |= 1;
+            } else if (vfork_mark != 1) {
+                sys_puts("[kinit] vfork child did not share our memory\n");
+                failed |= 1;
+            }
+        }
+
+        const char *const true_argv[] = {"true", 0};
+        pid = (long)sys_vfork();
+        if (pid == 0) {
+            (void)sys_execve("/bin/true", true_argv, 0);
+            sys_exit_group(127);
+        }
+        if (pid < 0) {
+            sys_puts("[kinit] vfork (exec) failed\n");
+            failed |= 1;
+        } else {
+            int st = 0;
+            if ((int64_t)sys_wait4((uint64_t)pid, &st, 0, 0) < 0 || ((st >> 8) & 0xff) != 0) {
+                sys_puts("[kinit] vfork + execve /bin/true failed\n");
+                failed |= 1;
+            }
+        }
+
+        /* Spawn echo with its stdout on a pipe and the read end closed. */
+        int pfds[2];
+        if ((int64_t)sys_pipe2(pfds, 0) < 0) {
+            sys_puts("[kinit] pipe2 failed\n");
+            failed |= 1;
+        } else {
+            const char *const echo_argv[] = {"echo", "spawned", 0};
+            mona_spawn_action_t acts[3] = {
+                {MONA_SPAWN_DUP2, (uint64_t)pfds[1], 1},
+                {MONA_SPAWN_CLOSE, (uint64_t)pfds[0], 0},
+                {MONA_SPAWN_CLOSE, (uint64_t)pfds[1], 0},
+            };
+            pid = (long)sys_mona_spawn("/bin/echo", echo_argv, 0, acts, 3);
+            (void)sys_close((uint64_t)pfds[1]);
+            if (pid < 0) {
+                sys_puts("[kinit] mona_spawn /bin/echo failed\n");
+                failed |= 1;
+            } else {
+                char out[64];
+                uint64_t pos = 0;
+                while (pos + 1 < sizeof(out)) {
+                    long n = (long)sys_read((uint64_t)pfds[0], out + pos, sizeof(out) - pos - 1);
+                    if (n <= 0) break;
+                    pos += (uint64_t)n;
+                }
+                out[pos] = '\0';
+                int st = 0;
+                if ((int64_t)sys_wait4((uint64_t)pid, &st, 0, 0) < 0 || ((st >> 8) & 0xff) != 0) {
+                    sys_puts("[kinit] spawned echo exit status unexpected\n");
+                    failed |= 1;
+                } else if (!mem_contains(out, pos, "spawned\n")) {
+                    sys_puts("[kinit] spawned echo output unexpected\n");
+                    failed |= 1;
+                }
+            }
+            (void)sys_close((uint64_t)pfds[0]);
+        }
+
+        /* Exec errors come back from the spawn call itself. */
+        if ((int64_t)sys_mona_spawn("/bin/does-not-exist", true_argv, 0, 0, 0) != -2) {
+            sys_puts("[kinit] mona_spawn of a missing file did not fail with ENOENT\n");
+            failed |= 1;
+        }
+        mona_spawn_action_t bad = {MONA_SPAWN_DUP2, 31, 1};
+        if ((int64_t)sys_mona_spawn("/bin/true", true_argv, 0, &bad, 1) != -9) {
+            sys_puts("[kinit] mona_spawn dup2 of a closed fd did not fail with EBADF\n");
+            failed |= 1;
+        }
+    }
+
+    /* Kernel interface test: pipe sizing, EOF/EPIPE, PIPE_BUF atomicity and
+     * EFAULT for a sleeping reader.
+     */
+    {
+        sys_puts("[kinit] selftest: pipe F_SETPIPE_SZ + PIPE_BUF atomicity + EFAULT\n");
+
+        enum {
+            EPERM_NEG = -1,
+            EBUSY_NEG = -16,
+            EFAULT_NEG = -14,
+            EPIPE_NEG = -32,
+            PIPE_BUF_LOCAL = 4096,
+            RECORDS = 16,
+            PROT_READ = 0x1,
+            MAP_PRIVATE = 0x02,
+            MAP_ANONYMOUS = 0x20,
+        };
+
+        int pfds[2];
+        if ((int64_t)sys_pipe2(pfds, 0) < 0) {
+            sys_puts("[kinit] pipe2 failed\n");
+            failed |= 1;
+        } else {
+            uint64_t rfd = (uint64_t)pfds[0];
+            uint64_t wfd = (uint64_t)pfds[1];
+            static char big[8000];
+            for (uint64_t i = 0; i < sizeof(big); i++) big[i] = (char)('a' + (i % 26u));
+
+            if ((int64_t)sys_fcntl(rfd, F_GETPIPE_SZ, 0) != 4096) {
+                sys_puts("[kinit] F_GETPIPE_SZ default unexpected\n");
+                failed |= 1;
+            }
+            /* Rounded up to a power of two; the limit is PIPE_MAX_SIZE. */
+            if ((int64_t)sys_fcntl(wfd, F_SETPIPE_SZ, 10000) != 16384 ||
+                (int64_t)sys_fcntl(rfd, F_GETPIPE_SZ, 0) != 16384) {
+                sys_puts("[kinit] F_SETPIPE_SZ did not grow the pipe\n");
+                failed |= 1;
+            }
+            if ((int64_t)sys_fcntl(wfd, F_SETPIPE_SZ, 65537) != EPERM_NEG) {
+                sys_puts("[kinit] F_SETPIPE_SZ above the limit did not fail with EPERM\n");
+                failed |= 1;
+            }
+
+            /* Queued data does not fit a smaller ring. */
+            if ((int64_t)sys_write(wfd, big, sizeof(big)) != (int64_t)sizeof(big)) {
+                sys_puts("[kinit] write into grown pipe failed\n");
+                failed |= 1;
+            } else if ((int64_t)sys_fcntl(wfd, F_SETPIPE_SZ, 4096) != EBUSY_NEG) {
+                sys_puts("[kinit] shrinking a full pipe did not fail with EBUSY\n");
+                failed |= 1;
+            }
+
+            static char got[8000];
+            uint64_t pos = 0;
+            while (pos < sizeof(got)) {
+                long n = (long)sys_read(rfd, got + pos, sizeof(got) - pos);
+                if (n <= 0) break;
+                pos += (uint64_t)n;
+            }
+            int same = (pos == sizeof(got));
+            for (uint64_t i = 0; same && i < sizeof(got); i++) {
+                if (got[i] != big[i]) same = 0;
+            }
+            if (!same) {
+                sys_puts("[kinit] data read back from pipe differs\n");
+                failed |= 1;
+            }
+
+            /* No writer left: EOF. */
+            (void)sys_close(wfd);
+            char c;
+            if ((int64_t)sys_read(rfd, &c, 1) != 0) {
+                sys_puts("[kinit] read after last writer closed did not return EOF\n");
+                failed |= 1;
+            }
+            (void)sys_close(rfd);
+        }
+
+        /* No reader left: EPIPE. */
+        if ((int64_t)sys_pipe2(pfds, 0) < 0) {
+            sys_puts("[kinit] pipe2 failed\n");
+            failed |= 1;
+        } else {
+            (void)sys_close((uint64_t)pfds[0]);
+            if ((int64_t)sys_write((uint64_t)pfds[1], "x", 1) != EPIPE_NEG) {
+                sys_puts("[kinit] write without readers did not fail with EPIPE\n");
+                failed |= 1;
+            }
+            (void)sys_close((uint64_t)pfds[1]);
+        }
+
+        /* Two writers block on the default-sized pipe while we read it in
+         * odd-sized pieces: each PIPE_BUF record must still arrive whole.
+         */
+        if ((int64_t)sys_pipe2(pfds, 0) < 0) {
+            sys_puts("[kinit] pipe2 failed\n");
+            failed |= 1;
+        } else {
+            long pids[2];
+            for (int w = 0; w < 2; w++) {
+                pids[w] = (long)sys_fork();
+                if (pids[w] == 0) {
+                    char rec[PIPE_BUF_LOCAL];
+                    for (uint64_t i = 0; i < sizeof(rec); i++) rec[i] = (char)('A' + w);
+                    (void)sys_close((uint64_t)pfds[0]);
+                    for (int r = 0; r < RECORDS; r++) {
+                        if ((int64_t)sys_write((uint64_t)pfds[1], rec, sizeof(rec)) != (int64_t)sizeof(rec)) {
+                            sys_exit_group(1);
+                        }
+                    }
+                    sys_exit_group(0);
+                }
+            }
+            (void)sys_close((uint64_t)pfds[1]);
+
+            uint64_t total = 0;
+            char rec_byte = 0;
+            int torn = 0;
+            char buf[1000];
+            for (;;) {
+                long n = (long)sys_read((uint64_t)pfds[0], buf, sizeof(buf));
+                if (n <= 0) break;
+                for (long i = 0; i < n; i++, total++) {
+                    if ((total % PIPE_BUF_LOCAL) == 0) rec_byte = buf[i];
+                    else if (buf[i] != rec_byte) torn = 1;
+                }
+            }
+            (void)sys_close((uint64_t)pfds[0]);
+
+            for (int w = 0; w < 2; w++) {
+                int st = 0;
+                if (pids[w] < 0 || (int64_t)sys_wait4((uint64_t)pids[w], &st, 0, 0) < 0 || ((st >> 8) & 0xff) != 0) {
+                    sys_puts("[kinit] pipe writer child failed\n");
+                    failed |= 1;
+                }
+            }
+            if (total != 2ull * RECORDS * PIPE_BUF_LOCAL) {
+                sys_puts("[kinit] pipe writers' data went missing\n");
+                failed |= 1;
+            } else if (torn) {
+                sys_puts("[kinit] PIPE_BUF-sized pipe writes were interleaved\n");
+                failed |= 1;
+            }
+        }
+
+        /* A reader asleep on an empty pipe with a buffer it may not write
+         * gets EFAULT, not the data (which stays queued for the next read).
+         */
+        uint64_t ro = sys_mmap(0, 4096, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if ((int64_t)ro < 0 || (int64_t)sys_pipe2(pfds, 0) < 0) {
+            sys_puts("[kinit] read-only pipe reader setup failed\n");
+            failed |= 1;
+        } else {
+            long pid = (long)sys_fork();
+            if (pid == 0) {
+                /* Give the parent time to block in read(). */
+                linux_timespec_t ts = {0, 50000000};
+                (void)sys_close((uint64_t)pfds[0]);
+                (void)sys_nanosleep(&ts, 0);
+                sys_exit_group((int64_t)sys_write((uint64_t)pfds[1], "hi", 2) == 2 ? 0 : 1);
+            }
+            (void)sys_close((uint64_t)pfds[1]);
+
+            char buf[4] = {0};
+            if ((int64_t)sys_read((uint64_t)pfds[0], (void *)(uintptr_t)ro, 2) != EFAULT_NEG) {
+                sys_puts("[kinit] pipe read into read-only memory did not fail with EFAULT\n");
+                failed |= 1;
+            }
+            if ((int64_t)sys_read((uint64_t)pfds[0], buf, 2) != 2 || buf[0] != 'h' || buf[1] != 'i') {
+                sys_puts("[kinit] pipe data lost after a faulting read\n");
+                failed |= 1;
+            }
+            int st = 0;
+            if (pid < 0 || (int64_t)sys_wait4((uint64_t)pid, &st, 0, 0) < 0 || ((st >> 8) & 0xff) != 0) {
+                sys_puts("[kinit] pipe writer child failed\n");
+                failed |= 1;
+            }
+            (void)sys_close((uint64_t)pfds[0]);
+        }
+        if ((int64_t)ro >= 0) (void)sys_munmap((void *)(uintptr_t)ro, 4096);
+    }
+
+    /* Kernel interface test: bad user buffers fail with EFAULT instead of
+     * killing us, and discarded anonymous pages read back as zeros.
+     */
+    {
+        sys_puts("[kinit] selftest: EFAULT user copies + madvise zero refill\n");
+
+        enum {
+            AT_FDCWD = -100,
+            O_RDONLY = 0,
+            O_WRONLY = 1,
+            O_CREAT = 0100,
+            O_TRUNC = 01000,
+            EFAULT_NEG = -14,
+            EINVAL_NEG = -22,
+            PROT_READ = 0x1,
+            PROT_WRITE = 0x2,
+            MAP_PRIVATE = 0x02,
+            MAP_ANONYMOUS = 0x20,
+            MADV_DONTNEED = 4,
+            MADV_FREE = 8,
+        };
+
+        uint64_t hole = sys_mmap(0, 4096, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        uint64_t ro = sys_mmap(0, 4096, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if ((int64_t)hole < 0 || (int64_t)ro < 0 || (int64_t)sys_munmap((void *)(uintptr_t)hole, 4096) < 0) {
+            sys_puts("[kinit] EFAULT setup: mmap/munmap failed\n");
+            failed |= 1;
+        } else {
+            uint64_t fd = sys_openat((uint64_t)AT_FDCWD, "/hello.txt", (uint64_t)O_RDONLY, 0);
+            if ((int64_t)fd < 0) {
+                sys_puts("[kinit] open /hello.txt failed\n");
+                failed |= 1;
+            } else {
+                if ((int64_t)sys_read(fd, (void *)(uintptr_t)hole, 4) != EFAULT_NEG) {
+                    sys_puts("[kinit] read into unmapped memory did not fail with EFAULT\n");
+                    failed |= 1;
+                }
+                if ((int64_t)sys_read(fd, (void *)(uintptr_t)ro, 4) != EFAULT_NEG) {
+                    sys_puts("[kinit] read into read-only memory did not fail with EFAULT\n");
+                    failed |= 1;
+                }
+                char c;
+                if ((int64_t)sys_read(fd, &c, 1) != 1) {
+                    sys_puts("[kinit] read after EFAULT failed\n");
+                    failed |= 1;
+                }
+                (void)sys_close(fd);
+            }
+
+            int pfds[2];
+            if ((int64_t)sys_pipe2(pfds, 0) < 0) {
+                sys_puts("[kinit] pipe2 failed\n");
+                failed |= 1;
+            } else {
+                if ((int64_t)sys_write((uint64_t)pfds[1], (const void *)(uintptr_t)hole, 16) != EFAULT_NEG) {
+                    sys_puts("[kinit] pipe write from unmapped memory did not fail with EFAULT\n");
+                    failed |= 1;
+                }
+                (void)sys_close((uint64_t)pfds[0]);
+                (void)sys_close((uint64_t)pfds[1]);
+            }
+
+            (void)sys_mkdirat((uint64_t)AT_FDCWD, "/tmp", 0755);
+            fd = sys_openat((uint64_t)AT_FDCWD, "/tmp/efault", (uint64_t)(O_CREAT | O_WRONLY | O_TRUNC), 0644);
+            if ((int64_t)fd < 0) {
+                sys_puts("[kinit] open /tmp/efault failed\n");
+                failed |= 1;
+            } else {
+                linux_stat_t st;
+                if ((int64_t)sys_write(fd, (const void *)(uintptr_t)hole, 16) != EFAULT_NEG) {
+                    sys_puts("[kinit] file write from unmapped memory did not fail with EFAULT\n");
+                    failed |= 1;
+                } else if ((int64_t)sys_newfstatat((uint64_t)AT_FDCWD, "/tmp/efault", &st, 0) < 0 || st.st_size != 0) {
+                    sys_puts("[kinit] failed file write changed the file size\n");
+                    failed |= 1;
+                }
+                (void)sys_close(fd);
+                (void)sys_unlinkat((uint64_t)AT_FDCWD, "/tmp/efault", 0);
+            }
+        }
+        if ((int64_t)ro >= 0) (void)sys_munmap((void *)(uintptr_t)ro, 4096);
+
+        /* DONTNEED and FREE both drop the pages; the next touch sees zeros. */
+        uint64_t m = sys_mmap(0, 3 * 4096, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if ((int64_t)m < 0) {
+            sys_puts("[kinit] madvise setup: mmap failed\n");
+            failed |= 1;
+        } else {
+            volatile uint8_t *p = (volatile uint8_t *)(uintptr_t)m;
+            const uint64_t advice[2] = {MADV_DONTNEED, MADV_FREE};
+            for (int a = 0; a < 2; a++) {
+                for (uint64_t i = 0; i < 3 * 4096; i++) p[i] = 0x5a;
+                /* Only the middle page. */
+                if ((int64_t)sys_madvise((void *)(uintptr_t)(m + 4096), 4096, advice[a]) < 0) {
+                    sys_puts("[kinit] madvise failed\n");
+                    failed |= 1;
+                    break;
+                }
+                int ok = 1;
+                for (uint64_t i = 0; i < 3 * 4096; i++) {
+                    uint8_t want = (i >= 4096 && i < 2 * 4096) ? 0 : 0x5a;
+                    if (p[i] != want) ok = 0;
+                }
+                if (!ok) {
+                    sys_puts(a == 0 ? "[kinit] MADV_DONTNEED page did not read back as zeros\n"
+                                    : "[kinit] MADV_FREE page did not read back as zeros\n");
+                    failed |= 1;
+                }
+            }
+            (void)sys_munmap((void *)(uintptr_t)m, 3 * 4096);
+        }
+
+        /* File mappings (and our own text) cannot be refilled with zeros:
+         * EINVAL, and the contents stay.
+         */
+        uint64_t fd = sys_openat((uint64_t)AT_FDCWD, "/hello.txt", (uint64_t)O_RDONLY, 0);
+        char want[8];
+        if ((int64_t)fd < 0 || (int64_t)sys_read(fd, want, sizeof(want)) != (int64_t)sizeof(want)) {
+            sys_puts("[kinit] madvise file setup: read /hello.txt failed\n");
+            failed |= 1;
+        } else {
+            uint64_t fm = sys_mmap(0, 4096, PROT_READ, MAP_PRIVATE, fd, 0);
+            if ((int64_t)fm < 0) {
+                sys_puts("[kinit] madvise file setup: mmap /hello.txt failed\n");
+                failed |= 1;
+            } else {
+                const volatile char *fp = (const volatile char *)(uintptr_t)fm;
+                int bad = (int64_t)sys_madvise((void *)(uintptr_t)fm, 4096, MADV_DONTNEED) != EINVAL_NEG;
+                for (uint64_t i = 0; i < sizeof(want); i++) bad |= fp[i] != want[i];
+                if (bad) {
+                    sys_puts("[kinit] madvise on a file mapping did not fail with EINVAL\n");
+                    failed |= 1;
+                }
+                (void)sys_munmap((void *)(uintptr_t)fm, 4096);
+            }
+            uint64_t text = (uint64_t)(uintptr_t)&main & ~4095ull;
+            if ((int64_t)sys_madvise((void *)(uintptr_t)text, 4096, MADV_DONTNEED) != EINVAL_NEG) {
+                sys_puts("[kinit] madvise on program text did not fail with EINVAL\n");
+                failed |= 1;
+            }
+        }
+        if ((int64_t)fd >= 0) (void)sys_close(fd);
+    }
+
+    /* Kernel interface test: getrusage/times/wait4 account a child's CPU time. */
+    {
+        sys_puts("[kinit] selftest: getrusage + times\n");
+
+        enum {
+            BURN_US = 150000,
+        };
+
+        linux_tms_t t0;
+        uint64_t ticks0 = sys_times(&t0);
+
+        long pid = (long)sys_fork();
+        if (pid == 0) {
+            /* Burn user time until our own rusage shows it (give up after 10s). */
+            linux_timespec_t start;
+            linux_timespec_t now;
+            (void)sys_clock_gettime(1, &start);
+            volatile uint64_t x = 0;
+            for (;;) {
+                for (int i = 0; i < 100000; i++) x += (uint64_t)i;
+                linux_rusage_t ru;
+                if ((int64_t)sys_getrusage(RUSAGE_SELF, &ru) < 0) sys_exit_group(1);
+                if (ru.ru_utime.tv_sec * 1000000 + ru.ru_utime.tv_usec >= BURN_US) break;
+                (void)sys_clock_gettime(1, &now);
+                if (ts_to_ns_clamp(now) - ts_to_ns_clamp(start) > 10000000000ull) sys_exit_group(2);
+            }
+            sys_exit_group(0);
+        }
+
+        if (pid < 0) {
+            sys_puts("[kinit] fork failed\n");
+            failed |= 1;
+        } else {
+            int st = 0;
+            linux_rusage_t ru;
+            if ((int64_t)sys_wait4((uint64_t)pid, &st, 0, &ru) < 0 || ((st >> 8) & 0xff) != 0) {
+                sys_puts("[kinit] CPU-burning child failed\n");
+                failed |= 1;
+            } else if (ru.ru_utime.tv_sec * 1000000 + ru.ru_utime.tv_usec < BURN_US) {
+                sys_puts("[kinit] wait4 rusage is missing the child's user time\n");
+                failed |= 1;
+            }
+
+            linux_rusage_t cru;
+            if ((int64_t)sys_getrusage(RUSAGE_CHILDREN, &cru) < 0 ||
+                cru.ru_utime.tv_sec * 1000000 + cru.ru_utime.tv_usec < BURN_US) {
+                sys_puts("[kinit] getrusage(RUSAGE_CHILDREN) is missing the child's user time\n");
+                failed |= 1;
+            }
+
+            /* times(): clock ticks at USER_HZ (100). */
+            linux_tms_t t1;
+            uint64_t ticks1 = sys_times(&t1);
+            if ((int64_t)ticks1 < 0 || ticks1 < ticks0 + BURN_US / 10000) {
+                sys_puts("[kinit] times() elapsed ticks did not advance\n");
+                failed |= 1;
+            }
+            if (t1.tms_cutime - t0.tms_cutime < BURN_US / 10000) {
+                sys_puts("[kinit] times() tms_cutime is missing the child's user time\n");
+                failed |= 1;
+            }
+            if (t1.tms_utime < t0.tms_utime || t1.tms_stime < t0.tms_stime) {
+                sys_puts("[kinit] times() own CPU time went backwards\n");
+                failed |= 1;
+            }
+        }
+    }
+
+    /* Kernel interface test: mremap grows, moves and shrinks anonymous
+     * mappings, and refuses to grow file mappings.
+     */
+    {
+        sys_puts("[kinit] selftest: mremap\n");
+
+        enum {
+            AT_FDCWD = -100,
+            O_RDONLY = 0,
+            EINVAL_NEG = -22,
+            ENOMEM_NEG = -12,
+            EFAULT_NEG = -14,
+            PROT_READ = 0x1,
+            PROT_WRITE = 0x2,
+            MAP_PRIVATE = 0x02,
+            MAP_ANONYMOUS = 0x20,
+            MREMAP_MAYMOVE = 1,
+            PG = 4096,
+        };
+
+        /* Four pages, the top two given back: room to grow in place. */
+        uint64_t a = sys_mmap(0, 4 * PG, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if ((int64_t)a < 0 || (int64_t)sys_munmap((void *)(uintptr_t)(a + 2 * PG), 2 * PG) < 0) {
+            sys_puts("[kinit] mremap setup: mmap failed\n");
+            failed |= 1;
+        } else {
+            volatile uint8_t *p = (volatile uint8_t *)(uintptr_t)a;
+            for (uint64_t i = 0; i < 2 * PG; i++) p[i] = (uint8_t)(i * 7u + 1u);
+
+            uint64_t size = 2 * PG;
+            if (sys_mremap((void *)(uintptr_t)a, 2 * PG, 4 * PG, 0) != a) {
+                sys_puts("[kinit] mremap did not grow the mapping in place\n");
+                failed |= 1;
+            } else {
+                size = 4 * PG;
+            }
+
+            /* Pin the page above, so the next growth has to move. */
+            uint64_t pin = sys_mmap((void *)(uintptr_t)(a + size), PG, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+            if (pin == a + size) {
+                if ((int64_t)sys_mremap((void *)(uintptr_t)a, size, 8 * PG, 0) != ENOMEM_NEG) {
+                    sys_puts("[kinit] mremap grew over a mapping without MREMAP_MAYMOVE\n");
+                    failed |= 1;
+                }
+                uint64_t r = sys_mremap((void *)(uintptr_t)a, size, 8 * PG, MREMAP_MAYMOVE);
+                if ((int64_t)r < 0 || r == a) {
+                    sys_puts("[kinit] mremap(MREMAP_MAYMOVE) did not move the mapping\n");
+                    failed |= 1;
+                } else {
+                    a = r;
+                    size = 8 * PG;
+                }
+            }
+            if ((int64_t)pin >= 0) (void)sys_munmap((void *)(uintptr_t)pin, PG);
+
+            /* Old bytes kept, new ones zero, wherever the mapping is now. */
+            p = (volatile uint8_t *)(uintptr_t)a;
+            for (uint64_t i = 0; i < size; i++) {
+                uint8_t want = (i < 2 * PG) ? (uint8_t)(i * 7u + 1u) : 0;
+                if (p[i] != want) {
+                    sys_puts("[kinit] mremap'd mapping has the wrong contents\n");
+                    failed |= 1;
+                    break;
+                }
+            }
+
+            /* Shrink to one page: the rest is gone. */
+            if (sys_mremap((void *)(uintptr_t)a, size, PG, 0) != a || p[0] != 1) {
+                sys_puts("[kinit] mremap did not shrink the mapping\n");
+                failed |= 1;
+            } else {
+                int pfds[2];
+                if ((int64_t)sys_pipe2(pfds, 0) == 0) {
+                    if ((int64_t)sys_write((uint64_t)pfds[1], (const void *)(uintptr_t)(a + PG), 1) != EFAULT_NEG) {
+                        sys_puts("[kinit] page cut off by mremap is still mapped\n");
+                        failed |= 1;
+                    }
+                    (void)sys_close((uint64_t)pfds[0]);
+                    (void)sys_close((uint64_t)pfds[1]);
+                }
+            }
+            (void)sys_munmap((void *)(uintptr_t)a, size);
+        }
+
+        /* A file mapping would grow with zeros, not file data: refused. */
+        uint64_t fd = sys_openat((uint64_t)AT_FDCWD, "/hello.txt", (uint64_t)O_RDONLY, 0);
+        if ((int64_t)fd < 0) {
+            sys_puts("[kinit] open /hello.txt failed\n");
+            failed |= 1;
+        } else {
+            uint64_t f = sys_mmap(0, PG, PROT_READ, MAP_PRIVATE, (int64_t)fd, 0);
+            (void)sys_close(fd);
+            if ((int64_t)f < 0) {
+                sys_puts("[kinit] mmap of /hello.txt failed\n");
+                failed |= 1;
+            } else {
+                if ((int64_t)sys_mremap((void *)(uintptr_t)f, PG, 4 * PG, MREMAP_MAYMOVE) != EINVAL_NEG) {
+                    sys_puts("[kinit] mremap grew a file mapping\n");
+                    failed |= 1;
+                }
+                (void)sys_munmap((void *)(uintptr_t)f, PG);
+            }
+        }
+    }
+
+    /* Kernel interface test: getdents64 resumes where the last call stopped. */
+    {
+        sys_puts("[kinit] selftest: getdents64 cursor\n");
+
+        enum {
+            AT_FDCWD = -100,
+            O_RDONLY = 0,
+            O_WRONLY = 1,
+            O_CREAT = 0100,
+            AT_REMOVEDIR = 0x200,
+            EINVAL_NEG = -22,
+            NFILES = 40,
+        };
+
+        char path[32] = "/gdtest/f00";
+        (void)sys_mkdirat((uint64_t)AT_FDCWD, "/gdtest", 0755);
+        int setup_ok = 1;
+        for (int i = 0; i < NFILES; i++) {
+            path[9] = (char)('0' + i / 10);
+            path[10] = (char)('0' + i % 10);
+            uint64_t fd = sys_openat((uint64_t)AT_FDCWD, path, (uint64_t)(O_CREAT | O_WRONLY), 0644);
+            if ((int64_t)fd < 0) {
+                setup_ok = 0;
+                break;
+            }
+            (void)sys_close(fd);
+        }
+
+        uint64_t dfd = sys_openat((uint64_t)AT_FDCWD, "/gdtest", (uint64_t)O_RDONLY, 0);
+        if (!setup_ok || (int64_t)dfd < 0) {
+            sys_puts("[kinit] getdents64 setup failed\n");
+            failed |= 1;
+        } else {
+            char buf[64];
+            if ((int64_t)sys_getdents64(dfd, buf, 8) != EINVAL_NEG) {
+                sys_puts("[kinit] getdents64 into a too-small buffer did not fail with EINVAL\n");
+                failed |= 1;
+            }
+
+            /* Read it twice (rewinding in between) a couple of records per
+             * call: every file exactly once per pass.
+             */
+            for (int pass = 0; pass < 2; pass++) {
+                uint8_t seen[NFILES];
+                for (int i = 0; i < NFILES; i++) seen[i] = 0;
+                int dup = 0;
+                int calls = 0;
+                for (;;) {
+                    long n = (long)sys_getdents64(dfd, buf, sizeof(buf));
+                    if (n <= 0) {
+                        if (n < 0) dup = 1;
+                        break;
+                    }
+                    calls++;
+                    for (long off = 0; off < n;) {
+                        uint16_t reclen = (uint16_t)((uint8_t)buf[off + 16] | ((uint16_t)(uint8_t)buf[off + 17] << 8));
+                        const char *name = buf + off + 19;
+                        if (reclen == 0) break;
+                        if (name[0] == 'f' && name[1] >= '0' && name[1] <= '9' && name[2] >= '0' && name[2] <= '9' && name[3] == '\0') {
+                            int i = (name[1] - '0') * 10 + (name[2] - '0');
+                            if (i < NFILES) {
+                                if (seen[i]) dup = 1;
+                                seen[i] = 1;
+                            }
+                        }
+                        off += reclen;
+                    }
+                }
+                int missing = 0;
+                for (int i = 0; i < NFILES; i++) {
+                    if (!seen[i]) missing = 1;
+                }
+                if (dup || missing || calls < NFILES / 2) {
+                    sys_puts("[kinit] getdents64 listing in small pieces is wrong\n");
+                    failed |= 1;
+                    break;
+                }
+                if ((int64_t)sys_lseek(dfd, 0, 0) != 0) {
+                    sys_puts("[kinit] lseek did not rewind the directory\n");
+                    failed |= 1;
+                    break;
+                }
+            }
+            (void)sys_close(dfd);
+        }
+
+        for (int i = 0; i < NFILES; i++) {
+            path[9] = (char)('0' + i / 10);
+            path[10] = (char)('0' + i % 10);
+            (void)sys_unlinkat((uint64_t)AT_FDCWD, path, 0);
+        }
+        (void)sys_unlinkat((uint64_t)AT_FDCWD, "/gdtest", (uint64_t)AT_REMOVEDIR);
+    }
+
+    /* Kernel interface test: sparse ramfiles with truncate and fallocate. */
+    {
+        sys_puts("[kinit] selftest: truncate + fallocate (sparse ramfiles)\n");
+
+        enum {
+            AT_FDCWD = -100,
+            O_RDWR = 2,
+            O_CREAT = 0100,
+            O_TRUNC = 01000,
+            EINVAL_NEG = -22,
+            EISDIR_NEG = -21,
+            EROFS_NEG = -30,
+            EOPNOTSUPP_NEG = -95,
+            FALLOC_FL_KEEP_SIZE = 0x01,
+            FALLOC_FL_PUNCH_HOLE = 0x02,
+            PG = 4096,
+        };
+        const char *path = "/tmp/sparse";
+        const int64_t big = 1ll << 30;
+
+        (void)sys_mkdirat((uint64_t)AT_FDCWD, "/tmp", 0755);
+        uint64_t fd = sys_openat((uint64_t)AT_FDCWD, path, (uint64_t)(O_CREAT | O_RDWR | O_TRUNC), 0644);
+        if ((int64_t)fd < 0) {
+            sys_puts("[kinit] open /tmp/sparse failed\n");
+            failed |= 1;
+        } else {
+            linux_stat_t st;
+            char buf[8];
+            int bad = 0;
+
+            /* A 1GiB hole costs nothing and reads as zeros. */
+            bad |= (int64_t)sys_ftruncate(fd, big) != 0;
+            bad |= (int64_t)sys_newfstatat((uint64_t)AT_FDCWD, path, &st, 0) != 0 || st.st_size != big || st.st_blocks != 0;
+            bad |= (int64_t)sys_lseek(fd, big / 2, 0) != big / 2;
+            bad |= (int64_t)sys_read(fd, buf, 4) != 4 || buf[0] != 0 || buf[3] != 0;
+            if (bad) {
+                sys_puts("[kinit] ftruncate did not make a sparse file\n");
+                failed |= 1;
+            }
+
+            /* One written page, two allocated ones, size unchanged. */
+            bad = 0;
+            bad |= (int64_t)sys_lseek(fd, 16 * PG, 0) != 16 * PG;
+            bad |= (int64_t)sys_write(fd, "abc", 3) != 3;
+            bad |= (int64_t)sys_fallocate(fd, 0, 32 * PG, 2 * PG) != 0;
+            bad |= (int64_t)sys_newfstatat((uint64_t)AT_FDCWD, path, &st, 0) != 0 || st.st_size != big || st.st_blocks != 3 * 8;
+            if (bad) {
+                sys_puts("[kinit] write/fallocate page accounting unexpected\n");
+                failed |= 1;
+            }
+
+            /* Allocating past the end grows the file unless KEEP_SIZE. */
+            bad = 0;
+            bad |= (int64_t)sys_fallocate(fd, FALLOC_FL_KEEP_SIZE, big, PG) != 0;
+            bad |= (int64_t)sys_newfstatat((uint64_t)AT_FDCWD, path, &st, 0) != 0 || st.st_size != big;
+            bad |= (int64_t)sys_fallocate(fd, 0, big, 2 * PG) != 0;
+            bad |= (int64_t)sys_newfstatat((uint64_t)AT_FDCWD, path, &st, 0) != 0 || st.st_size != big + 2 * PG;
+            if (bad) {
+                sys_puts("[kinit] fallocate past the end sized the file wrongly\n");
+                failed |= 1;
+            }
+
+            /* Punching frees the written page; it reads back as zeros. */
+            bad = 0;
+            int64_t blocks = st.st_blocks;
+            bad |= (int64_t)sys_fallocate(fd, FALLOC_FL_PUNCH_HOLE, 16 * PG, PG) != EOPNOTSUPP_NEG;
+            bad |= (int64_t)sys_fallocate(fd, FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE, 16 * PG, PG) != 0;
+            bad |= (int64_t)sys_newfstatat((uint64_t)AT_FDCWD, path, &st, 0) != 0 || st.st_blocks != blocks - 8;
+            bad |= (int64_t)sys_lseek(fd, 16 * PG, 0) != 16 * PG;
+            bad |= (int64_t)sys_read(fd, buf, 3) != 3 || buf[0] != 0 || buf[2] != 0;
+            if (bad) {
+                sys_puts("[kinit] FALLOC_FL_PUNCH_HOLE did not free the page\n");
+                failed |= 1;
+            }
+
+            /* Shrinking by path drops the pages past the end; growing
+             * again shows a hole, not the old data.
+             */
+            bad = 0;
+            bad |= (int64_t)sys_lseek(fd, 0, 0) != 0;
+            bad |= (int64_t)sys_write(fd, "xyzw", 4) != 4;
+            bad |= (int64_t)sys_truncate(path, 2) != 0;
+            bad |= (int64_t)sys_newfstatat((uint64_t)AT_FDCWD, path, &st, 0) != 0 || st.st_size != 2 || st.st_blocks != 8;
+            bad |= (int64_t)sys_ftruncate(fd, 4) != 0;
+            bad |= (int64_t)sys_lseek(fd, 0, 0) != 0;
+            bad |= (int64_t)sys_read(fd, buf, 8) != 4 || buf[0] != 'x' || buf[1] != 'y' || buf[2] != 0 || buf[3] != 0;
+            if (bad) {
+                sys_puts("[kinit] truncate shrink/regrow unexpected\n");
+                failed |= 1;
+            }
+
+            if ((int64_t)sys_ftruncate(fd, -1) != EINVAL_NEG ||
+                (int64_t)sys_truncate("/hello.txt", 0) != EROFS_NEG ||
+                (int64_t)sys_truncate("/tmp", 0) != EISDIR_NEG) {
+                sys_puts("[kinit] truncate error cases unexpected\n");
+                failed |= 1;
+            }
+
+            (void)sys_close(fd);
+            (void)sys_unlinkat((uint64_t)AT_FDCWD, path, 0);
+        }
+    }
+
+    /* Kernel interface test: sync/fsync, /proc/diskstats and the SD block device. */
+    {
+        sys_puts("[kinit] selftest: sync + fsync + /dev/mmcblk0\n");
+
+        enum {
+            AT_FDCWD = -100,
+            O_RDONLY = 0,
+            O_RDWR = 2,
+            O_CREAT = 0100,
+            O_TRUNC = 01000,
+            EBADF_NEG = -9,
+            ENOENT_NEG = -2,
+            EFAULT_NEG = -14,
+            EROFS_NEG = -30,
+            PROT_READ = 0x1,
+            PROT_WRITE = 0x2,
+            MAP_PRIVATE = 0x02,
+            MAP_ANONYMOUS = 0x20,
+            PG = 4096,
+            /* Far from anything read in before: not cached yet. */
+            FAULT_BLK = 1000,
+        };
+
+        if ((int64_t)sys_sync() != 0) {
+            sys_puts("[kinit] sync failed\n");
+            failed |= 1;
+        }
+        (void)sys_mkdirat((uint64_t)AT_FDCWD, "/tmp", 0755);
+        uint64_t rfd = sys_openat((uint64_t)AT_FDCWD, "/tmp/fsync", (uint64_t)(O_CREAT | O_RDWR | O_TRUNC), 0644);
+        if ((int64_t)rfd < 0 || (int64_t)sys_write(rfd, "x", 1) != 1 || (int64_t)sys_fsync(rfd) != 0) {
+            sys_puts("[kinit] fsync on a ramfile failed\n");
+            failed |= 1;
+        }
+        if ((int64_t)rfd >= 0) (void)sys_close(rfd);
+        (void)sys_unlinkat((uint64_t)AT_FDCWD, "/tmp/fsync", 0);
+        if ((int64_t)sys_fsync(31) != EBADF_NEG) {
+            sys_puts("[kinit] fsync on a closed fd did not fail with EBADF\n");
+            failed |= 1;
+        }
+        if ((int64_t)sys_openat((uint64_t)AT_FDCWD, "/proc/diskstats", (uint64_t)O_RDWR, 0) != EROFS_NEG) {
+            sys_puts("[kinit] /proc/diskstats opened for writing\n");
+            failed |= 1;
+        }
+
+        uint64_t fd = sys_openat((uint64_t)AT_FDCWD, "/dev/mmcblk0", (uint64_t)O_RDWR, 0);
+        uint64_t scratch = sys_mmap(0, 2 * PG, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if ((int64_t)fd == ENOENT_NEG) {
+            sys_puts("[kinit] no SD card, /dev/mmcblk0 part skipped\n");
+        } else if ((int64_t)fd < 0 || (int64_t)scratch < 0) {
+            sys_puts("[kinit] open /dev/mmcblk0 or mmap failed\n");
+            failed |= 1;
+            if ((int64_t)fd >= 0) (void)sys_close(fd);
+        } else {
+            uint8_t *wbuf = (uint8_t *)(uintptr_t)scratch;
+            uint8_t *rbuf = wbuf + PG;
+            int64_t size = (int64_t)sys_lseek(fd, 0, 2);
+            int bad = 0;
+
+            /* 3000 bytes across the boundary of blocks 2 and 3: both are read
+             * in first, written back by fsync and read back.
+             */
+            for (int i = 0; i < 3000; i++) wbuf[i] = (uint8_t)(i * 7 + 1);
+            bad |= (int64_t)sys_lseek(fd, 3 * PG - 1000, 0) != 3 * PG - 1000;
+            bad |= (int64_t)sys_write(fd, wbuf, 3000) != 3000;
+            bad |= (int64_t)sys_fsync(fd) != 0;
+            bad |= (int64_t)sys_lseek(fd, 3 * PG - 1000, 0) != 3 * PG - 1000;
+            bad |= (int64_t)sys_read(fd, rbuf, 3000) != 3000;
+            for (int i = 0; i < 3000 && !bad; i++) bad |= rbuf[i] != wbuf[i];
+            if (bad) {
+                sys_puts("[kinit] /dev/mmcblk0 write/fsync/read back mismatch\n");
+                failed |= 1;
+            }
+
+            /* A whole-block write whose source runs into an unmapped page
+             * fails with EFAULT and must not leave a half-filled block
+             * cached (or written) under that block number.
+             */
+            if (size >= (FAULT_BLK + 1) * PG &&
+                (int64_t)sys_munmap((void *)(uintptr_t)(scratch + PG), PG) == 0) {
+                for (int i = 0; i < PG; i++) wbuf[i] = (uint8_t)(0xA5u ^ (uint32_t)i);
+                bad = 0;
+                bad |= (int64_t)sys_lseek(fd, FAULT_BLK * PG, 0) != FAULT_BLK * PG;
+                bad |= (int64_t)sys_write(fd, wbuf + PG / 2, PG) != EFAULT_NEG;
+                bad |= (int64_t)sys_fsync(fd) != 0;
+                bad |= (int64_t)sys_lseek(fd, FAULT_BLK * PG, 0) != FAULT_BLK * PG;
+                bad |= (int64_t)sys_read(fd, wbuf, PG / 2) != PG / 2;
+                int same = 1;
+                for (int i = 0; i < PG / 2 && !bad; i++) same &= wbuf[i] == (uint8_t)(0xA5u ^ (uint32_t)(PG / 2 + i));
+                if (bad || same) {
+                    sys_puts("[kinit] faulting /dev/mmcblk0 write left data in the block\n");
+                    failed |= 1;
+                }
+                scratch = 0;
+                (void)sys_munmap((void *)(uintptr_t)wbuf, PG);
+            }
+            (void)sys_close(fd);
+
+            /* The card's Linux line, with the writes counted. */
+            char st[512];
+            uint64_t sfd = sys_openat((uint64_t)AT_FDCWD, "/proc/diskstats", (uint64_t)O_RDONLY, 0);
+            int64_t n = ((int64_t)sfd < 0) ? -1 : (int64_t)sys_read(sfd, st, sizeof(st) - 1);
+            if ((int64_t)sfd >= 0) (void)sys_close(sfd);
+            const char *want = "179 0 mmcblk0 ";
+            int ok = n > 0;
+            for (int i = 0; ok && want[i]; i++) ok = i < n && st[i] == want[i];
+            /* Fields after the name: reads, merges, sectors, ms, then writes. */
+            int field = 0;
+            uint64_t wr_ios = 0;
+            for (int i = 14; ok && i < n && st[i] != '\n'; i++) {
+                if (st[i] == ' ') field++;
+                else if (field == 4) wr_ios = wr_ios * 10u + (uint64_t)(st[i] - '0');
+            }
+            if (!ok || wr_ios == 0) {
+                sys_puts("[kinit] /proc/diskstats lacks the mmcblk0 writes\n");
+                failed |= 1;
+            }
+        }
+        if ((int64_t)scratch > 0) (void)sys_munmap((void *)(uintptr_t)scratch, 2 * PG);
+    }
+
     if (failed) {
         sys_puts("[kinit] selftests FAILED\n");
         sys_exit_group(1);
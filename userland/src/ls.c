@@ -150,7 +150,7 @@ static int list_dir(const char *path, int opt_all, int opt_long, int show_header
         }
     }
 
-    char buf[512];
+    char buf[4096];
     int status = 0;
     for (;;) {
         long n = (long)sys_getdents64((uint64_t)fd, buf, sizeof(buf));
@@ -35,8 +35,6 @@ static int read_whole_file(const char *path, char *out, uint64_t cap, uint64_t *
     while (pos + 1 < cap) {
         int64_t n = (int64_t)sys_read(fd, out + pos, cap - pos - 1);
         if (n < 0) {
-            /* EAGAIN => retry */
-            if (n == -11) continue;
             (void)sys_close(fd);
             return 1;
         }
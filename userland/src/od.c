@@ -45,7 +45,6 @@ static int write_all(uint64_t fd, const char *buf, uint64_t len) {
     while (off < len) {
         long rc = (long)sys_write(fd, buf + off, len - off);
         if (rc < 0) {
-            if (rc == -11) continue; /* EAGAIN */
             return -1;
         }
         if (rc == 0) return -1;
@@ -203,7 +202,6 @@ static int do_skip(uint64_t fd, int is_stdin, uint64_t skip) {
         uint64_t n = (left < sizeof(tmp)) ? left : (uint64_t)sizeof(tmp);
         long r = (long)sys_read(fd, tmp, n);
         if (r < 0) {
-            if (r == -11) continue;
             return -1;
         }
         if (r == 0) break;
@@ -314,7 +312,6 @@ static int od_fd(uint64_t fd, int is_stdin, addr_base_t addr_base, fmt_t fmt, in
 
         long r = (long)sys_read(fd, buf, want);
         if (r < 0) {
-            if (r == -11) continue;
             return -1;
         }
         if (r == 0) break;
@@ -349,7 +346,6 @@ static int od_fd_canonical(uint64_t fd, int is_stdin, uint64_t limit, uint64_t s
 
         long r = (long)sys_read(fd, buf, want);
         if (r < 0) {
-            if (r == -11) continue;
             return -1;
         }
         if (r == 0) break;
@@ -16,8 +16,6 @@ static int write_all(uint64_t fd, const char *buf, uint64_t len) {
     while (off < len) {
         long rc = (long)sys_write(fd, buf + off, len - off);
         if (rc < 0) {
-            /* EAGAIN (11) => retry (pipes). */
-            if (rc == -11) continue;
             return -1;
         }
         if (rc == 0) return -1;
@@ -55,8 +53,6 @@ static int rev_fd(uint64_t fd) {
             return 0;
         }
         if (rc < 0) {
-            /* EAGAIN (11) => retry (pipes). */
-            if (rc == -11) continue;
             return -1;
         }
 
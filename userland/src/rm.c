@@ -20,7 +20,7 @@ typedef struct {
 
 enum {
     MAX_PATH = 256,
-    DENTS_BUF = 512,
+    DENTS_BUF = 4096,
     MAX_ENTRIES = 32,
     NAME_MAX_LOCAL = 64,
 };
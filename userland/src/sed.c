@@ -92,8 +92,6 @@ static int read_line(uint64_t fd, char *line, uint64_t cap, int *out_eof) {
             return (int)n;
         }
         if (rc < 0) {
-            /* EAGAIN (11) => retry (pipes). */
-            if (rc == -11) continue;
             return -1;
         }
 
@@ -750,7 +750,10 @@ static int tokenize(char *buf, char **argv, int max_argv) {
     return argc;
 }
 
-static void exec_argv(char **av) {
+/* Start av (with the given fd actions) without waiting for it.
+ * Returns the pid, or -1 after reporting the failure.
+ */
+static long spawn_argv(char **av, const mona_spawn_action_t *acts, uint64_t nacts) {
     char path[64];
     if (av[0][0] == '/') {
         /* absolute path */
@@ -775,9 +778,17 @@ static void exec_argv(char **av) {
         path[i] = '\0';
     }
 
-    (void)sys_execve(path, (const char *const *)av, 0);
+    long pid = (long)sys_mona_spawn(path, (const char *const *)av, 0, acts, nacts);
+    if (pid < 0) {
+        sys_puts("execve failed\n");
+        return -1;
+    }
+    return pid;
 }
 
+/* Status of a command that could not be started (like exit 127). */
+#define SPAWN_FAILED_STATUS (127 << 8)
+
 static int find_pipe_pos(char **av) {
     if (!av) return -1;
     for (int i = 0; av[i]; i++) {
@@ -801,16 +812,9 @@ static int run_command(char **av) {
         return 0;
     }
 
-    long pid = (long)sys_fork();
+    long pid = spawn_argv(av, 0, 0);
     if (pid < 0) {
-        sys_puts("fork failed\n");
-        return -1;
-    }
-
-    if (pid == 0) {
-        exec_argv(av);
-        sys_puts("execve failed\n");
-        sys_exit_group(127);
+        return SPAWN_FAILED_STATUS;
     }
 
     int status = 0;
@@ -841,46 +845,32 @@ static int run_pipeline(char **av, int pipe_pos) {
         sys_puts("pipe2 failed\n");
         return -1;
     }
+    /* Fewer wakeups per byte between the two sides. */
+    (void)sys_fcntl((uint64_t)pfds[1], F_SETPIPE_SZ, 65536);
 
-    long lpid = (long)sys_fork();
-    if (lpid < 0) {
-        sys_puts("fork failed\n");
-        (void)sys_close((uint64_t)pfds[0]);
-        (void)sys_close((uint64_t)pfds[1]);
-        return -1;
-    }
-    if (lpid == 0) {
-        (void)sys_dup2((uint64_t)pfds[1], 1);
-        (void)sys_close((uint64_t)pfds[0]);
-        (void)sys_close((uint64_t)pfds[1]);
-        exec_argv(left);
-        sys_puts("execve failed\n");
-        sys_exit_group(127);
-    }
-
-    long rpid = (long)sys_fork();
-    if (rpid < 0) {
-        sys_puts("fork failed\n");
-        (void)sys_close((uint64_t)pfds[0]);
-        (void)sys_close((uint64_t)pfds[1]);
-        return -1;
-    }
-    if (rpid == 0) {
-        (void)sys_dup2((uint64_t)pfds[0], 0);
-        (void)sys_close((uint64_t)pfds[0]);
-        (void)sys_close((uint64_t)pfds[1]);
-        exec_argv(right);
-        sys_puts("execve failed\n");
-        sys_exit_group(127);
-    }
+    /* Each side gets its pipe end as stdin/stdout and neither keeps the
+     * other descriptors, or the reader would never see EOF.
+     */
+    mona_spawn_action_t lacts[3] = {
+        { MONA_SPAWN_DUP2, (uint64_t)pfds[1], 1 },
+        { MONA_SPAWN_CLOSE, (uint64_t)pfds[0], 0 },
+        { MONA_SPAWN_CLOSE, (uint64_t)pfds[1], 0 },
+    };
+    mona_spawn_action_t racts[3] = {
+        { MONA_SPAWN_DUP2, (uint64_t)pfds[0], 0 },
+        { MONA_SPAWN_CLOSE, (uint64_t)pfds[0], 0 },
+        { MONA_SPAWN_CLOSE, (uint64_t)pfds[1], 0 },
+    };
+    long lpid = spawn_argv(left, lacts, 3);
+    long rpid = spawn_argv(right, racts, 3);
 
     (void)sys_close((uint64_t)pfds[0]);
     (void)sys_close((uint64_t)pfds[1]);
 
-    int st_l = 0;
-    int st_r = 0;
-    (void)sys_wait4(lpid, &st_l, 0, 0);
-    (void)sys_wait4(rpid, &st_r, 0, 0);
+    int st_l = SPAWN_FAILED_STATUS;
+    int st_r = SPAWN_FAILED_STATUS;
+    if (lpid >= 0) (void)sys_wait4(lpid, &st_l, 0, 0);
+    if (rpid >= 0) (void)sys_wait4(rpid, &st_r, 0, 0);
     return st_r;
 }
 
@@ -1,3 +1,4 @@
+#include "alloc.h"
 #include "syscall.h"
 
 #define AT_FDCWD ((long)-100)
@@ -35,16 +36,19 @@ typedef struct {
 
 enum {
     LINE_MAX = 512,
-    POOL_CAP = 256 * 1024,
-    MAX_LINES = 8192,
 };
 
+/* Both arrays grow with mem_realloc(), which may move them, so lines are
+ * kept as offsets into pool until all input is read.
+ */
 typedef struct {
-    char pool[POOL_CAP];
+    char *pool;
     uint64_t pool_len;
+    uint64_t pool_cap;
 
-    const char *lines[MAX_LINES];
+    uint64_t *offs;
     uint64_t nlines;
+    uint64_t offs_cap;
 } lines_t;
 
 static int read_line(uint64_t fd, char *out, uint64_t cap, int *out_eof) {
@@ -62,8 +66,6 @@ static int read_line(uint64_t fd, char *out, uint64_t cap, int *out_eof) {
             return (int)n;
         }
         if (rc < 0) {
-            /* EAGAIN (11) => retry (pipes). */
-            if (rc == -11) continue;
             return -1;
         }
 
@@ -84,18 +86,28 @@ static int read_line(uint64_t fd, char *out, uint64_t cap, int *out_eof) {
 }
 
 static int store_line(lines_t *ls, const char *line) {
-    if (ls->nlines >= (uint64_t)MAX_LINES) return -1;
+    if (ls->nlines == ls->offs_cap) {
+        uint64_t *offs = (uint64_t *)mem_realloc(ls->offs, (ls->nlines + 1u) * sizeof(uint64_t));
+        if (!offs) return -1;
+        ls->offs = offs;
+        ls->offs_cap = mem_size(offs) / sizeof(uint64_t);
+    }
 
     uint64_t i = 0;
     while (line[i] != '\0') i++;
     uint64_t need = i + 1;
 
-    if (ls->pool_len + need > (uint64_t)POOL_CAP) return -1;
+    if (ls->pool_len + need > ls->pool_cap) {
+        char *pool = (char *)mem_realloc(ls->pool, ls->pool_len + need);
+        if (!pool) return -1;
+        ls->pool = pool;
+        ls->pool_cap = mem_size(pool);
+    }
 
     char *dst = &ls->pool[ls->pool_len];
     for (uint64_t k = 0; k < need; k++) dst[k] = line[k];
 
-    ls->lines[ls->nlines++] = dst;
+    ls->offs[ls->nlines++] = ls->pool_len;
     ls->pool_len += need;
     return 0;
 }
@@ -324,14 +336,18 @@ int main(int argc, char **argv, char **envp) {
     }
 
     lines_t ls;
+    ls.pool = 0;
     ls.pool_len = 0;
+    ls.pool_cap = 0;
+    ls.offs = 0;
     ls.nlines = 0;
+    ls.offs_cap = 0;
 
     int nfiles = argc - i;
     if (nfiles <= 0) {
         int rc = load_fd(&ls, 0);
         if (rc == -2) {
-            sys_puts("sort: input too large\n");
+            sys_puts("sort: out of memory\n");
             return 1;
         }
         if (rc != 0) {
@@ -355,7 +371,7 @@ int main(int argc, char **argv, char **envp) {
             (void)sys_close((uint64_t)fd);
 
             if (rc == -2) {
-                sys_puts("sort: input too large\n");
+                sys_puts("sort: out of memory\n");
                 return 1;
             }
             if (rc != 0) {
@@ -371,14 +387,26 @@ int main(int argc, char **argv, char **envp) {
         }
     }
 
-    if (quicksort_iter(&o, ls.lines, (int)ls.nlines) != 0) {
+    if (ls.nlines == 0) {
+        return 0;
+    }
+    const char **lines = (const char **)mem_alloc(ls.nlines * sizeof(const char *));
+    if (!lines) {
+        sys_puts("sort: out of memory\n");
+        return 1;
+    }
+    for (uint64_t k = 0; k < ls.nlines; k++) {
+        lines[k] = ls.pool + ls.offs[k];
+    }
+
+    if (quicksort_iter(&o, lines, (int)ls.nlines) != 0) {
         sys_puts("sort: internal error\n");
         return 1;
     }
 
     const char *prev = 0;
     for (uint64_t k = 0; k < ls.nlines; k++) {
-        const char *s = ls.lines[k];
+        const char *s = lines[k];
         if (o.opt_u) {
             if (prev && is_same_line(prev, s)) {
                 continue;
@@ -51,7 +51,6 @@ static int stream_copy_fd(uint64_t fd) {
         long n = (long)sys_read(fd, buf, sizeof(buf));
         if (n == 0) return 0;
         if (n < 0) {
-            if (n == -11) continue;
             return -1;
         }
         (void)sys_write(1, buf, (uint64_t)n);
@@ -88,7 +87,6 @@ static int tail_lines_seek_fd(uint64_t fd, int64_t size, uint64_t nlines) {
 
         long nr = (long)sys_read(fd, buf, (uint64_t)chunk);
         if (nr < 0) {
-            if (nr == -11) continue;
             return -1;
         }
         if (nr == 0) break;
@@ -174,7 +172,6 @@ static int tail_stream_bytes(uint64_t fd, uint64_t nbytes) {
         long n = (long)sys_read(fd, buf, sizeof(buf));
         if (n == 0) break;
         if (n < 0) {
-            if (n == -11) continue;
             return -1;
         }
 
@@ -210,7 +207,6 @@ static int tail_stream_lines(uint64_t fd, uint64_t nlines) {
         long n = (long)sys_read(fd, buf, sizeof(buf));
         if (n == 0) break;
         if (n < 0) {
-            if (n == -11) continue;
             return -1;
         }
 
@@ -21,8 +21,6 @@ static int write_all(uint64_t fd, const char *buf, uint64_t len) {
     while (off < len) {
         long rc = (long)sys_write(fd, buf + off, len - off);
         if (rc < 0) {
-            /* EAGAIN (11) => retry (pipes). */
-            if (rc == -11) continue;
             return -1;
         }
         if (rc == 0) return -1;
@@ -72,8 +70,6 @@ int main(int argc, char **argv, char **envp) {
         long n = (long)sys_read(0, buf, sizeof(buf));
         if (n == 0) break;
         if (n < 0) {
-            /* EAGAIN (11) => retry (pipes). */
-            if (n == -11) continue;
             sys_puts("tee: read failed\n");
             for (int i = 0; i < nfds; i++) (void)sys_close(fds[i]);
             return 1;
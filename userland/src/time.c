@@ -1,6 +1,7 @@
 #include "syscall.h"
 
-/* Minimal time(1): wall-clock (monotonic) around a child process.
+/* Minimal time(1): wall-clock (monotonic) time around a child process, plus
+ * its user/system CPU time from wait4()'s rusage.
  * Usage: time COMMAND [ARG...]
  */
 
@@ -109,7 +110,8 @@ int main(int argc, char **argv, char **envp) {
     }
 
     int status = 0;
-    if ((int64_t)sys_wait4(pid, &status, 0, 0) < 0) {
+    linux_rusage_t ru;
+    if ((int64_t)sys_wait4(pid, &status, 0, &ru) < 0) {
         sys_puts("time: wait4 failed\n");
         return 1;
     }
@@ -124,6 +126,14 @@ int main(int argc, char **argv, char **envp) {
     write_ns_as_seconds(dns);
     sys_puts("\n");
 
+    sys_puts("user\t");
+    write_ns_as_seconds((uint64_t)ru.ru_utime.tv_sec * 1000000000ull + (uint64_t)ru.ru_utime.tv_usec * 1000ull);
+    sys_puts("\n");
+
+    sys_puts("sys\t");
+    write_ns_as_seconds((uint64_t)ru.ru_stime.tv_sec * 1000000000ull + (uint64_t)ru.ru_stime.tv_usec * 1000ull);
+    sys_puts("\n");
+
     (void)cstr_len_u64_local;
 
     int exit_code = (status >> 8) & 0xff;
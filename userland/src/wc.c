@@ -58,39 +58,63 @@ typedef struct {
     uint64_t bytes;
 } counts_t;
 
+static void count_buf(counts_t *c, int *in_word, const char *buf, uint64_t n) {
+    c->bytes += n;
+
+    for (uint64_t i = 0; i < n; i++) {
+        char ch = buf[i];
+        if (ch == '\n') c->lines++;
+
+        if (is_space(ch)) {
+            *in_word = 0;
+        } else {
+            if (!*in_word) {
+                c->words++;
+                *in_word = 1;
+            }
+        }
+    }
+}
+
+/* Regular files are mapped and scanned in place instead of being copied
+ * through read(). Returns 0 if fd cannot be mapped (pipes, the console).
+ */
+static const char *map_fd(uint64_t fd, uint64_t *out_size) {
+    long size = (long)sys_lseek(fd, 0, 2 /* SEEK_END */);
+    (void)sys_lseek(fd, 0, 0 /* SEEK_SET */);
+    if (size <= 0) return 0;
+
+    long p = (long)sys_mmap(0, (uint64_t)size, 1 /* PROT_READ */, 2 /* MAP_PRIVATE */, (int64_t)fd, 0);
+    if (p < 0 && p > -4096) return 0;
+    *out_size = (uint64_t)size;
+    return (const char *)(uintptr_t)p;
+}
+
 static int count_fd(uint64_t fd, counts_t *out) {
     counts_t c;
     c.lines = 0;
     c.words = 0;
     c.bytes = 0;
 
-    char buf[512];
     int in_word = 0;
 
+    uint64_t size = 0;
+    const char *map = map_fd(fd, &size);
+    if (map) {
+        count_buf(&c, &in_word, map, size);
+        (void)sys_munmap((void *)map, size);
+        *out = c;
+        return 0;
+    }
+
+    char buf[512];
     for (;;) {
         long n = (long)sys_read(fd, buf, sizeof(buf));
         if (n == 0) break;
         if (n < 0) {
-            /* EAGAIN (11) => retry (pipes). */
-            if (n == -11) continue;
             return -1;
         }
-
-        c.bytes += (uint64_t)n;
-
-        for (long i = 0; i < n; i++) {
-            char ch = buf[i];
-            if (ch == '\n') c.lines++;
-
-            if (is_space(ch)) {
-                in_word = 0;
-            } else {
-                if (!in_word) {
-                    c.words++;
-                    in_word = 1;
-                }
-            }
-        }
+        count_buf(&c, &in_word, buf, (uint64_t)n);
     }
 
     *out = c;
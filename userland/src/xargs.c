@@ -63,18 +63,12 @@ static void build_exec_path(char *out, uint64_t cap, const char *cmd) {
 }
 
 static int run_one(const char *cmd, char **argv) {
-    long pid = (long)sys_fork();
+    char path[128];
+    build_exec_path(path, sizeof(path), cmd);
+    long pid = (long)sys_mona_spawn(path, (const char *const *)argv, 0, 0, 0);
     if (pid < 0) {
-        sys_puts("xargs: fork failed\n");
-        return 1;
-    }
-
-    if (pid == 0) {
-        char path[128];
-        build_exec_path(path, sizeof(path), cmd);
-        (void)sys_execve(path, (const char *const *)argv, 0);
         sys_puts("xargs: execve failed\n");
-        sys_exit_group(127);
+        return 127;
     }
 
     int status = 0;
@@ -202,7 +196,6 @@ int main(int argc, char **argv, char **envp) {
     for (;;) {
         long n = (long)sys_read(0, inbuf, sizeof(inbuf));
         if (n < 0) {
-            if (n == -11) continue; /* EAGAIN */
             sys_puts("xargs: read failed\n");
             return 1;
         }
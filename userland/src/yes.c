@@ -21,8 +21,6 @@ static int write_all(uint64_t fd, const void *buf, uint64_t len) {
     while (off < len) {
         long rc = (long)sys_write(fd, p + off, len - off);
         if (rc < 0) {
-            /* EAGAIN (11) => retry (pipes). */
-            if (rc == -11) continue;
             return -1;
         }
         if (rc == 0) return -1;